@@ -398,6 +398,9 @@ typedef struct {
 #define PRVALUE(x)	((x)->u.promsxp.value)
 #define PRSEEN(x)	((x)->sxpinfo.gp)
 #define SET_PRSEEN(x,v)	(((x)->sxpinfo.gp)=(v))
+/* set when forcing the promise added a reference to its value */
+#define PRVALUE_PINNED(x)	((x)->sxpinfo.extra)
+#define SET_PRVALUE_PINNED(x,v)	(((x)->sxpinfo.extra)=(v))
 
 /* Hashing Macros */
 #define HASHASH(x)      ((x)->sxpinfo.gp & HASHASH_MASK)
@@ -406,6 +409,15 @@ typedef struct {
 			  (((x)->sxpinfo.gp) &= (~HASHASH_MASK)))
 #define SET_HASHVALUE(x,v) SET_TRUELENGTH(x, ((int) (v)))
 
+/* A CHARSXP of length n has room for the hash of its bytes after the
+   terminating nul, aligned for an unsigned int.  It is set by
+   mkCharLenCE, so is only valid for cached CHARSXPs. */
+#define CHAR_HASH_OFFSET(n) (((n) + sizeof(unsigned int)) & \
+			     ~(sizeof(unsigned int) - 1))
+#define CHAR_HASH(x)	(*(unsigned int *) (CHAR_RW(x) + \
+					    CHAR_HASH_OFFSET(LENGTH(x))))
+#define SET_CHAR_HASH(x,v) (CHAR_HASH(x) = (v))
+
 /* Vector Heap Structure */
 typedef struct {
 	union {
@@ -473,6 +485,28 @@ Rboolean (BASE_SYM_CACHED)(SEXP b);
 
 #endif /* USE_RINTERNALS */
 
+/* The byte code engine caches the functions found by lookups that
+   pass only through hashed and base environments (see eval.c).
+   Changes to bindings in such environments that could alter the
+   result of a lookup advance the binding version of the symbol, which
+   invalidates the cached lookups of that symbol only.  The versions
+   are kept in a table indexed by the address of the symbol, so
+   symbols sharing an entry also share invalidations.  Changes to the
+   structure of the search path advance R_FunCacheEpoch, which
+   invalidates all cached lookups. */
+#define R_FUNBINDING_VERSIONS 1024
+#define FUNBINDING_VERSION(sym) \
+    R_FunBindingVersions[((R_size_t) (sym) >> 4) % R_FUNBINDING_VERSIONS]
+#define MAY_BE_FUNBINDING(v) \
+    (TYPEOF(v) == CLOSXP || TYPEOF(v) == BUILTINSXP || \
+     TYPEOF(v) == SPECIALSXP || TYPEOF(v) == PROMSXP || \
+     (v) == R_MissingArg)
+#define CHECK_FUNBINDING_CHANGE(sym, oldv, newv) do { \
+    if (MAY_BE_FUNBINDING(oldv) || MAY_BE_FUNBINDING(newv)) \
+	FUNBINDING_VERSION(sym)++; \
+} while (0)
+#define INVALIDATE_FUNCACHES() (R_FunCacheEpoch++)
+
 #ifdef R_USE_SIGNALS
 /* Stack entry for pending promises */
 typedef struct RPRSTACK {
@@ -560,6 +594,8 @@ extern0 int	R_BCIntActive INI_as(0); /* bcEval called more recently than
                                             eval */
 extern0 void*	R_BCpc INI_as(NULL);/* current byte code instruction */
 extern0 SEXP	R_BCbody INI_as(NULL); /* current byte code object */
+extern0 double	R_FunCacheEpoch INI_as(1); /* see CHECK_FUNBINDING_CHANGE */
+extern0 double	R_FunBindingVersions[R_FUNBINDING_VERSIONS];
 extern0 SEXP	R_NHeap;	    /* Start of the cons cell heap */
 extern0 SEXP	R_FreeSEXP;	    /* Cons cell free list */
 extern0 R_size_t R_Collected;	    /* Number of free cons cells (after gc) */
@@ -1072,10 +1108,13 @@ SEXP promiseArgs(SEXP, SEXP);
 void Rcons_vprintf(const char *, va_list);
 SEXP R_data_class(SEXP , Rboolean);
 SEXP R_data_class2(SEXP);
+SEXP R_findFunForCache(SEXP, SEXP);
 char *R_LibraryFileName(const char *, char *, size_t);
 SEXP R_LoadFromFile(FILE*, int);
 SEXP R_NewHashedEnv(SEXP, SEXP);
 extern int R_Newhashpjw(const char *);
+unsigned int R_CharHash(const char *, int);
+void R_mkCharLenCEs(SEXP, R_xlen_t, const char **, const int *, int, cetype_t);
 FILE* R_OpenLibraryFile(const char *);
 SEXP R_Primitive(const char *);
 void R_RestoreGlobalEnv(void);
@@ -1198,9 +1237,32 @@ const wchar_t *wtransChar(SEXP x); /* from sysutils.c */
 size_t Mbrtowc(wchar_t *wc, const char *s, size_t n, mbstate_t *ps);
 Rboolean mbcsValid(const char *str);
 Rboolean utf8Valid(const char *str);
+Rboolean utf8ValidLen(const char *str, size_t len);
 char *Rf_strchr(const char *s, int c);
 char *Rf_strrchr(const char *s, int c);
 
+/* string buffers, from altrep.c: the bytes of the elements of a
+   character vector with their offsets, and a validity bitmap with bits
+   set for elements that are not NA, or NULL */
+typedef struct {
+    const char *bytes;
+    const int *ioffsets;	/* one of these is not NULL */
+    const double *doffsets;
+    const Rbyte *valid;
+    cetype_t enc;
+    Rboolean ascii;
+    R_xlen_t n;
+} R_strbuf_t;
+
+Rboolean R_get_string_buffer(SEXP x, R_strbuf_t *sb);
+const char *R_string_buffer_elt(const R_strbuf_t *sb, R_xlen_t i, int *len);
+SEXP R_new_string_buffer(SEXP bytes, SEXP offsets, SEXP valid,
+			 cetype_t enc);
+
+SEXP R_wrap_meta(SEXP x, int srt, int no_na); /* altrep.c */
+SEXP R_hash_index(SEXP x, SEXP *data);
+void R_set_hash_index(SEXP x, SEXP index);
+
 SEXP fixup_NaRm(SEXP args); /* summary.c */
 void invalidate_cached_recodings(void);  /* from sysutils.c */
 void resetICUcollator(void); /* from util.c */
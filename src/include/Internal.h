@@ -179,6 +179,8 @@ SEXP do_formatPOSIXlt(SEXP, SEXP, SEXP, SEXP);
 SEXP do_formals(SEXP, SEXP, SEXP, SEXP);
 SEXP do_function(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gc(SEXP, SEXP, SEXP, SEXP);
+SEXP do_gchistory(SEXP, SEXP, SEXP, SEXP);
+SEXP do_gcpause(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gcinfo(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gctime(SEXP, SEXP, SEXP, SEXP);
 SEXP do_gctorture(SEXP, SEXP, SEXP, SEXP);
@@ -264,6 +266,8 @@ SEXP do_Math2(SEXP, SEXP, SEXP, SEXP);
 SEXP do_matrix(SEXP, SEXP, SEXP, SEXP);
 SEXP do_maxcol(SEXP, SEXP, SEXP, SEXP);
 SEXP do_memlimits(SEXP, SEXP, SEXP, SEXP);
+SEXP do_memorycensus(SEXP, SEXP, SEXP, SEXP);
+SEXP do_memoryusage(SEXP, SEXP, SEXP, SEXP);
 SEXP do_memoryprofile(SEXP, SEXP, SEXP, SEXP);
 SEXP do_merge(SEXP, SEXP, SEXP, SEXP);
 SEXP do_mget(SEXP, SEXP, SEXP, SEXP);
@@ -441,6 +445,10 @@ SEXP do_while(SEXP, SEXP, SEXP, SEXP);
 SEXP do_which(SEXP, SEXP, SEXP, SEXP);
 SEXP do_withVisible(SEXP, SEXP, SEXP, SEXP);
 SEXP do_wrap_meta(SEXP, SEXP, SEXP, SEXP);
+SEXP do_compress_vector(SEXP, SEXP, SEXP, SEXP);
+SEXP do_string_buffer(SEXP, SEXP, SEXP, SEXP);
+SEXP do_hash_index(SEXP, SEXP, SEXP, SEXP);
+SEXP do_hashmap(SEXP, SEXP, SEXP, SEXP);
 SEXP do_xtfrm(SEXP, SEXP, SEXP, SEXP);
 
 SEXP do_getSnapshot(SEXP, SEXP, SEXP, SEXP);
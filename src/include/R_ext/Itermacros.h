@@ -206,4 +206,69 @@
 	else ITERATE_BY_REGION0(sx, px, idx, nb, etype, vtype, expr);	\
     } while (0)
 
+/* Fill buf with the nb elements of sx starting at element j, going
+   back to the start of sx after its last element, as for recycling. */
+#define GET_REGION_RECYCLED(sx, j, nx, nb, buf, vtype) do {		\
+	R_xlen_t __grr_j__ = j;						\
+	for (R_xlen_t __grr_k__ = 0; __grr_k__ < nb; ) {		\
+	    R_xlen_t __grr_m__ = nx - __grr_j__ < nb - __grr_k__ ?	\
+		nx - __grr_j__ : nb - __grr_k__;			\
+	    vtype##_GET_REGION(sx, __grr_j__, __grr_m__, buf + __grr_k__); \
+	    __grr_k__ += __grr_m__;					\
+	    __grr_j__ += __grr_m__;					\
+	    if (__grr_j__ == nx) __grr_j__ = 0;				\
+	}								\
+    } while (0)
+
+/* MOD_ITERATE2_CHECK over sx1 and sx2, of lengths n1 and n2, for
+   arguments that may be ALTREP vectors without a data pointer.  Such
+   an argument is read GET_REGION_BUFSIZE recycled elements at a time
+   into a buffer on the stack; in either case loop_body uses px1[i1]
+   and px2[i2] for the elements, and i for the index of the result. */
+#define MOD_ITERATE2_CHECK_BY_REGION(ncheck, n, n1, n2, i, i1, i2,	\
+				     sx1, px1, etype1, vtype1,		\
+				     sx2, px2, etype2, vtype2,		\
+				     loop_body) do {			\
+	const etype1 *px1 = DATAPTR_OR_NULL(sx1);			\
+	const etype2 *px2 = DATAPTR_OR_NULL(sx2);			\
+	if (px1 != NULL && px2 != NULL)					\
+	    MOD_ITERATE2_CHECK(ncheck, n, n1, n2, i, i1, i2, loop_body); \
+	else {								\
+	    etype1 __ibr_buf1__[GET_REGION_BUFSIZE];			\
+	    etype2 __ibr_buf2__[GET_REGION_BUFSIZE];			\
+	    Rboolean __ibr_r1__ = px1 == NULL, __ibr_r2__ = px2 == NULL; \
+	    R_xlen_t __ibr_j1__ = 0, __ibr_j2__ = 0, __ibr_intr__ = 0;	\
+	    for (i = 0; i < n; ) {					\
+		R_xlen_t __ibr_nb__ = n - i > GET_REGION_BUFSIZE ?	\
+		    GET_REGION_BUFSIZE : n - i;				\
+		R_xlen_t __ibr_m1__ = n1, __ibr_m2__ = n2;		\
+		R_xlen_t __ibr_end__ = i + __ibr_nb__;			\
+		i1 = __ibr_j1__;					\
+		i2 = __ibr_j2__;					\
+		if (__ibr_r1__) {					\
+		    GET_REGION_RECYCLED(sx1, __ibr_j1__, n1, __ibr_nb__, \
+					__ibr_buf1__, vtype1);		\
+		    px1 = __ibr_buf1__;					\
+		    i1 = 0;						\
+		    __ibr_m1__ = __ibr_nb__;				\
+		}							\
+		if (__ibr_r2__) {					\
+		    GET_REGION_RECYCLED(sx2, __ibr_j2__, n2, __ibr_nb__, \
+					__ibr_buf2__, vtype2);		\
+		    px2 = __ibr_buf2__;					\
+		    i2 = 0;						\
+		    __ibr_m2__ = __ibr_nb__;				\
+		}							\
+		MOD_ITERATE2_CORE(__ibr_end__, __ibr_m1__, __ibr_m2__,	\
+				  i, i1, i2, loop_body);		\
+		__ibr_j1__ = (__ibr_j1__ + __ibr_nb__) % n1;		\
+		__ibr_j2__ = (__ibr_j2__ + __ibr_nb__) % n2;		\
+		if ((__ibr_intr__ += __ibr_nb__) >= ncheck && i < n) {	\
+		    __ibr_intr__ = 0;					\
+		    R_CheckUserInterrupt();				\
+		}							\
+	    }								\
+	}								\
+    } while (0)
+
 #endif /* R_EXT_ITERMACROS_H_ */
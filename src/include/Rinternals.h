@@ -215,7 +215,8 @@ struct sxpinfo_struct {
     unsigned int gcgen :  1;  /* old generation number */
     unsigned int gccls :  3;  /* node class */
     unsigned int named : NAMED_BITS;
-    unsigned int extra : 32 - NAMED_BITS;
+    unsigned int extra : 31 - NAMED_BITS;
+    unsigned int gcinc :  1;  /* incremental collection color */
 }; /*		    Tot: 64 */
 
 struct vecsxp_struct {
@@ -262,7 +263,8 @@ struct promsxp_struct {
    fields used to maintain the collector's linked list structures. */
 
 /* Define SWITH_TO_REFCNT to use reference counting instead of the
-   'NAMED' mechanism. */
+   'NAMED' mechanism.  configure --enable-refcnt defines it in config.h
+   and Rconfig.h. */
 //#define SWITCH_TO_REFCNT
 
 #if defined(SWITCH_TO_REFCNT) && ! defined(COMPUTE_REFCNT_VALUES)
@@ -712,10 +714,19 @@ R_xlen_t REAL_GET_REGION(SEXP sx, R_xlen_t i, R_xlen_t n, double *buf);
 int REAL_IS_SORTED(SEXP x);
 int REAL_NO_NA(SEXP x);
 SEXP REAL_IS_NA(SEXP x);
+R_xlen_t LOGICAL_GET_REGION(SEXP sx, R_xlen_t i, R_xlen_t n, int *buf);
+int LOGICAL_IS_SORTED(SEXP x);
+int LOGICAL_NO_NA(SEXP x);
+SEXP ALTLOGICAL_SUM(SEXP x, Rboolean narm);
+R_xlen_t COMPLEX_GET_REGION(SEXP sx, R_xlen_t i, R_xlen_t n, Rcomplex *buf);
+R_xlen_t RAW_GET_REGION(SEXP sx, R_xlen_t i, R_xlen_t n, Rbyte *buf);
 int STRING_IS_SORTED(SEXP x);
 int STRING_NO_NA(SEXP x);
 SEXP R_compact_intrange(R_xlen_t n1, R_xlen_t n2);
 SEXP R_deferred_coerceToString(SEXP v, SEXP sp);
+SEXP R_deferred_arith(int op, SEXP x, SEXP y);
+SEXP R_deferred_math1(SEXP x, double (*f)(double));
+SEXP R_slice_view(SEXP x, SEXP indx);
 SEXP R_virtrep_vec(SEXP, SEXP);
 
 #ifdef LONG_VECTOR_SUPPORT
@@ -1594,6 +1605,7 @@ typedef struct RCNTXT {
     SEXP returnValue;           /* only set during on.exit calls */
     struct RCNTXT *jumptarget;	/* target for a continuing jump */
     int jumpmask;               /* associated LONGJMP argument */
+    int nojump;                 /* cjmpbuf was not set */
 } RCNTXT, *context;
 
 /* The Various Context Types.
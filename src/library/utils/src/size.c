@@ -52,12 +52,16 @@ static R_size_t objectsize(SEXP s)
 	break;
     case LISTSXP:
     case LANGSXP:
-    case BCODESXP:
     case DOTSXP:
 	cnt += objectsize(TAG(s));
 	cnt += objectsize(CAR(s));
 	cnt += objectsize(CDR(s));
 	break;
+    case BCODESXP:
+	/* the TAG field holds the engine's function lookup cache */
+	cnt += objectsize(CAR(s));
+	cnt += objectsize(CDR(s));
+	break;
     case CLOSXP:
 	cnt += objectsize(FORMALS(s));
 	cnt += objectsize(BODY(s));
@@ -70,7 +74,7 @@ static R_size_t objectsize(SEXP s)
     case BUILTINSXP:
 	break;
     case CHARSXP:
-	vcnt = BYTE2VEC(length(s)+1);
+	vcnt = BYTE2VEC(CHAR_HASH_OFFSET(length(s)) + sizeof(unsigned int));
 	isVec = TRUE;
 	break;
     case LGLSXP:
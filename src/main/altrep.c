@@ -25,6 +25,8 @@
 #include <R_ext/Altrep.h>
 #include <float.h> /* for DBL_DIG */
 #include <Print.h> /* for R_print */
+#include <Rmath.h> /* for sign, expm1 */
+#include <stdint.h>
 #include <R_ext/Itermacros.h>
 
 
@@ -118,6 +120,9 @@ static void SET_ALTREP_CLASS(SEXP x, SEXP class)
 #define ALTVEC_METHODS_TABLE(x) GENERIC_METHODS_TABLE(x, altvec)
 #define ALTINTEGER_METHODS_TABLE(x) GENERIC_METHODS_TABLE(x, altinteger)
 #define ALTREAL_METHODS_TABLE(x) GENERIC_METHODS_TABLE(x, altreal)
+#define ALTLOGICAL_METHODS_TABLE(x) GENERIC_METHODS_TABLE(x, altlogical)
+#define ALTCOMPLEX_METHODS_TABLE(x) GENERIC_METHODS_TABLE(x, altcomplex)
+#define ALTRAW_METHODS_TABLE(x) GENERIC_METHODS_TABLE(x, altraw)
 #define ALTSTRING_METHODS_TABLE(x) GENERIC_METHODS_TABLE(x, altstring)
 
 #define ALTREP_METHODS						\
@@ -156,6 +161,24 @@ static void SET_ALTREP_CLASS(SEXP x, SEXP class)
     R_altreal_Min_method_t Min;			\
     R_altreal_Max_method_t Max
 
+#define ALTLOGICAL_METHODS				\
+    ALTVEC_METHODS;					\
+    R_altlogical_Elt_method_t Elt;			\
+    R_altlogical_Get_region_method_t Get_region;	\
+    R_altlogical_Is_sorted_method_t Is_sorted;		\
+    R_altlogical_No_NA_method_t No_NA;			\
+    R_altlogical_Sum_method_t Sum
+
+#define ALTCOMPLEX_METHODS				\
+    ALTVEC_METHODS;					\
+    R_altcomplex_Elt_method_t Elt;			\
+    R_altcomplex_Get_region_method_t Get_region
+
+#define ALTRAW_METHODS				\
+    ALTVEC_METHODS;				\
+    R_altraw_Elt_method_t Elt;			\
+    R_altraw_Get_region_method_t Get_region
+
 #define ALTSTRING_METHODS			\
     ALTVEC_METHODS;				\
     R_altstring_Elt_method_t Elt;		\
@@ -167,6 +190,9 @@ typedef struct { ALTREP_METHODS; } altrep_methods_t;
 typedef struct { ALTVEC_METHODS; } altvec_methods_t;
 typedef struct { ALTINTEGER_METHODS; } altinteger_methods_t;
 typedef struct { ALTREAL_METHODS; } altreal_methods_t;
+typedef struct { ALTLOGICAL_METHODS; } altlogical_methods_t;
+typedef struct { ALTCOMPLEX_METHODS; } altcomplex_methods_t;
+typedef struct { ALTRAW_METHODS; } altraw_methods_t;
 typedef struct { ALTSTRING_METHODS; } altstring_methods_t;
 
 /* Macro to extract first element from ... macro argument.
@@ -183,6 +209,9 @@ typedef struct { ALTSTRING_METHODS; } altstring_methods_t;
 #define ALTVEC_DISPATCH(fun, ...) DO_DISPATCH(ALTVEC, fun, __VA_ARGS__)
 #define ALTINTEGER_DISPATCH(fun, ...) DO_DISPATCH(ALTINTEGER, fun, __VA_ARGS__)
 #define ALTREAL_DISPATCH(fun, ...) DO_DISPATCH(ALTREAL, fun, __VA_ARGS__)
+#define ALTLOGICAL_DISPATCH(fun, ...) DO_DISPATCH(ALTLOGICAL, fun, __VA_ARGS__)
+#define ALTCOMPLEX_DISPATCH(fun, ...) DO_DISPATCH(ALTCOMPLEX, fun, __VA_ARGS__)
+#define ALTRAW_DISPATCH(fun, ...) DO_DISPATCH(ALTRAW, fun, __VA_ARGS__)
 #define ALTSTRING_DISPATCH(fun, ...) DO_DISPATCH(ALTSTRING, fun, __VA_ARGS__)
 
 
@@ -403,6 +432,73 @@ int REAL_NO_NA(SEXP x)
     return ALTREP(x) ? ALTREAL_DISPATCH(No_NA, x) : 0;
 }
 
+int attribute_hidden ALTLOGICAL_ELT(SEXP x, R_xlen_t i)
+{
+    return ALTLOGICAL_DISPATCH(Elt, x, i);
+}
+
+R_xlen_t LOGICAL_GET_REGION(SEXP sx, R_xlen_t i, R_xlen_t n, int *buf)
+{
+    const int *x = LOGICAL_OR_NULL(sx);
+    if (x != NULL) {
+	R_xlen_t size = XLENGTH(sx);
+	R_xlen_t ncopy = size - i > n ? n : size - i;
+	for (R_xlen_t k = 0; k < ncopy; k++)
+	    buf[k] = x[k + i];
+	return ncopy;
+    }
+    else
+	return ALTLOGICAL_DISPATCH(Get_region, sx, i, n, buf);
+}
+
+int LOGICAL_IS_SORTED(SEXP x)
+{
+    return ALTREP(x) ? ALTLOGICAL_DISPATCH(Is_sorted, x) : UNKNOWN_SORTEDNESS;
+}
+
+int LOGICAL_NO_NA(SEXP x)
+{
+    return ALTREP(x) ? ALTLOGICAL_DISPATCH(No_NA, x) : 0;
+}
+
+Rcomplex attribute_hidden ALTCOMPLEX_ELT(SEXP x, R_xlen_t i)
+{
+    return ALTCOMPLEX_DISPATCH(Elt, x, i);
+}
+
+R_xlen_t COMPLEX_GET_REGION(SEXP sx, R_xlen_t i, R_xlen_t n, Rcomplex *buf)
+{
+    const Rcomplex *x = COMPLEX_OR_NULL(sx);
+    if (x != NULL) {
+	R_xlen_t size = XLENGTH(sx);
+	R_xlen_t ncopy = size - i > n ? n : size - i;
+	for (R_xlen_t k = 0; k < ncopy; k++)
+	    buf[k] = x[k + i];
+	return ncopy;
+    }
+    else
+	return ALTCOMPLEX_DISPATCH(Get_region, sx, i, n, buf);
+}
+
+Rbyte attribute_hidden ALTRAW_ELT(SEXP x, R_xlen_t i)
+{
+    return ALTRAW_DISPATCH(Elt, x, i);
+}
+
+R_xlen_t RAW_GET_REGION(SEXP sx, R_xlen_t i, R_xlen_t n, Rbyte *buf)
+{
+    const Rbyte *x = RAW_OR_NULL(sx);
+    if (x != NULL) {
+	R_xlen_t size = XLENGTH(sx);
+	R_xlen_t ncopy = size - i > n ? n : size - i;
+	for (R_xlen_t k = 0; k < ncopy; k++)
+	    buf[k] = x[k + i];
+	return ncopy;
+    }
+    else
+	return ALTRAW_DISPATCH(Get_region, sx, i, n, buf);
+}
+
 SEXP /*attribute_hidden*/ ALTSTRING_ELT(SEXP x, R_xlen_t i)
 {
     SEXP val = NULL;
@@ -474,25 +570,15 @@ SEXP ALTREAL_MAX(SEXP x, Rboolean narm)
 
 }
 
-
-/*
- * Not yet implemented
- */
-
-int attribute_hidden ALTLOGICAL_ELT(SEXP x, R_xlen_t i)
+SEXP ALTLOGICAL_SUM(SEXP x, Rboolean narm)
 {
-    return LOGICAL(x)[i]; /* dispatch here */
+    return ALTLOGICAL_DISPATCH(Sum, x, narm);
 }
 
-Rcomplex attribute_hidden ALTCOMPLEX_ELT(SEXP x, R_xlen_t i)
-{
-    return COMPLEX(x)[i]; /* dispatch here */
-}
 
-Rbyte attribute_hidden ALTRAW_ELT(SEXP x, R_xlen_t i)
-{
-    return RAW(x)[i]; /* dispatch here */
-}
+/*
+ * Not yet implemented
+ */
 
 void ALTINTEGER_SET_ELT(SEXP x, R_xlen_t i, int v)
 {
@@ -634,6 +720,50 @@ static SEXP altreal_Sum_default(SEXP x, Rboolean narm) { return NULL; }
 static SEXP altreal_Min_default(SEXP x, Rboolean narm) { return NULL; }
 static SEXP altreal_Max_default(SEXP x, Rboolean narm) { return NULL; }
 
+static int altlogical_Elt_default(SEXP x, R_xlen_t i) { return LOGICAL(x)[i]; }
+
+static R_xlen_t
+altlogical_Get_region_default(SEXP sx, R_xlen_t i, R_xlen_t n, int *buf)
+{
+    R_xlen_t size = XLENGTH(sx);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    for (R_xlen_t k = 0; k < ncopy; k++)
+	buf[k] = LOGICAL_ELT(sx, k + i);
+    return ncopy;
+}
+
+static int altlogical_Is_sorted_default(SEXP x) { return UNKNOWN_SORTEDNESS; }
+static int altlogical_No_NA_default(SEXP x) { return 0; }
+
+static SEXP altlogical_Sum_default(SEXP x, Rboolean narm) { return NULL; }
+
+static Rcomplex altcomplex_Elt_default(SEXP x, R_xlen_t i)
+{
+    return COMPLEX(x)[i];
+}
+
+static R_xlen_t
+altcomplex_Get_region_default(SEXP sx, R_xlen_t i, R_xlen_t n, Rcomplex *buf)
+{
+    R_xlen_t size = XLENGTH(sx);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    for (R_xlen_t k = 0; k < ncopy; k++)
+	buf[k] = COMPLEX_ELT(sx, k + i);
+    return ncopy;
+}
+
+static Rbyte altraw_Elt_default(SEXP x, R_xlen_t i) { return RAW(x)[i]; }
+
+static R_xlen_t
+altraw_Get_region_default(SEXP sx, R_xlen_t i, R_xlen_t n, Rbyte *buf)
+{
+    R_xlen_t size = XLENGTH(sx);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    for (R_xlen_t k = 0; k < ncopy; k++)
+	buf[k] = RAW_ELT(sx, k + i);
+    return ncopy;
+}
+
 static SEXP altstring_Elt_default(SEXP x, R_xlen_t i)
 {
     error("ALTSTRING classes must provide an Elt method");
@@ -694,6 +824,56 @@ static altreal_methods_t altreal_default_methods = {
     .Max = altreal_Max_default
 };
 
+static altlogical_methods_t altlogical_default_methods = {
+    .UnserializeEX = altrep_UnserializeEX_default,
+    .Unserialize = altrep_Unserialize_default,
+    .Serialized_state = altrep_Serialized_state_default,
+    .DuplicateEX = altrep_DuplicateEX_default,
+    .Duplicate = altrep_Duplicate_default,
+    .Coerce = altrep_Coerce_default,
+    .Inspect = altrep_Inspect_default,
+    .Length = altrep_Length_default,
+    .Dataptr = altvec_Dataptr_default,
+    .Dataptr_or_null = altvec_Dataptr_or_null_default,
+    .Extract_subset = altvec_Extract_subset_default,
+    .Elt = altlogical_Elt_default,
+    .Get_region = altlogical_Get_region_default,
+    .Is_sorted = altlogical_Is_sorted_default,
+    .No_NA = altlogical_No_NA_default,
+    .Sum = altlogical_Sum_default
+};
+
+static altcomplex_methods_t altcomplex_default_methods = {
+    .UnserializeEX = altrep_UnserializeEX_default,
+    .Unserialize = altrep_Unserialize_default,
+    .Serialized_state = altrep_Serialized_state_default,
+    .DuplicateEX = altrep_DuplicateEX_default,
+    .Duplicate = altrep_Duplicate_default,
+    .Coerce = altrep_Coerce_default,
+    .Inspect = altrep_Inspect_default,
+    .Length = altrep_Length_default,
+    .Dataptr = altvec_Dataptr_default,
+    .Dataptr_or_null = altvec_Dataptr_or_null_default,
+    .Extract_subset = altvec_Extract_subset_default,
+    .Elt = altcomplex_Elt_default,
+    .Get_region = altcomplex_Get_region_default
+};
+
+static altraw_methods_t altraw_default_methods = {
+    .UnserializeEX = altrep_UnserializeEX_default,
+    .Unserialize = altrep_Unserialize_default,
+    .Serialized_state = altrep_Serialized_state_default,
+    .DuplicateEX = altrep_DuplicateEX_default,
+    .Duplicate = altrep_Duplicate_default,
+    .Coerce = altrep_Coerce_default,
+    .Inspect = altrep_Inspect_default,
+    .Length = altrep_Length_default,
+    .Dataptr = altvec_Dataptr_default,
+    .Dataptr_or_null = altvec_Dataptr_or_null_default,
+    .Extract_subset = altvec_Extract_subset_default,
+    .Elt = altraw_Elt_default,
+    .Get_region = altraw_Get_region_default
+};
 
 static altstring_methods_t altstring_default_methods = {
     .UnserializeEX = altrep_UnserializeEX_default,
@@ -743,6 +923,9 @@ make_altrep_class(int type, const char *cname, const char *pname, DllInfo *dll)
     switch(type) {
     case INTSXP:  MAKE_CLASS(class, altinteger); break;
     case REALSXP: MAKE_CLASS(class, altreal);    break;
+    case LGLSXP:  MAKE_CLASS(class, altlogical); break;
+    case CPLXSXP: MAKE_CLASS(class, altcomplex); break;
+    case RAWSXP:  MAKE_CLASS(class, altraw);     break;
     case STRSXP:  MAKE_CLASS(class, altstring);  break;
     default: error("unsupported ALTREP class");
     }
@@ -764,12 +947,18 @@ make_altrep_class(int type, const char *cname, const char *pname, DllInfo *dll)
 DEFINE_CLASS_CONSTRUCTOR(altstring, STRSXP)
 DEFINE_CLASS_CONSTRUCTOR(altinteger, INTSXP)
 DEFINE_CLASS_CONSTRUCTOR(altreal, REALSXP)
+DEFINE_CLASS_CONSTRUCTOR(altlogical, LGLSXP)
+DEFINE_CLASS_CONSTRUCTOR(altcomplex, CPLXSXP)
+DEFINE_CLASS_CONSTRUCTOR(altraw, RAWSXP)
 
 static void reinit_altrep_class(SEXP class)
 {
     switch (ALTREP_CLASS_BASE_TYPE(class)) {
     case INTSXP: INIT_CLASS(class, altinteger); break;
     case REALSXP: INIT_CLASS(class, altreal); break;
+    case LGLSXP: INIT_CLASS(class, altlogical); break;
+    case CPLXSXP: INIT_CLASS(class, altcomplex); break;
+    case RAWSXP: INIT_CLASS(class, altraw); break;
     case STRSXP: INIT_CLASS(class, altstring); break;
     default: error("unsupported ALTREP class");
     }
@@ -817,6 +1006,18 @@ DEFINE_METHOD_SETTER(altreal, Sum)
 DEFINE_METHOD_SETTER(altreal, Min)
 DEFINE_METHOD_SETTER(altreal, Max)
 
+DEFINE_METHOD_SETTER(altlogical, Elt)
+DEFINE_METHOD_SETTER(altlogical, Get_region)
+DEFINE_METHOD_SETTER(altlogical, Is_sorted)
+DEFINE_METHOD_SETTER(altlogical, No_NA)
+DEFINE_METHOD_SETTER(altlogical, Sum)
+
+DEFINE_METHOD_SETTER(altcomplex, Elt)
+DEFINE_METHOD_SETTER(altcomplex, Get_region)
+
+DEFINE_METHOD_SETTER(altraw, Elt)
+DEFINE_METHOD_SETTER(altraw, Get_region)
+
 DEFINE_METHOD_SETTER(altstring, Elt)
 DEFINE_METHOD_SETTER(altstring, Set_elt)
 DEFINE_METHOD_SETTER(altstring, Is_sorted)
@@ -1082,6 +1283,36 @@ static SEXP compact_intseq_Sum(SEXP x, Rboolean narm)
 	return ScalarInteger((int) tmp);
 }
 
+R_altrep_class_t R_compact_intseq_class;
+
+static SEXP compact_intseq_Extract_subset(SEXP x, SEXP indx, SEXP call)
+{
+#ifdef COMPACT_INTSEQ_MUTABLE
+    /* If the vector has been expanded it may have been modified. */
+    if (COMPACT_SEQ_EXPANDED(x) != R_NilValue)
+	return NULL;
+#endif
+    /* A contiguous range of a compact sequence, as used for example
+       for the remaining iterations of a for() loop, is again a compact
+       sequence. Other subsets use the default method. */
+    if (! ALTREP(indx) || ! R_altrep_inherits(indx, R_compact_intseq_class))
+	return NULL;
+
+    SEXP info = COMPACT_SEQ_INFO(x);
+    R_xlen_t size = COMPACT_INTSEQ_INFO_LENGTH(info);
+    R_xlen_t n1 = COMPACT_INTSEQ_INFO_FIRST(info);
+    int inc = COMPACT_INTSEQ_INFO_INCR(info);
+
+    SEXP iinfo = COMPACT_SEQ_INFO(indx);
+    R_xlen_t isize = COMPACT_INTSEQ_INFO_LENGTH(iinfo);
+    R_xlen_t i1 = COMPACT_INTSEQ_INFO_FIRST(iinfo);
+    R_xlen_t i2 = i1 + (isize - 1) * COMPACT_INTSEQ_INFO_INCR(iinfo);
+    if (i1 < 1 || i1 > size || i2 < 1 || i2 > size)
+	return NULL;
+
+    return R_compact_intrange(n1 + inc * (i1 - 1), n1 + inc * (i2 - 1));
+}
+
 
 /*
  * Class Objects and Method Tables
@@ -1106,6 +1337,7 @@ static void InitCompactIntegerClass()
     /* override ALTVEC methods */
     R_set_altvec_Dataptr_method(cls, compact_intseq_Dataptr);
     R_set_altvec_Dataptr_or_null_method(cls, compact_intseq_Dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, compact_intseq_Extract_subset);
 
     /* override ALTINTEGER methods */
     R_set_altinteger_Elt_method(cls, compact_intseq_Elt);
@@ -1656,96 +1888,1530 @@ SEXP attribute_hidden R_deferred_coerceToString(SEXP v, SEXP sp)
 
 
 /**
- ** Memory Mapped Vectors
+ ** Deferred Arithmetic
  **/
 
-/* For now, this code is designed to work both in base R and in a
-   package. Some simplifications would be possible if it was only to
-   be used in base. in particular, the issue of finalizing objects
-   before unloading the library would not need to be addressed, and
-   ordinary finalizers in the external pointers could be used instead
-   of maintaining a weak reference list of the live mmap objects. */
-
 /*
- * MMAP Object State
+ * Methods
  */
 
-/* State is held in a LISTSXP of length 3, and includes
-   
-       file
-       size and length in a REALSXP
-       type, ptrOK, wrtOK, serOK in an INTSXP
-
-   These are used by the methods, and also represent the serialized
-   state object.
- */
+/* The state is a list of an integer vector holding the operation and
+   the depth of the expression, and of the one or two operands.  The
+   operands are integer or real vectors of the length of the result
+   or of length one, or deferred results themselves.
+
+   Until the result is expanded, data2 is R_NilValue or a list of the
+   result being filled and the number of elements filled so far.  The
+   fill is started by a request for at least a block of elements from
+   the start, and continued by requests starting within the filled
+   part, a block at a time; so a pass through the vector computes each
+   element once and leaves the result expanded for later uses.  Single
+   elements and short regions are computed directly.  The operands are
+   kept until the result has been filled, then the state is dropped so
+   they can be reclaimed.  The
+   depth of the expressions is limited, so a result holds on to at most
+   DEFERRED_ARITH_MAXDEPTH levels of operands. */
+
+#define DEFERRED_ARITH_STATE(x) R_altrep_data1(x)
+#define CLEAR_DEFERRED_ARITH_STATE(x) R_set_altrep_data1(x, R_NilValue)
+#define DEFERRED_ARITH_EXPANDED(x) R_altrep_data2(x)
+#define SET_DEFERRED_ARITH_EXPANDED(x, v) R_set_altrep_data2(x, v)
+#define DEFERRED_ARITH_FILL(x) R_altrep_data2(x)
+#define DEFERRED_ARITH_FILL_VALUE(f) VECTOR_ELT(f, 0)
+#define DEFERRED_ARITH_FILL_COUNT(f) REAL0(VECTOR_ELT(f, 1))[0]
+
+#define DEFERRED_ARITH_STATE_OP(s) INTEGER0(VECTOR_ELT(s, 0))[0]
+#define DEFERRED_ARITH_STATE_DEPTH(s) INTEGER0(VECTOR_ELT(s, 0))[1]
+#define DEFERRED_ARITH_STATE_X(s) VECTOR_ELT(s, 1)
+#define DEFERRED_ARITH_STATE_Y(s) VECTOR_ELT(s, 2)
+
+/* Operations are the ARITHOP_TYPE codes for PLUSOP to POWOP, or an
+   offset index into the table of functions of one argument that do
+   not produce NaNs from numbers, so no warnings can be due. */
+#define DEFERRED_MATH1_OP 16
+static double (*const deferred_math1_fun[])(double) = {
+    floor, ceil, sign, exp, expm1, atan, cosh, sinh, tanh, asinh
+};
+static const char *const deferred_math1_name[] = {
+    "floor", "ceiling", "sign", "exp", "expm1", "atan", "cosh", "sinh",
+    "tanh", "asinh"
+};
+#define DEFERRED_MATH1_COUNT \
+    ((int) (sizeof(deferred_math1_fun) / sizeof(deferred_math1_fun[0])))
 
-static SEXP make_mmap_state(SEXP file, size_t size, int type,
-			    Rboolean ptrOK, Rboolean wrtOK, Rboolean serOK)
-{
-    SEXP sizes = PROTECT(allocVector(REALSXP, 2));
-    double *dsizes = REAL(sizes);
-    dsizes[0] = size;
-    switch(type) {
-    case INTSXP: dsizes[1] = size / sizeof(int); break;
-    case REALSXP: dsizes[1] = size / sizeof(double); break;
-    default: error("mmap for %s not supported yet", type2char(type));
-    }
+/* Results are computed a block at a time, so the temporaries of all
+   the operations stay in cache.  Deeper expressions are computed
+   eagerly, which expands their operands. */
+#define DEFERRED_ARITH_BLOCK 512
+#define DEFERRED_ARITH_MAXDEPTH 16
 
-    SEXP info = PROTECT(allocVector(INTSXP, 4));
-    INTEGER(info)[0] = type;
-    INTEGER(info)[1] = ptrOK;
-    INTEGER(info)[2] = wrtOK;
-    INTEGER(info)[3] = serOK;
+static R_xlen_t R_DeferredArithMin = 65536;
+static R_altrep_class_t R_deferred_arith_class;
 
-    SEXP state = list3(file, sizes, info);
+static R_INLINE R_xlen_t deferred_arith_state_length(SEXP state)
+{
+    SEXP y = DEFERRED_ARITH_STATE_Y(state);
+    R_xlen_t nx = XLENGTH(DEFERRED_ARITH_STATE_X(state));
+    R_xlen_t ny = y == R_NilValue ? 0 : XLENGTH(y);
+    return nx > ny ? nx : ny;
+}
 
-    UNPROTECT(2);
-    return state;
+static R_xlen_t deferred_arith_Length(SEXP x)
+{
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    return state == R_NilValue ?
+	XLENGTH(DEFERRED_ARITH_EXPANDED(x)) :
+	deferred_arith_state_length(state);
+}
+
+static R_xlen_t deferred_arith_region(SEXP state, R_xlen_t i, R_xlen_t n,
+				      double *buf);
+
+/* Elements i to i + n - 1 of an operand, as a pointer into its data
+   or filled into buf; unexpanded deferred operands are computed
+   without filling their results, as they are usually temporaries */
+static const double *deferred_arith_operand(SEXP v, R_xlen_t i, R_xlen_t n,
+					    double *buf)
+{
+    R_xlen_t k;
+    if (TYPEOF(v) == INTSXP) {
+	int ibuf[DEFERRED_ARITH_BLOCK];
+	if (XLENGTH(v) == 1) {
+	    int iv = INTEGER_ELT(v, 0);
+	    double dv = iv == NA_INTEGER ? NA_REAL : (double) iv;
+	    for (k = 0; k < n; k++) buf[k] = dv;
+	}
+	else {
+	    INTEGER_GET_REGION(v, i, n, ibuf);
+	    for (k = 0; k < n; k++)
+		buf[k] = ibuf[k] == NA_INTEGER ? NA_REAL : (double) ibuf[k];
+	}
+	return buf;
+    }
+    else if (XLENGTH(v) == 1) {
+	double dv = REAL_ELT(v, 0);
+	for (k = 0; k < n; k++) buf[k] = dv;
+	return buf;
+    }
+    else {
+	const double *pv = DATAPTR_OR_NULL(v);
+	if (pv != NULL)
+	    return pv + i;
+	if (ALTREP(v) && R_altrep_inherits(v, R_deferred_arith_class) &&
+	    DEFERRED_ARITH_STATE(v) != R_NilValue)
+	    deferred_arith_region(DEFERRED_ARITH_STATE(v), i, n, buf);
+	else
+	    REAL_GET_REGION(v, i, n, buf);
+	return buf;
+    }
 }
-			    
-#define MMAP_STATE_FILE(x) CAR(x)
-#define MMAP_STATE_SIZE(x) ((size_t) REAL_ELT(CADR(x), 0))
-#define MMAP_STATE_LENGTH(x) ((size_t) REAL_ELT(CADR(x), 1))
-#define MMAP_STATE_TYPE(x) INTEGER(CADDR(x))[0]
-#define MMAP_STATE_PTROK(x) INTEGER(CADDR(x))[1]
-#define MMAP_STATE_WRTOK(x) INTEGER(CADDR(x))[2]
-#define MMAP_STATE_SEROK(x) INTEGER(CADDR(x))[3]
 
+/* Compute elements i to i + n - 1, with n at most DEFERRED_ARITH_BLOCK,
+   exactly as real_binary and math1 in arithmetic.c do. */
+static void deferred_arith_block(SEXP state, R_xlen_t i, R_xlen_t n,
+				 double *buf)
+{
+    double ybuf[DEFERRED_ARITH_BLOCK];
+    int op = DEFERRED_ARITH_STATE_OP(state);
+    const double *px =
+	deferred_arith_operand(DEFERRED_ARITH_STATE_X(state), i, n, buf);
+    R_xlen_t k;
 
-/*
- * MMAP Classes and Objects
- */
+    if (op >= DEFERRED_MATH1_OP) {
+	double (*f)(double) = deferred_math1_fun[op - DEFERRED_MATH1_OP];
+	for (k = 0; k < n; k++) {
+	    double x = px[k], y = f(x);
+	    buf[k] = ISNAN(y) && ISNAN(x) ? x : y;
+	}
+	return;
+    }
 
-static R_altrep_class_t mmap_integer_class;
-static R_altrep_class_t mmap_real_class;
+    const double *py =
+	deferred_arith_operand(DEFERRED_ARITH_STATE_Y(state), i, n, ybuf);
+    switch (op) {
+    case PLUSOP: for (k = 0; k < n; k++) buf[k] = px[k] + py[k]; break;
+    case MINUSOP: for (k = 0; k < n; k++) buf[k] = px[k] - py[k]; break;
+    case TIMESOP: for (k = 0; k < n; k++) buf[k] = px[k] * py[k]; break;
+    case DIVOP: for (k = 0; k < n; k++) buf[k] = px[k] / py[k]; break;
+    case POWOP:
+	for (k = 0; k < n; k++)
+	    buf[k] = py[k] == 2.0 ? px[k] * px[k] : R_pow(px[k], py[k]);
+	break;
+    default:
+	error("unsupported deferred arithmetic operation");
+    }
+}
 
-/* MMAP objects are ALTREP objects with data fields
+static R_xlen_t deferred_arith_region(SEXP state, R_xlen_t i, R_xlen_t n,
+				      double *buf)
+{
+    R_xlen_t size = deferred_arith_state_length(state);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    for (R_xlen_t k = 0; k < ncopy; k += DEFERRED_ARITH_BLOCK) {
+	R_xlen_t nb = ncopy - k > DEFERRED_ARITH_BLOCK ?
+	    DEFERRED_ARITH_BLOCK : ncopy - k;
+	deferred_arith_block(state, i + k, nb, buf + k);
+    }
+    return ncopy;
+}
 
-       data1: an external pointer to the mmaped address
-       data2: the MMAP object's state
+static R_INLINE R_xlen_t deferred_arith_filled(SEXP x)
+{
+    SEXP fill = DEFERRED_ARITH_FILL(x);
+    return fill == R_NilValue ? 0 : (R_xlen_t) DEFERRED_ARITH_FILL_COUNT(fill);
+}
 
-   The state is also stored in the Protected field of the external
-   pointer for use by the finalizer.
-*/
+/* Fill the result of an unexpanded x up to at least element to - 1,
+   in whole blocks, and return a pointer to its data. */
+static double *deferred_arith_fill(SEXP x, R_xlen_t to)
+{
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    SEXP fill = DEFERRED_ARITH_FILL(x);
+    if (fill == R_NilValue) {
+	PROTECT(x);
+	fill = PROTECT(allocVector(VECSXP, 2));
+	SET_VECTOR_ELT(fill, 0, allocVector(REALSXP,
+					    deferred_arith_state_length(state)));
+	SET_VECTOR_ELT(fill, 1, ScalarReal(0));
+	R_set_altrep_data2(x, fill);
+	UNPROTECT(2); /* fill, x */
+    }
+    SEXP val = DEFERRED_ARITH_FILL_VALUE(fill);
+    double *pval = REAL0(val);
+    R_xlen_t n = XLENGTH(val);
+    R_xlen_t done = (R_xlen_t) DEFERRED_ARITH_FILL_COUNT(fill);
+    if (to > n)
+	to = n;
+    while (done < to) {
+	R_xlen_t nb = n - done > DEFERRED_ARITH_BLOCK ?
+	    DEFERRED_ARITH_BLOCK : n - done;
+	deferred_arith_block(state, done, nb, pval + done);
+	done += nb;
+    }
+    if (done == n) {
+	SET_DEFERRED_ARITH_EXPANDED(x, val);
+	SET_VECTOR_ELT(fill, 0, R_NilValue);
+#ifdef SWITCH_TO_REFCNT
+	/* the state may be shared by duplicates still to be computed */
+	if (REFCNT(state) == 1) {
+	    SET_VECTOR_ELT(state, 1, R_NilValue);
+	    SET_VECTOR_ELT(state, 2, R_NilValue);
+	}
+#endif
+	CLEAR_DEFERRED_ARITH_STATE(x); /* allow operands to be reclaimed */
+    }
+    else
+	DEFERRED_ARITH_FILL_COUNT(fill) = (double) done;
+    return pval;
+}
 
-static void register_mmap_eptr(SEXP eptr);
-static SEXP make_mmap(void *p, SEXP file, size_t size, int type,
-		      Rboolean ptrOK, Rboolean wrtOK, Rboolean serOK)
+static R_INLINE void expand_deferred_arith(SEXP x)
 {
-    SEXP state = PROTECT(make_mmap_state(file, size,
-					 type, ptrOK, wrtOK, serOK));
-    SEXP eptr = PROTECT(R_MakeExternalPtr(p, R_NilValue, state));
-    register_mmap_eptr(eptr);
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    if (state != R_NilValue)
+	deferred_arith_fill(x, deferred_arith_state_length(state));
+}
 
-    R_altrep_class_t class;
+static SEXP deferred_arith_Duplicate(SEXP x, Rboolean deep)
+{
+    /* the state is never modified, so it can be shared */
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    if (state == R_NilValue)
+	return NULL;
+    return R_new_altrep(R_deferred_arith_class, state, R_NilValue);
+}
+
+static
+Rboolean deferred_arith_Inspect(SEXP x, int pre, int deep, int pvec,
+				void (*inspect_subtree)(SEXP, int, int, int))
+{
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    if (state != R_NilValue) {
+	int op = DEFERRED_ARITH_STATE_OP(state);
+	static const char *const opname[] = { "", "+", "-", "*", "/", "^" };
+	Rprintf("  <deferred %s>\n", op >= DEFERRED_MATH1_OP ?
+		deferred_math1_name[op - DEFERRED_MATH1_OP] : opname[op]);
+	inspect_subtree(DEFERRED_ARITH_STATE_X(state), pre, deep, pvec);
+	if (op < DEFERRED_MATH1_OP)
+	    inspect_subtree(DEFERRED_ARITH_STATE_Y(state), pre, deep, pvec);
+    }
+    else {
+	Rprintf("  <expanded arithmetic>\n");
+	inspect_subtree(DEFERRED_ARITH_EXPANDED(x), pre, deep, pvec);
+    }
+    return TRUE;
+}
+
+static void *deferred_arith_Dataptr(SEXP x, Rboolean writeable)
+{
+    expand_deferred_arith(x);
+    return DATAPTR(DEFERRED_ARITH_EXPANDED(x));
+}
+
+static const void *deferred_arith_Dataptr_or_null(SEXP x)
+{
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    return state != R_NilValue ? NULL : DATAPTR(DEFERRED_ARITH_EXPANDED(x));
+}
+
+static double deferred_arith_Elt(SEXP x, R_xlen_t i)
+{
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    if (state == R_NilValue)
+	return REAL_ELT(DEFERRED_ARITH_EXPANDED(x), i);
+    R_xlen_t done = deferred_arith_filled(x);
+    if (i < done)
+	return REAL0(DEFERRED_ARITH_FILL_VALUE(DEFERRED_ARITH_FILL(x)))[i];
+    if (i == done && done > 0)
+	return deferred_arith_fill(x, i + 1)[i];
+    double val;
+    deferred_arith_block(state, i, 1, &val);
+    return val;
+}
+
+static
+R_xlen_t deferred_arith_Get_region(SEXP x, R_xlen_t i, R_xlen_t n,
+				   double *buf)
+{
+    SEXP state = DEFERRED_ARITH_STATE(x);
+    if (state == R_NilValue)
+	return REAL_GET_REGION(DEFERRED_ARITH_EXPANDED(x), i, n, buf);
+    R_xlen_t size = deferred_arith_state_length(state);
+    R_xlen_t ncopy = size - i > n ? n : size - i;
+    R_xlen_t done = deferred_arith_filled(x);
+    const double *pval;
+    if (i + ncopy <= done)
+	pval = REAL0(DEFERRED_ARITH_FILL_VALUE(DEFERRED_ARITH_FILL(x)));
+    else if (i <= done && (done > 0 || ncopy >= DEFERRED_ARITH_BLOCK))
+	pval = deferred_arith_fill(x, i + ncopy);
+    else
+	return deferred_arith_region(state, i, n, buf);
+    for (R_xlen_t k = 0; k < ncopy; k++)
+	buf[k] = pval[i + k];
+    return ncopy;
+}
+
+/*
+ * Class Object and Method Table
+ */
+
+static void InitDeferredArithClass()
+{
+    R_altrep_class_t cls = R_make_altreal_class("deferred_arith", "base",
+						NULL);
+    R_deferred_arith_class = cls;
+
+    /* override ALTREP methods */
+    R_set_altrep_Duplicate_method(cls, deferred_arith_Duplicate);
+    R_set_altrep_Inspect_method(cls, deferred_arith_Inspect);
+    R_set_altrep_Length_method(cls, deferred_arith_Length);
+
+    /* override ALTVEC methods */
+    R_set_altvec_Dataptr_method(cls, deferred_arith_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, deferred_arith_Dataptr_or_null);
+
+    /* override ALTREAL methods */
+    R_set_altreal_Elt_method(cls, deferred_arith_Elt);
+    R_set_altreal_Get_region_method(cls, deferred_arith_Get_region);
+
+    /* R_DEFERRED_ARITH_MIN is the shortest result to defer, 0 for none */
+    char *p = getenv("R_DEFERRED_ARITH_MIN");
+    if (p != NULL) {
+	int ierr;
+	R_size_t min = R_Decode2Long(p, &ierr);
+	if (ierr == 0)
+	    R_DeferredArithMin = min > R_XLEN_T_MAX ? 0 : (R_xlen_t) min;
+    }
+}
+
+
+/*
+ * Constructors
+ */
+
+static int deferred_arith_depth(SEXP v)
+{
+    if (ALTREP(v) && R_altrep_inherits(v, R_deferred_arith_class)) {
+	SEXP state = DEFERRED_ARITH_STATE(v);
+	if (state != R_NilValue)
+	    return DEFERRED_ARITH_STATE_DEPTH(state);
+    }
+    return 0;
+}
+
+static SEXP new_deferred_arith(int op, SEXP x, SEXP y)
+{
+    int depth = deferred_arith_depth(x), ydepth = deferred_arith_depth(y);
+    if (ydepth > depth)
+	depth = ydepth;
+    if (depth >= DEFERRED_ARITH_MAXDEPTH)
+	return NULL;
+
+    /* the operands must not change once captured; with reference
+       counting the state holds references to them, which are dropped
+       when the result is expanded */
+#ifndef SWITCH_TO_REFCNT
+    INCREMENT_NAMED(x);
+    INCREMENT_NAMED(y);
+#endif
+    SEXP info = PROTECT(allocVector(INTSXP, 2));
+    INTEGER0(info)[0] = op;
+    INTEGER0(info)[1] = depth + 1;
+    SEXP state = PROTECT(allocVector(VECSXP, 3));
+    SET_VECTOR_ELT(state, 0, info);
+    SET_VECTOR_ELT(state, 1, x);
+    SET_VECTOR_ELT(state, 2, y);
+    SEXP ans = R_new_altrep(R_deferred_arith_class, state, R_NilValue);
+    UNPROTECT(2); /* state, info */
+    return ans;
+}
+
+static R_INLINE Rboolean deferred_arith_operand_ok(SEXP v, R_xlen_t n)
+{
+    return (TYPEOF(v) == REALSXP || TYPEOF(v) == INTSXP) &&
+	(XLENGTH(v) == n || XLENGTH(v) == 1);
+}
+
+/* The deferred result of x op y for real arithmetic, or NULL if it
+   should be computed now */
+SEXP attribute_hidden R_deferred_arith(int op, SEXP x, SEXP y)
+{
+    if (op < PLUSOP || op > POWOP || R_DeferredArithMin == 0)
+	return NULL;
+    R_xlen_t nx = XLENGTH(x), ny = XLENGTH(y), n = nx > ny ? nx : ny;
+    if (n < R_DeferredArithMin ||
+	! deferred_arith_operand_ok(x, n) || ! deferred_arith_operand_ok(y, n))
+	return NULL;
+    return new_deferred_arith(op, x, y);
+}
+
+/* The deferred result of f(x) for a real vector x, or NULL if it
+   should be computed now */
+SEXP attribute_hidden R_deferred_math1(SEXP x, double (*f)(double))
+{
+    if (R_DeferredArithMin == 0 || TYPEOF(x) != REALSXP ||
+	XLENGTH(x) < R_DeferredArithMin)
+	return NULL;
+    for (int i = 0; i < DEFERRED_MATH1_COUNT; i++)
+	if (deferred_math1_fun[i] == f)
+	    return new_deferred_arith(DEFERRED_MATH1_OP + i, x, R_NilValue);
+    return NULL;
+}
+
+
+/**
+ ** Compressed Vectors
+ **/
+
+/* Integer, logical and real vectors can be held in one of three
+   encodings:
+
+   rle        the values of the runs and their cumulative ends;
+   dictionary the distinct values, and for each element the index of
+              its value packed into 1, 2, 4, 8 or 16 bits;
+   bitpack    for integer and logical vectors, the offset of each
+              element from the minimum packed the same way; if there
+              are NAs, the largest code is reserved for them.
+
+   Runs and distinct values are found by bit pattern, so decoding
+   restores the data exactly, including the kind of NaN. */
+
+enum { COMPRESS_AUTO, COMPRESS_RLE, COMPRESS_DICT, COMPRESS_BITPACK };
+
+/* the most distinct values of a dictionary */
+#define COMPRESS_DICT_MAX 65536
+
+
+/*
+ * Methods
+ */
+
+/* The state is a list of an integer vector of the encoding, the code
+   width, the sortedness and whether there are no NAs; the values (the
+   minimum for bitpack); the run ends or the packed codes; and the
+   length.  The state is kept while the data is only read, so the
+   vector stays compressed when it is serialized.  A writable data
+   pointer drops it. */
+
+#define COMPRESSED_STATE(x) R_altrep_data1(x)
+#define CLEAR_COMPRESSED_STATE(x) R_set_altrep_data1(x, R_NilValue)
+#define COMPRESSED_EXPANDED(x) R_altrep_data2(x)
+#define SET_COMPRESSED_EXPANDED(x, v) R_set_altrep_data2(x, v)
+
+#define COMPRESSED_STATE_ENCODING(s) INTEGER0(VECTOR_ELT(s, 0))[0]
+#define COMPRESSED_STATE_WIDTH(s) INTEGER0(VECTOR_ELT(s, 0))[1]
+#define COMPRESSED_STATE_SORTED(s) INTEGER0(VECTOR_ELT(s, 0))[2]
+#define COMPRESSED_STATE_NO_NA(s) INTEGER0(VECTOR_ELT(s, 0))[3]
+#define COMPRESSED_STATE_VALUES(s) VECTOR_ELT(s, 1)
+#define COMPRESSED_STATE_INDEX(s) VECTOR_ELT(s, 2)
+#define COMPRESSED_STATE_LENGTH(s) ((R_xlen_t) REAL0(VECTOR_ELT(s, 3))[0])
+/* the bitpack code for NA, -1 if there are no NAs */
+#define COMPRESSED_STATE_NACODE(s) \
+    (COMPRESSED_STATE_NO_NA(s) ? -1 : (1 << COMPRESSED_STATE_WIDTH(s)) - 1)
+
+static R_altrep_class_t compressed_integer_class;
+static R_altrep_class_t compressed_logical_class;
+static R_altrep_class_t compressed_real_class;
+
+static R_INLINE int packed_code(const Rbyte *p, int w, R_xlen_t i)
+{
+    switch (w) {
+    case 16: return ((const unsigned short *) p)[i];
+    case 8: return p[i];
+    case 4: return (p[i >> 1] >> ((i & 1) << 2)) & 0xf;
+    case 2: return (p[i >> 2] >> ((i & 3) << 1)) & 0x3;
+    default: return (p[i >> 3] >> (i & 7)) & 0x1;
+    }
+}
+
+static R_INLINE void set_packed_code(Rbyte *p, int w, R_xlen_t i, int code)
+{
+    /* the codes are zero to start with */
+    switch (w) {
+    case 16: ((unsigned short *) p)[i] = (unsigned short) code; break;
+    case 8: p[i] = (Rbyte) code; break;
+    case 4: p[i >> 1] |= (Rbyte) (code << ((i & 1) << 2)); break;
+    case 2: p[i >> 2] |= (Rbyte) (code << ((i & 3) << 1)); break;
+    default: p[i >> 3] |= (Rbyte) (code << (i & 7)); break;
+    }
+}
+
+/* the run holding element i: the first run ending after it */
+static R_INLINE R_xlen_t rle_run(const double *ends, R_xlen_t nruns,
+				 R_xlen_t i)
+{
+    R_xlen_t lo = 0, hi = nruns - 1;
+    while (lo < hi) {
+	R_xlen_t mid = lo + (hi - lo) / 2;
+	if (ends[mid] > i) hi = mid;
+	else lo = mid + 1;
+    }
+    return lo;
+}
+
+#define DEFINE_COMPRESSED_REGION(NAME, etype, DATA, NAVAL)		\
+    static R_xlen_t NAME(SEXP s, R_xlen_t i, R_xlen_t n, etype *buf)	\
+    {									\
+	R_xlen_t size = COMPRESSED_STATE_LENGTH(s);			\
+	R_xlen_t ncopy = size - i > n ? n : size - i, k;		\
+	SEXP vals = COMPRESSED_STATE_VALUES(s);				\
+	SEXP index = COMPRESSED_STATE_INDEX(s);				\
+	int w = COMPRESSED_STATE_WIDTH(s);				\
+	switch (COMPRESSED_STATE_ENCODING(s)) {				\
+	case COMPRESS_RLE: {						\
+	    const etype *pv = DATA(vals);				\
+	    const double *ends = REAL0(index);				\
+	    R_xlen_t r = rle_run(ends, XLENGTH(index), i);		\
+	    for (k = 0; k < ncopy; k++) {				\
+		if (i + k >= ends[r]) r++;				\
+		buf[k] = pv[r];						\
+	    }								\
+	    break;							\
+	}								\
+	case COMPRESS_DICT: {						\
+	    const etype *pv = DATA(vals);				\
+	    const Rbyte *p = RAW0(index);				\
+	    for (k = 0; k < ncopy; k++)					\
+		buf[k] = pv[packed_code(p, w, i + k)];			\
+	    break;							\
+	}								\
+	default: {							\
+	    const etype min = DATA(vals)[0];				\
+	    const int nacode = COMPRESSED_STATE_NACODE(s);		\
+	    const Rbyte *p = RAW0(index);				\
+	    for (k = 0; k < ncopy; k++) {				\
+		int code = packed_code(p, w, i + k);			\
+		buf[k] = code == nacode ? NAVAL : min + code;		\
+	    }								\
+	}								\
+	}								\
+	return ncopy;							\
+    }
+
+DEFINE_COMPRESSED_REGION(compressed_int_region, int, INTEGER0, NA_INTEGER)
+DEFINE_COMPRESSED_REGION(compressed_real_region, double, REAL0, NA_REAL)
+
+static SEXP new_compressed(SEXP state);
+
+static SEXP compressed_Serialized_state(SEXP x)
+{
+    SEXP state = COMPRESSED_STATE(x);
+    return state != R_NilValue ? state : NULL;
+}
+
+static SEXP compressed_Unserialize(SEXP class, SEXP state)
+{
+    return new_compressed(state);
+}
+
+static SEXP compressed_Duplicate(SEXP x, Rboolean deep)
+{
+    /* the state is never modified, so it can be shared */
+    SEXP state = COMPRESSED_STATE(x);
+    return state != R_NilValue ? new_compressed(state) : NULL;
+}
+
+static
+Rboolean compressed_Inspect(SEXP x, int pre, int deep, int pvec,
+			    void (*inspect_subtree)(SEXP, int, int, int))
+{
+    SEXP state = COMPRESSED_STATE(x);
+    if (state != R_NilValue) {
+	static const char *const name[] = { "", "rle", "dictionary",
+					    "bitpack" };
+	SEXP index = COMPRESSED_STATE_INDEX(state);
+	int enc = COMPRESSED_STATE_ENCODING(state);
+	if (enc == COMPRESS_RLE)
+	    Rprintf("  <compressed %s, %lld runs>\n", name[enc],
+		    (long long) XLENGTH(index));
+	else
+	    Rprintf("  <compressed %s, %d bits>\n", name[enc],
+		    COMPRESSED_STATE_WIDTH(state));
+	inspect_subtree(COMPRESSED_STATE_VALUES(state), pre, deep, pvec);
+    }
+    else {
+	Rprintf("  <expanded compressed vector>\n");
+	inspect_subtree(COMPRESSED_EXPANDED(x), pre, deep, pvec);
+    }
+    return TRUE;
+}
+
+static R_xlen_t compressed_Length(SEXP x)
+{
+    SEXP state = COMPRESSED_STATE(x);
+    return state == R_NilValue ? XLENGTH(COMPRESSED_EXPANDED(x)) :
+	COMPRESSED_STATE_LENGTH(state);
+}
+
+static void *compressed_Dataptr(SEXP x, Rboolean writeable)
+{
+    SEXP val = COMPRESSED_EXPANDED(x);
+    if (val == R_NilValue) {
+	PROTECT(x);
+	SEXP state = COMPRESSED_STATE(x);
+	R_xlen_t n = COMPRESSED_STATE_LENGTH(state);
+	val = allocVector(TYPEOF(x), n);
+	if (TYPEOF(x) == REALSXP)
+	    compressed_real_region(state, 0, n, REAL0(val));
+	else
+	    compressed_int_region(state, 0, n, (int *) DATAPTR(val));
+	SET_COMPRESSED_EXPANDED(x, val);
+	UNPROTECT(1);
+    }
+    if (writeable)
+	CLEAR_COMPRESSED_STATE(x);
+    return DATAPTR(val);
+}
+
+static const void *compressed_Dataptr_or_null(SEXP x)
+{
+    SEXP val = COMPRESSED_EXPANDED(x);
+    return val == R_NilValue ? NULL : DATAPTR(val);
+}
+
+static int compressed_int_Elt(SEXP x, R_xlen_t i)
+{
+    SEXP val = COMPRESSED_EXPANDED(x);
+    if (val != R_NilValue)
+	return ((int *) DATAPTR(val))[i];
+    int elt;
+    compressed_int_region(COMPRESSED_STATE(x), i, 1, &elt);
+    return elt;
+}
+
+static
+R_xlen_t compressed_int_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf)
+{
+    SEXP val = COMPRESSED_EXPANDED(x);
+    if (val != R_NilValue)
+	return TYPEOF(val) == LGLSXP ? LOGICAL_GET_REGION(val, i, n, buf) :
+	    INTEGER_GET_REGION(val, i, n, buf);
+    return compressed_int_region(COMPRESSED_STATE(x), i, n, buf);
+}
+
+static double compressed_real_Elt(SEXP x, R_xlen_t i)
+{
+    SEXP val = COMPRESSED_EXPANDED(x);
+    if (val != R_NilValue)
+	return REAL0(val)[i];
+    double elt;
+    compressed_real_region(COMPRESSED_STATE(x), i, 1, &elt);
+    return elt;
+}
+
+static
+R_xlen_t compressed_real_Get_region(SEXP x, R_xlen_t i, R_xlen_t n,
+				    double *buf)
+{
+    SEXP val = COMPRESSED_EXPANDED(x);
+    if (val != R_NilValue)
+	return REAL_GET_REGION(val, i, n, buf);
+    return compressed_real_region(COMPRESSED_STATE(x), i, n, buf);
+}
+
+static int compressed_Is_sorted(SEXP x)
+{
+    SEXP state = COMPRESSED_STATE(x);
+    return state != R_NilValue ? COMPRESSED_STATE_SORTED(state) :
+	UNKNOWN_SORTEDNESS;
+}
+
+static int compressed_No_NA(SEXP x)
+{
+    SEXP state = COMPRESSED_STATE(x);
+    return state != R_NilValue ? COMPRESSED_STATE_NO_NA(state) : 0;
+}
+
+/* Sums of integer and logical vectors from the run lengths or the
+   counts of the codes.  Sums out of the integer range are left to
+   isum, which signals the overflow. */
+#define COMPRESS_EXACT_MAX 4503599627370496.0 /* 2^52 */
+
+static SEXP compressed_int_Sum(SEXP x, Rboolean narm)
+{
+    SEXP state = COMPRESSED_STATE(x);
+    if (state == R_NilValue)
+	return NULL;
+    if (! narm && ! COMPRESSED_STATE_NO_NA(state))
+	return ScalarInteger(NA_INTEGER);
+
+    SEXP vals = COMPRESSED_STATE_VALUES(state);
+    SEXP index = COMPRESSED_STATE_INDEX(state);
+    const int *pv = (const int *) DATAPTR(vals);
+    R_xlen_t n = COMPRESSED_STATE_LENGTH(state), k;
+    int w = COMPRESSED_STATE_WIDTH(state);
+    const Rbyte *p;
+    double s = 0.0, t;
+
+    switch (COMPRESSED_STATE_ENCODING(state)) {
+    case COMPRESS_RLE: {
+	const double *ends = REAL0(index);
+	double start = 0.0;
+	for (k = 0; k < XLENGTH(index); start = ends[k++]) {
+	    if (pv[k] == NA_INTEGER) continue;
+	    t = pv[k] * (ends[k] - start);
+	    if (fabs(t) > COMPRESS_EXACT_MAX) return NULL;
+	    s += t;
+	}
+	break;
+    }
+    case COMPRESS_DICT: {
+	R_xlen_t nvals = XLENGTH(vals);
+	double *count = (double *) R_alloc(nvals, sizeof(double));
+	for (k = 0; k < nvals; k++) count[k] = 0;
+	p = RAW0(index);
+	for (k = 0; k < n; k++)
+	    count[packed_code(p, w, k)]++;
+	for (k = 0; k < nvals; k++) {
+	    if (pv[k] == NA_INTEGER) continue;
+	    t = pv[k] * count[k];
+	    if (fabs(t) > COMPRESS_EXACT_MAX) return NULL;
+	    s += t;
+	}
+	break;
+    }
+    default: {
+	int nacode = COMPRESSED_STATE_NACODE(state);
+	double nvalid = 0.0, codes = 0.0;
+	p = RAW0(index);
+	for (k = 0; k < n; k++) {
+	    int code = packed_code(p, w, k);
+	    if (code != nacode) {
+		codes += code;
+		nvalid++;
+	    }
+	}
+	t = pv[0] * nvalid;
+	if (fabs(t) > COMPRESS_EXACT_MAX) return NULL;
+	s = t + codes;
+    }
+    }
+    if (fabs(s) > COMPRESS_EXACT_MAX || s > INT_MAX || s < R_INT_MIN)
+	return NULL;
+    return ScalarInteger((int) s);
+}
+
+
+/*
+ * Class Objects and Method Tables
+ */
+
+#define INIT_COMPRESSED_CLASS(cls, TYPE, EltFun, RegionFun) do {	\
+	R_set_altrep_Unserialize_method(cls, compressed_Unserialize);	\
+	R_set_altrep_Serialized_state_method(cls,			\
+					     compressed_Serialized_state); \
+	R_set_altrep_Duplicate_method(cls, compressed_Duplicate);	\
+	R_set_altrep_Inspect_method(cls, compressed_Inspect);		\
+	R_set_altrep_Length_method(cls, compressed_Length);		\
+	R_set_altvec_Dataptr_method(cls, compressed_Dataptr);		\
+	R_set_altvec_Dataptr_or_null_method(cls,			\
+					    compressed_Dataptr_or_null); \
+	R_set_##TYPE##_Elt_method(cls, EltFun);				\
+	R_set_##TYPE##_Get_region_method(cls, RegionFun);		\
+	R_set_##TYPE##_Is_sorted_method(cls, compressed_Is_sorted);	\
+	R_set_##TYPE##_No_NA_method(cls, compressed_No_NA);		\
+    } while (0)
+
+static void InitCompressedClasses(DllInfo *dll)
+{
+    R_altrep_class_t cls;
+
+    cls = R_make_altinteger_class("compressed_integer", "base", dll);
+    compressed_integer_class = cls;
+    INIT_COMPRESSED_CLASS(cls, altinteger, compressed_int_Elt,
+			  compressed_int_Get_region);
+    R_set_altinteger_Sum_method(cls, compressed_int_Sum);
+
+    cls = R_make_altlogical_class("compressed_logical", "base", dll);
+    compressed_logical_class = cls;
+    INIT_COMPRESSED_CLASS(cls, altlogical, compressed_int_Elt,
+			  compressed_int_Get_region);
+    R_set_altlogical_Sum_method(cls, compressed_int_Sum);
+
+    cls = R_make_altreal_class("compressed_real", "base", dll);
+    compressed_real_class = cls;
+    INIT_COMPRESSED_CLASS(cls, altreal, compressed_real_Elt,
+			  compressed_real_Get_region);
+}
+
+
+/*
+ * Constructors
+ */
+
+static SEXP new_compressed(SEXP state)
+{
+    R_altrep_class_t cls;
+    switch (TYPEOF(COMPRESSED_STATE_VALUES(state))) {
+    case INTSXP: cls = compressed_integer_class; break;
+    case LGLSXP: cls = compressed_logical_class; break;
+    case REALSXP: cls = compressed_real_class; break;
+    default: error("invalid compressed vector state");
+    }
+    return R_new_altrep(cls, state, R_NilValue);
+}
+
+static R_INLINE Rboolean same_bits(SEXP x, R_xlen_t i, R_xlen_t j)
+{
+    if (TYPEOF(x) == REALSXP)
+	return memcmp(REAL0(x) + i, REAL0(x) + j, sizeof(double)) == 0;
+    else
+	return ((int *) DATAPTR(x))[i] == ((int *) DATAPTR(x))[j];
+}
+
+static R_INLINE uint64_t elt_bits(SEXP x, R_xlen_t i)
+{
+    if (TYPEOF(x) == REALSXP) {
+	uint64_t u;
+	memcpy(&u, REAL0(x) + i, sizeof(double));
+	return u;
+    }
+    else return (uint32_t) ((int *) DATAPTR(x))[i];
+}
+
+static R_INLINE int code_width(R_xlen_t ncodes)
+{
+    int w = 1;
+    while (w < 16 && ncodes > ((R_xlen_t) 1 << w))
+	w *= 2;
+    return ncodes > ((R_xlen_t) 1 << w) ? 0 : w;
+}
+
+/* Open addressing table of the first element with each bit pattern;
+   the distinct elements are numbered in order of appearance. */
+typedef struct {
+    R_xlen_t *first;
+    int *code;
+    int mask, ndist;
+} dict_table_t;
+
+static int dict_lookup(dict_table_t *d, SEXP x, R_xlen_t i, Rboolean add)
+{
+    uint64_t u = elt_bits(x, i);
+    unsigned int h = (unsigned int)
+	((u * 11400714819323198485ULL) >> 32) & d->mask;
+    while (d->first[h] >= 0) {
+	if (same_bits(x, d->first[h], i))
+	    return d->code[h];
+	h = (h + 1) & d->mask;
+    }
+    if (! add)
+	error("value not in the dictionary");
+    d->first[h] = i;
+    d->code[h] = d->ndist;
+    return d->ndist++;
+}
+
+/* number the distinct values, or return FALSE if there are too many */
+static Rboolean dict_build(dict_table_t *d, SEXP x)
+{
+    R_xlen_t n = XLENGTH(x);
+    int size = 2;
+    while (size < 2 * COMPRESS_DICT_MAX && size < 2 * n)
+	size *= 2;
+    d->first = (R_xlen_t *) R_alloc(size, sizeof(R_xlen_t));
+    d->code = (int *) R_alloc(size, sizeof(int));
+    for (int h = 0; h < size; h++)
+	d->first[h] = -1;
+    d->mask = size - 1;
+    d->ndist = 0;
+    for (R_xlen_t i = 0; i < n; i++) {
+	dict_lookup(d, x, i, TRUE);
+	if (d->ndist > COMPRESS_DICT_MAX)
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+static SEXP compress_vector(SEXP x, int encoding)
+{
+    R_xlen_t n = XLENGTH(x), i, nruns = n > 0 ? 1 : 0;
+    int type = TYPEOF(x), es = type == REALSXP ? sizeof(double) : sizeof(int);
+    Rboolean incr = TRUE, decr = TRUE, no_na = TRUE;
+    int imin = INT_MAX, imax = INT_MIN;
+    const void *vmax = vmaxget();
+
+    /* runs, order, NAs and range */
+    for (i = 0; i < n; i++) {
+	if (i > 0 && ! same_bits(x, i - 1, i))
+	    nruns++;
+	if (type == REALSXP) {
+	    double v = REAL0(x)[i];
+	    if (ISNAN(v)) no_na = FALSE;
+	    else if (i > 0) {
+		double u = REAL0(x)[i - 1];
+		if (v < u) incr = FALSE;
+		if (v > u) decr = FALSE;
+	    }
+	}
+	else {
+	    int v = ((int *) DATAPTR(x))[i];
+	    if (v == NA_INTEGER) no_na = FALSE;
+	    else {
+		if (v < imin) imin = v;
+		if (v > imax) imax = v;
+		if (i > 0) {
+		    int u = ((int *) DATAPTR(x))[i - 1];
+		    if (v < u) incr = FALSE;
+		    if (v > u) decr = FALSE;
+		}
+	    }
+	}
+    }
+
+    /* sizes of the encodings in bytes, 0 if not possible */
+    double rawsize = (double) n * es;
+    double rlesize = (double) nruns * (es + sizeof(double));
+    double packsize = 0, dictsize = 0;
+    int packwidth = 0, dictwidth = 0;
+    if (type != REALSXP) {
+	double range = imax >= imin ? (double) imax - imin + 1 : 0;
+	packwidth = range + ! no_na <= 65536 ?
+	    code_width((R_xlen_t) range + ! no_na) : 0;
+	if (packwidth > 0)
+	    packsize = ceil(n * (packwidth / 8.0));
+    }
+    dict_table_t dict;
+    Rboolean dictok = FALSE;
+    if (encoding == COMPRESS_DICT ||
+	(encoding == COMPRESS_AUTO && packwidth != 1)) {
+	dictok = dict_build(&dict, x);
+	if (dictok) {
+	    dictwidth = code_width(dict.ndist);
+	    dictsize = (double) dict.ndist * es +
+		ceil(n * (dictwidth / 8.0));
+	}
+    }
+
+    if (encoding == COMPRESS_AUTO) {
+	double best = rawsize;
+	if (rlesize < best) { best = rlesize; encoding = COMPRESS_RLE; }
+	if (packwidth > 0 && packsize < best) {
+	    best = packsize; encoding = COMPRESS_BITPACK;
+	}
+	if (dictok && dictsize < best) {
+	    best = dictsize; encoding = COMPRESS_DICT;
+	}
+	if (encoding == COMPRESS_AUTO) {
+	    vmaxset(vmax);
+	    return x;
+	}
+    }
+    else if (encoding == COMPRESS_BITPACK && packwidth == 0)
+	error(_("the values cannot be bit-packed"));
+    else if (encoding == COMPRESS_DICT && ! dictok)
+	error(_("more than %d distinct values"), COMPRESS_DICT_MAX);
+
+    SEXP info = PROTECT(allocVector(INTSXP, 4));
+    SEXP vals, index;
+    int w = 0;
+    switch (encoding) {
+    case COMPRESS_RLE: {
+	vals = PROTECT(allocVector(type, nruns));
+	index = PROTECT(allocVector(REALSXP, nruns));
+	R_xlen_t r = 0;
+	for (i = 0; i < n; i++) {
+	    if (i > 0 && ! same_bits(x, i - 1, i))
+		REAL0(index)[r++] = (double) i;
+	    memcpy((char *) DATAPTR(vals) + r * es,
+		   (char *) DATAPTR(x) + i * es, es);
+	}
+	if (nruns > 0)
+	    REAL0(index)[r] = (double) n;
+	break;
+    }
+    case COMPRESS_DICT:
+	w = dictwidth;
+	vals = PROTECT(allocVector(type, dict.ndist));
+	index = PROTECT(allocVector(RAWSXP, (R_xlen_t) ceil(n * (w / 8.0))));
+	memset(RAW0(index), 0, XLENGTH(index));
+	for (i = 0; i < n; i++) {
+	    set_packed_code(RAW0(index), w, i,
+			    dict_lookup(&dict, x, i, FALSE));
+	}
+	for (int h = 0; h <= dict.mask; h++)
+	    if (dict.first[h] >= 0)
+		memcpy((char *) DATAPTR(vals) + (R_xlen_t) dict.code[h] * es,
+		       (char *) DATAPTR(x) + dict.first[h] * es, es);
+	break;
+    default: {
+	w = packwidth;
+	int nacode = no_na ? -1 : (1 << w) - 1;
+	vals = PROTECT(allocVector(type, 1));
+	((int *) DATAPTR(vals))[0] = imax >= imin ? imin : 0;
+	index = PROTECT(allocVector(RAWSXP, (R_xlen_t) ceil(n * (w / 8.0))));
+	memset(RAW0(index), 0, XLENGTH(index));
+	for (i = 0; i < n; i++) {
+	    int v = ((int *) DATAPTR(x))[i];
+	    set_packed_code(RAW0(index), w, i,
+			    v == NA_INTEGER ? nacode : v - imin);
+	}
+    }
+    }
+    vmaxset(vmax);
+
+    INTEGER0(info)[0] = encoding;
+    INTEGER0(info)[1] = w;
+    INTEGER0(info)[2] = ! no_na ? UNKNOWN_SORTEDNESS :
+	incr ? SORTED_INCR : decr ? SORTED_DECR : KNOWN_UNSORTED;
+    INTEGER0(info)[3] = no_na;
+    SEXP state = PROTECT(allocVector(VECSXP, 4));
+    SET_VECTOR_ELT(state, 0, info);
+    SET_VECTOR_ELT(state, 1, vals);
+    SET_VECTOR_ELT(state, 2, index);
+    SET_VECTOR_ELT(state, 3, ScalarReal((double) n));
+    SEXP ans = new_compressed(state);
+    UNPROTECT(4); /* state, index, vals, info */
+    return ans;
+}
+
+SEXP attribute_hidden do_compress_vector(SEXP call, SEXP op, SEXP args,
+					 SEXP env)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args);
+    int encoding = asInteger(CADR(args));
+    if (encoding < COMPRESS_AUTO || encoding > COMPRESS_BITPACK)
+	error(_("invalid '%s' argument"), "encoding");
+    switch(TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP: break;
+    default: error(_("only logical, integer and double vectors can be compressed"));
+    }
+    if (ALTREP(x) && (R_altrep_inherits(x, compressed_integer_class) ||
+		      R_altrep_inherits(x, compressed_logical_class) ||
+		      R_altrep_inherits(x, compressed_real_class)) &&
+	COMPRESSED_STATE(x) != R_NilValue)
+	return x;
+
+    /* compress_vector reads the elements in place, so other ALTREP
+       vectors, such as compact sequences, are copied first */
+    SEXP y = x;
+    if (ALTREP(x)) {
+	R_xlen_t n = XLENGTH(x);
+	y = allocVector(TYPEOF(x), n);
+	switch(TYPEOF(x)) {
+	case LGLSXP: LOGICAL_GET_REGION(x, 0, n, LOGICAL0(y)); break;
+	case INTSXP: INTEGER_GET_REGION(x, 0, n, INTEGER0(y)); break;
+	default: REAL_GET_REGION(x, 0, n, REAL0(y));
+	}
+    }
+    PROTECT(x);
+    PROTECT(y);
+    SEXP ans = compress_vector(y, encoding);
+    if (ans == y)
+	ans = x;
+    else if (ATTRIB(x) != R_NilValue) {
+	PROTECT(ans);
+	SHALLOW_DUPLICATE_ATTRIB(ans, x);
+	UNPROTECT(1);
+    }
+    UNPROTECT(2);
+    return ans;
+}
+
+
+/**
+ ** Slice Views
+ **/
+
+/*
+ * Methods
+ */
+
+/* A slice view holds the elements start, start + stride, ... of a
+   parent vector, without copying them.  The state is a list of a real
+   vector holding the length, start and stride, and of the parent.  A
+   writable data pointer expands the view, and the state is then
+   dropped so the parent can be reclaimed.  Views are made by
+   ExtractSubset for indices in arithmetic progression, and a view of
+   an unexpanded view refers to its parent. */
+
+#define SLICE_VIEW_STATE(x) R_altrep_data1(x)
+#define CLEAR_SLICE_VIEW_STATE(x) R_set_altrep_data1(x, R_NilValue)
+#define SLICE_VIEW_EXPANDED(x) R_altrep_data2(x)
+#define SET_SLICE_VIEW_EXPANDED(x, v) R_set_altrep_data2(x, v)
+
+#define SLICE_VIEW_STATE_LENGTH(s) ((R_xlen_t) REAL0(VECTOR_ELT(s, 0))[0])
+#define SLICE_VIEW_STATE_START(s) ((R_xlen_t) REAL0(VECTOR_ELT(s, 0))[1])
+#define SLICE_VIEW_STATE_STRIDE(s) ((R_xlen_t) REAL0(VECTOR_ELT(s, 0))[2])
+#define SLICE_VIEW_STATE_PARENT(s) VECTOR_ELT(s, 1)
+
+static R_xlen_t R_SliceViewMin = 1024;
+static R_altrep_class_t slice_view_logical_class;
+static R_altrep_class_t slice_view_integer_class;
+static R_altrep_class_t slice_view_real_class;
+static R_altrep_class_t slice_view_complex_class;
+static R_altrep_class_t slice_view_raw_class;
+
+static R_xlen_t slice_view_Length(SEXP x)
+{
+    SEXP state = SLICE_VIEW_STATE(x);
+    return state == R_NilValue ?
+	XLENGTH(SLICE_VIEW_EXPANDED(x)) : SLICE_VIEW_STATE_LENGTH(state);
+}
+
+/* contiguous views of vectors with a data pointer can use it */
+static const void *slice_view_parent_dataptr(SEXP state)
+{
+    if (SLICE_VIEW_STATE_STRIDE(state) != 1)
+	return NULL;
+    SEXP parent = SLICE_VIEW_STATE_PARENT(state);
+    const char *p = DATAPTR_OR_NULL(parent);
+    if (p == NULL)
+	return NULL;
+    R_xlen_t start = SLICE_VIEW_STATE_START(state);
+    switch (TYPEOF(parent)) {
+    case LGLSXP: return p + start * sizeof(int);
+    case INTSXP: return p + start * sizeof(int);
+    case REALSXP: return p + start * sizeof(double);
+    case CPLXSXP: return p + start * sizeof(Rcomplex);
+    case RAWSXP: return p + start * sizeof(Rbyte);
+    default: return NULL;
+    }
+}
+
+#define DEFINE_SLICE_VIEW_ELT_METHODS(KIND, CTYPE, ELT, GET_REGION)	\
+    static CTYPE slice_view_##KIND##_Elt(SEXP x, R_xlen_t i)		\
+    {									\
+	SEXP state = SLICE_VIEW_STATE(x);				\
+	if (state == R_NilValue)					\
+	    return ELT(SLICE_VIEW_EXPANDED(x), i);			\
+	return ELT(SLICE_VIEW_STATE_PARENT(state),			\
+		   SLICE_VIEW_STATE_START(state) +			\
+		   i * SLICE_VIEW_STATE_STRIDE(state));			\
+    }									\
+									\
+    static R_xlen_t							\
+    slice_view_##KIND##_Get_region(SEXP x, R_xlen_t i, R_xlen_t n,	\
+				   CTYPE *buf)				\
+    {									\
+	SEXP state = SLICE_VIEW_STATE(x);				\
+	if (state == R_NilValue)					\
+	    return GET_REGION(SLICE_VIEW_EXPANDED(x), i, n, buf);	\
+	SEXP parent = SLICE_VIEW_STATE_PARENT(state);			\
+	R_xlen_t size = SLICE_VIEW_STATE_LENGTH(state);			\
+	R_xlen_t start = SLICE_VIEW_STATE_START(state);			\
+	R_xlen_t stride = SLICE_VIEW_STATE_STRIDE(state);		\
+	R_xlen_t ncopy = size - i > n ? n : size - i;			\
+	if (stride == 1)						\
+	    return GET_REGION(parent, start + i, ncopy, buf);		\
+	for (R_xlen_t k = 0; k < ncopy; k++)				\
+	    buf[k] = ELT(parent, start + (i + k) * stride);		\
+	return ncopy;							\
+    }
+
+DEFINE_SLICE_VIEW_ELT_METHODS(logical, int, LOGICAL_ELT, LOGICAL_GET_REGION)
+DEFINE_SLICE_VIEW_ELT_METHODS(integer, int, INTEGER_ELT, INTEGER_GET_REGION)
+DEFINE_SLICE_VIEW_ELT_METHODS(real, double, REAL_ELT, REAL_GET_REGION)
+DEFINE_SLICE_VIEW_ELT_METHODS(complex, Rcomplex, COMPLEX_ELT,
+			      COMPLEX_GET_REGION)
+DEFINE_SLICE_VIEW_ELT_METHODS(raw, Rbyte, RAW_ELT, RAW_GET_REGION)
+
+/* Slices in increasing order keep the order of the parent.  An
+   expanded view may have been modified. */
+#define DEFINE_SLICE_VIEW_SORTED_METHODS(KIND, IS_SORTED, NO_NA)	\
+    static int slice_view_##KIND##_Is_sorted(SEXP x)			\
+    {									\
+	SEXP state = SLICE_VIEW_STATE(x);				\
+	if (state == R_NilValue || SLICE_VIEW_STATE_STRIDE(state) <= 0) \
+	    return UNKNOWN_SORTEDNESS;					\
+	return IS_SORTED(SLICE_VIEW_STATE_PARENT(state));		\
+    }									\
+									\
+    static int slice_view_##KIND##_No_NA(SEXP x)			\
+    {									\
+	SEXP state = SLICE_VIEW_STATE(x);				\
+	return state == R_NilValue ?					\
+	    FALSE : NO_NA(SLICE_VIEW_STATE_PARENT(state));		\
+    }
+
+DEFINE_SLICE_VIEW_SORTED_METHODS(logical, LOGICAL_IS_SORTED, LOGICAL_NO_NA)
+DEFINE_SLICE_VIEW_SORTED_METHODS(integer, INTEGER_IS_SORTED, INTEGER_NO_NA)
+DEFINE_SLICE_VIEW_SORTED_METHODS(real, REAL_IS_SORTED, REAL_NO_NA)
+
+static void expand_slice_view(SEXP x)
+{
+    SEXP state = SLICE_VIEW_STATE(x);
+    if (state != R_NilValue) {
+	PROTECT(x);
+	R_xlen_t n = SLICE_VIEW_STATE_LENGTH(state);
+	SEXP val = allocVector(TYPEOF(x), n);
+	switch (TYPEOF(x)) {
+	case LGLSXP: slice_view_logical_Get_region(x, 0, n, LOGICAL0(val)); break;
+	case INTSXP: slice_view_integer_Get_region(x, 0, n, INTEGER0(val)); break;
+	case REALSXP: slice_view_real_Get_region(x, 0, n, REAL0(val)); break;
+	case CPLXSXP: slice_view_complex_Get_region(x, 0, n, COMPLEX0(val)); break;
+	case RAWSXP: slice_view_raw_Get_region(x, 0, n, RAW0(val)); break;
+	default: error("unsupported slice view type");
+	}
+	SET_SLICE_VIEW_EXPANDED(x, val);
+	CLEAR_SLICE_VIEW_STATE(x); /* allow the parent to be reclaimed */
+	UNPROTECT(1);
+    }
+}
+
+static SEXP slice_view_Duplicate(SEXP x, Rboolean deep)
+{
+    /* the state is never modified, so it can be shared */
+    SEXP state = SLICE_VIEW_STATE(x);
+    if (state == R_NilValue)
+	return NULL;
+    return R_new_altrep(R_cast_altrep_class(ALTREP_CLASS(x)), state,
+			R_NilValue);
+}
+
+static
+Rboolean slice_view_Inspect(SEXP x, int pre, int deep, int pvec,
+			    void (*inspect_subtree)(SEXP, int, int, int))
+{
+    SEXP state = SLICE_VIEW_STATE(x);
+    if (state != R_NilValue) {
+	Rprintf("  <slice view from %.0f by %.0f>\n",
+		(double) SLICE_VIEW_STATE_START(state) + 1,
+		(double) SLICE_VIEW_STATE_STRIDE(state));
+	inspect_subtree(SLICE_VIEW_STATE_PARENT(state), pre, deep, pvec);
+    }
+    else {
+	Rprintf("  <expanded slice view>\n");
+	inspect_subtree(SLICE_VIEW_EXPANDED(x), pre, deep, pvec);
+    }
+    return TRUE;
+}
+
+static void *slice_view_Dataptr(SEXP x, Rboolean writeable)
+{
+    SEXP state = SLICE_VIEW_STATE(x);
+    if (state != R_NilValue && ! writeable) {
+	const void *p = slice_view_parent_dataptr(state);
+	if (p != NULL)
+	    return (void *) p;
+    }
+    expand_slice_view(x);
+    return DATAPTR(SLICE_VIEW_EXPANDED(x));
+}
+
+static const void *slice_view_Dataptr_or_null(SEXP x)
+{
+    SEXP state = SLICE_VIEW_STATE(x);
+    return state != R_NilValue ?
+	slice_view_parent_dataptr(state) : DATAPTR(SLICE_VIEW_EXPANDED(x));
+}
+
+
+/*
+ * Class Objects and Method Tables
+ */
+
+static R_altrep_class_t InitSliceViewClass(R_altrep_class_t cls)
+{
+    /* override ALTREP methods */
+    R_set_altrep_Duplicate_method(cls, slice_view_Duplicate);
+    R_set_altrep_Inspect_method(cls, slice_view_Inspect);
+    R_set_altrep_Length_method(cls, slice_view_Length);
+
+    /* override ALTVEC methods */
+    R_set_altvec_Dataptr_method(cls, slice_view_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, slice_view_Dataptr_or_null);
+
+    return cls;
+}
+
+#define INIT_SLICE_VIEW_CLASS(KIND) do {				\
+	R_altrep_class_t cls =						\
+	    R_make_alt##KIND##_class("slice_view_" #KIND, "base", NULL); \
+	slice_view_##KIND##_class = InitSliceViewClass(cls);		\
+	R_set_alt##KIND##_Elt_method(cls, slice_view_##KIND##_Elt);	\
+	R_set_alt##KIND##_Get_region_method(cls,			\
+					    slice_view_##KIND##_Get_region); \
+    } while (0)
+
+#define INIT_SLICE_VIEW_SORTED_METHODS(KIND) do {			\
+	R_altrep_class_t cls = slice_view_##KIND##_class;		\
+	R_set_alt##KIND##_Is_sorted_method(cls,				\
+					   slice_view_##KIND##_Is_sorted); \
+	R_set_alt##KIND##_No_NA_method(cls, slice_view_##KIND##_No_NA);	\
+    } while (0)
+
+static void InitSliceViewClasses()
+{
+    INIT_SLICE_VIEW_CLASS(logical);
+    INIT_SLICE_VIEW_CLASS(integer);
+    INIT_SLICE_VIEW_CLASS(real);
+    INIT_SLICE_VIEW_CLASS(complex);
+    INIT_SLICE_VIEW_CLASS(raw);
+    INIT_SLICE_VIEW_SORTED_METHODS(logical);
+    INIT_SLICE_VIEW_SORTED_METHODS(integer);
+    INIT_SLICE_VIEW_SORTED_METHODS(real);
+
+    /* R_SLICE_VIEW_MIN is the shortest subset made a view, 0 for none */
+    char *p = getenv("R_SLICE_VIEW_MIN");
+    if (p != NULL) {
+	int ierr;
+	R_size_t min = R_Decode2Long(p, &ierr);
+	if (ierr == 0)
+	    R_SliceViewMin = min > R_XLEN_T_MAX ? 0 : (R_xlen_t) min;
+    }
+}
+
+
+/*
+ * Constructor
+ */
+
+/* Find the zero-based start and the stride of the positions in an
+   index vector as made by makeSubscript, if they are in arithmetic
+   progression and within the n elements of the vector. */
+static Rboolean slice_index_stride(SEXP indx, R_xlen_t nx,
+				   R_xlen_t *pstart, R_xlen_t *pstride)
+{
+    R_xlen_t n = XLENGTH(indx), start, stride, i;
+
+    if (TYPEOF(indx) == INTSXP) {
+	if (R_altrep_inherits(indx, R_compact_intseq_class)) {
+	    start = (R_xlen_t) INTEGER_ELT(indx, 0) - 1;
+	    stride = (R_xlen_t) INTEGER_ELT(indx, 1) - 1 - start;
+	}
+	else {
+	    const int *pi = INTEGER_OR_NULL(indx);
+	    if (pi == NULL)
+		return FALSE;
+	    start = (R_xlen_t) pi[0] - 1;
+	    stride = (R_xlen_t) pi[1] - pi[0];
+	    for (i = 2; i < n; i++)
+		if ((R_xlen_t) pi[i] - 1 != start + i * stride)
+		    return FALSE;
+	}
+    }
+    else if (TYPEOF(indx) == REALSXP) {
+	/* non-integer positions are truncated, as in ExtractSubset */
+	const double *pd = REAL_OR_NULL(indx);
+	if (pd == NULL || ! R_FINITE(pd[0]) || ! R_FINITE(pd[1]) ||
+	    fabs(pd[0]) > R_XLEN_T_MAX || fabs(pd[1]) > R_XLEN_T_MAX)
+	    return FALSE;
+	start = (R_xlen_t) (pd[0] - 1);
+	stride = (R_xlen_t) (pd[1] - 1) - start;
+	for (i = 2; i < n; i++)
+	    if (! R_FINITE(pd[i]) || fabs(pd[i]) > R_XLEN_T_MAX ||
+		(R_xlen_t) (pd[i] - 1) != start + i * stride)
+		return FALSE;
+    }
+    else
+	return FALSE;
+
+    R_xlen_t last = start + (n - 1) * stride;
+    if (start < 0 || start >= nx || last < 0 || last >= nx)
+	return FALSE;
+    *pstart = start;
+    *pstride = stride;
+    return TRUE;
+}
+
+SEXP attribute_hidden R_slice_view(SEXP x, SEXP indx)
+{
+    R_xlen_t n = XLENGTH(indx), start, stride;
+    if (R_SliceViewMin == 0 || n < R_SliceViewMin || n < 2)
+	return NULL;
+
+    R_altrep_class_t cls;
+    switch (TYPEOF(x)) {
+    case LGLSXP: cls = slice_view_logical_class; break;
+    case INTSXP: cls = slice_view_integer_class; break;
+    case REALSXP: cls = slice_view_real_class; break;
+    case CPLXSXP: cls = slice_view_complex_class; break;
+    case RAWSXP: cls = slice_view_raw_class; break;
+    default: return NULL;
+    }
+
+    if (! slice_index_stride(indx, XLENGTH(x), &start, &stride))
+	return NULL;
+
+    if (R_altrep_inherits(x, cls) && SLICE_VIEW_STATE(x) != R_NilValue) {
+	SEXP state = SLICE_VIEW_STATE(x);
+	R_xlen_t pstride = SLICE_VIEW_STATE_STRIDE(state);
+	start = SLICE_VIEW_STATE_START(state) + start * pstride;
+	stride *= pstride;
+	x = SLICE_VIEW_STATE_PARENT(state);
+    }
+
+    /* A view keeps the parent referenced even after it is no longer
+       used, so a parent that could be modified in place would be
+       copied when next assigned into.  Only parents that would be
+       copied anyway are viewed. */
+    if (! MAYBE_SHARED(x))
+	return NULL;
+    ENSURE_NAMEDMAX(x);
+    SEXP info = PROTECT(allocVector(REALSXP, 3));
+    REAL0(info)[0] = n;
+    REAL0(info)[1] = start;
+    REAL0(info)[2] = stride;
+    SEXP state = PROTECT(allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(state, 0, info);
+    SET_VECTOR_ELT(state, 1, x);
+    SEXP ans = R_new_altrep(cls, state, R_NilValue);
+    UNPROTECT(2); /* info, state */
+    return ans;
+}
+
+
+/**
+ ** Memory Mapped Vectors
+ **/
+
+/* For now, this code is designed to work both in base R and in a
+   package. Some simplifications would be possible if it was only to
+   be used in base. in particular, the issue of finalizing objects
+   before unloading the library would not need to be addressed, and
+   ordinary finalizers in the external pointers could be used instead
+   of maintaining a weak reference list of the live mmap objects. */
+
+/*
+ * MMAP Object State
+ */
+
+/* State is held in a LISTSXP of length 3, and includes
+   
+       file
+       size, length and offset in a REALSXP
+       type, ptrOK, wrtOK, serOK in an INTSXP
+
+   These are used by the methods, and also represent the serialized
+   state object. States serialized before the offset was recorded
+   have a sizes vector of length 2 and map from the start of the
+   file. */
+
+static size_t mmap_eltsize(int type)
+{
     switch(type) {
+    case LGLSXP: return sizeof(int);
+    case INTSXP: return sizeof(int);
+    case REALSXP: return sizeof(double);
+    case CPLXSXP: return sizeof(Rcomplex);
+    case RAWSXP: return sizeof(Rbyte);
+    default: error("mmap for %s not supported yet", type2char(type));
+    }
+}
+
+static SEXP make_mmap_state(SEXP file, size_t size, double offset, int type,
+			    Rboolean ptrOK, Rboolean wrtOK, Rboolean serOK)
+{
+    SEXP sizes = PROTECT(allocVector(REALSXP, 3));
+    double *dsizes = REAL(sizes);
+    dsizes[0] = size;
+    dsizes[1] = size / mmap_eltsize(type);
+    dsizes[2] = offset;
+
+    SEXP info = PROTECT(allocVector(INTSXP, 4));
+    INTEGER(info)[0] = type;
+    INTEGER(info)[1] = ptrOK;
+    INTEGER(info)[2] = wrtOK;
+    INTEGER(info)[3] = serOK;
+
+    SEXP state = list3(file, sizes, info);
+
+    UNPROTECT(2);
+    return state;
+}
+			    
+#define MMAP_STATE_FILE(x) CAR(x)
+#define MMAP_STATE_SIZE(x) ((size_t) REAL_ELT(CADR(x), 0))
+#define MMAP_STATE_LENGTH(x) ((size_t) REAL_ELT(CADR(x), 1))
+#define MMAP_STATE_OFFSET(x) \
+    (XLENGTH(CADR(x)) > 2 ? REAL_ELT(CADR(x), 2) : 0.0)
+#define MMAP_STATE_TYPE(x) INTEGER(CADDR(x))[0]
+#define MMAP_STATE_PTROK(x) INTEGER(CADDR(x))[1]
+#define MMAP_STATE_WRTOK(x) INTEGER(CADDR(x))[2]
+#define MMAP_STATE_SEROK(x) INTEGER(CADDR(x))[3]
+
+
+/*
+ * MMAP Classes and Objects
+ */
+
+static R_altrep_class_t mmap_logical_class;
+static R_altrep_class_t mmap_integer_class;
+static R_altrep_class_t mmap_real_class;
+static R_altrep_class_t mmap_complex_class;
+static R_altrep_class_t mmap_raw_class;
+
+/* MMAP objects are ALTREP objects with data fields
+
+       data1: an external pointer to the mmaped address
+       data2: the MMAP object's state
+
+   The state is also stored in the Protected field of the external
+   pointer for use by the finalizer. The address is that of the first
+   element; the mapping itself starts at the page boundary at or
+   before it.
+*/
+
+static void register_mmap_eptr(SEXP eptr);
+static SEXP make_mmap(void *p, SEXP file, size_t size, double offset,
+		      int type, Rboolean ptrOK, Rboolean wrtOK, Rboolean serOK)
+{
+    SEXP state = PROTECT(make_mmap_state(file, size, offset,
+					 type, ptrOK, wrtOK, serOK));
+    SEXP eptr = PROTECT(R_MakeExternalPtr(p, R_NilValue, state));
+    register_mmap_eptr(eptr);
+
+    R_altrep_class_t class;
+    switch(type) {
+    case LGLSXP:
+	class = mmap_logical_class;
+	break;
     case INTSXP:
 	class = mmap_integer_class;
 	break;
     case REALSXP:
 	class = mmap_real_class;
 	break;
+    case CPLXSXP:
+	class = mmap_complex_class;
+	break;
+    case RAWSXP:
+	class = mmap_raw_class;
+	break;
     default: error("mmap for %s not supported yet", type2char(type));
     }
 
@@ -1757,9 +3423,19 @@ static SEXP make_mmap(void *p, SEXP file, size_t size, int type,
     return ans;
 }
 
+static Rboolean is_mmap(SEXP x)
+{
+    return R_altrep_inherits(x, mmap_logical_class) ||
+	R_altrep_inherits(x, mmap_integer_class) ||
+	R_altrep_inherits(x, mmap_real_class) ||
+	R_altrep_inherits(x, mmap_complex_class) ||
+	R_altrep_inherits(x, mmap_raw_class);
+}
+
 #define MMAP_EPTR(x) R_altrep_data1(x)
 #define MMAP_STATE(x) R_altrep_data2(x)
 #define MMAP_LENGTH(x) MMAP_STATE_LENGTH(MMAP_STATE(x))
+#define MMAP_OFFSET(x) MMAP_STATE_OFFSET(MMAP_STATE(x))
 #define MMAP_PTROK(x) MMAP_STATE_PTROK(MMAP_STATE(x))
 #define MMAP_WRTOK(x) MMAP_STATE_WRTOK(MMAP_STATE(x))
 #define MMAP_SEROK(x) MMAP_STATE_SEROK(MMAP_STATE(x))
@@ -1847,17 +3523,21 @@ static SEXP mmap_Serialized_state(SEXP x)
 	return NULL;
 }
 
-static SEXP mmap_file(SEXP, int, Rboolean, Rboolean, Rboolean, Rboolean);
+static SEXP mmap_file(SEXP, int, double, R_xlen_t,
+		      Rboolean, Rboolean, Rboolean, Rboolean, Rboolean);
 
 static SEXP mmap_Unserialize(SEXP class, SEXP state)
 {
     SEXP file = MMAP_STATE_FILE(state);
     int type = MMAP_STATE_TYPE(state);
+    double offset = MMAP_STATE_OFFSET(state);
+    R_xlen_t n = MMAP_STATE_LENGTH(state);
     Rboolean ptrOK = MMAP_STATE_PTROK(state);
     Rboolean wrtOK = MMAP_STATE_WRTOK(state);
     Rboolean serOK = MMAP_STATE_SEROK(state);
 
-    SEXP val = mmap_file(file, type, ptrOK, wrtOK, serOK, TRUE);
+    SEXP val = mmap_file(file, type, offset, n, ptrOK, wrtOK, serOK,
+			 FALSE, TRUE);
     if (val == NULL) {
 	/**** The attempt to memory map failed. Eventually it would be
 	      good to have a mechanism to allow the user to try to
@@ -1876,6 +3556,8 @@ Rboolean mmap_Inspect(SEXP x, int pre, int deep, int pvec,
     Rboolean wrtOK = MMAP_WRTOK(x);
     Rboolean serOK = MMAP_SEROK(x);
     Rprintf(" mmaped %s", type2char(TYPEOF(x)));
+    if (MMAP_OFFSET(x) != 0)
+	Rprintf(" at offset %.0f", MMAP_OFFSET(x));
     Rprintf(" [ptr=%d,wrt=%d,ser=%d]\n", ptrOK, wrtOK, serOK);
     return TRUE;
 }
@@ -1895,8 +3577,13 @@ static void *mmap_Dataptr(SEXP x, Rboolean writeable)
     /* get addr first to get error if the object has been unmapped */
     void *addr = MMAP_ADDR(x);
 
-    if (MMAP_PTROK(x))
+    if (MMAP_PTROK(x)) {
+	/* changes to a private mapping are not in the file, so it can
+	   no longer be serialized as a reference to the file */
+	if (writeable && ! MMAP_WRTOK(x))
+	    MMAP_SEROK(x) = FALSE;
 	return addr;
+    }
     else
 	error("cannot access data pointer for this mmaped vector");
 }
@@ -1908,49 +3595,35 @@ static const void *mmap_Dataptr_or_null(SEXP x)
 
 
 /*
- * ALTINTEGER Methods
+ * Element Methods
  */
 
-static int mmap_integer_Elt(SEXP x, R_xlen_t i)
-{
-    int *p = MMAP_ADDR(x);
-    return p[i];
-}
-
-static
-R_xlen_t mmap_integer_Get_region(SEXP sx, R_xlen_t i, R_xlen_t n, int *buf)
-{
-    int *x = MMAP_ADDR(sx);
-    R_xlen_t size = XLENGTH(sx);
-    R_xlen_t ncopy = size - i > n ? n : size - i;
-    for (R_xlen_t k = 0; k < ncopy; k++)
-	buf[k] = x[k + i];
-    //memcpy(buf, x + i, ncopy * sizeof(int));
-    return ncopy;
-}
-
+/* The classes differ only in the element type, so the Elt and
+   Get_region methods are generated for each. */
 
-/*
- * ALTREAL Methods
- */
-
-static double mmap_real_Elt(SEXP x, R_xlen_t i)
-{
-    double *p = MMAP_ADDR(x);
-    return p[i];
-}
+#define DEFINE_MMAP_ELT_METHODS(KIND, CTYPE)				\
+    static CTYPE mmap_##KIND##_Elt(SEXP x, R_xlen_t i)			\
+    {									\
+	CTYPE *p = MMAP_ADDR(x);					\
+	return p[i];							\
+    }									\
+									\
+    static R_xlen_t							\
+    mmap_##KIND##_Get_region(SEXP sx, R_xlen_t i, R_xlen_t n, CTYPE *buf) \
+    {									\
+	CTYPE *x = MMAP_ADDR(sx);					\
+	R_xlen_t size = XLENGTH(sx);					\
+	R_xlen_t ncopy = size - i > n ? n : size - i;			\
+	for (R_xlen_t k = 0; k < ncopy; k++)				\
+	    buf[k] = x[k + i];						\
+	return ncopy;							\
+    }
 
-static
-R_xlen_t mmap_real_Get_region(SEXP sx, R_xlen_t i, R_xlen_t n, double *buf)
-{
-    double *x = MMAP_ADDR(sx);
-    R_xlen_t size = XLENGTH(sx);
-    R_xlen_t ncopy = size - i > n ? n : size - i;
-    for (R_xlen_t k = 0; k < ncopy; k++)
-	buf[k] = x[k + i];
-    //memcpy(buf, x + i, ncopy * sizeof(double));
-    return ncopy;
-}
+DEFINE_MMAP_ELT_METHODS(logical, int)
+DEFINE_MMAP_ELT_METHODS(integer, int)
+DEFINE_MMAP_ELT_METHODS(real, double)
+DEFINE_MMAP_ELT_METHODS(complex, Rcomplex)
+DEFINE_MMAP_ELT_METHODS(raw, Rbyte)
 
 
 /*
@@ -1963,33 +3636,8 @@ R_xlen_t mmap_real_Get_region(SEXP sx, R_xlen_t i, R_xlen_t n, double *buf)
 # define MMAPPKG "base"
 #endif
 
-static void InitMmapIntegerClass(DllInfo *dll)
+static R_altrep_class_t InitMmapClass(R_altrep_class_t cls)
 {
-    R_altrep_class_t cls =
-	R_make_altinteger_class("mmap_integer", MMAPPKG, dll);
-    mmap_integer_class = cls;
- 
-    /* override ALTREP methods */
-    R_set_altrep_Unserialize_method(cls, mmap_Unserialize);
-    R_set_altrep_Serialized_state_method(cls, mmap_Serialized_state);
-    R_set_altrep_Inspect_method(cls, mmap_Inspect);
-    R_set_altrep_Length_method(cls, mmap_Length);
-
-    /* override ALTVEC methods */
-    R_set_altvec_Dataptr_method(cls, mmap_Dataptr);
-    R_set_altvec_Dataptr_or_null_method(cls, mmap_Dataptr_or_null);
-
-    /* override ALTINTEGER methods */
-    R_set_altinteger_Elt_method(cls, mmap_integer_Elt);
-    R_set_altinteger_Get_region_method(cls, mmap_integer_Get_region);
-}
-
-static void InitMmapRealClass(DllInfo *dll)
-{
-    R_altrep_class_t cls =
-	R_make_altreal_class("mmap_real", MMAPPKG, dll);
-    mmap_real_class = cls;
-
     /* override ALTREP methods */
     R_set_altrep_Unserialize_method(cls, mmap_Unserialize);
     R_set_altrep_Serialized_state_method(cls, mmap_Serialized_state);
@@ -2000,9 +3648,24 @@ static void InitMmapRealClass(DllInfo *dll)
     R_set_altvec_Dataptr_method(cls, mmap_Dataptr);
     R_set_altvec_Dataptr_or_null_method(cls, mmap_Dataptr_or_null);
 
-    /* override ALTREAL methods */
-    R_set_altreal_Elt_method(cls, mmap_real_Elt);
-    R_set_altreal_Get_region_method(cls, mmap_real_Get_region);
+    return cls;
+}
+
+#define INIT_MMAP_CLASS(KIND, dll) do {					\
+	R_altrep_class_t cls =						\
+	    R_make_alt##KIND##_class("mmap_" #KIND, MMAPPKG, dll);	\
+	mmap_##KIND##_class = InitMmapClass(cls);			\
+	R_set_alt##KIND##_Elt_method(cls, mmap_##KIND##_Elt);		\
+	R_set_alt##KIND##_Get_region_method(cls, mmap_##KIND##_Get_region); \
+    } while (0)
+
+static void InitMmapClasses(DllInfo *dll)
+{
+    INIT_MMAP_CLASS(logical, dll);
+    INIT_MMAP_CLASS(integer, dll);
+    INIT_MMAP_CLASS(real, dll);
+    INIT_MMAP_CLASS(complex, dll);
+    INIT_MMAP_CLASS(raw, dll);
 }
 
 
@@ -2016,8 +3679,9 @@ static void mmap_finalize(SEXP eptr)
     error("mmop objects not supported on Windows yet");
 }
 
-static SEXP mmap_file(SEXP file, int type, Rboolean ptrOK, Rboolean wrtOK,
-		      Rboolean serOK, Rboolean warn)
+static SEXP mmap_file(SEXP file, int type, double offset, R_xlen_t n,
+		      Rboolean ptrOK, Rboolean wrtOK, Rboolean serOK,
+		      Rboolean create, Rboolean warn)
 {
     error("mmop objects not supported on Windows yet");
 }
@@ -2034,15 +3698,24 @@ static SEXP mmap_file(SEXP file, int type, Rboolean ptrOK, Rboolean wrtOK,
 //#define DEBUG_PRINT(x) REprintf(x);
 #define DEBUG_PRINT(x) do { } while (0)
 
+/* mmap offsets must be multiples of the page size, so the mapping
+   starts this many bytes before the first element */
+static size_t mmap_page_delta(double offset)
+{
+    return (size_t) ((off_t) offset % sysconf(_SC_PAGESIZE));
+}
+
 static void mmap_finalize(SEXP eptr)
 {
     DEBUG_PRINT("finalizing ... ");
     void *p = R_ExternalPtrAddr(eptr);
-    size_t size = MMAP_STATE_SIZE(MMAP_EPTR_STATE(eptr));
+    SEXP state = MMAP_EPTR_STATE(eptr);
+    size_t size = MMAP_STATE_SIZE(state);
+    size_t delta = mmap_page_delta(MMAP_STATE_OFFSET(state));
     R_SetExternalPtrAddr(eptr, NULL);
 
     if (p != NULL) {
-	munmap(p, size); /* don't check for errors */
+	munmap((char *) p - delta, size + delta); /* don't check for errors */
 	R_SetExternalPtrAddr(eptr, NULL);
     }
     DEBUG_PRINT("done\n");
@@ -2055,32 +3728,76 @@ static void mmap_finalize(SEXP eptr)
 	}						\
 	else error(str, __VA_ARGS__);			\
     } while (0)
-	    
-static SEXP mmap_file(SEXP file, int type, Rboolean ptrOK, Rboolean wrtOK,
-		      Rboolean serOK, Rboolean warn)
+
+/* Map n elements of the given type starting offset bytes into the
+   file, or all the elements to the end of the file if n is negative.
+   With create, a writable mapping may create the file or extend it
+   with zero bytes to hold n elements. */
+static SEXP mmap_file(SEXP file, int type, double offset, R_xlen_t n,
+		      Rboolean ptrOK, Rboolean wrtOK, Rboolean serOK,
+		      Rboolean create, Rboolean warn)
 {
     const char *efn = R_ExpandFileName(translateChar(STRING_ELT(file, 0)));
+    size_t eltsize = mmap_eltsize(type);
     struct stat sb;
 
-    /* Target not link */
-    if (stat(efn, &sb) != 0)
-	MMAP_FILE_WARNING_OR_ERROR("stat: %s", strerror(errno));
+    create = create && wrtOK && n >= 0;
 
-    if (! S_ISREG(sb.st_mode))
+    /* Target not link */
+    if (stat(efn, &sb) != 0) {
+	if (! (create && errno == ENOENT))
+	    MMAP_FILE_WARNING_OR_ERROR("stat: %s", strerror(errno));
+	sb.st_size = 0;
+    }
+    else if (! S_ISREG(sb.st_mode))
 	MMAP_FILE_WARNING_OR_ERROR("%s is not a regular file", efn);
 
+    double fsize = (double) sb.st_size;
+    double size;
+    if (n < 0) {
+	if (offset > fsize)
+	    MMAP_FILE_WARNING_OR_ERROR("offset is beyond the end of %s", efn);
+	size = fsize - offset;
+	if (fmod(size, (double) eltsize) != 0)
+	    MMAP_FILE_WARNING_OR_ERROR("size of %s is not a whole number "
+				       "of %d-byte elements", efn,
+				       (int) eltsize);
+    }
+    else {
+	size = (double) n * eltsize;
+	if (offset + size > fsize && ! create)
+	    MMAP_FILE_WARNING_OR_ERROR("%s is too short for %.0f elements",
+				       efn, (double) n);
+    }
+    if (size == 0)
+	return allocVector(type, 0);
+
     int oflags = wrtOK ? O_RDWR : O_RDONLY;
-    int fd = open(efn, oflags);
+    if (create)
+	oflags |= O_CREAT;
+    int fd = open(efn, oflags, 0666);
     if (fd == -1)
 	MMAP_FILE_WARNING_OR_ERROR("open: %s", strerror(errno));
 
-    int pflags = wrtOK ? PROT_READ | PROT_WRITE : PROT_READ;
-    void *p = mmap(0, sb.st_size, pflags, MAP_SHARED, fd, 0);
+    if (offset + size > fsize && ftruncate(fd, (off_t) (offset + size))) {
+	int err = errno;
+	close(fd);
+	MMAP_FILE_WARNING_OR_ERROR("ftruncate: %s", strerror(err));
+    }
+
+    /* a read-only file is mapped privately, so that writes through
+       the data pointer of an unshared vector copy the pages changed
+       instead of faulting */
+    size_t delta = mmap_page_delta(offset);
+    int mflags = wrtOK ? MAP_SHARED : MAP_PRIVATE;
+    void *p = mmap(0, (size_t) size + delta, PROT_READ | PROT_WRITE, mflags,
+		   fd, (off_t) offset - delta);
     close(fd); /* don't care if this fails */
     if (p == MAP_FAILED)
 	MMAP_FILE_WARNING_OR_ERROR("mmap: %s", strerror(errno));
 
-    return make_mmap(p, file, sb.st_size, type, ptrOK, wrtOK, serOK);
+    return make_mmap((char *) p + delta, file, (size_t) size, offset,
+		     type, ptrOK, wrtOK, serOK);
 }
 #endif
 
@@ -2103,15 +3820,24 @@ SEXP attribute_hidden do_mmap_file(SEXP call, SEXP op, SEXP args, SEXP env)
     SEXP sptrOK = CADDR(args);
     SEXP swrtOK = CADDDR(args);
     SEXP sserOK = CADDDR(CDR(args));
+    SEXP sn = length(args) > 5 ? CAD4R(CDR(args)) : R_NilValue;
+    SEXP soffset = length(args) > 6 ? CAD4R(CDDR(args)) : R_NilValue;
 
     int type = REALSXP;
     if (stype != R_NilValue) {
 	const char *typestr = CHAR(asChar(stype));
-	if (strcmp(typestr, "double") == 0)
+	if (strcmp(typestr, "double") == 0 ||
+	    strcmp(typestr, "numeric") == 0)
 	    type = REALSXP;
 	else if (strcmp(typestr, "integer") == 0 ||
 		 strcmp(typestr, "int") == 0)
 	    type = INTSXP;
+	else if (strcmp(typestr, "logical") == 0)
+	    type = LGLSXP;
+	else if (strcmp(typestr, "complex") == 0)
+	    type = CPLXSXP;
+	else if (strcmp(typestr, "raw") == 0)
+	    type = RAWSXP;
 	else
 	    error("type '%s' is not supported", typestr);
     }    
@@ -2120,10 +3846,26 @@ SEXP attribute_hidden do_mmap_file(SEXP call, SEXP op, SEXP args, SEXP env)
     Rboolean wrtOK = swrtOK == R_NilValue ? FALSE : asLogicalNA(swrtOK, FALSE);
     Rboolean serOK = sserOK == R_NilValue ? FALSE : asLogicalNA(sserOK, FALSE);
 
+    /* a missing or NA length maps to the end of the file */
+    R_xlen_t n = -1;
+    if (sn != R_NilValue) {
+	double dn = asReal(sn);
+	if (! ISNAN(dn)) {
+	    if (dn < 0 || dn > R_XLEN_T_MAX)
+		error("invalid '%s' argument", "n");
+	    n = (R_xlen_t) dn;
+	}
+    }
+
+    double offset = soffset == R_NilValue ? 0 : asReal(soffset);
+    if (! R_FINITE(offset) || offset < 0 || offset != floor(offset))
+	error("invalid '%s' argument", "offset");
+
     if (TYPEOF(file) != STRSXP || LENGTH(file) != 1 || file == NA_STRING)
 	error("invalud 'file' argument");
 
-    return mmap_file(file, type, ptrOK, wrtOK, serOK, FALSE);
+    return mmap_file(file, type, offset, n, ptrOK, wrtOK, serOK,
+		     TRUE, FALSE);
 }
 
 #ifdef SIMPLEMMAP
@@ -2137,8 +3879,7 @@ SEXP attribute_hidden do_munmap_file(SEXP call, SEXP op, SEXP args, SEXP env)
     SEXP x = CAR(args);
 
     /**** would be useful to have R_mmap_class virtual class as parent here */
-    if (! (R_altrep_inherits(x, mmap_integer_class) ||
-	   R_altrep_inherits(x, mmap_real_class)))
+    if (! is_mmap(x))
 	error("not a memory-mapped object");
 
     /* using the finalizer is a cheat to avoid yet another #ifdef Windows */
@@ -2151,6 +3892,511 @@ SEXP attribute_hidden do_munmap_file(SEXP call, SEXP op, SEXP args, SEXP env)
 }
 
 
+/**
+ ** String Buffers
+ **/
+
+/*
+ * Methods
+ */
+
+/* A string buffer holds the bytes of all the elements of a character
+   vector in one raw vector, with the offset of each element in an
+   integer or, for buffers of 2^31 bytes or more, a real vector of
+   length n + 1, as in the Apache Arrow string layout.  NAs are
+   recorded in an optional validity bitmap, with bit i % 8 of byte
+   i / 8 set for elements that are not NA.  All elements have the same
+   encoding.
+
+   The state is a list of an integer vector of the encoding, whether
+   the buffer is all ASCII and whether there are no NAs; the offsets;
+   the bytes; and the bitmap or NULL.  CHARSXPs are only made for
+   elements accessed with STRING_ELT, and are kept in data2 with NULL
+   for those not made yet.  nchar, substr, ==, match and grepl work on
+   the bytes through R_get_string_buffer.  A writable data pointer
+   makes all the elements and drops the state. */
+
+#define STRING_BUFFER_STATE(x) R_altrep_data1(x)
+#define CLEAR_STRING_BUFFER_STATE(x) R_set_altrep_data1(x, R_NilValue)
+#define STRING_BUFFER_EXPANDED(x) R_altrep_data2(x)
+#define SET_STRING_BUFFER_EXPANDED(x, v) R_set_altrep_data2(x, v)
+
+#define STRING_BUFFER_STATE_ENCODING(s) INTEGER0(VECTOR_ELT(s, 0))[0]
+#define STRING_BUFFER_STATE_ASCII(s) INTEGER0(VECTOR_ELT(s, 0))[1]
+#define STRING_BUFFER_STATE_NO_NA(s) INTEGER0(VECTOR_ELT(s, 0))[2]
+#define STRING_BUFFER_STATE_OFFSETS(s) VECTOR_ELT(s, 1)
+#define STRING_BUFFER_STATE_BYTES(s) VECTOR_ELT(s, 2)
+#define STRING_BUFFER_STATE_VALID(s) VECTOR_ELT(s, 3)
+
+static R_altrep_class_t string_buffer_class;
+
+static SEXP new_string_buffer(SEXP state);
+
+static void string_buffer_init(SEXP state, R_strbuf_t *sb)
+{
+    SEXP offsets = STRING_BUFFER_STATE_OFFSETS(state);
+    SEXP valid = STRING_BUFFER_STATE_VALID(state);
+    /* the bytes may be a memory-mapped raw vector */
+    sb->bytes = (const char *) RAW(STRING_BUFFER_STATE_BYTES(state));
+    sb->ioffsets = TYPEOF(offsets) == INTSXP ? INTEGER(offsets) : NULL;
+    sb->doffsets = TYPEOF(offsets) == REALSXP ? REAL(offsets) : NULL;
+    sb->valid = valid != R_NilValue ? RAW(valid) : NULL;
+    sb->enc = (cetype_t) STRING_BUFFER_STATE_ENCODING(state);
+    sb->ascii = STRING_BUFFER_STATE_ASCII(state);
+    sb->n = XLENGTH(offsets) - 1;
+}
+
+static SEXP string_buffer_mkChar(SEXP state, R_xlen_t i)
+{
+    R_strbuf_t sb;
+    int len;
+    string_buffer_init(state, &sb);
+    const char *p = R_string_buffer_elt(&sb, i, &len);
+    return p == NULL ? NA_STRING : mkCharLenCE(p, len, sb.enc);
+}
+
+static SEXP string_buffer_Serialized_state(SEXP x)
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    return state != R_NilValue ? state : NULL;
+}
+
+static SEXP string_buffer_Unserialize(SEXP class, SEXP state)
+{
+    return new_string_buffer(state);
+}
+
+static SEXP string_buffer_Duplicate(SEXP x, Rboolean deep)
+{
+    /* the state is never modified, so it can be shared */
+    SEXP state = STRING_BUFFER_STATE(x);
+    return state != R_NilValue ? new_string_buffer(state) : NULL;
+}
+
+static
+Rboolean string_buffer_Inspect(SEXP x, int pre, int deep, int pvec,
+			       void (*inspect_subtree)(SEXP, int, int, int))
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    if (state != R_NilValue) {
+	static const char *const name[] = { "native", "UTF-8", "latin1",
+					    "bytes" };
+	int enc = STRING_BUFFER_STATE_ENCODING(state);
+	Rprintf("  <string buffer, %lld bytes, %s%s>\n",
+		(long long) XLENGTH(STRING_BUFFER_STATE_BYTES(state)),
+		STRING_BUFFER_STATE_ASCII(state) ? "ASCII" : name[enc],
+		STRING_BUFFER_STATE_NO_NA(state) ? "" : ", with NAs");
+    }
+    else {
+	Rprintf("  <expanded string buffer>\n");
+	inspect_subtree(STRING_BUFFER_EXPANDED(x), pre, deep, pvec);
+    }
+    return TRUE;
+}
+
+static R_xlen_t string_buffer_Length(SEXP x)
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    return state == R_NilValue ? XLENGTH(STRING_BUFFER_EXPANDED(x)) :
+	XLENGTH(STRING_BUFFER_STATE_OFFSETS(state)) - 1;
+}
+
+static SEXP string_buffer_Elt(SEXP x, R_xlen_t i)
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    SEXP val = STRING_BUFFER_EXPANDED(x);
+    if (state == R_NilValue)
+	return STRING_ELT(val, i);
+
+    PROTECT(x);
+    if (val == R_NilValue) {
+	/* elements not made yet are NULL */
+	R_xlen_t n = XLENGTH(x);
+	val = allocVector(STRSXP, n);
+	memset(STDVEC_DATAPTR(val), 0, n * sizeof(SEXP));
+	SET_STRING_BUFFER_EXPANDED(x, val);
+    }
+    SEXP elt = STRING_ELT(val, i);
+    if (elt == NULL) {
+	elt = string_buffer_mkChar(state, i);
+	SET_STRING_ELT(val, i, elt);
+    }
+    UNPROTECT(1);
+    return elt;
+}
+
+static void expand_string_buffer(SEXP x)
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    if (state != R_NilValue) {
+	PROTECT(x);
+	R_xlen_t n = XLENGTH(x);
+	if (n == 0)
+	    SET_STRING_BUFFER_EXPANDED(x, allocVector(STRSXP, 0));
+	else
+	    for (R_xlen_t i = 0; i < n; i++)
+		string_buffer_Elt(x, i);
+	CLEAR_STRING_BUFFER_STATE(x);
+	UNPROTECT(1);
+    }
+}
+
+static void *string_buffer_Dataptr(SEXP x, Rboolean writeable)
+{
+    expand_string_buffer(x);
+    return DATAPTR(STRING_BUFFER_EXPANDED(x));
+}
+
+static const void *string_buffer_Dataptr_or_null(SEXP x)
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    return state != R_NilValue ? NULL : DATAPTR(STRING_BUFFER_EXPANDED(x));
+}
+
+static void string_buffer_Set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+    expand_string_buffer(x);
+    SET_STRING_ELT(STRING_BUFFER_EXPANDED(x), i, v);
+}
+
+static int string_buffer_No_NA(SEXP x)
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    return state != R_NilValue ? STRING_BUFFER_STATE_NO_NA(state) : FALSE;
+}
+
+static SEXP string_buffer_offsets(double size, R_xlen_t n)
+{
+    return allocVector(size > INT_MAX ? REALSXP : INTSXP, n + 1);
+}
+
+static R_INLINE void set_string_buffer_offset(SEXP offsets, R_xlen_t i,
+					      double v)
+{
+    if (TYPEOF(offsets) == INTSXP)
+	INTEGER0(offsets)[i] = (int) v;
+    else
+	REAL0(offsets)[i] = v;
+}
+
+static R_INLINE double subset_index(SEXP indx, R_xlen_t i)
+{
+    if (TYPEOF(indx) == REALSXP)
+	return REAL_ELT(indx, i);
+    int ii = INTEGER_ELT(indx, i);
+    return ii == NA_INTEGER ? NA_REAL : ii;
+}
+
+static SEXP string_buffer_Extract_subset(SEXP x, SEXP indx, SEXP call)
+{
+    SEXP state = STRING_BUFFER_STATE(x);
+    if (OBJECT(x) || ATTRIB(x) != R_NilValue || state == R_NilValue)
+	return NULL;
+
+    /* copy the bytes of the selected elements into a new buffer */
+    R_strbuf_t sb;
+    R_xlen_t n = XLENGTH(indx), nx = XLENGTH(x), i, ii;
+    double size = 0;
+    Rboolean no_na = TRUE;
+    int len;
+    string_buffer_init(state, &sb);
+    for (i = 0; i < n; i++) {
+	double di = subset_index(indx, i);
+	ii = (R_xlen_t) (di - 1);
+	if (R_FINITE(di) && 0 <= ii && ii < nx &&
+	    R_string_buffer_elt(&sb, ii, &len) != NULL)
+	    size += len;
+	else
+	    no_na = FALSE;
+    }
+
+    SEXP offsets = PROTECT(string_buffer_offsets(size, n));
+    SEXP bytes = PROTECT(allocVector(RAWSXP, (R_xlen_t) size));
+    SEXP valid = R_NilValue;
+    if (! no_na) {
+	valid = allocVector(RAWSXP, (n + 7) / 8);
+	memset(RAW0(valid), 0, XLENGTH(valid));
+    }
+    PROTECT(valid);
+    char *q = (char *) RAW0(bytes);
+    double pos = 0;
+    set_string_buffer_offset(offsets, 0, 0);
+    for (i = 0; i < n; i++) {
+	double di = subset_index(indx, i);
+	ii = (R_xlen_t) (di - 1);
+	const char *p = R_FINITE(di) && 0 <= ii && ii < nx ?
+	    R_string_buffer_elt(&sb, ii, &len) : NULL;
+	if (p != NULL) {
+	    memcpy(q, p, len);
+	    q += len;
+	    pos += len;
+	    if (! no_na)
+		RAW0(valid)[i >> 3] |= (Rbyte) (1 << (i & 7));
+	}
+	set_string_buffer_offset(offsets, i + 1, pos);
+    }
+
+    SEXP info = PROTECT(allocVector(INTSXP, 3));
+    INTEGER0(info)[0] = sb.enc;
+    INTEGER0(info)[1] = sb.ascii;
+    INTEGER0(info)[2] = no_na;
+    SEXP sstate = PROTECT(allocVector(VECSXP, 4));
+    SET_VECTOR_ELT(sstate, 0, info);
+    SET_VECTOR_ELT(sstate, 1, offsets);
+    SET_VECTOR_ELT(sstate, 2, bytes);
+    SET_VECTOR_ELT(sstate, 3, valid);
+    SEXP ans = new_string_buffer(sstate);
+    UNPROTECT(5); /* sstate, info, valid, bytes, offsets */
+    return ans;
+}
+
+
+/*
+ * Class Object and Method Table
+ */
+
+static void InitStringBufferClass(DllInfo *dll)
+{
+    R_altrep_class_t cls = R_make_altstring_class("string_buffer", "base",
+						  dll);
+    string_buffer_class = cls;
+
+    /* override ALTREP methods */
+    R_set_altrep_Unserialize_method(cls, string_buffer_Unserialize);
+    R_set_altrep_Serialized_state_method(cls,
+					 string_buffer_Serialized_state);
+    R_set_altrep_Duplicate_method(cls, string_buffer_Duplicate);
+    R_set_altrep_Inspect_method(cls, string_buffer_Inspect);
+    R_set_altrep_Length_method(cls, string_buffer_Length);
+
+    /* override ALTVEC methods */
+    R_set_altvec_Dataptr_method(cls, string_buffer_Dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, string_buffer_Dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, string_buffer_Extract_subset);
+
+    /* override ALTSTRING methods */
+    R_set_altstring_Elt_method(cls, string_buffer_Elt);
+    R_set_altstring_Set_elt_method(cls, string_buffer_Set_elt);
+    R_set_altstring_No_NA_method(cls, string_buffer_No_NA);
+}
+
+
+/*
+ * Constructors and Access
+ */
+
+static SEXP new_string_buffer(SEXP state)
+{
+    return R_new_altrep(string_buffer_class, state, R_NilValue);
+}
+
+/* fills in sb and returns TRUE if x is a string buffer that has not
+   been expanded */
+Rboolean attribute_hidden R_get_string_buffer(SEXP x, R_strbuf_t *sb)
+{
+    if (! ALTREP(x) || TYPEOF(x) != STRSXP ||
+	! R_altrep_inherits(x, string_buffer_class))
+	return FALSE;
+    SEXP state = STRING_BUFFER_STATE(x);
+    if (state == R_NilValue)
+	return FALSE;
+    string_buffer_init(state, sb);
+    return TRUE;
+}
+
+/* the bytes of element i and their number, or NULL for NA */
+const char attribute_hidden *R_string_buffer_elt(const R_strbuf_t *sb,
+						 R_xlen_t i, int *len)
+{
+    if (sb->valid != NULL && ! (sb->valid[i >> 3] & (1 << (i & 7))))
+	return NULL;
+    R_xlen_t start, end;
+    if (sb->ioffsets != NULL) {
+	start = sb->ioffsets[i];
+	end = sb->ioffsets[i + 1];
+    }
+    else {
+	start = (R_xlen_t) sb->doffsets[i];
+	end = (R_xlen_t) sb->doffsets[i + 1];
+    }
+    *len = (int) (end - start);
+    return sb->bytes + start;
+}
+
+/* Makes a string buffer from the bytes, the offsets of the n + 1
+   element boundaries and the validity bitmap or NULL.  The offsets
+   are checked, and the bytes of the elements for embedded nuls. */
+SEXP attribute_hidden R_new_string_buffer(SEXP bytes, SEXP offsets,
+					  SEXP valid, cetype_t enc)
+{
+    if (TYPEOF(bytes) != RAWSXP)
+	error(_("invalid '%s' argument"), "bytes");
+    if ((TYPEOF(offsets) != INTSXP && TYPEOF(offsets) != REALSXP) ||
+	XLENGTH(offsets) < 1)
+	error(_("invalid '%s' argument"), "offsets");
+    R_xlen_t n = XLENGTH(offsets) - 1, nb = XLENGTH(bytes);
+    if (valid != R_NilValue &&
+	(TYPEOF(valid) != RAWSXP || XLENGTH(valid) < (n + 7) / 8))
+	error(_("invalid '%s' argument"), "valid");
+    switch (enc) {
+    case CE_NATIVE:
+    case CE_UTF8:
+    case CE_LATIN1:
+    case CE_BYTES: break;
+    default: error(_("unknown encoding: %d"), enc);
+    }
+
+    PROTECT(bytes);
+    PROTECT(offsets);
+    const unsigned char *p = (const unsigned char *) RAW(bytes);
+    Rboolean ascii = TRUE, no_na = TRUE;
+    double prev = 0;
+    for (R_xlen_t i = 0; i <= n; i++) {
+	double off = subset_index(offsets, i);
+	if (! R_FINITE(off) || off != floor(off) || off < 0 || off > nb ||
+	    (i > 0 && (off < prev || off - prev > INT_MAX)))
+	    error(_("invalid '%s' argument"), "offsets");
+	if (i > 0 && valid != R_NilValue &&
+	    ! (RAW(valid)[(i - 1) >> 3] & (1 << ((i - 1) & 7))))
+	    no_na = FALSE;
+	else if (i > 0)
+	    for (R_xlen_t k = (R_xlen_t) prev; k < (R_xlen_t) off; k++) {
+		if (p[k] > 127) ascii = FALSE;
+		else if (p[k] == 0)
+		    error(_("embedded nul in string, element %lld"),
+			  (long long) i);
+	    }
+	prev = off;
+    }
+
+    SEXP info = PROTECT(allocVector(INTSXP, 3));
+    INTEGER0(info)[0] = enc;
+    INTEGER0(info)[1] = ascii;
+    INTEGER0(info)[2] = no_na;
+    SEXP state = PROTECT(allocVector(VECSXP, 4));
+    SET_VECTOR_ELT(state, 0, info);
+    SET_VECTOR_ELT(state, 1, offsets);
+    SET_VECTOR_ELT(state, 2, bytes);
+    SET_VECTOR_ELT(state, 3, no_na ? R_NilValue : valid);
+    SEXP ans = new_string_buffer(state);
+    UNPROTECT(4); /* state, info, offsets, bytes */
+    return ans;
+}
+
+/* Packs a character vector.  Elements in different encodings are
+   translated to UTF-8. */
+static SEXP pack_strings(SEXP x)
+{
+    R_xlen_t n = XLENGTH(x), i;
+    cetype_t enc = CE_NATIVE;
+    Rboolean mixed = FALSE, no_na = TRUE, seen = FALSE;
+    double size = 0;
+    const void *vmax = vmaxget();
+
+    for (i = 0; i < n; i++) {
+	SEXP s = STRING_ELT(x, i);
+	if (s == NA_STRING)
+	    no_na = FALSE;
+	else if (! IS_ASCII(s)) {
+	    cetype_t e = getCharCE(s);
+	    if (! seen) {
+		enc = e;
+		seen = TRUE;
+	    }
+	    else if (e != enc)
+		mixed = TRUE;
+	}
+    }
+    if (mixed)
+	enc = CE_UTF8;
+    for (i = 0; i < n; i++) {
+	SEXP s = STRING_ELT(x, i);
+	if (s == NA_STRING) continue;
+	size += mixed && ! IS_ASCII(s) ?
+	    strlen(translateCharUTF8(s)) : LENGTH(s);
+	vmaxset(vmax);
+    }
+
+    SEXP offsets = PROTECT(string_buffer_offsets(size, n));
+    SEXP bytes = PROTECT(allocVector(RAWSXP, (R_xlen_t) size));
+    SEXP valid = R_NilValue;
+    if (! no_na) {
+	valid = allocVector(RAWSXP, (n + 7) / 8);
+	memset(RAW0(valid), 0, XLENGTH(valid));
+    }
+    PROTECT(valid);
+    char *q = (char *) RAW0(bytes);
+    double pos = 0;
+    set_string_buffer_offset(offsets, 0, 0);
+    for (i = 0; i < n; i++) {
+	SEXP s = STRING_ELT(x, i);
+	if (s != NA_STRING) {
+	    const char *p = mixed && ! IS_ASCII(s) ?
+		translateCharUTF8(s) : CHAR(s);
+	    size_t len = mixed && ! IS_ASCII(s) ? strlen(p) : LENGTH(s);
+	    memcpy(q, p, len);
+	    q += len;
+	    pos += len;
+	    vmaxset(vmax);
+	    if (! no_na)
+		RAW0(valid)[i >> 3] |= (Rbyte) (1 << (i & 7));
+	}
+	set_string_buffer_offset(offsets, i + 1, pos);
+    }
+
+    SEXP ans = R_new_string_buffer(bytes, offsets, valid, enc);
+    UNPROTECT(3); /* valid, bytes, offsets */
+    return ans;
+}
+
+SEXP attribute_hidden do_string_buffer(SEXP call, SEXP op, SEXP args,
+				       SEXP env)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args);
+    SEXP offsets = CADR(args);
+    SEXP na = CADDR(args);
+    int enc = asInteger(CADDDR(args));
+
+    if (TYPEOF(x) == STRSXP) {
+	R_strbuf_t sb;
+	if (R_get_string_buffer(x, &sb))
+	    return x;
+	PROTECT(x);
+	SEXP ans = pack_strings(x);
+	if (ATTRIB(x) != R_NilValue) {
+	    PROTECT(ans);
+	    SHALLOW_DUPLICATE_ATTRIB(ans, x);
+	    UNPROTECT(1);
+	}
+	UNPROTECT(1);
+	return ans;
+    }
+    if (TYPEOF(x) != RAWSXP)
+	error(_("'%s' must be a character or raw vector"), "x");
+    if (enc < CE_NATIVE || enc > CE_BYTES)
+	error(_("invalid '%s' argument"), "encoding");
+
+    SEXP valid = R_NilValue;
+    if (na != R_NilValue) {
+	R_xlen_t n = xlength(offsets) - 1;
+	if (TYPEOF(na) != LGLSXP || XLENGTH(na) != n)
+	    error(_("'%s' must be a logical vector with one element for each string"),
+		  "na");
+	valid = PROTECT(allocVector(RAWSXP, (n + 7) / 8));
+	memset(RAW0(valid), 0, XLENGTH(valid));
+	for (R_xlen_t i = 0; i < n; i++)
+	    if (LOGICAL_ELT(na, i) != TRUE)
+		RAW0(valid)[i >> 3] |= (Rbyte) (1 << (i & 7));
+	UNPROTECT(1);
+    }
+    PROTECT(valid);
+    SEXP ans = R_new_string_buffer(x, offsets, valid, (cetype_t) enc);
+    UNPROTECT(1);
+    return ans;
+}
+
+
 /**
  ** Attribute and Meta Data Wrappers
  **/
@@ -2176,6 +4422,25 @@ static R_altrep_class_t wrap_string_class;
 #define WRAPPER_SORTED(x) INTEGER(WRAPPER_METADATA(x))[0]
 #define WRAPPER_NO_NA(x) INTEGER(WRAPPER_METADATA(x))[1]
 
+/* Wrappers made by hashIndex() have a third meta data element, which
+   is not cleared, and keep the hash index match() builds for them as
+   an attribute of the meta data. */
+#define WRAPPER_HASHED(x) (XLENGTH(WRAPPER_METADATA(x)) > NMETA && \
+			   INTEGER(WRAPPER_METADATA(x))[NMETA])
+
+static SEXP R_HashIndexSymbol = NULL;
+
+static SEXP meta_without_index(SEXP meta)
+{
+    if (ATTRIB(meta) == R_NilValue)
+	return meta;
+    R_xlen_t n = XLENGTH(meta);
+    SEXP ans = allocVector(INTSXP, n);
+    for (R_xlen_t i = 0; i < n; i++)
+	INTEGER(ans)[i] = INTEGER(meta)[i];
+    return ans;
+}
+
 
 /*
  * ALTREP Methods
@@ -2183,7 +4448,8 @@ static R_altrep_class_t wrap_string_class;
 
 static SEXP wrapper_Serialized_state(SEXP x)
 {
-    return CONS(WRAPPER_WRAPPED(x), WRAPPER_METADATA(x));
+    /* the hash index is rebuilt when it is needed */
+    return CONS(WRAPPER_WRAPPED(x), meta_without_index(WRAPPER_METADATA(x)));
 }
 
 static SEXP make_wrapper(SEXP, SEXP);
@@ -2210,8 +4476,13 @@ static SEXP wrapper_Duplicate(SEXP x, Rboolean deep)
 #endif
     PROTECT(data);
 
-    /* always duplicate the meta data */
-    SEXP meta = PROTECT(duplicate(WRAPPER_METADATA(x)));
+    /* always duplicate the meta data; the hash index is not modified
+       once built, so the copy can share it */
+    SEXP meta = WRAPPER_METADATA(x);
+    SEXP index = getAttrib(meta, R_HashIndexSymbol);
+    meta = PROTECT(duplicate(meta_without_index(meta)));
+    if (index != R_NilValue)
+	setAttrib(meta, R_HashIndexSymbol, index);
 
     SEXP ans = make_wrapper(data, meta);
 
@@ -2224,7 +4495,11 @@ Rboolean wrapper_Inspect(SEXP x, int pre, int deep, int pvec,
 {
     Rboolean srt = WRAPPER_SORTED(x);
     Rboolean no_na = WRAPPER_NO_NA(x);
-    Rprintf(" wrapper [srt=%d,no_na=%d]\n", srt, no_na);
+    if (WRAPPER_HASHED(x))
+	Rprintf(" wrapper [srt=%d,no_na=%d,hash=%s]\n", srt, no_na,
+		ATTRIB(WRAPPER_METADATA(x)) != R_NilValue ? "built" : "none");
+    else
+	Rprintf(" wrapper [srt=%d,no_na=%d]\n", srt, no_na);
     inspect_subtree(WRAPPER_WRAPPED(x), pre, deep, pvec);
     return TRUE;
 }
@@ -2245,6 +4520,7 @@ static void clear_meta_data(SEXP x)
     INTEGER(meta)[0] = UNKNOWN_SORTEDNESS;
     for (int i = 1; i < NMETA; i++)
 	INTEGER(meta)[i] = 0;
+    SET_ATTRIB(meta, R_NilValue);
 }
 
 static void *wrapper_Dataptr(SEXP x, Rboolean writeable)
@@ -2353,6 +4629,18 @@ static SEXP wrapper_string_Elt(SEXP x, R_xlen_t i)
     return STRING_ELT(WRAPPER_WRAPPED(x), i);
 }
 
+static void wrapper_string_Set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+    SEXP data = WRAPPER_WRAPPED(x);
+    if (MAYBE_SHARED(data)) {
+	PROTECT(x);
+	WRAPPER_SET_WRAPPED(x, shallow_duplicate(data));
+	UNPROTECT(1);
+    }
+    clear_meta_data(x);
+    SET_STRING_ELT(WRAPPER_WRAPPED(x), i, v);
+}
+
 static int wrapper_string_Is_sorted(SEXP x)
 {
     if (WRAPPER_SORTED(x) != UNKNOWN_SORTEDNESS)
@@ -2445,6 +4733,7 @@ static void InitWrapStringClass(DllInfo *dll)
 
     /* override ALTSTRING methods */
     R_set_altstring_Elt_method(cls, wrapper_string_Elt);
+    R_set_altstring_Set_elt_method(cls, wrapper_string_Set_elt);
     R_set_altstring_Is_sorted_method(cls, wrapper_string_Is_sorted);
     R_set_altstring_No_NA_method(cls, wrapper_string_no_NA);
 }
@@ -2476,6 +4765,29 @@ static SEXP make_wrapper(SEXP x, SEXP meta)
     return ans;
 }
 
+/* A wrapper marking x as sorted as srt and, if no_na, as having no
+   NAs; x itself if it is not an integer, double or character vector.
+   The wrapper gets a shallow copy of the attributes of x. */
+SEXP attribute_hidden R_wrap_meta(SEXP x, int srt, int no_na)
+{
+    switch(TYPEOF(x)) {
+    case INTSXP:
+    case REALSXP:
+    case STRSXP: break;
+    default: return x;
+    }
+
+    PROTECT(x);
+    SEXP meta = allocVector(INTSXP, NMETA);
+    INTEGER(meta)[0] = srt;
+    INTEGER(meta)[1] = no_na;
+    SEXP ans = PROTECT(make_wrapper(x, meta));
+    if (ATTRIB(x) != R_NilValue)
+	SHALLOW_DUPLICATE_ATTRIB(ans, x);
+    UNPROTECT(2);
+    return ans;
+}
+
 SEXP attribute_hidden do_wrap_meta(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP x = CAR(args);
@@ -2486,14 +4798,6 @@ SEXP attribute_hidden do_wrap_meta(SEXP call, SEXP op, SEXP args, SEXP env)
     default: error("only INTSXP, REALSXP, STRSXP vectors suppoted for now");
     }
 
-    if (ATTRIB(x) != R_NilValue)
-	/* For objects without references we could move the attributes
-	   to the wrapper. For objects with references the attributes
-	   would have to be shallow duplicated at least. The object/S4
-	   bits would need to be moved as well.	*/
-	/* For now, just return the original object. */
-	return x;
-
     int srt = asInteger(CADR(args));
     if (!KNOWN_SORTED(srt) && srt != KNOWN_UNSORTED &&
 	srt != UNKNOWN_SORTEDNESS)
@@ -2503,11 +4807,71 @@ SEXP attribute_hidden do_wrap_meta(SEXP call, SEXP op, SEXP args, SEXP env)
     if (no_na < 0 || no_na > 1)
 	error("no_na must be 0 or +1");
 
-    SEXP meta = allocVector(INTSXP, NMETA);
+    return R_wrap_meta(x, srt, no_na);
+}
+
+static Rboolean is_wrapper(SEXP x)
+{
+    if (ALTREP(x))
+	switch(TYPEOF(x)) {
+	case INTSXP: return R_altrep_inherits(x, wrap_integer_class);
+	case REALSXP: return R_altrep_inherits(x, wrap_real_class);
+	case STRSXP: return R_altrep_inherits(x, wrap_string_class);
+	default: return FALSE;
+	}
+    return FALSE;
+}
+
+/* The hash index kept by x, or R_NilValue if it has not been built
+   since x was last modified, with *data set to the vector it indexes;
+   NULL if x was not made by hashIndex(). */
+SEXP attribute_hidden R_hash_index(SEXP x, SEXP *data)
+{
+    if (! is_wrapper(x) || ! WRAPPER_HASHED(x))
+	return NULL;
+    *data = WRAPPER_WRAPPED(x);
+    return getAttrib(WRAPPER_METADATA(x), R_HashIndexSymbol);
+}
+
+void attribute_hidden R_set_hash_index(SEXP x, SEXP index)
+{
+    if (is_wrapper(x) && WRAPPER_HASHED(x))
+	setAttrib(WRAPPER_METADATA(x), R_HashIndexSymbol, index);
+}
+
+SEXP attribute_hidden do_hash_index(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args);
+    int srt, no_na;
+    switch(TYPEOF(x)) {
+    case INTSXP:
+	srt = INTEGER_IS_SORTED(x);
+	no_na = INTEGER_NO_NA(x);
+	break;
+    case REALSXP:
+	srt = REAL_IS_SORTED(x);
+	no_na = REAL_NO_NA(x);
+	break;
+    case STRSXP:
+	srt = STRING_IS_SORTED(x);
+	no_na = STRING_NO_NA(x);
+	break;
+    default: return x;
+    }
+    if (is_wrapper(x) && WRAPPER_HASHED(x))
+	return x;
+
+    SEXP meta = allocVector(INTSXP, NMETA + 1);
     INTEGER(meta)[0] = srt;
     INTEGER(meta)[1] = no_na;
-
-    return make_wrapper(x, meta);
+    INTEGER(meta)[NMETA] = TRUE;
+    PROTECT(meta);
+    SEXP ans = PROTECT(make_wrapper(x, meta));
+    if (ATTRIB(x) != R_NilValue)
+	SHALLOW_DUPLICATE_ATTRIB(ans, x);
+    UNPROTECT(2);
+    return ans;
 }
 
 
@@ -2520,9 +4884,13 @@ void attribute_hidden R_init_altrep()
     InitCompactIntegerClass();
     InitCompactRealClass();
     InitDefferredStringClass();
-    InitMmapIntegerClass(NULL);
-    InitMmapRealClass(NULL);
+    InitDeferredArithClass();
+    InitCompressedClasses(NULL);
+    InitSliceViewClasses();
+    InitMmapClasses(NULL);
+    InitStringBufferClass(NULL);
     InitWrapIntegerClass(NULL);
     InitWrapRealClass(NULL);
     InitWrapStringClass(NULL);
+    R_HashIndexSymbol = install("hash.index");
 }
@@ -662,7 +662,19 @@ SEXP attribute_hidden R_binary(SEXP call, SEXP op, SEXP x, SEXP y)
 	/* Can get a LGLSXP. In base-Ex.R on 24 Oct '06, got 8 of these. */
 	if (TYPEOF(x) != INTSXP) COERCE_IF_NEEDED(x, REALSXP, xpi);
 	if (TYPEOF(y) != INTSXP) COERCE_IF_NEEDED(y, REALSXP, ypi);
-	val = real_binary(oper, x, y);
+	/* long results may be computed when they are used, see altrep.c */
+	val = R_deferred_arith(oper, x, y);
+	if (val == NULL)
+	    val = real_binary(oper, x, y);
+	else if (ATTRIB(x) != R_NilValue || ATTRIB(y) != R_NilValue) {
+	    /* copy attributes from the longer argument, as real_binary does */
+	    PROTECT(val);
+	    if (XLENGTH(y) == XLENGTH(val) && ATTRIB(y) != R_NilValue)
+		copyMostAttrib(y, val);
+	    if (XLENGTH(x) == XLENGTH(val) && ATTRIB(x) != R_NilValue)
+		copyMostAttrib(x, val); /* x's attributes overwrite y's */
+	    UNPROTECT(1);
+	}
     }
     else val = integer_binary(oper, x, y, call);
 
@@ -732,18 +744,21 @@ static SEXP logical_unary(ARITHOP_TYPE code, SEXP s1, SEXP call)
     UNPROTECT(3);
 
     int *pa = INTEGER(ans);
-    const int *px = LOGICAL_RO(s1);
 
     switch (code) {
     case PLUSOP:
-	for (R_xlen_t  i = 0; i < n; i++) pa[i] = px[i];
+	ITERATE_BY_REGION(s1, px, idx, nb, int, LOGICAL, {
+		for (R_xlen_t k = 0; k < nb; k++) pa[idx + k] = px[k];
+	    });
 	break;
     case MINUSOP:
-	for (R_xlen_t  i = 0; i < n; i++) {
-	    int x = px[i];
-	    pa[i] = (x == NA_INTEGER) ?
-		NA_INTEGER : ((x == 0.0) ? 0 : -x);
-	}
+	ITERATE_BY_REGION(s1, px, idx, nb, int, LOGICAL, {
+		for (R_xlen_t k = 0; k < nb; k++) {
+		    int x = px[k];
+		    pa[idx + k] = (x == NA_INTEGER) ?
+			NA_INTEGER : ((x == 0.0) ? 0 : -x);
+		}
+	    });
 	break;
     default:
 	errorcall(call, _("invalid unary operator"));
@@ -752,24 +767,35 @@ static SEXP logical_unary(ARITHOP_TYPE code, SEXP s1, SEXP call)
     return ans;
 }
 
+/* The result of a unary minus: the argument itself if it can be
+   modified, otherwise a new vector with its attributes. */
+static SEXP unary_result(SEXP s1)
+{
+    if (NO_REFERENCES(s1) && ! ALTREP(s1))
+	return s1;
+    SEXP ans = PROTECT(allocVector(TYPEOF(s1), XLENGTH(s1)));
+    DUPLICATE_ATTRIB(ans, s1);
+    UNPROTECT(1);
+    return ans;
+}
+
 static SEXP integer_unary(ARITHOP_TYPE code, SEXP s1, SEXP call)
 {
-    R_xlen_t i, n;
     SEXP ans;
 
     switch (code) {
     case PLUSOP:
 	return s1;
     case MINUSOP:
-	ans = NO_REFERENCES(s1) ? s1 : duplicate(s1);
+	ans = unary_result(s1);
 	int *pa = INTEGER(ans);
-	const int *px = INTEGER_RO(s1);
-	n = XLENGTH(s1);
-	for (i = 0; i < n; i++) {
-	    int x = px[i];
-	    pa[i] = (x == NA_INTEGER) ?
-		NA_INTEGER : ((x == 0.0) ? 0 : -x);
-	}
+	ITERATE_BY_REGION(s1, px, idx, nb, int, INTEGER, {
+		for (R_xlen_t k = 0; k < nb; k++) {
+		    int x = px[k];
+		    pa[idx + k] = (x == NA_INTEGER) ?
+			NA_INTEGER : ((x == 0.0) ? 0 : -x);
+		}
+	    });
 	return ans;
     default:
 	errorcall(call, _("invalid unary operator"));
@@ -779,18 +805,17 @@ static SEXP integer_unary(ARITHOP_TYPE code, SEXP s1, SEXP call)
 
 static SEXP real_unary(ARITHOP_TYPE code, SEXP s1, SEXP lcall)
 {
-    R_xlen_t i, n;
     SEXP ans;
 
     switch (code) {
     case PLUSOP: return s1;
     case MINUSOP:
-	ans = NO_REFERENCES(s1) ? s1 : duplicate(s1);
+	ans = unary_result(s1);
 	double *pa = REAL(ans);
-	const double *px = REAL_RO(s1);
-	n = XLENGTH(s1);
-	for (i = 0; i < n; i++)
-	    pa[i] = -px[i];
+	ITERATE_BY_REGION(s1, px, idx, nb, double, REAL, {
+		for (R_xlen_t k = 0; k < nb; k++)
+		    pa[idx + k] = -px[k];
+	    });
 	return ans;
     default:
 	errorcall(lcall, _("invalid unary operator"));
@@ -821,9 +846,9 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     case PLUSOP:
 	{
 	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, int, INTEGER, {
 		    x1 = px1[i1];
 		    x2 = px2[i2];
 		    pa[i] = R_integer_plus(x1, x2, &naflag);
@@ -835,9 +860,9 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     case MINUSOP:
 	{
 	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, int, INTEGER, {
 		    x1 = px1[i1];
 		    x2 = px2[i2];
 		    pa[i] = R_integer_minus(x1, x2, &naflag);
@@ -849,9 +874,9 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     case TIMESOP:
 	{
 	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, int, INTEGER, {
 		    x1 = px1[i1];
 		    x2 = px2[i2];
 		    pa[i] = R_integer_times(x1, x2, &naflag);
@@ -863,9 +888,9 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     case DIVOP:
 	{
 	    double *pa = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, int, INTEGER, {
 		    x1 = px1[i1];
 		    x2 = px2[i2];
 		    pa[i] = R_integer_divide(x1, x2);
@@ -875,9 +900,9 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     case POWOP:
 	{
 	    double *pa = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, int, INTEGER, {
 		    if((x1 = px1[i1]) == 1 || (x2 = px2[i2]) == 0)
 			pa[i] = 1.;
 		    else if (x1 == NA_INTEGER || x2 == NA_INTEGER)
@@ -890,9 +915,9 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     case MODOP:
 	{
 	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, int, INTEGER, {
 		    x1 = px1[i1];
 		    x2 = px2[i2];
 		    if (x1 == NA_INTEGER || x2 == NA_INTEGER || x2 == 0)
@@ -908,9 +933,9 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     case IDIVOP:
 	{
 	    int *pa = INTEGER(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, int, INTEGER, {
 		    x1 = px1[i1];
 		    x2 = px2[i2];
 		    /* This had x %/% 0 == 0 prior to 2.14.1, but
@@ -960,9 +985,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
     case PLUSOP:
 	if(TYPEOF(s1) == REALSXP && TYPEOF(s2) == REALSXP) {
 	    double *da = REAL(ans);
-	    const double *dx = REAL_RO(s1);
-	    const double *dy = REAL_RO(s2);
-	    if (n2 == 1) {
+	    const double *dx = DATAPTR_OR_NULL(s1);
+	    const double *dy = DATAPTR_OR_NULL(s2);
+	    if (dx == NULL || dy == NULL)
+		MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					     s1, px1, double, REAL,
+					     s2, px2, double, REAL,
+					     da[i] = px1[i1] + px2[i2];);
+	    else if (n2 == 1) {
 		double tmp = dy[0];
 		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] + tmp;);
 	    }
@@ -978,25 +1008,30 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	}
 	else if(TYPEOF(s1) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = R_INTEGER(px1[i1]) + px2[i2];);
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, double, REAL,
+					 da[i] = R_INTEGER(px1[i1]) + px2[i2];);
 	}
 	else if(TYPEOF(s2) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = px1[i1] + R_INTEGER(px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, int, INTEGER,
+					 da[i] = px1[i1] + R_INTEGER(px2[i2]););
 	}
 	break;
     case MINUSOP:
 	if(TYPEOF(s1) == REALSXP && TYPEOF(s2) == REALSXP) {
 	    double *da = REAL(ans);
-	    const double *dx = REAL_RO(s1);
-	    const double *dy = REAL_RO(s2);
-	    if (n2 == 1) {
+	    const double *dx = DATAPTR_OR_NULL(s1);
+	    const double *dy = DATAPTR_OR_NULL(s2);
+	    if (dx == NULL || dy == NULL)
+		MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					     s1, px1, double, REAL,
+					     s2, px2, double, REAL,
+					     da[i] = px1[i1] - px2[i2];);
+	    else if (n2 == 1) {
 		double tmp = dy[0];
 		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] - tmp;);
 	    }
@@ -1012,25 +1047,30 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	}
 	else if(TYPEOF(s1) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = R_INTEGER(px1[i1]) - px2[i2];);
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, double, REAL,
+					 da[i] = R_INTEGER(px1[i1]) - px2[i2];);
 	}
 	else if(TYPEOF(s2) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = px1[i1] - R_INTEGER(px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, int, INTEGER,
+					 da[i] = px1[i1] - R_INTEGER(px2[i2]););
 	}
 	break;
     case TIMESOP:
 	if(TYPEOF(s1) == REALSXP && TYPEOF(s2) == REALSXP) {
 	    double *da = REAL(ans);
-	    const double *dx = REAL_RO(s1);
-	    const double *dy = REAL_RO(s2);
-	    if (n2 == 1) {
+	    const double *dx = DATAPTR_OR_NULL(s1);
+	    const double *dy = DATAPTR_OR_NULL(s2);
+	    if (dx == NULL || dy == NULL)
+		MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					     s1, px1, double, REAL,
+					     s2, px2, double, REAL,
+					     da[i] = px1[i1] * px2[i2];);
+	    else if (n2 == 1) {
 		double tmp = dy[0];
 		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] * tmp;);
 	    }
@@ -1046,25 +1086,30 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	}
 	else if(TYPEOF(s1) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = R_INTEGER(px1[i1]) * px2[i2];);
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, double, REAL,
+					 da[i] = R_INTEGER(px1[i1]) * px2[i2];);
 	}
 	else if(TYPEOF(s2) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = px1[i1] * R_INTEGER(px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, int, INTEGER,
+					 da[i] = px1[i1] * R_INTEGER(px2[i2]););
 	}
 	break;
     case DIVOP:
 	if(TYPEOF(s1) == REALSXP && TYPEOF(s2) == REALSXP) {
 	    double *da = REAL(ans);
-	    const double *dx = REAL_RO(s1);
-	    const double *dy = REAL_RO(s2);
-	    if (n2 == 1) {
+	    const double *dx = DATAPTR_OR_NULL(s1);
+	    const double *dy = DATAPTR_OR_NULL(s2);
+	    if (dx == NULL || dy == NULL)
+		MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					     s1, px1, double, REAL,
+					     s2, px2, double, REAL,
+					     da[i] = px1[i1] / px2[i2];);
+	    else if (n2 == 1) {
 		double tmp = dy[0];
 		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] / tmp;);
 	    }
@@ -1080,25 +1125,30 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	}
 	else if(TYPEOF(s1) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = R_INTEGER(px1[i1]) / px2[i2];);
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, double, REAL,
+					 da[i] = R_INTEGER(px1[i1]) / px2[i2];);
 	}
 	else if(TYPEOF(s2) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = px1[i1] / R_INTEGER(px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, int, INTEGER,
+					 da[i] = px1[i1] / R_INTEGER(px2[i2]););
 	}
 	break;
     case POWOP:
 	if(TYPEOF(s1) == REALSXP && TYPEOF(s2) == REALSXP) {
 	    double *da = REAL(ans);
-	    const double *dx = REAL_RO(s1);
-	    const double *dy = REAL_RO(s2);
-	    if (n2 == 1) {
+	    const double *dx = DATAPTR_OR_NULL(s1);
+	    const double *dy = DATAPTR_OR_NULL(s2);
+	    if (dx == NULL || dy == NULL)
+		MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					     s1, px1, double, REAL,
+					     s2, px2, double, REAL,
+					     da[i] = R_POW(px1[i1], px2[i2]););
+	    else if (n2 == 1) {
 		double tmp = dy[0];
 		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = R_POW(dx[i], tmp););
 	    }
@@ -1114,63 +1164,63 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	}
 	else if(TYPEOF(s1) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = R_POW( R_INTEGER(px1[i1]), px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, double, REAL,
+					 da[i] = R_POW( R_INTEGER(px1[i1]), px2[i2]););
 	}
 	else if(TYPEOF(s2) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = R_POW(px1[i1], R_INTEGER(px2[i2])););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, int, INTEGER,
+					 da[i] = R_POW(px1[i1], R_INTEGER(px2[i2])););
 	}
 	break;
     case MODOP:
 	if(TYPEOF(s1) == REALSXP && TYPEOF(s2) == REALSXP) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = myfmod(px1[i1], px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, double, REAL,
+					 da[i] = myfmod(px1[i1], px2[i2]););
 	}
 	else if(TYPEOF(s1) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = myfmod(R_INTEGER(px1[i1]), px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, double, REAL,
+					 da[i] = myfmod(R_INTEGER(px1[i1]), px2[i2]););
 	}
 	else if(TYPEOF(s2) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = myfmod(px1[i1], R_INTEGER(px2[i2])););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, int, INTEGER,
+					 da[i] = myfmod(px1[i1], R_INTEGER(px2[i2])););
 	}
 	break;
     case IDIVOP:
 	if(TYPEOF(s1) == REALSXP && TYPEOF(s2) == REALSXP) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = myfloor(px1[i1], px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, double, REAL,
+					 da[i] = myfloor(px1[i1], px2[i2]););
 	}
 	else if(TYPEOF(s1) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const int *px1 = INTEGER_RO(s1);
-	    const double *px2 = REAL_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = myfloor(R_INTEGER(px1[i1]), px2[i2]););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, int, INTEGER,
+					 s2, px2, double, REAL,
+					 da[i] = myfloor(R_INTEGER(px1[i1]), px2[i2]););
 	}
 	else if(TYPEOF(s2) == INTSXP ) {
 	    double *da = REAL(ans);
-	    const double *px1 = REAL_RO(s1);
-	    const int *px2 = INTEGER_RO(s2);
-	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
-			       da[i] = myfloor(px1[i1], R_INTEGER(px2[i2])););
+	    MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,
+					 s1, px1, double, REAL,
+					 s2, px2, int, INTEGER,
+					 da[i] = myfloor(px1[i1], R_INTEGER(px2[i2])););
 	}
 	break;
     }
@@ -1205,22 +1255,34 @@ static SEXP math1(SEXP sa, double(*f)(double), SEXP lcall)
     n = XLENGTH(sa);
     /* coercion can lose the object bit */
     PROTECT(sa = coerceVector(sa, REALSXP));
-    PROTECT(sy = NO_REFERENCES(sa) ? sa : allocVector(REALSXP, n));
-    const double *a = REAL_RO(sa);
-    double *y = REAL(sy);
-    naflag = 0;
-    for (i = 0; i < n; i++) {
-	double x = a[i]; /* in case y == a */
-	/* This code assumes that ISNAN(x) implies ISNAN(f(x)), so we
-	   only need to check ISNAN(x) if ISNAN(f(x)) is true. */
-	y[i] = f(x);
-	if (ISNAN(y[i])) {
-	    if (ISNAN(x))
-		y[i] = x; /* make sure the incoming NaN is preserved */
-	    else
-		naflag = 1;
+    if ((sy = R_deferred_math1(sa, f)) != NULL) {
+	if (ATTRIB(sa) != R_NilValue) {
+	    PROTECT(sy);
+	    SHALLOW_DUPLICATE_ATTRIB(sy, sa);
+	    UNPROTECT(1);
 	}
+	UNPROTECT(1);
+	return sy;
     }
+    PROTECT(sy = NO_REFERENCES(sa) && ! ALTREP(sa) ?
+	    sa : allocVector(REALSXP, n));
+    double *y = REAL(sy);
+    naflag = 0;
+    ITERATE_BY_REGION(sa, a, idx, nb, double, REAL, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		double x = a[k]; /* in case y == a */
+		/* This code assumes that ISNAN(x) implies ISNAN(f(x)), so
+		   we only need to check ISNAN(x) if ISNAN(f(x)) is true. */
+		i = idx + k;
+		y[i] = f(x);
+		if (ISNAN(y[i])) {
+		    if (ISNAN(x))
+			y[i] = x; /* make sure the incoming NaN is preserved */
+		    else
+			naflag = 1;
+		}
+	    }
+	});
     /* These are primitives, so need to use the call */
     if(naflag) warningcall(lcall, R_MSG_NA);
 
@@ -1326,24 +1388,33 @@ SEXP attribute_hidden do_abs(SEXP call, SEXP op, SEXP args, SEXP env)
     if (isInteger(x) || isLogical(x)) {
 	/* integer or logical ==> return integer,
 	   factor was covered by Math.factor. */
-	R_xlen_t i, n = XLENGTH(x);
-	s = (NO_REFERENCES(x) && TYPEOF(x) == INTSXP) ?
+	R_xlen_t n = XLENGTH(x);
+	s = (NO_REFERENCES(x) && TYPEOF(x) == INTSXP && ! ALTREP(x)) ?
 	    x : allocVector(INTSXP, n);
 	PROTECT(s);
-	/* Note: relying on INTEGER(.) === LOGICAL(.) : */
+	/* Note: relying on NA_INTEGER == NA_LOGICAL : */
 	int *pa = INTEGER(s);
-	const int *px = INTEGER_RO(x);
-	for(i = 0 ; i < n ; i++) {
-	    int xi = px[i];
-	    pa[i] = (xi == NA_INTEGER) ? xi : abs(xi);
-	}
+#define ABS_INT_BY_REGION(vtype)					\
+	ITERATE_BY_REGION(x, px, idx, nb, int, vtype, {		\
+		for (R_xlen_t k = 0; k < nb; k++) {			\
+		    int xi = px[k];					\
+		    pa[idx + k] = (xi == NA_INTEGER) ? xi : abs(xi);	\
+		}							\
+	    })
+	if (TYPEOF(x) == LGLSXP)
+	    ABS_INT_BY_REGION(LOGICAL);
+	else
+	    ABS_INT_BY_REGION(INTEGER);
+#undef ABS_INT_BY_REGION
     } else if (TYPEOF(x) == REALSXP) {
-	R_xlen_t i, n = XLENGTH(x);
-	PROTECT(s = NO_REFERENCES(x) ? x : allocVector(REALSXP, n));
+	R_xlen_t n = XLENGTH(x);
+	PROTECT(s = NO_REFERENCES(x) && ! ALTREP(x) ?
+		x : allocVector(REALSXP, n));
 	double *pa = REAL(s);
-	const double *px = REAL_RO(x);
-	for(i = 0 ; i < n ; i++)
-	    pa[i] = fabs(px[i]);
+	ITERATE_BY_REGION(x, px, idx, nb, double, REAL, {
+		for (R_xlen_t k = 0; k < nb; k++)
+		    pa[idx + k] = fabs(px[k]);
+	    });
     } else if (isComplex(x)) {
 	SET_TAG(args, R_NilValue); /* cmathfuns want "z"; we might have "x" PR#16047 */
 	return do_cmathfuns(call, op, args, env);
@@ -69,10 +69,11 @@ static R_INLINE SEXP R_allocOrReuseVector(SEXP s1, SEXP s2,
     R_xlen_t n2 = XLENGTH(s2);
 
     /* Try to use space for 2nd arg if both same length, so 1st argument's
-       attributes will then take precedence when copied. */
+       attributes will then take precedence when copied.  ALTREP
+       arguments are not reused, as writing to them would expand them. */
 
     if (n == n2) {
-        if (TYPEOF(s2) == type && NO_REFERENCES(s2)) {
+        if (TYPEOF(s2) == type && NO_REFERENCES(s2) && ! ALTREP(s2)) {
 	    if (ATTRIB(s2) != R_NilValue)
 		/* need to remove 'names' attribute if present to
 		   match what copyMostAttrib does. copyMostAttributes
@@ -86,10 +87,11 @@ static R_INLINE SEXP R_allocOrReuseVector(SEXP s1, SEXP s2,
             /* Can use 1st arg's space only if 2nd arg has no attributes, else
                we may not get attributes of result right. */
             if (n == n1 && TYPEOF(s1) == type && NO_REFERENCES(s1)
-		&& ATTRIB(s2) == R_NilValue)
+		&& ! ALTREP(s1) && ATTRIB(s2) == R_NilValue)
                 return s1;
     }
-    else if (n == n1 && TYPEOF(s1) == type && NO_REFERENCES(s1))
+    else if (n == n1 && TYPEOF(s1) == type && NO_REFERENCES(s1) &&
+	     ! ALTREP(s1))
 	return s1;
 
     return allocVector(type, n);
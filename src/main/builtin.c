@@ -424,6 +424,7 @@ SEXP attribute_hidden do_parentenvgets(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("'parent' is not an environment"));
 
     SET_ENCLOS(env, parent);
+    INVALIDATE_FUNCACHES();
 
     return( CAR(args) );
 }
@@ -257,11 +257,36 @@ SEXP attribute_hidden do_nchar(SEXP call, SEXP op, SEXP args, SEXP env)
     } else  keepNA = (type_ == Width) ? FALSE : TRUE;
     PROTECT(s = allocVector(INTSXP, len));
     int *s_ = INTEGER(s);
-    for (R_xlen_t i = 0; i < len; i++) {
-	SEXP sxi = STRING_ELT(x, i);
-	char msg_i[30]; sprintf(msg_i, "element %ld", (long)i+1);
-	s_[i] = R_nchar(sxi, type_, allowNA, keepNA, msg_i);
-    }
+    R_strbuf_t sb;
+    if (R_get_string_buffer(x, &sb) &&
+	(type_ == Bytes || (type_ == Chars &&
+			    (sb.ascii || sb.enc == CE_UTF8)))) {
+	/* count from the bytes without making the strings */
+	for (R_xlen_t i = 0; i < len; i++) {
+	    int nb;
+	    const char *p = R_string_buffer_elt(&sb, i, &nb);
+	    if (p == NULL)
+		s_[i] = keepNA ? NA_INTEGER : 2;
+	    else if (type_ == Bytes || sb.ascii)
+		s_[i] = nb;
+	    else if (!utf8ValidLen(p, nb)) {
+		if (!allowNA)
+		    error(_("invalid multibyte string, element %ld"),
+			  (long)i+1);
+		s_[i] = NA_INTEGER;
+	    } else {
+		int nc = 0;
+		for (int j = 0; j < nb; j++)
+		    if ((p[j] & 0xC0) != 0x80) nc++;
+		s_[i] = nc;
+	    }
+	}
+    } else
+	for (R_xlen_t i = 0; i < len; i++) {
+	    SEXP sxi = STRING_ELT(x, i);
+	    char msg_i[30]; sprintf(msg_i, "element %ld", (long)i+1);
+	    s_[i] = R_nchar(sxi, type_, allowNA, keepNA, msg_i);
+	}
     R_FreeStringBufferL(&cbuff);
     if ((d = getAttrib(x, R_NamesSymbol)) != R_NilValue)
 	setAttrib(s, R_NamesSymbol, d);
@@ -303,15 +328,95 @@ static void substr(char *buf, const char *str, int ienc, int sa, int so)
     *buf = '\0';
 }
 
+/* The substrings of a string buffer as a string buffer, copying their
+   bytes.  The ranges are found as by substr() for the encodings where
+   this needs no translation. */
+static SEXP substr_string_buffer(const R_strbuf_t *sb, SEXP sa, SEXP so)
+{
+    R_xlen_t len = sb->n, i;
+    int k = LENGTH(sa), l = LENGTH(so), nb;
+    R_xlen_t *from = (R_xlen_t *) R_alloc(len, sizeof(R_xlen_t));
+    int *nbytes = (int *) R_alloc(len, sizeof(int));
+    double size = 0;
+    Rboolean no_na = TRUE;
+
+    for (i = 0; i < len; i++) {
+	int start = INTEGER(sa)[i % k],
+	    stop  = INTEGER(so)[i % l];
+	const char *p = R_string_buffer_elt(sb, i, &nb);
+	if (p == NULL || start == NA_INTEGER || stop == NA_INTEGER) {
+	    nbytes[i] = -1;
+	    no_na = FALSE;
+	    continue;
+	}
+	if (start < 1) start = 1;
+	from[i] = p - sb->bytes;
+	nbytes[i] = 0;
+	if (start > stop || start > nb)
+	    continue;
+	if (stop > nb) stop = nb;
+	if (sb->enc == CE_UTF8 && !sb->ascii) {
+	    const char *str = p, *end = p + nb, *first = p;
+	    for (int j = 0; j < stop && str < end; j++) {
+		str += utf8clen(*str);
+		if (j < start - 1) first = str;
+	    }
+	    if (str > end) str = end;
+	    from[i] = first - sb->bytes;
+	    nbytes[i] = first < str ? (int) (str - first) : 0;
+	} else {
+	    from[i] += start - 1;
+	    nbytes[i] = stop - start + 1;
+	}
+	size += nbytes[i];
+    }
+
+    SEXP offsets = PROTECT(allocVector(size > INT_MAX ? REALSXP : INTSXP,
+				       len + 1));
+    SEXP bytes = PROTECT(allocVector(RAWSXP, (R_xlen_t) size));
+    SEXP valid = PROTECT(allocVector(RAWSXP, no_na ? 0 : (len + 7) / 8));
+    memset(RAW(valid), 0, XLENGTH(valid));
+    char *q = (char *) RAW(bytes);
+    double pos = 0;
+    for (i = 0; i <= len; i++) {
+	if (TYPEOF(offsets) == INTSXP) INTEGER(offsets)[i] = (int) pos;
+	else REAL(offsets)[i] = pos;
+	if (i == len || nbytes[i] < 0) continue;
+	memcpy(q, sb->bytes + from[i], nbytes[i]);
+	q += nbytes[i];
+	pos += nbytes[i];
+	if (!no_na) RAW(valid)[i >> 3] |= (Rbyte) (1 << (i & 7));
+    }
+    SEXP s = R_new_string_buffer(bytes, offsets,
+				 no_na ? R_NilValue : valid, sb->enc);
+    UNPROTECT(3);
+    return s;
+}
+
 SEXP attribute_hidden
 do_substr(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP s, x;
+    R_strbuf_t sb;
     checkArity(op, args);
     x = CAR(args);
     if (!isString(x))
 	error(_("extracting substrings from a non-character object"));
     R_xlen_t len = XLENGTH(x);
+    if (len > 0 && R_get_string_buffer(x, &sb) &&
+	(sb.ascii || sb.enc != CE_NATIVE || !mbcslocale)) {
+	SEXP sa = CADR(args),
+	    so = CADDR(args);
+	if (!isInteger(sa) || !isInteger(so) ||
+	    LENGTH(sa) == 0 || LENGTH(so) == 0)
+	    error(_("invalid substring arguments"));
+	const void *vmax = vmaxget();
+	PROTECT(s = substr_string_buffer(&sb, sa, so));
+	vmaxset(vmax);
+	SHALLOW_DUPLICATE_ATTRIB(s, x);
+	UNPROTECT(1);
+	return s;
+    }
     PROTECT(s = allocVector(STRSXP, len));
     if (len > 0) {
 	SEXP sa = CADR(args),
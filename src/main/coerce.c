@@ -33,6 +33,7 @@
 #define R_MSG_list_vec	_("applies only to lists and vectors")
 #include <Rmath.h>
 #include <Print.h>
+#include <R_ext/Itermacros.h>
 
 
 /* This section of code handles type conversion for elements */
@@ -2061,22 +2062,43 @@ SEXP attribute_hidden do_isna(SEXP call, SEXP op, SEXP args, SEXP rho)
     int *pa = LOGICAL(ans);
     switch (TYPEOF(x)) {
     case LGLSXP:
-       for (i = 0; i < n; i++)
-	   pa[i] = (LOGICAL_ELT(x, i) == NA_LOGICAL);
+	if (LOGICAL_NO_NA(x)) {
+	    for (i = 0; i < n; i++)
+		pa[i] = 0;
+	    break;
+	}
+	ITERATE_BY_REGION(x, px, idx, nb, int, LOGICAL, {
+		for (R_xlen_t k = 0; k < nb; k++)
+		    pa[idx + k] = (px[k] == NA_LOGICAL);
+	    });
 	break;
     case INTSXP:
-	for (i = 0; i < n; i++)
-	    pa[i] = (INTEGER_ELT(x, i) == NA_INTEGER);
+	if (INTEGER_NO_NA(x)) {
+	    for (i = 0; i < n; i++)
+		pa[i] = 0;
+	    break;
+	}
+	ITERATE_BY_REGION(x, px, idx, nb, int, INTEGER, {
+		for (R_xlen_t k = 0; k < nb; k++)
+		    pa[idx + k] = (px[k] == NA_INTEGER);
+	    });
 	break;
     case REALSXP:
-	for (i = 0; i < n; i++)
-	    pa[i] = ISNAN(REAL_ELT(x, i));
+	if (REAL_NO_NA(x)) {
+	    for (i = 0; i < n; i++)
+		pa[i] = 0;
+	    break;
+	}
+	ITERATE_BY_REGION(x, px, idx, nb, double, REAL, {
+		for (R_xlen_t k = 0; k < nb; k++)
+		    pa[idx + k] = ISNAN(px[k]);
+	    });
 	break;
     case CPLXSXP:
-	for (i = 0; i < n; i++) {
-	    Rcomplex v = COMPLEX_ELT(x, i);
-	    pa[i] = (ISNAN(v.r) || ISNAN(v.i));
-	}
+	ITERATE_BY_REGION(x, px, idx, nb, Rcomplex, COMPLEX, {
+		for (R_xlen_t k = 0; k < nb; k++)
+		    pa[idx + k] = (ISNAN(px[k].r) || ISNAN(px[k].i));
+	    });
 	break;
     case STRSXP:
 	for (i = 0; i < n; i++)
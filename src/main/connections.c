@@ -3768,6 +3768,49 @@ static void con_cleanup(void *data)
     checkClose(con);
 }
 
+/* readLines makes the CHARSXPs of its lines in batches of up to
+   LINES_BATCH lines, kept one after the other in buf.  buf is
+   allocated by R_alloc, so it is released on error or interrupt. */
+#define LINES_BATCH 4096
+
+typedef struct {
+    char *buf;
+    size_t size, used;
+    size_t start[LINES_BATCH];
+    int len[LINES_BATCH];
+    int n;
+    R_xlen_t first;	/* index in the answer of the first line */
+} LineBatch;
+
+static void add_line(LineBatch *b, const char *line)
+{
+    size_t len = strlen(line);
+    if (len > INT_MAX)
+	error("R character strings are limited to 2^31-1 bytes");
+    if (b->used + len > b->size) {
+	size_t size = 2 * b->size > b->used + len ? 2 * b->size : b->used + len;
+	char *tmp = R_alloc(size, sizeof(char));
+	if (b->used) memcpy(tmp, b->buf, b->used);
+	b->buf = tmp;
+	b->size = size;
+    }
+    memcpy(b->buf + b->used, line, len);
+    b->start[b->n] = b->used;
+    b->len[b->n++] = (int) len;
+    b->used += len;
+}
+
+static void flush_lines(SEXP ans, LineBatch *b, cetype_t enc)
+{
+    const char *names[LINES_BATCH];
+    for (int i = 0; i < b->n; i++)
+	names[i] = b->buf + b->start[i];
+    R_mkCharLenCEs(ans, b->first, names, b->len, b->n, enc);
+    b->first += b->n;
+    b->n = 0;
+    b->used = 0;
+}
+
 /* readLines(con = stdin(), n = 1, ok = TRUE, warn = TRUE) */
 #define BUF_SIZE 1000
 SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
@@ -3782,6 +3825,8 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
     const char *encoding;
     RCNTXT cntxt;
     R_xlen_t i, n, nn, nnn, nread;
+    LineBatch batch;
+    const void *vmax = vmaxget();
 
     checkArity(op, args);
     if(!inherits(CAR(args), "connection"))
@@ -3831,6 +3876,10 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
     buf = (char *) malloc(buf_size);
     if(!buf)
 	error(_("cannot allocate buffer in readLines"));
+    batch.buf = NULL;
+    batch.size = batch.used = 0;
+    batch.n = 0;
+    batch.first = 0;
     nn = (n < 0) ? 1000 : n; /* initially allocate space for 1000 lines */
     nnn = (n < 0) ? R_XLEN_T_MAX : n;
     PROTECT(ans = allocVector(STRSXP, nn));
@@ -3864,16 +3913,23 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
 	// avoid valgrind warning if < 3 bytes
 	if (nread == 0 && utf8locale && strlen(buf) >= 3 &&
 	    !memcmp(buf, "\xef\xbb\xbf", 3)) qbuf = buf + 3;
-	SET_STRING_ELT(ans, nread, mkCharCE(qbuf, oenc));
+	if (c != R_EOF || nbuf > 0) {
+	    add_line(&batch, qbuf);
+	    if (batch.n == LINES_BATCH) flush_lines(ans, &batch, oenc);
+	}
 	if (warn && strlen(buf) < nbuf)
 	    warning(_("line %d appears to contain an embedded nul"), nread + 1);
 	if(c == R_EOF) goto no_more_lines;
     }
+    flush_lines(ans, &batch, oenc);
     if(!wasopen) {endcontext(&cntxt); con->close(con);}
     UNPROTECT(1);
     free(buf);
+    vmaxset(vmax);
     return ans;
 no_more_lines:
+    flush_lines(ans, &batch, oenc);
+    vmaxset(vmax);
     if(!wasopen) {endcontext(&cntxt); con->close(con);}
     if(nbuf > 0) { /* incomplete last line */
 	if(con->text && !con->blocking &&
@@ -51,6 +51,8 @@
  *	cenddata	a void pointer to data for cend to use
  *	vmax		the current setting of the R_alloc stack
  *	srcref		the srcref at the time of the call
+ *	nojump		set for closure calls that did not set cjmpbuf
+ *			because their byte code cannot return by a jump
  *
  *  Context types can be one of:
  *
@@ -209,9 +211,11 @@ static RCNTXT *first_jump_target(RCNTXT *cptr, int mask)
 {
     RCNTXT *c;
 
+    /* contexts without a jump target have their on.exit code run by
+       R_run_onexits before the jump */
     for (c = R_GlobalContext; c && c != cptr; c = c->nextcontext) {
-	if ((c->cloenv != R_NilValue && c->conexit != R_NilValue) ||
-	    c->callflag == CTXT_UNWIND) {
+	if ((c->cloenv != R_NilValue && c->conexit != R_NilValue &&
+	     ! c->nojump) || c->callflag == CTXT_UNWIND) {
 	    c->jumptarget = cptr;
 	    c->jumpmask = mask;
 	    return c;
@@ -227,6 +231,9 @@ void attribute_hidden NORET R_jumpctxt(RCNTXT * targetcptr, int mask, SEXP val)
     Rboolean savevis = R_Visible;
     RCNTXT *cptr;
 
+    if (targetcptr->nojump)
+	error(_("cannot jump to a function call without a jump target"));
+
     /* find the target for the first jump -- either an intermediate
        context with an on.exit action to run or the final target if
        there are no intermediate on.exit actions */
@@ -288,6 +295,7 @@ void begincontext(RCNTXT * cptr, int flags,
     cptr->returnValue = NULL;
     cptr->jumptarget = NULL;
     cptr->jumpmask = 0;
+    cptr->nojump = FALSE;
 
     R_GlobalContext = cptr;
 }
@@ -24,32 +24,37 @@
 
 #include <Defn.h>
 #include <Internal.h>
+#include <R_ext/Itermacros.h>
 
 static SEXP cumsum(SEXP x, SEXP s)
 {
     LDOUBLE sum = 0.;
-    double *rx = REAL(x), *rs = REAL(s);
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	sum += rx[i]; /* NA and NaN propagated */
-	rs[i] = (double) sum;
-    }
+    double *rs = REAL(s);
+    ITERATE_BY_REGION(x, rx, i, nb, double, REAL, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		sum += rx[k]; /* NA and NaN propagated */
+		rs[i + k] = (double) sum;
+	    }
+	});
     return s;
 }
 
 /* We need to ensure that overflow gives NA here */
 static SEXP icumsum(SEXP x, SEXP s)
 {
-    int *ix = INTEGER(x), *is = INTEGER(s);
+    int *is = INTEGER(s);
     double sum = 0.0;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	if (ix[i] == NA_INTEGER) break;
-	sum += ix[i];
-	if(sum > INT_MAX || sum < 1 + INT_MIN) { /* INT_MIN is NA_INTEGER */
-	    warning(_("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'"));
-	    break;
-	}
-	is[i] = (int) sum;
-    }
+    ITERATE_BY_REGION(x, ix, i, nb, int, INTEGER, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		if (ix[k] == NA_INTEGER) return s;
+		sum += ix[k];
+		if(sum > INT_MAX || sum < 1 + INT_MIN) { /* INT_MIN is NA_INTEGER */
+		    warning(_("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'"));
+		    return s;
+		}
+		is[i + k] = (int) sum;
+	    }
+	});
     return s;
 }
 
@@ -70,12 +75,14 @@ static SEXP ccumsum(SEXP x, SEXP s)
 static SEXP cumprod(SEXP x, SEXP s)
 {
     LDOUBLE prod;
-    double *rx = REAL(x), *rs = REAL(s);
+    double *rs = REAL(s);
     prod = 1.0;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	prod *= rx[i]; /* NA and NaN propagated */
-	rs[i] = (double) prod;
-    }
+    ITERATE_BY_REGION(x, rx, i, nb, double, REAL, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		prod *= rx[k]; /* NA and NaN propagated */
+		rs[i + k] = (double) prod;
+	    }
+	});
     return s;
 }
 
@@ -97,55 +104,61 @@ static SEXP ccumprod(SEXP x, SEXP s)
 
 static SEXP cummax(SEXP x, SEXP s)
 {
-    double max, *rx = REAL(x), *rs = REAL(s);
+    double max, *rs = REAL(s);
     max = R_NegInf;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	if(ISNAN(rx[i]) || ISNAN(max))
-	    max = max + rx[i];  /* propagate NA and NaN */
-	else
-	    max = (max > rx[i]) ? max : rx[i];
-	rs[i] = max;
-    }
+    ITERATE_BY_REGION(x, rx, i, nb, double, REAL, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		if(ISNAN(rx[k]) || ISNAN(max))
+		    max = max + rx[k];  /* propagate NA and NaN */
+		else
+		    max = (max > rx[k]) ? max : rx[k];
+		rs[i + k] = max;
+	    }
+	});
     return s;
 }
 
 static SEXP cummin(SEXP x, SEXP s)
 {
-    double min, *rx = REAL(x), *rs = REAL(s);
+    double min, *rs = REAL(s);
     min = R_PosInf; /* always positive, not NA */
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++ ) {
-	if (ISNAN(rx[i]) || ISNAN(min))
-	    min = min + rx[i];  /* propagate NA and NaN */
-	else
-	    min = (min < rx[i]) ? min : rx[i];
-	rs[i] = min;
-    }
+    ITERATE_BY_REGION(x, rx, i, nb, double, REAL, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		if (ISNAN(rx[k]) || ISNAN(min))
+		    min = min + rx[k];  /* propagate NA and NaN */
+		else
+		    min = (min < rx[k]) ? min : rx[k];
+		rs[i + k] = min;
+	    }
+	});
     return s;
 }
 
 static SEXP icummax(SEXP x, SEXP s)
 {
-    int *ix = INTEGER(x);
-    if(ix[0] == NA_INTEGER)
+    int max = INTEGER_ELT(x, 0);
+    if(max == NA_INTEGER)
 	return s; // all NA
-    int *is = INTEGER(s), max = ix[0];
-    is[0] = max;
-    for (R_xlen_t i = 1 ; i < XLENGTH(x) ; i++) {
-	if(ix[i] == NA_INTEGER) break;
-	is[i] = max = (max > ix[i]) ? max : ix[i];
-    }
+    int *is = INTEGER(s);
+    ITERATE_BY_REGION(x, ix, i, nb, int, INTEGER, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		if(ix[k] == NA_INTEGER) return s;
+		is[i + k] = max = (max > ix[k]) ? max : ix[k];
+	    }
+	});
     return s;
 }
 
 static SEXP icummin(SEXP x, SEXP s)
 {
-    int *ix = INTEGER(x), *is = INTEGER(s);
-    int min = ix[0];
-    is[0] = min;
-    for (R_xlen_t i = 1 ; i < XLENGTH(x) ; i++ ) {
-	if(ix[i] == NA_INTEGER) break;
-	is[i] = min = (min < ix[i]) ? min : ix[i];
-    }
+    int *is = INTEGER(s);
+    int min = INTEGER_ELT(x, 0);
+    ITERATE_BY_REGION(x, ix, i, nb, int, INTEGER, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		if(ix[k] == NA_INTEGER) return s;
+		is[i + k] = min = (min < ix[k]) ? min : ix[k];
+	    }
+	});
     return s;
 }
 
@@ -132,6 +132,7 @@
   if (BINDING_IS_LOCKED(__sym__)) \
     error(_("cannot change value of locked binding for '%s'"), \
 	  CHAR(PRINTNAME(__sym__))); \
+  CHECK_FUNBINDING_CHANGE(__sym__, SYMVALUE(__sym__), __val__); \
   if (IS_ACTIVE_BINDING(__sym__)) \
     setActiveValue(SYMVALUE(__sym__), __val__); \
   else \
@@ -245,12 +246,14 @@ static void R_HashSet(int hashcode, SEXP symbol, SEXP table, SEXP value,
     /* Search for the value in the chain */
     for (; !ISNULL(chain); chain = CDR(chain))
 	if (TAG(chain) == symbol) {
+	    CHECK_FUNBINDING_CHANGE(symbol, CAR(chain), value);
 	    SET_BINDING_VALUE(chain, value);
 	    SET_MISSING(chain, 0);	/* Over-ride for new value */
 	    return;
 	}
     if (frame_locked)
 	error(_("cannot add bindings to a locked environment"));
+    CHECK_FUNBINDING_CHANGE(symbol, R_NilValue, value);
     if (ISNULL(chain))
 	SET_HASHPRI(table, HASHPRI(table) + 1);
     /* Add the value into the chain */
@@ -381,6 +384,7 @@ static SEXP DeleteItem(SEXP symbol, SEXP lst)
     if (lst != R_NilValue) {
 	SETCDR(lst, DeleteItem(symbol, CDR(lst)));
 	if (TAG(lst) == symbol) {
+	    CHECK_FUNBINDING_CHANGE(symbol, CAR(lst), R_UnboundValue);
 	    SETCAR(lst, R_UnboundValue); /* in case binding is cached */
 	    LOCK_BINDING(lst);           /* in case binding is cached */
 	    lst = CDR(lst);
@@ -801,6 +805,7 @@ static SEXP RemoveFromList(SEXP thing, SEXP list, int *found)
     }
     else if (TAG(list) == thing) {
 	*found = 1;
+	CHECK_FUNBINDING_CHANGE(thing, CAR(list), R_UnboundValue);
 	SETCAR(list, R_UnboundValue); /* in case binding is cached */
 	LOCK_BINDING(list);           /* in case binding is cached */
 	SEXP rest = CDR(list);
@@ -813,6 +818,7 @@ static SEXP RemoveFromList(SEXP thing, SEXP list, int *found)
 	while (next != R_NilValue) {
 	    if (TAG(next) == thing) {
 		*found = 1;
+		CHECK_FUNBINDING_CHANGE(thing, CAR(next), R_UnboundValue);
 		SETCAR(next, R_UnboundValue); /* in case binding is cached */
 		LOCK_BINDING(next);           /* in case binding is cached */
 		SETCDR(last, CDR(next));
@@ -975,6 +981,7 @@ Rboolean R_GetVarLocMISSING(R_varloc_t vl)
 attribute_hidden
 void R_SetVarLocValue(R_varloc_t vl, SEXP value)
 {
+    CHECK_FUNBINDING_CHANGE(TAG(vl.cell), CAR(vl.cell), value);
     SET_BINDING_VALUE(vl.cell, value);
 }
 
@@ -1507,6 +1514,51 @@ SEXP findFun(SEXP symbol, SEXP rho)
     return findFun3(symbol, rho, R_CurrentExpression);
 }
 
+/* Variant of findFun used to fill the function lookup caches of the
+   byte code engine.  It returns R_UnboundValue, rather than signaling
+   an error, if the function is not found or if the result could
+   change without a change to the binding version of the symbol or to
+   R_FunCacheEpoch: this is the case if the search passes through an
+   unhashed frame (other than base), a user database or an active
+   binding. */
+SEXP attribute_hidden R_findFunForCache(SEXP symbol, SEXP rho)
+{
+    SEXP vl;
+
+    while (rho != R_EmptyEnv) {
+	if (rho == R_BaseEnv || rho == R_BaseNamespace) {
+	    if (IS_ACTIVE_BINDING(symbol) || symbol == R_LastvalueSymbol)
+		return R_UnboundValue;
+	    vl = SYMVALUE(symbol);
+	}
+	else if (HASHTAB(rho) == R_NilValue || IS_USER_DATABASE(rho))
+	    return R_UnboundValue;
+	else {
+	    SEXP loc = findVarLocInFrame(rho, symbol, NULL);
+	    if (loc == R_NilValue)
+		vl = R_UnboundValue;
+	    else if (IS_ACTIVE_BINDING(loc))
+		return R_UnboundValue;
+	    else
+		vl = CAR(loc);
+	}
+	if (vl != R_UnboundValue) {
+	    if (TYPEOF(vl) == PROMSXP) {
+		PROTECT(vl);
+		vl = eval(vl, rho);
+		UNPROTECT(1);
+	    }
+	    if (TYPEOF(vl) == CLOSXP || TYPEOF(vl) == BUILTINSXP ||
+		TYPEOF(vl) == SPECIALSXP)
+		return (vl);
+	    if (vl == R_MissingArg)
+		return R_UnboundValue;
+	}
+	rho = ENCLOS(rho);
+    }
+    return R_UnboundValue;
+}
+
 /*----------------------------------------------------------------------
 
   defineVar
@@ -1692,6 +1744,7 @@ static SEXP setVarInFrame(SEXP rho, SEXP symbol, SEXP value)
 	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
 	frame = R_HashGetLoc(hashcode, symbol, HASHTAB(rho));
 	if (frame != R_NilValue) {
+	    CHECK_FUNBINDING_CHANGE(symbol, CAR(frame), value);
 	    SET_BINDING_VALUE(frame, value);
 	    SET_MISSING(frame, 0);	/* same as defineVar */
 	    return symbol;
@@ -2443,6 +2496,7 @@ SEXP attribute_hidden do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
 	SET_ENCLOS(t, s);
 	SET_ENCLOS(s, x);
     }
+    INVALIDATE_FUNCACHES();
 
     if(!isSpecial) { /* Temporary: need to remove the elements identified by objects(CAR(args)) */
 #ifdef USE_GLOBAL_CACHE
@@ -2504,6 +2558,7 @@ SEXP attribute_hidden do_detach(SEXP call, SEXP op, SEXP args, SEXP env)
 
 	SET_ENCLOS(s, R_BaseEnv);
     }
+    INVALIDATE_FUNCACHES();
 #ifdef USE_GLOBAL_CACHE
     if(!isSpecial) {
 	R_FlushGlobalCacheFromTable(HASHTAB(s));
@@ -3292,6 +3347,7 @@ void R_MakeActiveBinding(SEXP sym, SEXP fun, SEXP env)
 	    error(_("cannot change active binding if binding is locked"));
 	SET_SYMVALUE(sym, fun);
 	SET_ACTIVE_BINDING_BIT(sym);
+	INVALIDATE_FUNCACHES();
 	/* we don't need to worry about the global cache here as
 	   a regular binding cannot be changed */
     }
@@ -3441,6 +3497,7 @@ SEXP attribute_hidden do_mkUnbound(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("cannot unbind a locked binding"));
     if (R_BindingIsActive(sym, R_BaseEnv))
 	error(_("cannot unbind an active binding"));
+    CHECK_FUNBINDING_CHANGE(sym, SYMVALUE(sym), R_UnboundValue);
     SET_SYMVALUE(sym, R_UnboundValue);
 #ifdef USE_GLOBAL_CACHE
     R_FlushGlobalCache(sym);
@@ -3761,14 +3818,26 @@ SEXP mkChar(const char *name)
    and a power of 2 for the hash size.
 */
 
-/* char_hash_size MUST be a power of 2 and char_hash_mask ==
-   char_hash_size - 1 for x & char_hash_mask to be equivalent to x %
-   char_hash_size.
+/* The cache is split into CHAR_HASH_SHARDS tables, chosen by the top
+   bits of the scrambled hash of a string, and each shard is resized on
+   its own, so that growing the cache only moves the chains of one
+   shard.  R_StringHash is the list of the shards.  The size of a shard
+   MUST be a power of 2, for h & (size - 1) to be equivalent to
+   h % size.
 */
-static unsigned int char_hash_size = 65536;
-static unsigned int char_hash_mask = 65535;
+#define CHAR_HASH_SHARD_BITS 4
+#define CHAR_HASH_SHARDS (1 << CHAR_HASH_SHARD_BITS)
+#define CHAR_HASH_SHARD(h) \
+    ((unsigned int) ((h) * 2654435769U) >> (32 - CHAR_HASH_SHARD_BITS))
+static unsigned int char_hash_size = 4096; /* initial size of a shard */
+
+#ifdef __GNUC__
+# define CHAR_PREFETCH(p) __builtin_prefetch(p)
+#else
+# define CHAR_PREFETCH(p)
+#endif
 
-static unsigned int char_hash(const char *s, int len)
+unsigned int attribute_hidden R_CharHash(const char *s, int len)
 {
     /* djb2 as from http://www.cse.yorku.ca/~oz/hash.html */
     char *p;
@@ -3781,21 +3850,25 @@ static unsigned int char_hash(const char *s, int len)
 
 void attribute_hidden InitStringHash()
 {
-    R_StringHash = R_NewHashTable(char_hash_size);
+    SEXP shards = PROTECT(allocVector(VECSXP, CHAR_HASH_SHARDS));
+    for (int k = 0; k < CHAR_HASH_SHARDS; k++)
+	SET_VECTOR_ELT(shards, k, R_NewHashTable(char_hash_size));
+    R_StringHash = shards;
+    UNPROTECT(1);
 }
 
 /* #define DEBUG_GLOBAL_STRING_HASH 1 */
 
-/* Resize the global R_StringHash CHARSXP cache */
-static void R_StringHash_resize(unsigned int newsize)
+/* Resize shard k of the global R_StringHash CHARSXP cache */
+static void R_StringHash_resize(int k, unsigned int newsize)
 {
-    SEXP old_table = R_StringHash;
+    SEXP old_table = VECTOR_ELT(R_StringHash, k);
     SEXP new_table, chain, new_chain, val, next;
     unsigned int counter, new_hashcode, newmask;
 #ifdef DEBUG_GLOBAL_STRING_HASH
-    unsigned int oldsize = HASHSIZE(R_StringHash);
-    unsigned int oldpri = HASHPRI(R_StringHash);
-    unsigned int newsize, newpri;
+    unsigned int oldsize = HASHSIZE(old_table);
+    unsigned int oldpri = HASHPRI(old_table);
+    unsigned int newpri;
 #endif
 
     /* Allocate the new hash table.  This could fail to allocate
@@ -3814,7 +3887,7 @@ static void R_StringHash_resize(unsigned int newsize)
 	while (!ISNULL(chain)) {
 	    val = CXHEAD(chain);
 	    next = CXTAIL(chain);
-	    new_hashcode = char_hash(CHAR(val), LENGTH(val)) & newmask;
+	    new_hashcode = CHAR_HASH(val) & newmask;
 	    new_chain = VECTOR_ELT(new_table, new_hashcode);
 	    /* If using a primary slot then increase HASHPRI */
 	    if (ISNULL(new_chain))
@@ -3826,29 +3899,20 @@ static void R_StringHash_resize(unsigned int newsize)
 	    chain = next;
 	}
     }
-    R_StringHash = new_table;
-    char_hash_size = newsize;
-    char_hash_mask = newmask;
+    SET_VECTOR_ELT(R_StringHash, k, new_table);
 #ifdef DEBUG_GLOBAL_STRING_HASH
-    newsize = HASHSIZE(new_table);
     newpri = HASHPRI(new_table);
-    Rprintf("Resized: size %d => %d\tpri %d => %d\n",
-	    oldsize, newsize, oldpri, newpri);
+    Rprintf("Resized shard %d: size %d => %d\tpri %d => %d\n",
+	    k, oldsize, newsize, oldpri, newpri);
 #endif
 }
 
-/* mkCharCE - make a character (CHARSXP) variable and set its
-   encoding bit.  If a CHARSXP with the same string already exists in
-   the global CHARSXP cache, R_StringHash, it is returned.  Otherwise,
-   a new CHARSXP is created, added to the cache and then returned. */
-
-
-SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
+/* Check the bytes of a string to be cached, which may not contain
+   nuls.  Sets *is_ascii and returns the encoding to mark it with. */
+static cetype_t char_check(const char *name, int len, cetype_t enc,
+			   Rboolean *is_ascii)
 {
-    SEXP cval, chain;
-    unsigned int hashcode;
-    int need_enc;
-    Rboolean embedNul = FALSE, is_ascii = TRUE;
+    Rboolean embedNul = FALSE;
 
     switch(enc){
     case CE_NATIVE:
@@ -3861,8 +3925,9 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
     default:
 	error(_("unknown encoding: %d"), enc);
     }
+    *is_ascii = TRUE;
     for (int slen = 0; slen < len; slen++) {
-	if ((unsigned int) name[slen] > 127) is_ascii = FALSE;
+	if ((unsigned int) name[slen] > 127) *is_ascii = FALSE;
 	if (!name[slen]) embedNul = TRUE;
     }
     if (embedNul) {
@@ -3878,12 +3943,21 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
 	case CE_BYTES: SET_BYTES(c); break;
 	default: break;
 	}
-	if (is_ascii) SET_ASCII(c);
+	if (*is_ascii) SET_ASCII(c);
 	error(_("embedded nul in string: '%s'"),
 	      EncodeString(c, 0, 0, Rprt_adj_none));
     }
 
-    if (enc && is_ascii) enc = CE_NATIVE;
+    if (enc && *is_ascii) enc = CE_NATIVE;
+    return enc;
+}
+
+/* The cached CHARSXP with the given bytes and encoding, or R_NilValue.
+   This only reads the cache, so it can be called from threads. */
+static R_INLINE SEXP char_cache_find(const char *name, int len, cetype_t enc,
+				     unsigned int hash)
+{
+    int need_enc;
     switch(enc) {
     case CE_UTF8: need_enc = UTF8_MASK; break;
     case CE_LATIN1: need_enc = LATIN1_MASK; break;
@@ -3891,64 +3965,148 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
     default: need_enc = 0;
     }
 
-    hashcode = char_hash(name, len) & char_hash_mask;
-
-    /* Search for a cached value */
-    cval = R_NilValue;
-    chain = VECTOR_ELT(R_StringHash, hashcode);
+    SEXP table = VECTOR_ELT(R_StringHash, CHAR_HASH_SHARD(hash));
+    SEXP chain = VECTOR_ELT(table, hash & (LENGTH(table) - 1));
     for (; !ISNULL(chain) ; chain = CXTAIL(chain)) {
 	SEXP val = CXHEAD(chain);
 	if (TYPEOF(val) != CHARSXP) break; /* sanity check */
 	if (need_enc == (ENC_KNOWN(val) | IS_BYTES(val)) &&
-	    LENGTH(val) == len &&  /* quick pretest */
-	    (!len || (memcmp(CHAR(val), name, len) == 0))) { // called with len = 0
-	    cval = val;
-	    break;
-	}
+	    CHAR_HASH(val) == hash && LENGTH(val) == len && /* quick pretest */
+	    (!len || (memcmp(CHAR(val), name, len) == 0))) // called with len = 0
+	    return val;
     }
-    if (cval == R_NilValue) {
-	/* no cached value; need to allocate one and add to the cache */
-	PROTECT(cval = allocCharsxp(len));
-	memcpy(CHAR_RW(cval), name, len);
-	switch(enc) {
-	case CE_NATIVE:
-	    break;          /* don't set encoding */
-	case CE_UTF8:
-	    SET_UTF8(cval);
-	    break;
-	case CE_LATIN1:
-	    SET_LATIN1(cval);
-	    break;
-	case CE_BYTES:
-	    SET_BYTES(cval);
-	    break;
-	default:
-	    error("unknown encoding mask: %d", enc);
-	}
-	if (is_ascii) SET_ASCII(cval);
-	SET_CACHED(cval);  /* Mark it */
-	/* add the new value to the cache */
-	chain = VECTOR_ELT(R_StringHash, hashcode);
-	if (ISNULL(chain))
-	    SET_HASHPRI(R_StringHash, HASHPRI(R_StringHash) + 1);
-	/* this is a destrictive modification */
-	chain = SET_CXTAIL(cval, chain);
-	SET_VECTOR_ELT(R_StringHash, hashcode, chain);
-
-	/* resize the hash table if necessary with the new entry still
-	   protected.
-	   Maximum possible power of two is 2^30 for a VECSXP.
-	   FIXME: this has changed with long vectors.
-	*/
-	if (R_HashSizeCheck(R_StringHash)
-	    && char_hash_size < 1073741824 /* 2^30 */)
-	    R_StringHash_resize(char_hash_size * 2);
+    return R_NilValue;
+}
 
-	UNPROTECT(1);
+/* Allocate a CHARSXP for a string not in the cache and add it */
+static SEXP char_cache_add(const char *name, int len, cetype_t enc,
+			   Rboolean is_ascii, unsigned int hash)
+{
+    SEXP cval, table, chain;
+    unsigned int hashcode;
+    int k = CHAR_HASH_SHARD(hash);
+
+    PROTECT(cval = allocCharsxp(len));
+    memcpy(CHAR_RW(cval), name, len);
+    switch(enc) {
+    case CE_NATIVE:
+	break;          /* don't set encoding */
+    case CE_UTF8:
+	SET_UTF8(cval);
+	break;
+    case CE_LATIN1:
+	SET_LATIN1(cval);
+	break;
+    case CE_BYTES:
+	SET_BYTES(cval);
+	break;
+    default:
+	error("unknown encoding mask: %d", enc);
     }
+    if (is_ascii) SET_ASCII(cval);
+    SET_CHAR_HASH(cval, hash);
+    SET_CACHED(cval);  /* Mark it */
+    /* add the new value to the cache */
+    table = VECTOR_ELT(R_StringHash, k);
+    hashcode = hash & (LENGTH(table) - 1);
+    chain = VECTOR_ELT(table, hashcode);
+    if (ISNULL(chain))
+	SET_HASHPRI(table, HASHPRI(table) + 1);
+    /* this is a destrictive modification */
+    chain = SET_CXTAIL(cval, chain);
+    SET_VECTOR_ELT(table, hashcode, chain);
+
+    /* resize the shard if necessary with the new entry still
+       protected.
+       Maximum possible power of two is 2^30 for a VECSXP.
+       FIXME: this has changed with long vectors.
+    */
+    if (R_HashSizeCheck(table) && LENGTH(table) < 1073741824 /* 2^30 */)
+	R_StringHash_resize(k, 2 * LENGTH(table));
+
+    UNPROTECT(1);
     return cval;
 }
 
+/* mkCharCE - make a character (CHARSXP) variable and set its
+   encoding bit.  If a CHARSXP with the same string already exists in
+   the global CHARSXP cache, R_StringHash, it is returned.  Otherwise,
+   a new CHARSXP is created, added to the cache and then returned. */
+
+
+SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
+{
+    SEXP cval;
+    unsigned int hash;
+    Rboolean is_ascii;
+
+    enc = char_check(name, len, enc, &is_ascii);
+    hash = R_CharHash(name, len);
+    cval = char_cache_find(name, len, enc, hash);
+    if (cval == R_NilValue)
+	/* no cached value; need to allocate one and add to the cache */
+	cval = char_cache_add(name, len, enc, is_ascii, hash);
+    return cval;
+}
+
+/* Make CHARSXPs for n strings at once, as mkCharLenCE does for each,
+   and set them as elements off, ..., off + n - 1 of the character
+   vector ans, which the caller protects.  All the strings are hashed,
+   and their buckets prefetched, before any is looked up.  As the
+   lookups only read the cache, a batch of at least CHAR_BULK_PAR_MIN
+   strings is looked up on R_num_math_threads threads.  The strings not
+   found are then added one at a time, as that allocates. */
+#define CHAR_BULK_PAR_MIN 4096
+
+typedef struct {
+    unsigned int hash;
+    cetype_t enc;
+    Rboolean is_ascii;
+    SEXP cval;
+} CharBulkItem;
+
+void attribute_hidden R_mkCharLenCEs(SEXP ans, R_xlen_t off,
+				     const char **names, const int *lens,
+				     int n, cetype_t enc)
+{
+    const void *vmax = vmaxget();
+    CharBulkItem *items = (CharBulkItem *) R_alloc(n, sizeof(CharBulkItem));
+    int i;
+
+    for (i = 0; i < n; i++) {
+	CharBulkItem *it = items + i;
+	it->enc = char_check(names[i], lens[i], enc, &it->is_ascii);
+	it->hash = R_CharHash(names[i], lens[i]);
+	SEXP table = VECTOR_ELT(R_StringHash, CHAR_HASH_SHARD(it->hash));
+	CHAR_PREFETCH((SEXP *) DATAPTR(table) +
+		      (it->hash & (LENGTH(table) - 1)));
+    }
+
+#ifdef _OPENMP
+    int nthreads = n >= CHAR_BULK_PAR_MIN ? R_num_math_threads : 1;
+#pragma omp parallel for num_threads(nthreads) schedule(static) if(nthreads > 1)
+#endif
+    for (i = 0; i < n; i++)
+	items[i].cval = char_cache_find(names[i], lens[i], items[i].enc,
+					items[i].hash);
+
+    /* the strings found are only protected once in ans */
+    for (i = 0; i < n; i++)
+	if (items[i].cval != R_NilValue)
+	    SET_STRING_ELT(ans, off + i, items[i].cval);
+    for (i = 0; i < n; i++) {
+	CharBulkItem *it = items + i;
+	if (it->cval != R_NilValue) continue;
+	/* an earlier string of the batch may have added it */
+	SEXP cval = char_cache_find(names[i], lens[i], it->enc, it->hash);
+	if (cval == R_NilValue)
+	    cval = char_cache_add(names[i], lens[i], it->enc, it->is_ascii,
+				  it->hash);
+	SET_STRING_ELT(ans, off + i, cval);
+    }
+    vmaxset(vmax);
+}
+
 
 #ifdef DEBUG_SHOW_CHARSXP_CACHE
 /* Call this from gdb with
@@ -3958,51 +4116,57 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
    for the first 10 cache chains in use. */
 void do_show_cache(int n)
 {
-    int i, j;
-    Rprintf("Cache size: %d\n", LENGTH(R_StringHash));
-    Rprintf("Cache pri:  %d\n", HASHPRI(R_StringHash));
-    for (i = 0, j = 0; j < n && i < LENGTH(R_StringHash); i++) {
-	SEXP chain = VECTOR_ELT(R_StringHash, i);
-	if (! ISNULL(chain)) {
-	    Rprintf("Line %d: ", i);
-	    do {
-		if (IS_UTF8(CXHEAD(chain)))
-		    Rprintf("U");
-		else if (IS_LATIN1(CXHEAD(chain)))
-		    Rprintf("L");
-		else if (IS_BYTES(CXHEAD(chain)))
-		    Rprintf("B");
-		Rprintf("|%s| ", CHAR(CXHEAD(chain)));
-		chain = CXTAIL(chain);
-	    } while(! ISNULL(chain));
-	    Rprintf("\n");
-	    j++;
+    int i, j, k;
+    for (k = 0, j = 0; k < CHAR_HASH_SHARDS; k++) {
+	SEXP table = VECTOR_ELT(R_StringHash, k);
+	Rprintf("Shard %d size: %d\n", k, LENGTH(table));
+	Rprintf("Shard %d pri:  %d\n", k, HASHPRI(table));
+	for (i = 0; j < n && i < LENGTH(table); i++) {
+	    SEXP chain = VECTOR_ELT(table, i);
+	    if (! ISNULL(chain)) {
+		Rprintf("Line %d: ", i);
+		do {
+		    if (IS_UTF8(CXHEAD(chain)))
+			Rprintf("U");
+		    else if (IS_LATIN1(CXHEAD(chain)))
+			Rprintf("L");
+		    else if (IS_BYTES(CXHEAD(chain)))
+			Rprintf("B");
+		    Rprintf("|%s| ", CHAR(CXHEAD(chain)));
+		    chain = CXTAIL(chain);
+		} while(! ISNULL(chain));
+		Rprintf("\n");
+		j++;
+	    }
 	}
     }
 }
 
 void do_write_cache()
 {
-    int i;
+    int i, k;
     FILE *f = fopen("/tmp/CACHE", "w");
     if (f != NULL) {
-	fprintf(f, "Cache size: %d\n", LENGTH(R_StringHash));
-	fprintf(f, "Cache pri:  %d\n", HASHPRI(R_StringHash));
-	for (i = 0; i < LENGTH(R_StringHash); i++) {
-	    SEXP chain = VECTOR_ELT(R_StringHash, i);
-	    if (! ISNULL(chain)) {
-		fprintf(f, "Line %d: ", i);
-		do {
-		    if (IS_UTF8(CXHEAD(chain)))
-			fprintf(f, "U");
-		    else if (IS_LATIN1(CXHEAD(chain)))
-			fprintf(f, "L");
-		    else if (IS_BYTES(CXHEAD(chain)))
-			fprintf(f, "B");
-		    fprintf(f, "|%s| ", CHAR(CXHEAD(chain)));
-		    chain = CXTAIL(chain);
-		} while(! ISNULL(chain));
-		fprintf(f, "\n");
+	for (k = 0; k < CHAR_HASH_SHARDS; k++) {
+	    SEXP table = VECTOR_ELT(R_StringHash, k);
+	    fprintf(f, "Shard %d size: %d\n", k, LENGTH(table));
+	    fprintf(f, "Shard %d pri:  %d\n", k, HASHPRI(table));
+	    for (i = 0; i < LENGTH(table); i++) {
+		SEXP chain = VECTOR_ELT(table, i);
+		if (! ISNULL(chain)) {
+		    fprintf(f, "Line %d: ", i);
+		    do {
+			if (IS_UTF8(CXHEAD(chain)))
+			    fprintf(f, "U");
+			else if (IS_LATIN1(CXHEAD(chain)))
+			    fprintf(f, "L");
+			else if (IS_BYTES(CXHEAD(chain)))
+			    fprintf(f, "B");
+			fprintf(f, "|%s| ", CHAR(CXHEAD(chain)));
+			chain = CXTAIL(chain);
+		    } while(! ISNULL(chain));
+		    fprintf(f, "\n");
+		}
 	    }
 	}
 	fclose(f);
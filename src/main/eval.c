@@ -527,6 +527,13 @@ SEXP forcePromise(SEXP e)
 	SET_PRSEEN(e, 0);
 	SET_PRVALUE(e, val);
 	ENSURE_NAMEDMAX(val);
+#ifdef SWITCH_TO_REFCNT
+	/* UseMethod and NextMethod pass the promise on, so its value
+	   has to stay shared while the promise is in use, as it does
+	   with NAMED.  The reference is dropped by releasePromise. */
+	INCREMENT_REFCNT(val);
+	SET_PRVALUE_PINNED(e, 1);
+#endif
 	SET_PRENV(e, R_NilValue);
     }
     return PRVALUE(e);
@@ -551,16 +558,14 @@ void registerExternalCode(external_code_eval eval, external_closure_call call,
 	externalKeepAlive = keepAlive;
 }
 
-/* Return value of "e" evaluated in "rho". */
+/* The steps eval() takes around the evaluation of an object that is
+   not self-evaluating.  They are also used by R_execClosure, which
+   runs byte code closure bodies without an eval() C stack frame
+   between the calling and the called bcEval. */
+static int evalcount = 0;
 
-/* some places, e.g. deparse2buff, call this with a promise and rho = NULL */
-SEXP eval(SEXP e, SEXP rho)
+static R_INLINE void evalPoll(void)
 {
-    SEXP op, tmp;
-    static int evalcount = 0;
-
-    R_Visible = TRUE;
-
     /* this is needed even for self-evaluating objects or something like
        'while (TRUE) NULL' will not be interruptable */
     if (++evalcount > 1000) { /* was 100 before 2.8.0 */
@@ -572,6 +577,64 @@ SEXP eval(SEXP e, SEXP rho)
 #endif
 	evalcount = 0 ;
     }
+}
+
+typedef struct {
+    int bcintactive;
+    SEXP srcref;
+    int depth;
+} R_evalsave_t;
+
+static R_INLINE void evalEnter(R_evalsave_t *save)
+{
+    save->bcintactive = R_BCIntActive;
+    R_BCIntActive = 0;
+
+    /* Save the current srcref context. */
+
+    save->srcref = R_Srcref;
+
+    /* The saved depth is necessary because of the
+       possibility of non-local returns from evaluation.  Without this
+       an "expression too complex error" is quite likely. */
+
+    save->depth = R_EvalDepth++;
+
+    /* We need to explicit set a NULL call here to circumvent attempts
+       to deparse the call in the error-handler */
+    if (R_EvalDepth > R_Expressions) {
+	R_Expressions = R_Expressions_keep + 500;
+	errorcall(R_NilValue,
+		  _("evaluation nested too deeply: infinite recursion / options(expressions=)?"));
+    }
+    R_CheckStack();
+
+#ifdef Win32
+    /* This is an inlined version of Rwin_fpreset (src/gnuwin/extra.c)
+       and resets the precision, rounding and exception modes of a ix86
+       fpu.
+     */
+    __asm__ ( "fninit" );
+#endif
+}
+
+static R_INLINE void evalExit(R_evalsave_t *save)
+{
+    R_EvalDepth = save->depth;
+    R_Srcref = save->srcref;
+    R_BCIntActive = save->bcintactive;
+}
+
+/* Return value of "e" evaluated in "rho". */
+
+/* some places, e.g. deparse2buff, call this with a promise and rho = NULL */
+SEXP eval(SEXP e, SEXP rho)
+{
+    SEXP op, tmp;
+    R_evalsave_t save;
+
+    R_Visible = TRUE;
+    evalPoll();
 
     /* handle self-evaluating objects with minimal overhead */
     switch (TYPEOF(e)) {
@@ -601,42 +664,15 @@ SEXP eval(SEXP e, SEXP rho)
     default: break;
     }
 
-    int bcintactivesave = R_BCIntActive;
-    R_BCIntActive = 0;
-
     if (!rho)
 	error("'rho' cannot be C NULL: detected in C-level eval");
     if (!isEnvironment(rho))
 	error("'rho' must be an environment not %s: detected in C-level eval",
 	      type2char(TYPEOF(rho)));
 
-    /* Save the current srcref context. */
-
-    SEXP srcrefsave = R_Srcref;
-
-    /* The use of depthsave below is necessary because of the
-       possibility of non-local returns from evaluation.  Without this
-       an "expression too complex error" is quite likely. */
-
-    int depthsave = R_EvalDepth++;
-
-    /* We need to explicit set a NULL call here to circumvent attempts
-       to deparse the call in the error-handler */
-    if (R_EvalDepth > R_Expressions) {
-	R_Expressions = R_Expressions_keep + 500;
-	errorcall(R_NilValue,
-		  _("evaluation nested too deeply: infinite recursion / options(expressions=)?"));
-    }
-    R_CheckStack();
+    evalEnter(&save);
 
     tmp = R_NilValue;		/* -Wall */
-#ifdef Win32
-    /* This is an inlined version of Rwin_fpreset (src/gnuwin/extra.c)
-       and resets the precision, rounding and exception modes of a ix86
-       fpu.
-     */
-    __asm__ ( "fninit" );
-#endif
 
     switch (TYPEOF(e)) {
     case BCODESXP:
@@ -781,9 +817,7 @@ SEXP eval(SEXP e, SEXP rho)
     default:
 	UNIMPLEMENTED_TYPE("eval", e);
     }
-    R_EvalDepth = depthsave;
-    R_Srcref = srcrefsave;
-    R_BCIntActive = bcintactivesave;
+    evalExit(&save);
     return (tmp);
 }
 
@@ -889,6 +923,57 @@ static R_exprhash_t hashsrcref(SEXP e, R_exprhash_t h)
     }
     return h;
 }
+
+/* Hash used for the on-disk JIT cache. Unlike hashexpr1 it must not
+   depend on addresses, as it has to agree across sessions: symbols
+   are hashed by their names and vectors by their full contents. */
+static R_exprhash_t hashexpr_stable(SEXP e, R_exprhash_t h)
+{
+    int type = TYPEOF(e);
+    h = HASH(type, h);
+
+    switch(type) {
+    case SYMSXP:
+	return hash((unsigned char *) CHAR(PRINTNAME(e)),
+		    LENGTH(PRINTNAME(e)), h);
+    case LANGSXP:
+    case LISTSXP:
+	for (; e != R_NilValue; e = CDR(e)) {
+	    if (TAG(e) != R_NilValue)
+		h = hashexpr_stable(TAG(e), h);
+	    h = hashexpr_stable(CAR(e), h);
+	}
+	return h;
+    case LGLSXP:
+    case INTSXP:
+	for (R_xlen_t i = 0; i < XLENGTH(e); i++) {
+	    int ival = INTEGER(e)[i];
+	    h = HASH(ival, h);
+	}
+	return h;
+    case REALSXP:
+	for (R_xlen_t i = 0; i < XLENGTH(e); i++) {
+	    double dval = REAL(e)[i];
+	    h = HASH(dval, h);
+	}
+	return h;
+    case CPLXSXP:
+	for (R_xlen_t i = 0; i < XLENGTH(e); i++) {
+	    Rcomplex cval = COMPLEX(e)[i];
+	    h = HASH(cval, h);
+	}
+	return h;
+    case STRSXP:
+	for (R_xlen_t i = 0; i < XLENGTH(e); i++) {
+	    SEXP cval = STRING_ELT(e, i);
+	    h = hash((unsigned char *) CHAR(cval), LENGTH(cval), h);
+	}
+	return h;
+    }
+    /* other objects only contribute their type; the match is
+       verified with identical() after loading anyway */
+    return h;
+}
 #undef HASH
 
 static R_exprhash_t hashexpr(SEXP e)
@@ -939,6 +1024,11 @@ static SEXP R_RepeatSymbol = NULL;
 #define JIT_CACHE_SIZE 1024
 static SEXP JIT_cache = NULL;
 static R_exprhash_t JIT_cache_hashes[JIT_CACHE_SIZE];
+#define JIT_LOOP_CACHE_SIZE 256
+static SEXP JIT_loop_cache = NULL;
+static SEXP JIT_loop_marker = NULL;
+static SEXP JIT_loop_tail = NULL;
+static char *JIT_disk_cache_dir = NULL;
 
 /**** allow MIN_JIT_SCORE, or both, to be changed by environment variables? */
 static int MIN_JIT_SCORE = 50;
@@ -999,6 +1089,15 @@ void attribute_hidden R_init_jit_enabled(void)
 	    R_check_constants = atoi(check);
     }
 
+    /* optional directory for the persistent JIT cache; ignored unless
+       it exists */
+    char *cachedir = getenv("R_JIT_CACHE_DIR");
+    if (cachedir != NULL && cachedir[0] != '\0') {
+	const char *path = R_ExpandFileName(cachedir);
+	if (R_FileExists(path))
+	    JIT_disk_cache_dir = strdup(path);
+    }
+
     /* initialize JIT variables */
     R_IfSymbol = install("if");
     R_ForSymbol = install("for");
@@ -1006,6 +1105,11 @@ void attribute_hidden R_init_jit_enabled(void)
     R_RepeatSymbol = install("repeat");
 
     R_PreserveObject(JIT_cache = allocVector(VECSXP, JIT_CACHE_SIZE));
+    R_PreserveObject(JIT_loop_cache = allocVector(VECSXP,
+						  JIT_LOOP_CACHE_SIZE));
+    /* distinct constants: the compiler merges identical ones */
+    R_PreserveObject(JIT_loop_marker = allocVector(VECSXP, 0));
+    R_PreserveObject(JIT_loop_tail = allocVector(VECSXP, 1));
 }
 
 static int JIT_score(SEXP e)
@@ -1036,7 +1140,8 @@ static int JIT_score(SEXP e)
 #define STRATEGY_ALL_SMALL_MAYBE 2
 #define STRATEGY_NO_SCORE 3
 #define STRATEGY_NO_CACHE 4
-/* max strategy index is hardcoded in R_CheckJIT */
+#define STRATEGY_CALL_COUNT 5
+/* max strategy index is hardcoded in R_init_jit_strategy */
 
 /*
   NO_CACHE
@@ -1058,29 +1163,70 @@ static int JIT_score(SEXP e)
           2nd time seen if top-level, never otherwise
       functions with high score compiled
           1st time seen if top-level, 2nd time seen otherwise
+
+  CALL_COUNT
+      functions are compiled when called for the JIT_call_threshold-th
+        time, regardless of their score
+      loops in functions that are not compiled are compiled after
+        JIT_loop_threshold iterations and the remaining iterations
+	are run by the byte code interpreter
 */
 
 static int jit_strategy = -1;
 
+/* Closures count their calls for STRATEGY_CALL_COUNT in the gp bits
+   above MAYBEJIT, which are not otherwise used for closures. */
+#define JIT_COUNT_SHIFT 7
+#define JIT_COUNT_MAX 511
+#define JIT_COUNT(x) ((x)->sxpinfo.gp >> JIT_COUNT_SHIFT)
+#define SET_JIT_COUNT(x, v) \
+    ((x)->sxpinfo.gp = (unsigned short) \
+     (((x)->sxpinfo.gp & ((1 << JIT_COUNT_SHIFT) - 1)) | \
+      ((v) << JIT_COUNT_SHIFT)))
+
+static int JIT_call_threshold = 2;
+static int JIT_loop_threshold = 100;
+
+static int jit_threshold_env(const char *name, int dflt, int max)
+{
+    char *valstr = getenv(name);
+    if (valstr != NULL) {
+	int val = atoi(valstr);
+	if (val >= 1 && val <= max)
+	    return val;
+    }
+    return dflt;
+}
+
+static void R_init_jit_strategy(void)
+{
+    int dflt = R_jit_enabled == 1 ?
+	STRATEGY_NO_SMALL : STRATEGY_CALL_COUNT;
+    int val = dflt;
+    char *valstr = getenv("R_JIT_STRATEGY");
+    if (valstr != NULL)
+	val = atoi(valstr);
+    if (val < 0 || val > 5)
+	jit_strategy = dflt;
+    else
+	jit_strategy = val;
+
+    valstr = getenv("R_MIN_JIT_SCORE");
+    if (valstr != NULL)
+	MIN_JIT_SCORE = atoi(valstr);
+
+    JIT_call_threshold = jit_threshold_env("R_JIT_CALL_THRESHOLD",
+					   JIT_call_threshold,
+					   JIT_COUNT_MAX + 1);
+    JIT_loop_threshold = jit_threshold_env("R_JIT_LOOP_THRESHOLD",
+					   JIT_loop_threshold, INT_MAX);
+}
+
 static R_INLINE Rboolean R_CheckJIT(SEXP fun)
 {
     /* to help with testing */
-    if (jit_strategy < 0) {
-	int dflt = R_jit_enabled == 1 ?
-	    STRATEGY_NO_SMALL : STRATEGY_TOP_SMALL_MAYBE;
-	int val = dflt;
-	char *valstr = getenv("R_JIT_STRATEGY");
-	if (valstr != NULL)
-	    val = atoi(valstr);
-	if (val < 0 || val > 4)
-	    jit_strategy = dflt;
-	else
-	    jit_strategy = val;
-
-	valstr = getenv("R_MIN_JIT_SCORE");
-	if (valstr != NULL)
-	    MIN_JIT_SCORE = atoi(valstr);
-    }
+    if (jit_strategy < 0)
+	R_init_jit_strategy();
 
     SEXP body = BODY(fun);
 
@@ -1100,6 +1246,14 @@ static R_INLINE Rboolean R_CheckJIT(SEXP fun)
 	    jit_strategy == STRATEGY_NO_CACHE)
 	    return TRUE;
 
+	if (jit_strategy == STRATEGY_CALL_COUNT) {
+	    int count = JIT_COUNT(fun) + 1;
+	    if (count >= JIT_call_threshold)
+		return TRUE;
+	    SET_JIT_COUNT(fun, count);
+	    return FALSE;
+	}
+
 	int score = JIT_score(body);
 	if (jit_strategy == STRATEGY_ALL_SMALL_MAYBE)
 	    if (score < MIN_JIT_SCORE) { SET_MAYBEJIT(fun); return FALSE; }
@@ -1167,10 +1321,8 @@ static R_INLINE void cmpenv_enter_frame(SEXP frame, SEXP newenv)
 	defineVar(TAG(frame), R_NilValue, newenv);
 }
 
-static R_INLINE SEXP make_cached_cmpenv(SEXP fun)
+static R_INLINE SEXP make_cached_cmpenv_frames(SEXP frmls, SEXP cmpenv)
 {
-    SEXP frmls = FORMALS(fun);
-    SEXP cmpenv = CLOENV(fun);
     SEXP top = topenv(R_NilValue, cmpenv);
     if (cmpenv == top && frmls == R_NilValue)
 	return cmpenv;
@@ -1201,6 +1353,11 @@ static R_INLINE SEXP make_cached_cmpenv(SEXP fun)
     }
 }
 
+static R_INLINE SEXP make_cached_cmpenv(SEXP fun)
+{
+    return make_cached_cmpenv_frames(FORMALS(fun), CLOENV(fun));
+}
+
 /* Cache entries are CONS cells with the body in CAR, the environment
    in CDR, and the Srcref in the TAG. */
 static R_INLINE void set_jit_cache_entry(R_exprhash_t hash, SEXP val)
@@ -1275,23 +1432,23 @@ static R_INLINE Rboolean cmpenv_exists_local(SEXP sym, SEXP cmpenv, SEXP top)
     return FALSE;
 }
 
-static R_INLINE Rboolean jit_env_match(SEXP cmpenv, SEXP fun)
+static R_INLINE Rboolean jit_env_match_frames(SEXP cmpenv, SEXP frmls,
+					      SEXP env)
 {
     /* Can code compiled for environment cmpenv be used as compiled
        code for environment env?  These tests rely on the assumption
        that compilation is only affected by what variables are bound,
        not their values. So as long as both cmpenv and env have the
        same top level environment and all local bindings present in
-       the formals and environment of fun are also present in cmpenv
-       the code for cmpenv can be reused, though it might be less
-       efficient if a binding in cmpenv prevents an optimization that
-       would be possible in env. */
+       the formals frmls and in env and its enclosures are also
+       present in cmpenv the code for cmpenv can be reused, though it
+       might be less efficient if a binding in cmpenv prevents an
+       optimization that would be possible in env. */
 
-    SEXP env = CLOENV(fun);
     SEXP top = topenv(R_NilValue, env);
 
     if (top == cmpenv_topenv(cmpenv)) {
-	for (SEXP frmls = FORMALS(fun); frmls != R_NilValue; frmls = CDR(frmls))
+	for (; frmls != R_NilValue; frmls = CDR(frmls))
 	    if (! cmpenv_exists_local(TAG(frmls), cmpenv, top))
 		return FALSE;
 	for (; env != top; env = ENCLOS(env)) {
@@ -1312,6 +1469,11 @@ static R_INLINE Rboolean jit_env_match(SEXP cmpenv, SEXP fun)
     else return FALSE;
 }
 
+static R_INLINE Rboolean jit_env_match(SEXP cmpenv, SEXP fun)
+{
+    return jit_env_match_frames(cmpenv, FORMALS(fun), CLOENV(fun));
+}
+
 static R_INLINE Rboolean jit_srcref_match(SEXP cmpsrcref, SEXP srcref)
 {
     return R_compute_identical(cmpsrcref, srcref, 0);
@@ -1343,6 +1505,195 @@ SEXP attribute_hidden R_cmpfun1(SEXP fun)
     return val;
 }
 
+/* Byte code versions produced and accepted by bcEval; the persistent
+   JIT cache below also names its files by version. */
+static int R_bcVersion = 12;
+static int R_bcMinVersion = 9;
+
+/* Persistent JIT cache. When R_JIT_CACHE_DIR names an existing
+   directory, compiled bodies of closures defined in the global
+   environment are saved there and reused by later sessions. Files are
+   named by a stable hash of the function and the byte code version.
+   Each file holds a list with the body, formals, search path names,
+   optimization level and compiled code; all but the code must match
+   the current function and session for the code to be used, so
+   changed functions and hash collisions are simply recompiled. Only
+   functions without source references are eligible, as srcrefs refer
+   to session-specific environments. */
+
+#define JIT_DISK_BODY    0
+#define JIT_DISK_FORMALS 1
+#define JIT_DISK_SEARCH  2
+#define JIT_DISK_OPTIMIZE 3
+#define JIT_DISK_CODE    4
+#define JIT_DISK_LENGTH  5
+
+static R_INLINE Rboolean jit_disk_eligible(SEXP fun)
+{
+    return JIT_disk_cache_dir != NULL &&
+	CLOENV(fun) == R_GlobalEnv &&
+	getAttrib(fun, R_SrcrefSymbol) == R_NilValue &&
+	getAttrib(BODY(fun), R_SrcrefSymbol) == R_NilValue;
+}
+
+static SEXP jit_disk_search_names(void)
+{
+    int n = 0;
+    for (SEXP env = ENCLOS(R_GlobalEnv); env != R_EmptyEnv; env = ENCLOS(env))
+	n++;
+    SEXP names = PROTECT(allocVector(STRSXP, n));
+    int i = 0;
+    for (SEXP env = ENCLOS(R_GlobalEnv); env != R_EmptyEnv; env = ENCLOS(env)) {
+	SEXP name = getAttrib(env, R_NameSymbol);
+	if (TYPEOF(name) == STRSXP && LENGTH(name) > 0)
+	    SET_STRING_ELT(names, i, STRING_ELT(name, 0));
+	else
+	    SET_STRING_ELT(names, i, R_BlankString);
+	i++;
+    }
+    UNPROTECT(1); /* names */
+    return names;
+}
+
+static SEXP jit_disk_optimize(void)
+{
+    SEXP fcall = PROTECT(lang3(R_TripleColonSymbol, install("compiler"),
+			       install("getCompilerOption")));
+    SEXP call = PROTECT(lang2(fcall, mkString("optimize")));
+    SEXP val = eval(call, R_GlobalEnv);
+    UNPROTECT(2); /* call, fcall */
+    return val;
+}
+
+static char *jit_disk_path(SEXP body, SEXP formals)
+{
+    R_exprhash_t h = hashexpr_stable(body, 5381);
+    h = hashexpr_stable(formals, h);
+    size_t len = strlen(JIT_disk_cache_dir) + 64;
+    char *path = (char *) R_alloc(len, sizeof(char));
+    snprintf(path, len, "%s%s%016llx-v%d.rds", JIT_disk_cache_dir, FILESEP,
+	     (unsigned long long) h, R_bcVersion);
+    return path;
+}
+
+typedef struct {
+    FILE *fp;
+    SEXP val;
+} jit_disk_data;
+
+static void jit_disk_cend(void *data)
+{
+    jit_disk_data *d = (jit_disk_data *) data;
+    if (d->fp != NULL) {
+	fclose(d->fp);
+	d->fp = NULL;
+    }
+}
+
+static SEXP jit_disk_read(void *data)
+{
+    jit_disk_data *d = (jit_disk_data *) data;
+    RCNTXT cntxt;
+    struct R_inpstream_st in;
+
+    begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    cntxt.cend = &jit_disk_cend;
+    cntxt.cenddata = d;
+    R_InitFileInPStream(&in, d->fp, R_pstream_any_format, NULL, R_NilValue);
+    SEXP val = R_Unserialize(&in);
+    endcontext(&cntxt);
+    jit_disk_cend(d);
+    return val;
+}
+
+static SEXP jit_disk_write(void *data)
+{
+    jit_disk_data *d = (jit_disk_data *) data;
+    RCNTXT cntxt;
+    struct R_outpstream_st out;
+
+    begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    cntxt.cend = &jit_disk_cend;
+    cntxt.cenddata = d;
+    R_InitFileOutPStream(&out, d->fp, R_pstream_xdr_format, 0, NULL,
+			 R_NilValue);
+    R_Serialize(d->val, &out);
+    endcontext(&cntxt);
+    int status = fclose(d->fp);
+    d->fp = NULL;
+    return status == 0 ? R_TrueValue : R_NilValue;
+}
+
+static SEXP jit_disk_error(SEXP cond, void *data)
+{
+    return R_NilValue;
+}
+
+/* Returns the compiled body stored for fun, or R_NilValue. Errors
+   while reading, e.g. from a corrupt file, are caught and the file is
+   then ignored. */
+static SEXP jit_disk_load(SEXP fun)
+{
+    const void *vmax = vmaxget();
+    jit_disk_data d = { NULL, R_NilValue };
+    SEXP code = R_NilValue;
+
+    d.fp = R_fopen(jit_disk_path(BODY(fun), FORMALS(fun)), "rb");
+    if (d.fp != NULL) {
+	SEXP val = PROTECT(R_tryCatchError(jit_disk_read, &d,
+					   jit_disk_error, NULL));
+	if (TYPEOF(val) == VECSXP && XLENGTH(val) == JIT_DISK_LENGTH &&
+	    TYPEOF(VECTOR_ELT(val, JIT_DISK_CODE)) == BCODESXP &&
+	    R_compute_identical(VECTOR_ELT(val, JIT_DISK_BODY), BODY(fun), 16) &&
+	    R_compute_identical(VECTOR_ELT(val, JIT_DISK_FORMALS),
+				FORMALS(fun), 16)) {
+	    SEXP search = PROTECT(jit_disk_search_names());
+	    SEXP optimize = PROTECT(jit_disk_optimize());
+	    if (R_compute_identical(VECTOR_ELT(val, JIT_DISK_SEARCH),
+				    search, 0) &&
+		R_compute_identical(VECTOR_ELT(val, JIT_DISK_OPTIMIZE),
+				    optimize, 0))
+		code = VECTOR_ELT(val, JIT_DISK_CODE);
+	    UNPROTECT(2); /* optimize, search */
+	}
+	UNPROTECT(1); /* val */
+    }
+    vmaxset(vmax);
+    return code;
+}
+
+/* Saves the compiled body of fun. The file is written under a
+   temporary name and then renamed, so concurrent sessions never see
+   partially written files. Failures are silently ignored. */
+static void jit_disk_save(SEXP fun)
+{
+    const void *vmax = vmaxget();
+    SEXP body = bytecodeExpr(BODY(fun));
+    char *path = jit_disk_path(body, FORMALS(fun));
+    char *tmp = R_tmpnam2("jit", JIT_disk_cache_dir, ".tmp");
+    jit_disk_data d = { NULL, R_NilValue };
+
+    SEXP val = PROTECT(allocVector(VECSXP, JIT_DISK_LENGTH));
+    SET_VECTOR_ELT(val, JIT_DISK_BODY, body);
+    SET_VECTOR_ELT(val, JIT_DISK_FORMALS, FORMALS(fun));
+    SET_VECTOR_ELT(val, JIT_DISK_SEARCH, jit_disk_search_names());
+    SET_VECTOR_ELT(val, JIT_DISK_OPTIMIZE, jit_disk_optimize());
+    SET_VECTOR_ELT(val, JIT_DISK_CODE, BODY(fun));
+    d.val = val;
+
+    d.fp = R_fopen(tmp, "wb");
+    if (d.fp != NULL) {
+	if (R_tryCatchError(jit_disk_write, &d, jit_disk_error, NULL)
+	    == R_NilValue || rename(tmp, path) != 0)
+	    remove(tmp);
+    }
+    UNPROTECT(1); /* val */
+    free(tmp);
+    vmaxset(vmax);
+}
+
 /* fun is modified in-place when compiled */
 static void R_cmpfun(SEXP fun)
 {
@@ -1398,14 +1749,31 @@ static void R_cmpfun(SEXP fun)
 	PRINT_JIT_INFO;
     }
 
+    Rboolean disk = jit_disk_eligible(fun);
+    if (disk) {
+	SEXP code = jit_disk_load(fun);
+	if (code != R_NilValue) {
+	    PROTECT(code);
+	    SET_BODY(fun, code);
+	    if (jit_strategy != STRATEGY_NO_CACHE)
+		set_jit_cache_entry(hash, fun);
+	    UNPROTECT(1); /* code */
+	    return;
+	}
+    }
+
     SEXP val = R_cmpfun1(fun);
 
     if (TYPEOF(BODY(val)) != BCODESXP)
 	SET_NOJIT(fun);
     else {
+	PROTECT(val);
 	if (jit_strategy != STRATEGY_NO_CACHE)
-	    set_jit_cache_entry(hash, val); /* val is protected by callee */
+	    set_jit_cache_entry(hash, val);
 	SET_BODY(fun, BODY(val));
+	if (disk)
+	    jit_disk_save(fun);
+	UNPROTECT(1); /* val */
     }
 }
 
@@ -1457,6 +1825,77 @@ static Rboolean R_compileAndExecute(SEXP call, SEXP rho)
     return ans;
 }
 
+/* Used to finish loops promoted from the AST interpreter. The loop is
+   compiled in a block ending with a marker constant. The compiler does
+   not know that the loop is only part of a function body, so a
+   return() in the loop may be compiled as a return from the byte code;
+   any value other than the marker is therefore passed on to the
+   function context, as return() does in the AST interpreter.
+
+   The code is cached by call site in JIT_loop_cache, so a loop that is
+   run many times, or that is in a closure that is not compiled, is
+   only compiled once. Entries are CONS cells with the loop call in the
+   TAG, the code in the CAR and the compilation environment in the CDR,
+   which is checked against the environment of the loop as for the
+   closure cache. An entry with R_NilValue as the code records that the
+   loop could not be compiled. For the tail of a for() loop the
+   sequence is compiled as the JIT_loop_tail constant, which is
+   replaced by the remaining elements in a copy of the constant pool
+   each time the code is run. */
+static SEXP R_compileLoop(SEXP call, SEXP rho, Rboolean fortail)
+{
+    int hashidx = ((R_size_t) call >> 4) % JIT_LOOP_CACHE_SIZE;
+    SEXP entry = VECTOR_ELT(JIT_loop_cache, hashidx);
+    if (entry != R_NilValue && TAG(entry) == call &&
+	(CAR(entry) == R_NilValue ||
+	 jit_env_match_frames(CDR(entry), R_NilValue, rho)))
+	return CAR(entry);
+
+    int old_enabled = R_jit_enabled;
+    SEXP loop, expr, code, cmpenv;
+
+    PROTECT(rho);
+    if (fortail)
+	loop = LCONS(CAR(call),
+		     list3(CADR(call), JIT_loop_tail, CADDDR(call)));
+    else
+	loop = call;
+    PROTECT(loop);
+    PROTECT(expr = lang3(R_BraceSymbol, loop, JIT_loop_marker));
+    R_jit_enabled = 0;
+    PROTECT(code = R_compileExpr(expr, rho));
+    R_jit_enabled = old_enabled;
+
+    if (TYPEOF(code) == BCODESXP)
+	cmpenv = make_cached_cmpenv_frames(R_NilValue, rho);
+    else
+	cmpenv = code = R_NilValue;
+    PROTECT(cmpenv);
+    entry = CONS(code, cmpenv);
+    SET_TAG(entry, call);
+    SET_VECTOR_ELT(JIT_loop_cache, hashidx, entry);
+    UNPROTECT(5); /* cmpenv, code, expr, loop, rho */
+    return code;
+}
+
+static void R_executeLoop(SEXP code, SEXP rho)
+{
+    SEXP val = bcEval(code, rho, TRUE);
+    if (val != JIT_loop_marker)
+	findcontext(CTXT_BROWSER | CTXT_FUNCTION, rho, val);
+}
+
+static Rboolean R_compileAndExecuteLoop(SEXP call, SEXP rho)
+{
+    SEXP code = R_compileLoop(call, rho, FALSE);
+    if (code == R_NilValue)
+	return FALSE;
+    PROTECT(code);
+    R_executeLoop(code, rho);
+    UNPROTECT(1); /* code */
+    return TRUE;
+}
+
 SEXP attribute_hidden do_enablejit(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int old = R_jit_enabled, new;
@@ -1558,6 +1997,16 @@ static void PrintCall(SEXP call, SEXP rho)
    drops reference counts on the values and the environments.
 */
 
+static R_INLINE void releasePromise(SEXP p)
+{
+    if (PRVALUE_PINNED(p)) {
+	SET_PRVALUE_PINNED(p, 0);
+	DECREMENT_REFCNT(PRVALUE(p));
+    }
+    SET_PRVALUE(p, R_UnboundValue);
+    SET_PRENV(p, R_NilValue);
+}
+
 static int countCycleRefs(SEXP rho, SEXP val)
 {
     /* check for simple cycles */
@@ -1591,8 +2040,7 @@ static R_INLINE void cleanupEnvDots(SEXP d)
     for (; d != R_NilValue && REFCNT(d) == 1; d = CDR(d)) {
 	SEXP v = CAR(d);
 	if (REFCNT(v) == 1 && TYPEOF(v) == PROMSXP) {
-	    SET_PRVALUE(v, R_UnboundValue);
-	    SET_PRENV(v, R_NilValue);
+	    releasePromise(v);
 	}
 	SETCAR(d, R_NilValue);
     }
@@ -1625,8 +2073,7 @@ static R_INLINE void R_CleanupEnvir(SEXP rho, SEXP val)
 		if (REFCNT(v) == 1 && v != val) {
 		    switch(TYPEOF(v)) {
 		    case PROMSXP:
-			SET_PRVALUE(v, R_UnboundValue);
-			SET_PRENV(v, R_NilValue);
+			releasePromise(v);
 			break;
 		    case DOTSXP:
 			cleanupEnvDots(v);
@@ -1650,15 +2097,14 @@ void attribute_hidden unpromiseArgs(SEXP pargs)
     for (; pargs != R_NilValue; pargs = CDR(pargs)) {
 	SEXP v = CAR(pargs);
 	if (TYPEOF(v) == PROMSXP && REFCNT(v) == 1) {
-	    SET_PRVALUE(v, R_UnboundValue);
-	    SET_PRENV(v, R_NilValue);
+	    releasePromise(v);
 	}
 	SETCAR(pargs, R_NilValue);
     }
 }
 #endif
 
-/* Note: GCC will not inline execClosure because it calls setjmp */
+/* Note: GCC will not inline execClosureInCntxt because it calls setjmp */
 static R_INLINE SEXP R_execClosure(SEXP call, SEXP newrho, SEXP sysparent,
                                    SEXP rho, SEXP arglist, SEXP op);
 
@@ -1722,113 +2168,37 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
 	}
 	f = CDR(f);
 	a = CDR(a);
-    }
-
-    /*  Fix up any extras that were supplied by usemethod. */
-
-    if (suppliedvars != R_NilValue)
-	addMissingVarsToNewEnv(newrho, suppliedvars);
-
-    if (R_envHasNoSpecialSymbols(newrho))
-	SET_NO_SPECIAL_SYMBOLS(newrho);
-
-#ifdef ADJUST_ENVIR_REFCNTS
-    Rboolean is_getter_call =
-	(CADR(call) == R_TmpvalSymbol && ! R_isReplaceSymbol(CAR(call)));
-#endif
-
-    UNPROTECT(1); /* newrho - below protected via context */
-
-    /*  If we have a generic function we need to use the sysparent of
-	the generic as the sysparent of the method because the method
-	is a straight substitution of the generic.  */
-
-    SEXP val = R_execClosure(call, newrho,
-			     (R_GlobalContext->callflag == CTXT_GENERIC) ?
-			     R_GlobalContext->sysparent : rho,
-			     rho, arglist, op);
-#ifdef ADJUST_ENVIR_REFCNTS
-    R_CleanupEnvir(newrho, val);
-    if (MAYBE_REFERENCED(val) && is_getter_call)
-    	val = shallow_duplicate(val);
-#endif
-    return val;
-}
-
-static R_INLINE SEXP R_execClosure(SEXP call, SEXP newrho, SEXP sysparent,
-                                   SEXP rho, SEXP arglist, SEXP op)
-{
-    volatile SEXP body;
-    RCNTXT cntxt;
-    Rboolean dbg = FALSE;
-
-    begincontext(&cntxt, CTXT_RETURN, call, newrho, sysparent, arglist, op);
-
-    body = BODY(op);
-    if (R_CheckJIT(op)) {
-	int old_enabled = R_jit_enabled;
-	R_jit_enabled = 0;
-	R_cmpfun(op);
-	body = BODY(op);
-	R_jit_enabled = old_enabled;
-    }
-
-    /* Get the srcref record from the closure object. The old srcref was
-       saved in cntxt. */
-
-    R_Srcref = getAttrib(op, R_SrcrefSymbol);
-
-    /* Debugging */
-
-    if ((RDEBUG(op) && R_current_debug_state()) || RSTEP(op)
-         || (RDEBUG(rho) && R_BrowserLastCommand == 's')) {
-
-	dbg = TRUE;
-	SET_RSTEP(op, 0);
-	SET_RDEBUG(newrho, 1);
-	cntxt.browserfinish = 0; /* Don't want to inherit the "f" */
-	/* switch to interpreted version when debugging compiled code */
-	if (TYPEOF(body) == BCODESXP || TYPEOF(body) == EXTERNALSXP)
-	    body = bytecodeExpr(body);
-	Rprintf("debugging in: ");
-	PrintCall(call, rho);
-	SrcrefPrompt("debug", R_Srcref);
-	PrintValue(body);
-	do_browser(call, op, R_NilValue, newrho);
-    }
-
-    /*  Set a longjmp target which will catch any explicit returns
-	from the function body.  */
-
-    if ((SETJMP(cntxt.cjmpbuf))) {
-	if (!cntxt.jumptarget) {
-	    /* ignores intermediate jumps for on.exits */
-	    if (R_ReturnedValue == R_RestartToken) {
-		cntxt.callflag = CTXT_RETURN;  /* turn restart off */
-		R_ReturnedValue = R_NilValue;  /* remove restart token */
-		cntxt.returnValue = eval(body, newrho);
-	    } else
-		cntxt.returnValue = R_ReturnedValue;
-	}
-	else
-	    cntxt.returnValue = NULL; /* undefined */
-    }
-    else
-	/* make it available to on.exit and implicitly protect */
-	cntxt.returnValue = eval(body, newrho);
+    }
 
-    R_Srcref = cntxt.srcref;
-    endcontext(&cntxt);
+    /*  Fix up any extras that were supplied by usemethod. */
 
-    if (dbg) {
-	Rprintf("exiting from: ");
-	PrintCall(call, rho);
-    }
+    if (suppliedvars != R_NilValue)
+	addMissingVarsToNewEnv(newrho, suppliedvars);
 
-    /* clear R_ReturnedValue to allow GC to reclaim old value */
-    R_ReturnedValue = R_NilValue;
+    if (R_envHasNoSpecialSymbols(newrho))
+	SET_NO_SPECIAL_SYMBOLS(newrho);
+
+#ifdef ADJUST_ENVIR_REFCNTS
+    Rboolean is_getter_call =
+	(CADR(call) == R_TmpvalSymbol && ! R_isReplaceSymbol(CAR(call)));
+#endif
+
+    UNPROTECT(1); /* newrho - below protected via context */
+
+    /*  If we have a generic function we need to use the sysparent of
+	the generic as the sysparent of the method because the method
+	is a straight substitution of the generic.  */
 
-    return cntxt.returnValue;
+    SEXP val = R_execClosure(call, newrho,
+			     (R_GlobalContext->callflag == CTXT_GENERIC) ?
+			     R_GlobalContext->sysparent : rho,
+			     rho, arglist, op);
+#ifdef ADJUST_ENVIR_REFCNTS
+    R_CleanupEnvir(newrho, val);
+    if (MAYBE_REFERENCED(val) && is_getter_call)
+    	val = shallow_duplicate(val);
+#endif
+    return val;
 }
 
 SEXP R_forceAndCall(SEXP e, int n, SEXP rho)
@@ -1996,12 +2366,89 @@ SEXP R_execMethod(SEXP op, SEXP rho)
     return val;
 }
 
+#ifdef SWITCH_TO_REFCNT
+/* Whether a closure body calls UseMethod or Recall, which pass the
+   promises of the call on again.  The answer is cached in the 'extra'
+   bits of language and byte code bodies: bit 0 if it is known, bit 1
+   if the body may pass its promises on. */
+#define BODY_REPASS_KNOWN 1
+#define BODY_REPASS 2
+
+static Rboolean callsSymbol(SEXP e, SEXP sym1, SEXP sym2)
+{
+    for (; TYPEOF(e) == LANGSXP || TYPEOF(e) == LISTSXP; e = CDR(e)) {
+	SEXP a = CAR(e);
+	if (a == sym1 || a == sym2 || callsSymbol(a, sym1, sym2))
+	    return TRUE;
+    }
+    return e == sym1 || e == sym2;
+}
+
+static Rboolean mayRepassPromises(SEXP fun)
+{
+    static SEXP UseMethodSym = NULL, RecallSym = NULL;
+    SEXP body = BODY(fun);
+    if (TYPEOF(body) != LANGSXP && TYPEOF(body) != BCODESXP)
+	return FALSE;
+    if (! (body->sxpinfo.extra & BODY_REPASS_KNOWN)) {
+	if (UseMethodSym == NULL) {
+	    UseMethodSym = install("UseMethod");
+	    RecallSym = install("Recall");
+	}
+	Rboolean repass = callsSymbol(R_ClosureExpr(fun),
+				      UseMethodSym, RecallSym);
+	body->sxpinfo.extra =
+	    BODY_REPASS_KNOWN | (repass ? BODY_REPASS : 0);
+    }
+    return (body->sxpinfo.extra & BODY_REPASS) != 0;
+}
+
+/* An argument about to be modified by the closure of rho: if nothing
+   but the promise holds its value the promise gives the value up, so
+   the closure can modify it in place.  The promise keeps pointing to
+   the value without counting it; it is only used again if UseMethod
+   or Recall are called, and closures that can do so are excluded.
+   The caller has to bind the value itself, so that later references
+   to the variable are counted. */
+static Rboolean takePromiseValue(SEXP prom, SEXP rho)
+{
+    SEXP val = PRVALUE(prom);
+    if (val == R_UnboundValue || ! TRACKREFS(prom) || REFCNT(prom) > 2 ||
+	REFCNT(val) != (PRVALUE_PINNED(prom) ? 2 : 1))
+	return FALSE;
+    for (RCNTXT *cptr = R_GlobalContext; cptr != NULL;
+	 cptr = cptr->nextcontext)
+	if ((cptr->callflag & CTXT_FUNCTION) && cptr->cloenv == rho) {
+	    if (mayRepassPromises(cptr->callfun))
+		return FALSE;
+	    if (PRVALUE_PINNED(prom)) {
+		SET_PRVALUE_PINNED(prom, 0);
+		DECREMENT_REFCNT(val);
+	    }
+	    DECREMENT_REFCNT(val);
+	    DISABLE_REFCNT(prom);
+	    return TRUE;
+	}
+    return FALSE;
+}
+#endif
+
 static SEXP EnsureLocal(SEXP symbol, SEXP rho)
 {
     SEXP vl;
 
     if ((vl = findVarInFrame3(rho, symbol, TRUE)) != R_UnboundValue) {
+#ifdef SWITCH_TO_REFCNT
+	SEXP binding = vl;
+#endif
 	vl = eval(symbol, rho);	/* for promises */
+#ifdef SWITCH_TO_REFCNT
+	if (TYPEOF(binding) == PROMSXP && takePromiseValue(binding, rho)) {
+	    PROTECT(vl);
+	    defineVar(symbol, vl, rho);
+	    UNPROTECT(1);
+	}
+#endif
 	if(MAYBE_SHARED(vl)) {
 	    PROTECT(vl = shallow_duplicate(vl));
 	    defineVar(symbol, vl, rho);
@@ -2198,11 +2645,13 @@ static R_INLINE SEXP GET_BINDING_CELL(SEXP symbol, SEXP rho)
     }
 }
 
-static R_INLINE Rboolean SET_BINDING_VALUE(SEXP loc, SEXP value) {
+static R_INLINE Rboolean SET_BINDING_VALUE(SEXP loc, SEXP value, SEXP rho) {
     /* This depends on the current implementation of bindings */
     if (loc != R_NilValue &&
 	! BINDING_IS_LOCKED(loc) && ! IS_ACTIVE_BINDING(loc)) {
 	if (CAR(loc) != value) {
+	    if (HASHTAB(rho) != R_NilValue)
+		CHECK_FUNBINDING_CHANGE(TAG(loc), CAR(loc), value);
 	    SETCAR(loc, value);
 	    if (MISSING(loc))
 		SET_MISSING(loc, 0);
@@ -2213,6 +2662,48 @@ static R_INLINE Rboolean SET_BINDING_VALUE(SEXP loc, SEXP value) {
 	return FALSE;
 }
 
+/* With STRATEGY_CALL_COUNT, loops run by the AST interpreter are
+   compiled once they have completed JIT_loop_threshold iterations, and
+   the byte code interpreter runs the remaining iterations. The check
+   is made at the start of each iteration, before the condition of a
+   while() loop is evaluated. */
+static R_INLINE Rboolean R_CheckLoopJIT(SEXP call, SEXP rho, R_xlen_t iter)
+{
+    if (iter != JIT_loop_threshold)
+	return FALSE;
+    if (jit_strategy < 0)
+	R_init_jit_strategy();
+    /* duplicated constants would hide the marker and the tail
+       constant used by R_compileLoop */
+    return jit_strategy == STRATEGY_CALL_COUNT && R_jit_enabled > 0 &&
+	! R_disable_bytecode && R_check_constants >= 0 &&
+	externalCodeCompile == NULL && ! RDEBUG(rho) &&
+	isUnmodifiedSpecSym(CAR(call), rho) &&
+	isUnmodifiedSpecSym(R_BraceSymbol, rho);
+}
+
+/* A for() loop is continued by compiling a loop over the remaining
+   elements of the sequence. */
+static Rboolean R_compileAndExecuteForTail(SEXP call, SEXP val,
+					   R_xlen_t i, R_xlen_t n, SEXP rho)
+{
+    SEXP code = R_compileLoop(call, rho, TRUE);
+    if (code == R_NilValue)
+	return FALSE;
+    PROTECT(code);
+    SEXP indx = PROTECT(R_compact_intrange(i + 1, n));
+    SEXP tail = PROTECT(ExtractSubset(val, indx, call));
+    SEXP consts = PROTECT(shallow_duplicate(BCODE_CONSTS(code)));
+    for (int k = 0; k < LENGTH(consts); k++)
+	if (VECTOR_ELT(consts, k) == JIT_loop_tail)
+	    SET_VECTOR_ELT(consts, k, tail);
+    SEXP tcode = PROTECT(CONS(BCODE_CODE(code), consts));
+    SET_TYPEOF(tcode, BCODESXP);
+    R_executeLoop(tcode, rho);
+    UNPROTECT(5); /* tcode, consts, tail, indx, code */
+    return TRUE;
+}
+
 SEXP attribute_hidden do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     /* Need to declare volatile variables whose values are relied on
@@ -2279,6 +2770,10 @@ SEXP attribute_hidden do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     for (i = 0; i < n; i++) {
 
+	if (R_CheckLoopJIT(call, rho, i) && val_type != LISTSXP &&
+	    R_compileAndExecuteForTail(call, val, i, n, rho))
+	    break;
+
 	switch (val_type) {
 
 	case EXPRSXP:
@@ -2327,7 +2822,7 @@ SEXP attribute_hidden do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    default:
 		errorcall(call, _("invalid for() loop sequence"));
 	    }
-	    if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, v))
+	    if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, v, rho))
 		defineVar(sym, v, rho);
 	}
 	if (!bgn && RDEBUG(rho) && !R_GlobalContext->browserfinish) {
@@ -2353,6 +2848,7 @@ SEXP attribute_hidden do_while(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int dbg;
     volatile int bgn;
+    volatile R_xlen_t iter = 0;
     volatile SEXP body;
     RCNTXT cntxt;
 
@@ -2371,7 +2867,9 @@ SEXP attribute_hidden do_while(SEXP call, SEXP op, SEXP args, SEXP rho)
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
     if (SETJMP(cntxt.cjmpbuf) != CTXT_BREAK) {
-	while (asLogicalNoNA(eval(CAR(args), rho), call, rho)) {
+	while (! (R_CheckLoopJIT(call, rho, iter++) &&
+		  R_compileAndExecuteLoop(call, rho)) &&
+	       asLogicalNoNA(eval(CAR(args), rho), call, rho)) {
 	    if (RDEBUG(rho) && !bgn && !R_GlobalContext->browserfinish) {
 		SrcrefPrompt("debug", R_Srcref);
 		PrintValue(body);
@@ -2396,6 +2894,7 @@ SEXP attribute_hidden do_repeat(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int dbg;
     volatile SEXP body;
+    volatile R_xlen_t iter = 0;
     RCNTXT cntxt;
 
     checkArity(op, args);
@@ -2412,7 +2911,8 @@ SEXP attribute_hidden do_repeat(SEXP call, SEXP op, SEXP args, SEXP rho)
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
     if (SETJMP(cntxt.cjmpbuf) != CTXT_BREAK) {
-	for (;;) {
+	while (! (R_CheckLoopJIT(call, rho, iter++) &&
+		  R_compileAndExecuteLoop(call, rho))) {
 	    eval(body, rho);
 	}
     }
@@ -3742,8 +4242,6 @@ int DispatchGroup(const char* group, SEXP call, SEXP op, SEXP args, SEXP rho,
 }
 
 /* start of bytecode section */
-static int R_bcVersion = 10;
-static int R_bcMinVersion = 9;
 
 static SEXP R_AddSym = NULL;
 static SEXP R_SubSym = NULL;
@@ -3949,6 +4447,28 @@ enum {
   SEQALONG_OP,
   SEQLEN_OP,
   BASEGUARD_OP,
+  SETVAR_POP_OP,
+  LDCONST_ADD_OP,
+  LDCONST_SUB_OP,
+  LDCONST_MUL_OP,
+  LDCONST_DIV_OP,
+  LDCONST_EQ_OP,
+  LDCONST_NE_OP,
+  LDCONST_LT_OP,
+  LDCONST_LE_OP,
+  LDCONST_GE_OP,
+  LDCONST_GT_OP,
+  GETVAR_ADD_OP,
+  GETVAR_SUB_OP,
+  GETVAR_MUL_OP,
+  GETVAR_DIV_OP,
+  GETVAR_EQ_OP,
+  GETVAR_NE_OP,
+  GETVAR_LT_OP,
+  GETVAR_LE_OP,
+  GETVAR_GE_OP,
+  GETVAR_GT_OP,
+  MAKEPROM_VAR_OP,
   OPCOUNT
 };
 
@@ -4831,6 +5351,153 @@ static R_INLINE void BCNPOP_AND_END_CNTXT() {
     R_BCNodeStackTop -= RCNTXT_ELEMS + 1;
 }
 
+/* Evaluate a byte code closure body as eval(body, rho) does, but
+   without an eval() C stack frame between the calling and the called
+   bcEval. */
+static R_INLINE SEXP bcEvalClosureBody(SEXP body, SEXP rho)
+{
+    R_evalsave_t save;
+
+    R_Visible = TRUE;
+    evalPoll();
+    evalEnter(&save);
+    SEXP value = bcEval(body, rho, TRUE);
+    evalExit(&save);
+    return value;
+}
+
+/* Byte code that makes no calls, sets up no loop contexts and has no
+   RETURNJMP instructions cannot make its closure call the target of a
+   jump; R_bcEncode marks such code with BCNOJUMP_MASK. */
+#define BCNOJUMP_MASK ((unsigned short)(1<<6))
+#define BCNOJUMP(body) (LEVELS(BCODE_CODE(body)) & BCNOJUMP_MASK)
+
+/* Run a closure call in an already allocated context. */
+static SEXP execClosureInCntxt(RCNTXT *cntxt, SEXP call, SEXP newrho,
+			       SEXP sysparent, SEXP rho, SEXP arglist, SEXP op)
+{
+    volatile SEXP body;
+    Rboolean dbg = FALSE;
+
+    begincontext(cntxt, CTXT_RETURN, call, newrho, sysparent, arglist, op);
+
+    body = BODY(op);
+    if (R_CheckJIT(op)) {
+	int old_enabled = R_jit_enabled;
+	R_jit_enabled = 0;
+	R_cmpfun(op);
+	body = BODY(op);
+	R_jit_enabled = old_enabled;
+    }
+
+    /* Get the srcref record from the closure object. The old srcref was
+       saved in cntxt. */
+
+    R_Srcref = getAttrib(op, R_SrcrefSymbol);
+
+    /* Debugging */
+
+    if ((RDEBUG(op) && R_current_debug_state()) || RSTEP(op)
+         || (RDEBUG(rho) && R_BrowserLastCommand == 's')) {
+
+	dbg = TRUE;
+	SET_RSTEP(op, 0);
+	SET_RDEBUG(newrho, 1);
+	cntxt->browserfinish = 0; /* Don't want to inherit the "f" */
+	/* switch to interpreted version when debugging compiled code */
+	if (TYPEOF(body) == BCODESXP || TYPEOF(body) == EXTERNALSXP)
+	    body = bytecodeExpr(body);
+	Rprintf("debugging in: ");
+	PrintCall(call, rho);
+	SrcrefPrompt("debug", R_Srcref);
+	PrintValue(body);
+	do_browser(call, op, R_NilValue, newrho);
+    }
+
+    /*  Set a longjmp target which will catch any explicit returns
+	from the function body.  Byte code bodies that cannot return
+	through a jump get no jump target; R_jumpctxt refuses to jump
+	to such a context and leaves on.exit code set on it from
+	outside to R_run_onexits. */
+
+    if (TYPEOF(body) == BCODESXP && BCNOJUMP(body)) {
+	cntxt->nojump = TRUE;
+	cntxt->returnValue = bcEvalClosureBody(body, newrho);
+    }
+    else if ((SETJMP(cntxt->cjmpbuf))) {
+	if (!cntxt->jumptarget) {
+	    /* ignores intermediate jumps for on.exits */
+	    if (R_ReturnedValue == R_RestartToken) {
+		cntxt->callflag = CTXT_RETURN;  /* turn restart off */
+		R_ReturnedValue = R_NilValue;  /* remove restart token */
+		cntxt->returnValue = eval(body, newrho);
+	    } else
+		cntxt->returnValue = R_ReturnedValue;
+	}
+	else
+	    cntxt->returnValue = NULL; /* undefined */
+    }
+    else if (TYPEOF(body) == BCODESXP)
+	cntxt->returnValue = bcEvalClosureBody(body, newrho);
+    else
+	/* make it available to on.exit and implicitly protect */
+	cntxt->returnValue = eval(body, newrho);
+
+    R_Srcref = cntxt->srcref;
+    SEXP val = cntxt->returnValue;
+    endcontext(cntxt);
+
+    if (dbg) {
+	Rprintf("exiting from: ");
+	PrintCall(call, rho);
+    }
+
+    /* clear R_ReturnedValue to allow GC to reclaim old value */
+    R_ReturnedValue = R_NilValue;
+
+    return val;
+}
+
+#ifdef __GNUC__
+# define R_NOINLINE __attribute__((noinline))
+#else
+# define R_NOINLINE
+#endif
+
+/* Kept out of line so that only calls taking this path pay for the
+   context in their C stack frame. */
+static R_NOINLINE SEXP execClosureCStackCntxt(SEXP call, SEXP newrho,
+					      SEXP sysparent, SEXP rho,
+					      SEXP arglist, SEXP op)
+{
+    RCNTXT cntxt;
+    return execClosureInCntxt(&cntxt, call, newrho, sysparent, rho,
+			      arglist, op);
+}
+
+/* Byte code closure calls keep their context on the node stack while
+   it is less than a quarter full, which takes the context off the C
+   stack of shallow recursion.  Interpreted calls, and deep recursion
+   that would otherwise exhaust the node stack, use a C stack
+   context. */
+#define CNTXT_NODESTACK_LIMIT (R_BCNODESTACKSIZE / 4)
+
+static R_INLINE SEXP R_execClosure(SEXP call, SEXP newrho, SEXP sysparent,
+                                   SEXP rho, SEXP arglist, SEXP op)
+{
+    if (TYPEOF(BODY(op)) == BCODESXP &&
+	R_BCNodeStackTop - R_BCNodeStackBase < CNTXT_NODESTACK_LIMIT) {
+	RCNTXT *cntxt = BCNALLOC_CNTXT();
+	SEXP val = execClosureInCntxt(cntxt, call, newrho, sysparent, rho,
+				      arglist, op);
+	R_BCNodeStackTop -= RCNTXT_ELEMS + 1;
+	return val;
+    }
+    else
+	return execClosureCStackCntxt(call, newrho, sysparent, rho,
+				      arglist, op);
+}
+
 static SEXP bytecodeExpr(SEXP e)
 {
     if (TYPEOF(e) == EXTERNALSXP) {
@@ -5008,6 +5675,61 @@ static R_INLINE SEXP GET_BINDING_CELL_CACHE(SEXP symbol, SEXP rho,
     }
 }
 
+/* MAKEPROM_VAR passes the value of a local variable to a closure
+   instead of a promise for it when the closure cannot tell the
+   difference: its body is byte code that makes no calls (see
+   BCNOJUMP), so nothing can run between the call and the forcing of
+   the argument that could look at its expression or assign to the
+   variable, and its default arguments are constants.  Closures that
+   are being debugged or traced, or called from a frame being stepped
+   through, always get promises. */
+static R_INLINE Rboolean ELIDE_ARGS_OK(SEXP fun, SEXP rho)
+{
+    SEXP body = BODY(fun);
+    if (TYPEOF(body) != BCODESXP || ! BCNOJUMP(body) ||
+	RDEBUG(fun) || RSTEP(fun) || RTRACE(fun) || RDEBUG(rho))
+	return FALSE;
+    for (SEXP f = FORMALS(fun); f != R_NilValue; f = CDR(f))
+	switch (TYPEOF(CAR(f))) {
+	case SYMSXP:
+	    if (CAR(f) != R_MissingArg)
+		return FALSE;
+	    break;
+	case LANGSXP:
+	case PROMSXP:
+	case BCODESXP:
+	    return FALSE;
+	}
+    return TRUE;
+}
+
+/* The value MAKEPROM_VAR passes for the local variable symbol, or NULL
+   if a promise is needed.  Unforced promises keep their evaluation
+   order, and missing arguments stay missing. */
+static R_INLINE SEXP ELIDED_ARG_VALUE(SEXP symbol, SEXP rho,
+				      R_binding_cache_t vcache, int sidx)
+{
+    SEXP cell = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
+    if (cell == R_NilValue || IS_ACTIVE_BINDING(cell) || MISSING(cell))
+	return NULL;
+    SEXP value = CAR(cell);
+    if (TYPEOF(value) == PROMSXP) {
+	if (PRVALUE(value) == R_UnboundValue)
+	    return NULL;
+	value = PRVALUE(value);
+    }
+    switch (TYPEOF(value)) {
+    case SYMSXP: /* including R_MissingArg and R_UnboundValue */
+    case LANGSXP:
+    case PROMSXP:
+    case BCODESXP:
+    case DOTSXP:
+	return NULL;
+    }
+    ENSURE_NAMEDMAX(value);
+    return value;
+}
+
 static void NORET MISSING_ARGUMENT_ERROR(SEXP symbol)
 {
     const char *n = CHAR(PRINTNAME(symbol));
@@ -5139,6 +5861,67 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 } while (0)
 #endif
 
+/* Superinstructions.  The compiler fuses an LDCONST or GETVAR
+   instruction with an immediately following arithmetic or comparison
+   instruction into a single LDCONST_<op> or GETVAR_<op> instruction.
+   The fused instruction has the operand index of the load followed by
+   the call index of the operation, so after the operand has been
+   pushed the code for the operation can be run as is. Setting
+   currentpc to the call index makes the location tables report the
+   call, as they would for the unfused operation. The loads set
+   R_Visible as LDCONST and GETVAR do, since the fast paths of the
+   operations leave it alone. */
+#define DO_LDCONST_OPERAND() do {				\
+	R_Visible = TRUE;					\
+	SEXP __cvalue__ = VECTOR_ELT(constants, GETOP());	\
+	if (R_check_constants < 0)				\
+	    __cvalue__ = duplicate(__cvalue__);			\
+	MARK_NOT_MUTABLE(__cvalue__);				\
+	BCNPUSH(__cvalue__);					\
+	currentpc = pc;						\
+    } while (0)
+
+/* Same value as pushed by DO_GETVAR(FALSE, FALSE), without the push. */
+static R_INLINE SEXP GETVAR_OPERAND(int sidx, SEXP rho, SEXP constants,
+				    R_binding_cache_t vcache,
+				    Rboolean smallcache)
+{
+    if (smallcache) {
+	SEXP cell = GET_SMALLCACHE_BINDING_CELL(vcache, sidx);
+	SEXP value = CAR(cell);
+	switch(TYPEOF(value)) {
+	case REALSXP:
+	case INTSXP:
+	case LGLSXP:
+	    ENSURE_NAMED(value); /* should not really be needed - LT */
+	    return value;
+	}
+	if (cell != R_NilValue && ! IS_ACTIVE_BINDING(cell) &&
+	    TYPEOF(value) != SYMSXP) {
+	    if (TYPEOF(value) == PROMSXP) {
+		SEXP pv = PRVALUE(value);
+		if (pv == R_UnboundValue) {
+		    SEXP symbol = VECTOR_ELT(constants, sidx);
+		    value = FORCE_PROMISE(value, symbol, rho, FALSE);
+		}
+		else value = pv;
+	    }
+	    else ENSURE_NAMED(value);
+	    return value;
+	}
+    }
+    SEXP symbol = VECTOR_ELT(constants, sidx);
+    return getvar(symbol, rho, FALSE, FALSE, vcache, sidx);
+}
+
+#define DO_GETVAR_OPERAND() do {					\
+	R_Visible = TRUE;						\
+	int __sidx__ = GETOP();						\
+	BCNPUSH(GETVAR_OPERAND(__sidx__, rho, constants,		\
+			       vcache, smallcache));			\
+	currentpc = pc;							\
+    } while (0)
+
 /* call frame accessors */
 #define CALL_FRAME_FUN() GETSTACK(-3)
 #define CALL_FRAME_ARGS() GETSTACK(-2)
@@ -6245,6 +7028,160 @@ static R_INLINE Rboolean FIND_ON_STACK(SEXP x, R_bcstack_t *base, int skip)
     return FALSE;
 }
 
+/* Function lookup caches.  The function found by GETFUN or GETGLOBFUN
+   for the symbol at index sidx of the constant pool is recorded in
+   slot sidx of a cache held in the TAG field of the byte code object,
+   along with the environment the search was started from, the value
+   of R_FunCacheEpoch and the binding version of the symbol at the
+   time.  That environment is the first hashed or base environment on
+   the search path (the anchor); the unhashed frames before it,
+   usually closure call frames, are checked for a binding of the
+   symbol on each lookup.  The cache is only filled if the search from
+   the anchor passes through hashed and base environments only, which
+   advance the binding version of a symbol when a binding changes that
+   might affect the result (see CHECK_FUNBINDING_CHANGE in Defn.h).
+
+   The cache is a CONS cell with a generic vector holding the function
+   and the anchor of each slot in the CAR and a real vector holding the
+   epoch and the version in the CDR, so the collector sees the cached
+   functions and need not invalidate the caches.  Only anchors that
+   are reachable anyway, the global and base environments, namespaces
+   and package environments, are recorded, so the cache does not keep
+   other environments alive. */
+#define BCODE_FUNCACHE(x) TAG(x)
+#define FUNCACHE_OBJECTS(c) CAR(c)
+#define FUNCACHE_STAMPS(c) REAL(CDR(c))
+
+static R_INLINE SEXP FUNCACHE_ANCHOR(SEXP symbol, SEXP rho)
+{
+    while (HASHTAB(rho) == R_NilValue && rho != R_BaseEnv &&
+	   rho != R_BaseNamespace && rho != R_EmptyEnv) {
+	for (SEXP frame = FRAME(rho); frame != R_NilValue; frame = CDR(frame))
+	    if (TAG(frame) == symbol)
+		return R_NilValue;
+	rho = ENCLOS(rho);
+    }
+    return rho;
+}
+
+static Rboolean funCacheAnchorOK(SEXP anchor)
+{
+    return anchor == R_GlobalEnv || anchor == R_BaseEnv ||
+	anchor == R_BaseNamespace || R_IsNamespaceEnv(anchor) ||
+	R_IsPackageEnv(anchor);
+}
+
+static SEXP allocFunCache(int n)
+{
+    SEXP cache = PROTECT(CONS(R_NilValue, R_NilValue));
+    SETCAR(cache, allocVector(VECSXP, 2 * n));
+    SETCDR(cache, allocVector(REALSXP, 2 * n));
+    double *stamps = FUNCACHE_STAMPS(cache);
+    for (int i = 0; i < 2 * n; i++)
+	stamps[i] = 0; /* R_FunCacheEpoch starts at 1 */
+    UNPROTECT(1); /* cache */
+    return cache;
+}
+
+static R_INLINE SEXP FIND_FUN_CACHED(SEXP body, SEXP constants, int sidx,
+				     SEXP rho)
+{
+    SEXP symbol = VECTOR_ELT(constants, sidx);
+    SEXP anchor = FUNCACHE_ANCHOR(symbol, rho);
+    if (anchor == R_NilValue || anchor == R_EmptyEnv)
+	return findFun(symbol, rho);
+
+    SEXP cache = BCODE_FUNCACHE(body);
+    if (cache != R_NilValue) {
+	double *stamps = FUNCACHE_STAMPS(cache) + 2 * sidx;
+	SEXP objects = FUNCACHE_OBJECTS(cache);
+	if (stamps[0] == R_FunCacheEpoch &&
+	    VECTOR_ELT(objects, 2 * sidx + 1) == anchor &&
+	    stamps[1] == FUNBINDING_VERSION(symbol))
+	    return VECTOR_ELT(objects, 2 * sidx);
+    }
+    if (! funCacheAnchorOK(anchor))
+	return findFun(symbol, rho);
+    if (cache == R_NilValue) {
+	cache = allocFunCache(LENGTH(constants));
+	SET_TAG(body, cache); /* BCODE_FUNCACHE */
+    }
+
+    /* forcing a promise in the search may change the epoch or the
+       version, so record them first */
+    double epoch = R_FunCacheEpoch;
+    double version = FUNBINDING_VERSION(symbol);
+    SEXP value = R_findFunForCache(symbol, anchor);
+    if (value == R_UnboundValue)
+	return findFun(symbol, rho);
+    SEXP objects = FUNCACHE_OBJECTS(cache);
+    SET_VECTOR_ELT(objects, 2 * sidx, value);
+    SET_VECTOR_ELT(objects, 2 * sidx + 1, anchor);
+    double *stamps = FUNCACHE_STAMPS(cache) + 2 * sidx;
+    stamps[0] = epoch;
+    stamps[1] = version;
+    return value;
+}
+
+/* Assign the value on top of the stack, leaving it there. */
+static R_INLINE void SETVAR_PTR(int sidx, SEXP rho, SEXP constants,
+				R_binding_cache_t vcache, Rboolean smallcache,
+				R_bcstack_t *vcache_top)
+{
+    SEXP loc;
+    if (smallcache)
+	loc = GET_SMALLCACHE_BINDING_CELL(vcache, sidx);
+    else {
+	SEXP symbol = VECTOR_ELT(constants, sidx);
+	loc = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
+    }
+#ifdef TYPED_STACK
+    R_bcstack_t *s = R_BCNodeStackTop - 1;
+    /* reading the locked bit is OK even if cell is R_NilValue */
+    if (s->tag && ! BINDING_IS_LOCKED(loc)) {
+	/* if cell is R_NilValue or an active binding, or if the value
+	   is R_UnboundValue, then TYPEOF(CAR(cell)) will not match the
+	   immediate value tag. */
+	SEXP x = CAR(loc);  /* fast, but assumes binding is a CONS */
+	if (NOT_SHARED(x) && IS_SIMPLE_SCALAR(x, s->tag)) {
+	    /* if the binding value is not shared and is a simple
+	       scalar of the same type as the immediate value,
+	       then we can copy the stack value into the binding
+	       value */
+
+#define MAX_ON_STACK_CHECK 63
+	    /* Check whether the value is on the stack before
+	       modifying.  Limit the number of items to check to
+	       MAX_ON_STACK_CHECK; this will result in some
+	       defensive boxing. This number could be tuned; in
+	       some limited testing ncheck never went above
+	       36. Not worrying BCNALLOC stuff could result in
+	       false positives and unnecessary boxing but is
+	       probably worth it for avoiding checking and
+	       branching. LT */
+	    int tag = s->tag;
+	    if (R_BCNodeStackTop - vcache_top > MAX_ON_STACK_CHECK ||
+		FIND_ON_STACK(x, vcache_top, TRUE))
+		tag = 0;
+
+	    switch (tag) {
+	    case REALSXP: SET_SCALAR_DVAL(x, s->u.dval); return;
+	    case INTSXP: SET_SCALAR_IVAL(x, s->u.ival); return;
+	    case LGLSXP: SET_SCALAR_LVAL(x, s->u.ival); return;
+	    }
+	}
+    }
+#endif
+    SEXP value = GETSTACK(-1);
+    INCREMENT_NAMED(value);
+    if (! SET_BINDING_VALUE(loc, value, rho)) {
+	SEXP symbol = VECTOR_ELT(constants, sidx);
+	PROTECT(value);
+	defineVar(symbol, value, rho);
+	UNPROTECT(1);
+    }
+}
+
 static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 {
   SEXP retvalue = R_NilValue, constants;
@@ -6531,7 +7468,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	  default:
 	    error(_("invalid sequence argument in for loop"));
 	  }
-	  if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, value))
+	  if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, value, rho))
 	      defineVar(BINDING_SYMBOL(cell), value, rho);
 	  BC_CHECK_SIGINT();
 	  pc = codebase + label;
@@ -6568,81 +7505,30 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(SETVAR, 1):
       {
 	int sidx = GETOP();
-	SEXP loc;
-	if (smallcache)
-	    loc = GET_SMALLCACHE_BINDING_CELL(vcache, sidx);
-	else {
-	    SEXP symbol = VECTOR_ELT(constants, sidx);
-	    loc = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
-	}
-#ifdef TYPED_STACK
-	R_bcstack_t *s = R_BCNodeStackTop - 1;
-	/* reading the locked bit is OK even if cell is R_NilValue */
-	if (s->tag && ! BINDING_IS_LOCKED(loc)) {
-	    /* if cell is R_NilValue or an active binding, or if the value
-	       is R_UnboundValue, then TYPEOF(CAR(cell)) will not match the
-	       immediate value tag. */
-	    SEXP x = CAR(loc);  /* fast, but assumes binding is a CONS */
-	    if (NOT_SHARED(x) && IS_SIMPLE_SCALAR(x, s->tag)) {
-		/* if the binding value is not shared and is a simple
-		   scalar of the same type as the immediate value,
-		   then we can copy the stack value into the binding
-		   value */
-
-#define MAX_ON_STACK_CHECK 63
-		/* Check whether the value is on the stack before
-		   modifying.  Limit the number of items to check to
-		   MAX_ON_STACK_CHECK; this will result in some
-		   defensive boxing. This number could be tuned; in
-		   some limited testing ncheck never went above
-		   36. Not worrying BCNALLOC stuff could result in
-		   false positives and unnecessary boxing but is
-		   probably worth it for avoiding checking and
-		   branching. LT */
-		int tag = s->tag;
-		if (R_BCNodeStackTop - vcache_top > MAX_ON_STACK_CHECK ||
-		    FIND_ON_STACK(x, vcache_top, TRUE))
-		    tag = 0;		
-
-		switch (tag) {
-		case REALSXP: SET_SCALAR_DVAL(x, s->u.dval); NEXT();
-		case INTSXP: SET_SCALAR_IVAL(x, s->u.ival); NEXT();
-		case LGLSXP: SET_SCALAR_LVAL(x, s->u.ival); NEXT();
-		}
-	    }
-	}
-#endif
-	SEXP value = GETSTACK(-1);
-	INCREMENT_NAMED(value);
-	if (! SET_BINDING_VALUE(loc, value)) {
-	    SEXP symbol = VECTOR_ELT(constants, sidx);
-	    PROTECT(value);
-	    defineVar(symbol, value, rho);
-	    UNPROTECT(1);
-	}
+	SETVAR_PTR(sidx, rho, constants, vcache, smallcache, vcache_top);
 	NEXT();
       }
     OP(GETFUN, 1):
       {
 	/* get the function */
-	SEXP symbol = VECTOR_ELT(constants, GETOP());
-	SEXP value = findFun(symbol, rho);
+	int sidx = GETOP();
+	SEXP value = FIND_FUN_CACHED(body, constants, sidx, rho);
 	INIT_CALL_FRAME(value);
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
-	  PrintValue(symbol);
+	  PrintValue(VECTOR_ELT(constants, sidx));
 	}
 	NEXT();
       }
     OP(GETGLOBFUN, 1):
       {
 	/* get the function */
-	SEXP symbol = VECTOR_ELT(constants, GETOP());
-	SEXP value = findFun(symbol, R_GlobalEnv);
+	int sidx = GETOP();
+	SEXP value = FIND_FUN_CACHED(body, constants, sidx, R_GlobalEnv);
 	INIT_CALL_FRAME(value);
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
-	  PrintValue(symbol);
+	  PrintValue(VECTOR_ELT(constants, sidx));
 	}
 	NEXT();
       }
@@ -6930,7 +7816,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	SEXP cell = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
 	SEXP value = GETSTACK(-1); /* leave on stack for GC protection */
 	INCREMENT_NAMED(value);
-	if (! SET_BINDING_VALUE(cell, value))
+	if (! SET_BINDING_VALUE(cell, value, rho))
 	    defineVar(symbol, value, rho);
 	R_BCNodeStackTop--; /* now pop LHS value off the stack */
 	/* original right-hand side value is now on top of stack again */
@@ -7344,6 +8230,66 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(SEQALONG, 1): DO_SEQ_ALONG(); NEXT();
     OP(SEQLEN, 1): DO_SEQ_LEN(); NEXT();
     OP(BASEGUARD, 2): DO_BASEGUARD(); NEXT();
+    OP(SETVAR_POP, 1):
+      {
+	int sidx = GETOP();
+	SETVAR_PTR(sidx, rho, constants, vcache, smallcache, vcache_top);
+	BCNPOP_IGNORE_VALUE();
+	NEXT();
+      }
+    OP(LDCONST_ADD, 2):
+	DO_LDCONST_OPERAND(); FastBinary(R_ADD, PLUSOP, R_AddSym);
+    OP(LDCONST_SUB, 2):
+	DO_LDCONST_OPERAND(); FastBinary(R_SUB, MINUSOP, R_SubSym);
+    OP(LDCONST_MUL, 2):
+	DO_LDCONST_OPERAND(); FastBinary(R_MUL, TIMESOP, R_MulSym);
+    OP(LDCONST_DIV, 2):
+	DO_LDCONST_OPERAND(); FastBinary(R_DIV, DIVOP, R_DivSym);
+    OP(LDCONST_EQ, 2): DO_LDCONST_OPERAND(); FastRelop2(==, EQOP, R_EqSym);
+    OP(LDCONST_NE, 2): DO_LDCONST_OPERAND(); FastRelop2(!=, NEOP, R_NeSym);
+    OP(LDCONST_LT, 2): DO_LDCONST_OPERAND(); FastRelop2(<, LTOP, R_LtSym);
+    OP(LDCONST_LE, 2): DO_LDCONST_OPERAND(); FastRelop2(<=, LEOP, R_LeSym);
+    OP(LDCONST_GE, 2): DO_LDCONST_OPERAND(); FastRelop2(>=, GEOP, R_GeSym);
+    OP(LDCONST_GT, 2): DO_LDCONST_OPERAND(); FastRelop2(>, GTOP, R_GtSym);
+    OP(GETVAR_ADD, 2):
+	DO_GETVAR_OPERAND(); FastBinary(R_ADD, PLUSOP, R_AddSym);
+    OP(GETVAR_SUB, 2):
+	DO_GETVAR_OPERAND(); FastBinary(R_SUB, MINUSOP, R_SubSym);
+    OP(GETVAR_MUL, 2):
+	DO_GETVAR_OPERAND(); FastBinary(R_MUL, TIMESOP, R_MulSym);
+    OP(GETVAR_DIV, 2):
+	DO_GETVAR_OPERAND(); FastBinary(R_DIV, DIVOP, R_DivSym);
+    OP(GETVAR_EQ, 2): DO_GETVAR_OPERAND(); FastRelop2(==, EQOP, R_EqSym);
+    OP(GETVAR_NE, 2): DO_GETVAR_OPERAND(); FastRelop2(!=, NEOP, R_NeSym);
+    OP(GETVAR_LT, 2): DO_GETVAR_OPERAND(); FastRelop2(<, LTOP, R_LtSym);
+    OP(GETVAR_LE, 2): DO_GETVAR_OPERAND(); FastRelop2(<=, LEOP, R_LeSym);
+    OP(GETVAR_GE, 2): DO_GETVAR_OPERAND(); FastRelop2(>=, GEOP, R_GeSym);
+    OP(GETVAR_GT, 2): DO_GETVAR_OPERAND(); FastRelop2(>, GTOP, R_GtSym);
+    OP(MAKEPROM_VAR, 2):
+      {
+	SEXP code = VECTOR_ELT(constants, GETOP());
+	int sidx = GETOP();
+	SEXP fun = CALL_FRAME_FUN();
+	SEXPTYPE ftype = TYPEOF(fun);
+	if (ftype == CLOSXP) {
+	  SEXP value = NULL;
+	  if (ELIDE_ARGS_OK(fun, rho))
+	    value = ELIDED_ARG_VALUE(VECTOR_ELT(constants, sidx), rho,
+				     vcache, sidx);
+	  if (value == NULL)
+	    value = mkPROMISE(code, rho);
+	  PUSHCALLARG(value);
+	}
+	else if (ftype == BUILTINSXP) {
+	  SEXP value;
+	  if (TYPEOF(code) == BCODESXP)
+	    value = bcEval(code, rho, TRUE);
+	  else
+	    value = eval(code, rho);
+	  PUSHCALLARG(value);
+	}
+	NEXT();
+      }
     LASTOP;
   }
 
@@ -7362,6 +8308,41 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
   return retvalue;
 }
 
+/* Instructions that neither call functions nor jump to a context.
+   Dispatch on objects and active bindings can still run R code, but
+   such code cannot return from the closure being run. */
+static Rboolean bcOpCannotJump(int op)
+{
+    switch (op) {
+    case RETURN_OP: case GOTO_OP: case BRIFNOT_OP: case POP_OP: case DUP_OP:
+    case STARTFOR_OP: case STEPFOR_OP: case ENDFOR_OP: case SETLOOPVAL_OP:
+    case INVISIBLE_OP: case VISIBLE_OP:
+    case LDCONST_OP: case LDNULL_OP: case LDTRUE_OP: case LDFALSE_OP:
+    case GETVAR_OP: case SETVAR_OP: case SETVAR_POP_OP:
+    case UMINUS_OP: case UPLUS_OP: case ADD_OP: case SUB_OP: case MUL_OP:
+    case DIV_OP: case EXPT_OP: case SQRT_OP: case EXP_OP:
+    case EQ_OP: case NE_OP: case LT_OP: case LE_OP: case GE_OP: case GT_OP:
+    case AND_OP: case OR_OP: case NOT_OP:
+    case AND1ST_OP: case AND2ND_OP: case OR1ST_OP: case OR2ND_OP:
+    case ISNULL_OP: case ISLOGICAL_OP: case ISINTEGER_OP: case ISDOUBLE_OP:
+    case ISCOMPLEX_OP: case ISCHARACTER_OP: case ISSYMBOL_OP:
+    case ISOBJECT_OP: case ISNUMERIC_OP:
+    case LOG_OP: case LOGBASE_OP: case MATH1_OP:
+    case COLON_OP: case SEQALONG_OP: case SEQLEN_OP:
+    case LDCONST_ADD_OP: case LDCONST_SUB_OP: case LDCONST_MUL_OP:
+    case LDCONST_DIV_OP: case LDCONST_EQ_OP: case LDCONST_NE_OP:
+    case LDCONST_LT_OP: case LDCONST_LE_OP: case LDCONST_GE_OP:
+    case LDCONST_GT_OP:
+    case GETVAR_ADD_OP: case GETVAR_SUB_OP: case GETVAR_MUL_OP:
+    case GETVAR_DIV_OP: case GETVAR_EQ_OP: case GETVAR_NE_OP:
+    case GETVAR_LT_OP: case GETVAR_LE_OP: case GETVAR_GE_OP:
+    case GETVAR_GT_OP:
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
 #ifdef THREADED_CODE
 SEXP R_bcEncode(SEXP bytes)
 {
@@ -7399,13 +8380,18 @@ SEXP R_bcEncode(SEXP bytes)
 	if (n == 2 && ipc[1] == BCMISMATCH_OP)
 	    pc[0].i = 2;
 
+	Rboolean nojump = TRUE;
 	for (i = 1; i < n;) {
 	    int op = pc[i].i;
 	    if (op < 0 || op >= OPCOUNT)
 		error("unknown instruction code");
+	    if (nojump && ! bcOpCannotJump(op))
+		nojump = FALSE;
 	    pc[i].v = opinfo[op].addr;
 	    i += opinfo[op].argc + 1;
 	}
+	if (nojump)
+	    SETLEVELS(code, LEVELS(code) | BCNOJUMP_MASK);
 
 	return code;
     }
@@ -7710,15 +8696,12 @@ static SEXP disassemble(SEXP bc)
   int i;
   SEXP code = BCODE_CODE(bc);
   SEXP consts = BCODE_CONSTS(bc);
-  SEXP expr = BCODE_EXPR(bc);
   int nc = LENGTH(consts);
 
-  PROTECT(ans = allocVector(VECSXP, expr != R_NilValue ? 4 : 3));
+  PROTECT(ans = allocVector(VECSXP, 3));
   SET_VECTOR_ELT(ans, 0, install(".Code"));
   SET_VECTOR_ELT(ans, 1, R_bcDecode(code));
   SET_VECTOR_ELT(ans, 2, allocVector(VECSXP, nc));
-  if (expr != R_NilValue)
-      SET_VECTOR_ELT(ans, 3, duplicate(expr));
 
   dconsts = VECTOR_ELT(ans, 2);
   for (i = 0; i < nc; i++) {
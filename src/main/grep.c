@@ -902,6 +902,8 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
     Rboolean use_UTF8 = FALSE, use_WC = FALSE;
     const void *vmax;
     int nwarn = 0;
+    R_strbuf_t sb;
+    Rboolean tbuf, tbuf_direct = FALSE;
 
     checkArity(op, args);
     pat = CAR(args); args = CDR(args);
@@ -949,9 +951,13 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 	return ans;
     }
 
+    /* the encoding of a string buffer is that of all its elements */
+    tbuf = R_get_string_buffer(text, &sb);
     if (!useBytes) {
 	Rboolean onlyASCII = IS_ASCII(STRING_ELT(pat, 0));
-	if (onlyASCII)
+	if (tbuf)
+	    onlyASCII = onlyASCII && sb.ascii;
+	else if (onlyASCII)
 	    for (i = 0; i < n; i++) {
 		if(STRING_ELT(text, i) == NA_STRING) continue;
 		if (!IS_ASCII(STRING_ELT(text, i))) {
@@ -963,7 +969,9 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
     }
     if (!useBytes) {
 	Rboolean haveBytes = IS_BYTES(STRING_ELT(pat, 0));
-	if (!haveBytes)
+	if (tbuf)
+	    haveBytes = haveBytes || (!sb.ascii && sb.enc == CE_BYTES);
+	else if (!haveBytes)
 	    for (i = 0; i < n; i++)
 		if (IS_BYTES(STRING_ELT(text, i))) {
 		    haveBytes = TRUE;
@@ -977,7 +985,9 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 	/* As from R 2.10.0 we use UTF-8 mode in PCRE in all MBCS locales */
 	if (perl_opt && mbcslocale) use_UTF8 = TRUE;
 	else if (IS_UTF8(STRING_ELT(pat, 0))) use_UTF8 = TRUE;
-	if (!use_UTF8)
+	if (tbuf)
+	    use_UTF8 = use_UTF8 || (!sb.ascii && sb.enc == CE_UTF8);
+	else if (!use_UTF8)
 	    for (i = 0; i < n; i++)
 		if (IS_UTF8(STRING_ELT(text, i))) {
 		    use_UTF8 = TRUE;
@@ -1029,11 +1039,17 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 	if(R_PCRE_limit_recursion == NA_LOGICAL) {
 	    // use recursion limit only on long strings
 	    Rboolean use = FALSE;
-	    for (i = 0 ; i < n ; i++)
-		if(strlen(CHAR(STRING_ELT(text, i))) >= 1000) {
+	    for (i = 0 ; i < n ; i++) {
+		int len = 0;
+		if (tbuf)
+		    R_string_buffer_elt(&sb, i, &len);
+		else
+		    len = (int) strlen(CHAR(STRING_ELT(text, i)));
+		if (len >= 1000) {
 		    use = TRUE;
 		    break;
 		}
+	    }
 	    if (use)
 		set_pcre_recursion_limit(&re_pe, R_pcre_max_recursions());
 	} else if (R_PCRE_limit_recursion)
@@ -1048,14 +1064,42 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 	if (rc) reg_report(rc, &reg, spat);
     }
 
+    /* Elements of a string buffer that need no translation are matched
+       in a copy of their bytes, without making the strings. */
+    if (tbuf)
+	tbuf_direct = !use_WC &&
+	    (useBytes || sb.ascii ||
+	     sb.enc == (use_UTF8 ? CE_UTF8 : CE_NATIVE));
+
     PROTECT(ind = allocVector(LGLSXP, n));
     vmax = vmaxget();
     for (i = 0 ; i < n ; i++) {
 //	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
 	LOGICAL(ind)[i] = 0;
-	if (STRING_ELT(text, i) != NA_STRING) {
+	const char *bs = NULL;
+	int blen;
+	if (tbuf_direct && (bs = R_string_buffer_elt(&sb, i, &blen))) {
+	    char *buf = R_alloc(blen + 1, sizeof(char));
+	    memcpy(buf, bs, blen);
+	    buf[blen] = '\0';
+	    bs = buf;
+	}
+	if (tbuf_direct ? bs != NULL : STRING_ELT(text, i) != NA_STRING) {
 	    const char *s = NULL;
-	    if (useBytes)
+	    if (bs) {
+		s = bs;
+		if (!useBytes && use_UTF8 && !utf8Valid(s)) {
+		    if(nwarn++ < NWARN)
+			warning(_("input string %d is invalid UTF-8"), i+1);
+		    continue;
+		}
+		if (!useBytes && !use_UTF8 && mbcslocale && !mbcsValid(s)) {
+		    if(nwarn++ < NWARN)
+			warning(_("input string %d is invalid in this locale"), i+1);
+		    continue;
+		}
+	    }
+	    else if (useBytes)
 		s = CHAR(STRING_ELT(text, i));
 	    else if (use_WC) ;
 	    else if (use_UTF8) {
@@ -1078,7 +1122,8 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 		LOGICAL(ind)[i] = fgrep_one(spat, s, useBytes, use_UTF8, NULL) >= 0;
 	    else if (perl_opt) {
 		int rc =
-		    pcre_exec(re_pcre, re_pe, s, (int) strlen(s), 0, 0, ov, 0);
+		    pcre_exec(re_pcre, re_pe, s, bs ? blen : (int) strlen(s),
+			      0, 0, ov, 0);
 		if(rc >= 0) INTEGER(ind)[i] = 1;
 		else {
 		    INTEGER(ind)[i] = 0;
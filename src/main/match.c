@@ -43,6 +43,7 @@
 #endif
 
 #include "Defn.h"
+#include <R_ext/RS.h> /* for Calloc */
 
 
 /* used in subscript.c and subassign.c */
@@ -180,16 +181,151 @@ SEXP attribute_hidden matchArgExact(SEXP tag, SEXP * list)
 #define SET_ARGUSED(x,v) SETLEVELS(x,v)
 
 
+/* Match plans.  Unless some of the supplied arguments are missing, the
+   result of matching depends only on the formals and on the tags of
+   the supplied arguments, which are usually the same for all calls
+   from one call site.  So the formal each supplied argument went to,
+   or -1 for ..., is recorded after a successful match in a hash table
+   keyed by the identity of the formals and the tags, and later
+   matches with the same key just move the arguments into place.  The
+   formals of the cached plans are kept alive in MatchPlanFormals so
+   their addresses cannot be reused. */
+
+#define MATCH_PLAN_CACHE_SIZE 1024 /* must be a power of 2 */
+#define MATCH_PLAN_MAX_ARGS 16
+
+typedef struct {
+    SEXP formals;	/* NULL for an unused entry */
+    int nsupplied;
+    int nformals;
+    int dotsformal;	/* index of ... in formals, or -1 */
+    int ndots;
+    Rboolean partial;	/* partial matching was used */
+    SEXP tags[MATCH_PLAN_MAX_ARGS];
+    int target[MATCH_PLAN_MAX_ARGS];
+} R_matchplan_t;
+
+static R_matchplan_t *MatchPlans = NULL;
+static SEXP MatchPlanFormals = NULL;
+
+/* Returns the hash of the key, or -1 if the call cannot use a plan. */
+static R_INLINE int matchPlanKey(SEXP formals, SEXP supplied, int *pn)
+{
+    uintptr_t h = (uintptr_t) formals >> 3;
+    int n = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), n++) {
+	if (n == MATCH_PLAN_MAX_ARGS || CAR(b) == R_MissingArg)
+	    return -1;
+	h = h * 31 + ((uintptr_t) TAG(b) >> 3);
+    }
+    *pn = n;
+    return (int) ((h ^ (h >> 16)) & (MATCH_PLAN_CACHE_SIZE - 1));
+}
+
+static R_INLINE R_matchplan_t *findMatchPlan(int key, SEXP formals,
+					     SEXP supplied, int n)
+{
+    if (MatchPlans == NULL)
+	return NULL;
+    R_matchplan_t *p = MatchPlans + key;
+    if (p->formals != formals || p->nsupplied != n ||
+	(p->partial && R_warn_partial_match_args))
+	return NULL;
+    int i = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), i++)
+	if (p->tags[i] != TAG(b))
+	    return NULL;
+    return p;
+}
+
+static SEXP applyMatchPlan(R_matchplan_t *p, SEXP supplied)
+{
+    int nf = p->nformals;
+    SEXP cells[nf ? nf : 1]; // avoid undefined behaviour
+    SEXP actuals = R_NilValue;
+    for (int k = nf - 1; k >= 0; k--) {
+	actuals = CONS_NR(R_MissingArg, actuals);
+	SET_MISSING(actuals, 1);
+	cells[k] = actuals;
+    }
+    if (p->dotsformal >= 0)
+	SET_MISSING(cells[p->dotsformal], 0);
+    if (p->ndots == 0) {
+	int i = 0;
+	for (SEXP b = supplied; b != R_NilValue; b = CDR(b), i++) {
+	    SEXP a = cells[p->target[i]];
+	    SETCAR(a, CAR(b));
+	    SET_MISSING(a, 0);
+	}
+	return actuals;
+    }
+    PROTECT(actuals);
+    SEXP dots = allocList(p->ndots);
+    SET_TYPEOF(dots, DOTSXP);
+    SETCAR(cells[p->dotsformal], dots);
+    SEXP d = dots;
+    int i = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), i++) {
+	SEXP a;
+	if (p->target[i] < 0) {
+	    a = d;
+	    d = CDR(d);
+	    SET_TAG(a, TAG(b));
+	}
+	else {
+	    a = cells[p->target[i]];
+	    SET_MISSING(a, 0);
+	}
+	SETCAR(a, CAR(b));
+    }
+    UNPROTECT(1); /* actuals */
+    return actuals;
+}
+
+static void saveMatchPlan(int key, SEXP formals, SEXP supplied, int n,
+			  int nformals, int dotsformal, Rboolean partial,
+			  int *target)
+{
+    if (MatchPlans == NULL) {
+	MatchPlanFormals = allocVector(VECSXP, MATCH_PLAN_CACHE_SIZE);
+	R_PreserveObject(MatchPlanFormals);
+	MatchPlans = Calloc(MATCH_PLAN_CACHE_SIZE, R_matchplan_t);
+    }
+    R_matchplan_t *p = MatchPlans + key;
+    SET_VECTOR_ELT(MatchPlanFormals, key, formals);
+    p->formals = formals;
+    p->nsupplied = n;
+    p->nformals = nformals;
+    p->dotsformal = dotsformal;
+    p->partial = partial;
+    p->ndots = 0;
+    int i = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), i++) {
+	p->tags[i] = TAG(b);
+	p->target[i] = target[i];
+	if (target[i] < 0) p->ndots++;
+    }
+}
+
 /* We need to leave 'supplied' unchanged in case we call UseMethod */
 /* MULTIPLE_MATCHES was added by RI in Jan 2005 but never activated:
    code in R-2-8-branch */
 
 SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
 {
-    Rboolean seendots;
-    int i, arg_i = 0;
+    Rboolean seendots, partial = FALSE;
+    int i, arg_i = 0, nsupplied = 0;
     SEXP f, a, b, dots, actuals;
 
+    int key = matchPlanKey(formals, supplied, &nsupplied);
+    if (key >= 0) {
+	R_matchplan_t *p = findMatchPlan(key, formals, supplied, nsupplied);
+	if (p != NULL)
+	    return applyMatchPlan(p, supplied);
+    }
+    /* the formal each supplied argument is matched to, -1 for ... */
+    int target[key >= 0 && nsupplied ? nsupplied : 1];
+
     actuals = R_NilValue;
     for (f = formals ; f != R_NilValue ; f = CDR(f), arg_i++) {
 	/* CONS_NR is used since argument lists created here are only
@@ -239,6 +375,7 @@ SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
                               i);
 		      SETCAR(a, CAR(b));
 		      if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
+		      if (key >= 0) target[i - 1] = arg_i;
 		      SET_ARGUSED(b, 2);
 		      fargused[arg_i] = 2;
 		  }
@@ -284,6 +421,8 @@ SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
 			}
 			SETCAR(a, CAR(b));
 			if (CAR(b) != R_MissingArg) SET_MISSING(a, 0);
+			if (key >= 0) target[i - 1] = arg_i;
+			partial = TRUE;
 			SET_ARGUSED(b, 1);
 			fargused[arg_i] = 1;
 		    }
@@ -305,6 +444,8 @@ SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
     f = formals;
     a = actuals;
     b = supplied;
+    i = 1;
+    arg_i = 0;
     seendots = FALSE;
 
     while (f != R_NilValue && b != R_NilValue && !seendots) {
@@ -313,11 +454,13 @@ SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    seendots = TRUE;
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (CAR(a) != R_MissingArg) {
 	    /* Already matched by tag */
 	    /* skip to next formal */
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (ARGUSED(b) || TAG(b) != R_NilValue) {
 	    /* This value used or tagged , skip to next value */
 	    /* The second test above is needed because we */
@@ -325,14 +468,18 @@ SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    /* matches. */
 	    /* The formal being considered remains the same */
 	    b = CDR(b);
+	    i++;
 	} else {
 	    /* We have a positional match */
 	    SETCAR(a, CAR(b));
 	    if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
+	    if (key >= 0) target[i - 1] = arg_i;
 	    SET_ARGUSED(b, 1);
 	    b = CDR(b);
+	    i++;
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	}
     }
 
@@ -346,10 +493,11 @@ SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    a = allocList(i);
 	    SET_TYPEOF(a, DOTSXP);
 	    f = a;
-	    for(b = supplied; b != R_NilValue; b = CDR(b))
+	    for(b = supplied, i = 1; b != R_NilValue; b = CDR(b), i++)
 		if(!ARGUSED(b)) {
 		    SETCAR(f, CAR(b));
 		    SET_TAG(f, TAG(b));
+		    if (key >= 0) target[i - 1] = -1;
 		    f = CDR(f);
 		}
 	    SETCAR(dots, a);
@@ -394,6 +542,13 @@ SEXP matchArgs(SEXP formals, SEXP supplied, SEXP call)
 		      strchr(CHAR(asChar(deparse1line(unusedForError, 0))), '('));
 	}
     }
+    if (key >= 0) {
+	int nformals = 0, dotsformal = -1;
+	for (a = actuals; a != R_NilValue; a = CDR(a), nformals++)
+	    if (a == dots) dotsformal = nformals;
+	saveMatchPlan(key, formals, supplied, nsupplied, nformals,
+		      dotsformal, partial, target);
+    }
     UNPROTECT(1);
     return(actuals);
 }
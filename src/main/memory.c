@@ -91,6 +91,20 @@
 #include <Rmath.h> // R_pow_di
 #include <Print.h> // R_print
 
+#ifdef _OPENMP
+# include <omp.h> /* for the locks of the parallel mark stacks */
+#endif
+
+#if defined(HAVE_MMAP) && defined(HAVE_MUNMAP)
+# define USE_LARGE_MMAP
+# include <sys/mman.h>
+# include <unistd.h> /* for sysconf */
+# include <stdint.h> /* for uintptr_t */
+# if ! defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
+
 #if defined(Win32)
 extern void *Rm_malloc(size_t n);
 extern void *Rm_calloc(size_t n_elements, size_t element_size);
@@ -110,6 +124,7 @@ extern void *Rm_realloc(void * p, size_t n);
 
 static int gc_reporting = 0;
 static int gc_count = 0;
+static double gc_last_pause = 0, gc_max_pause = 0; /* elapsed seconds */
 
 /* These are used in profiling to separate out time in GC */
 int R_gc_running() { return R_in_gc; }
@@ -499,6 +514,20 @@ static int num_old_gens_to_collect = 0;
 static int gen_gc_counts[NUM_OLD_GENERATIONS + 1];
 static int collect_counts[NUM_OLD_GENERATIONS];
 
+/* Collection Log.  The last GC_LOG_SIZE collections are recorded in a
+   ring buffer for gc.history().  RunGenCollect fills in the entry at
+   gc_log_next and R_gc_internal completes it and moves on. */
+#define GC_LOG_SIZE 256
+typedef struct {
+    double start, pause;		/* seconds */
+    int level;				/* generations collected */
+    Rboolean incremental;		/* part of an incremental cycle */
+    R_size_t ncells, vcells;		/* freed */
+    R_size_t promoted[NUM_NODE_CLASSES]; /* out of the new space */
+} gc_log_entry_t;
+static gc_log_entry_t gc_log[GC_LOG_SIZE];
+static int gc_log_next = 0, gc_log_count = 0;
+
 
 /* Node Pages.  Non-vector nodes and small vector nodes are allocated
    from fixed size pages.  The pages for each node class are kept in a
@@ -722,6 +751,8 @@ uint32_t traceableSEXPs(SEXP s) {
     SET_NEXT_NODE(fn__n__, forwarded_nodes); \
     forwarded_nodes = fn__n__; \
   } \
+  else if (gc_inc_shading && fn__n__) \
+    GC_INC_SHADE(fn__n__); \
 } while (0)
 
 #define FORWARD_NODE_MAYBE_STUB(s) do { \
@@ -1021,35 +1052,32 @@ static void TryToReleasePages(void)
     else release_count--;
 }
 
-/* compute size in VEC units so result will fit in LENGTH field for FREESXPs */
-static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
+/* size in VEC units of a vector of length n and the type of s */
+static R_INLINE R_size_t vecSizeInVEC(SEXP s, R_xlen_t n)
 {
-    if (IS_GROWABLE(s))
-	SET_STDVEC_LENGTH(s, XTRUELENGTH(s));
-
     R_size_t size;
     switch (TYPEOF(s)) {	/* get size in bytes */
     case CHARSXP:
-	size = XLENGTH(s) + 1;
+	size = CHAR_HASH_OFFSET(n) + sizeof(unsigned int);
 	break;
     case RAWSXP:
     case EXTERNALSXP:
-	size = XLENGTH(s);
+	size = n;
 	break;
     case LGLSXP:
     case INTSXP:
-	size = XLENGTH(s) * sizeof(int);
+	size = n * sizeof(int);
 	break;
     case REALSXP:
-	size = XLENGTH(s) * sizeof(double);
+	size = n * sizeof(double);
 	break;
     case CPLXSXP:
-	size = XLENGTH(s) * sizeof(Rcomplex);
+	size = n * sizeof(Rcomplex);
 	break;
     case STRSXP:
     case EXPRSXP:
     case VECSXP:
-	size = XLENGTH(s) * sizeof(SEXP);
+	size = n * sizeof(SEXP);
 	break;
     default:
 	register_bad_sexp_type(s, __LINE__);
@@ -1058,6 +1086,178 @@ static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
     return BYTE2VEC(size);
 }
 
+/* compute size in VEC units so result will fit in LENGTH field for FREESXPs */
+static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
+{
+    if (IS_GROWABLE(s))
+	SET_STDVEC_LENGTH(s, XTRUELENGTH(s));
+
+    return vecSizeInVEC(s, XLENGTH(s));
+}
+
+/* Large Vector Allocation.
+
+   Large vectors of at least R_LargeMapThreshold bytes get their own
+   anonymous mappings, so their memory goes back to the system when
+   they are released; malloc keeps freed blocks below its (growing)
+   mmap threshold on its heap.  The length of a mapping only depends
+   on the size of the vector and need not be recorded.  Released
+   mappings are kept in a small pool after their pages are handed
+   back with madvise; a vector of the same mapping length reuses
+   them without system calls and, with huge pages, keeps their
+   alignment.  The pool is unmapped after full collections and at the
+   end of incremental cycles. */
+
+static R_size_t R_LargeMappedSize = 0;	/* bytes mapped for live vectors */
+static R_size_t R_LargeMappedBytes = 0;	/* bytes of those vectors */
+static R_size_t R_LargePoolSize = 0;	/* bytes mapped in the pool */
+
+#ifdef USE_LARGE_MMAP
+#define LARGE_POOL_SIZE 16
+#define HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+static size_t R_LargeMapThreshold = 1024 * 1024; /* 0 turns mapping off */
+static size_t R_SysPageSize = 4096;
+static Rboolean R_LargeHugePages = FALSE;
+static int R_LargeMadvise = MADV_DONTNEED;	/* -1 unmaps right away */
+
+static struct {
+    void *mem;
+    size_t len;
+} R_LargePool[LARGE_POOL_SIZE];
+static int R_LargePoolCount = 0;
+
+#define LARGE_VEC_MAPPED(bytes) \
+    (R_LargeMapThreshold > 0 && (bytes) >= R_LargeMapThreshold)
+
+static void init_large_alloc(void)
+{
+    char *arg;
+    int ierr;
+    long psize = sysconf(_SC_PAGESIZE);
+
+    if (psize > 0)
+	R_SysPageSize = psize;
+    if ((arg = getenv("R_GC_MMAP_THRESHOLD")) != NULL) {
+	R_size_t threshold = R_Decode2Long(arg, &ierr);
+	if (ierr == 0)
+	    R_LargeMapThreshold = threshold;
+    }
+    if ((arg = getenv("R_GC_HUGEPAGES")) != NULL)
+	R_LargeHugePages = StringTrue(arg);
+    if ((arg = getenv("R_GC_MADVISE")) != NULL) {
+	if (strcmp(arg, "none") == 0)
+	    R_LargeMadvise = -1;
+#ifdef MADV_FREE
+	else if (strcmp(arg, "free") == 0)
+	    R_LargeMadvise = MADV_FREE;
+#endif
+    }
+}
+
+static size_t large_map_length(size_t bytes)
+{
+    size_t unit = R_LargeHugePages && bytes >= HUGE_PAGE_SIZE ?
+	HUGE_PAGE_SIZE : R_SysPageSize;
+    return (bytes + unit - 1) / unit * unit;
+}
+
+static void *large_map_alloc(size_t bytes)
+{
+    size_t len = large_map_length(bytes);
+    char *mem;
+
+    for (int i = 0; i < R_LargePoolCount; i++)
+	if (R_LargePool[i].len == len) {
+	    mem = R_LargePool[i].mem;
+	    R_LargePool[i] = R_LargePool[--R_LargePoolCount];
+	    R_LargePoolSize -= len;
+	    goto found;
+	}
+
+    if (len >= HUGE_PAGE_SIZE && R_LargeHugePages) {
+	/* map an extra huge page and trim the ends to align */
+	size_t maplen = len + HUGE_PAGE_SIZE;
+	char *map = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+	    return NULL;
+	mem = (char *) (((uintptr_t) map + HUGE_PAGE_SIZE - 1) &
+			~(uintptr_t) (HUGE_PAGE_SIZE - 1));
+	if (mem > map)
+	    munmap(map, mem - map);
+	if (mem + len < map + maplen)
+	    munmap(mem + len, map + maplen - (mem + len));
+#ifdef MADV_HUGEPAGE
+	madvise(mem, len, MADV_HUGEPAGE);
+#endif
+    }
+    else {
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+	    return NULL;
+    }
+
+ found:
+    R_LargeMappedSize += len;
+    R_LargeMappedBytes += bytes;
+    return mem;
+}
+
+static void large_map_free(void *mem, size_t bytes)
+{
+    size_t len = large_map_length(bytes);
+
+    R_LargeMappedSize -= len;
+    R_LargeMappedBytes -= bytes;
+    if (R_LargeMadvise >= 0 && R_LargePoolCount < LARGE_POOL_SIZE &&
+	madvise(mem, len, R_LargeMadvise) == 0) {
+	R_LargePool[R_LargePoolCount].mem = mem;
+	R_LargePool[R_LargePoolCount].len = len;
+	R_LargePoolCount++;
+	R_LargePoolSize += len;
+    }
+    else munmap(mem, len);
+}
+
+static void ReleaseLargePool(void)
+{
+    while (R_LargePoolCount > 0) {
+	R_LargePoolCount--;
+	munmap(R_LargePool[R_LargePoolCount].mem,
+	       R_LargePool[R_LargePoolCount].len);
+    }
+    R_LargePoolSize = 0;
+}
+#else
+#define init_large_alloc()
+#define ReleaseLargePool()
+#endif
+
+/* size is in vector cells, as in R_LargeVallocSize */
+static void *large_vec_alloc(R_size_t size)
+{
+    size_t bytes = sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC);
+#ifdef USE_LARGE_MMAP
+    if (LARGE_VEC_MAPPED(bytes))
+	return large_map_alloc(bytes);
+#endif
+    return malloc(bytes);
+}
+
+static void large_vec_free(SEXP s, R_size_t size)
+{
+    size_t bytes = sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC);
+#ifdef USE_LARGE_MMAP
+    if (LARGE_VEC_MAPPED(bytes)) {
+	large_map_free(s, bytes);
+	return;
+    }
+#endif
+    free(s);
+}
+
 static void custom_node_free(void *ptr);
 
 static void ReleaseLargeFreeVectors()
@@ -1081,7 +1281,7 @@ static void ReleaseLargeFreeVectors()
 		R_GenHeap[node_class].AllocCount--;
 		if (node_class == LARGE_NODE_CLASS) {
 		    R_LargeVallocSize -= size;
-		    free(s);
+		    large_vec_free(s, size);
 		} else {
 		    custom_node_free(s);
 		}
@@ -1153,6 +1353,83 @@ static void AdjustHeapSize(R_size_t size_needed)
 }
 
 
+/* Incremental Collection of the Oldest Generation.  If the environment
+   variable R_GC_PAUSE_BUDGET is set to a positive number of
+   milliseconds at startup, collections that would collect all
+   generations are replaced by an incremental cycle over the oldest
+   generation, run in slices at the end of the collections triggered
+   by allocation.
+
+   A cycle has a marking and a sweeping phase.  The gcinc bit is the
+   color of a node in the oldest generation: black if it equals
+   gc_inc_black, white otherwise; the colors of younger nodes are
+   meaningless.  A cycle starts by flipping gc_inc_black, which makes
+   all oldest nodes white.  While marking, the collections shade any
+   white oldest node they reach from the roots and the younger
+   generations, and the write barrier shades a white oldest node
+   whenever it is stored in a node, so no black node can point to a
+   white one without it being on the grey stack.  Slices scan grey
+   nodes for white oldest children; references to younger nodes are
+   covered by the old-to-new lists.  Nodes promoted into the oldest
+   generation while marking are white unless the collection promoting
+   them marks the cycle final.  Once the grey stack is empty a level
+   NUM_OLD_GENERATIONS - 1 collection rescans the roots and younger
+   generations, drains the grey stack and treats white nodes as
+   unreachable for weak references and the CHARSXP cache.  The white
+   nodes left are then freed by a page-by-page sweep in later slices,
+   and page release is suspended until the sweep is done.
+
+   A full collection, requested explicitly or because memory is
+   exhausted, cancels a cycle and leaves all oldest nodes black. */
+
+#define GC_INC_GEN (NUM_OLD_GENERATIONS - 1)
+
+enum { GC_INC_IDLE, GC_INC_MARKING, GC_INC_SWEEPING };
+
+static double gc_inc_budget = 0; /* seconds; 0 for no incremental cycles */
+static int gc_inc_state = GC_INC_IDLE;
+static int gc_inc_black = 0;
+static int gc_inc_cycles = 0;
+static Rboolean gc_inc_shading = FALSE;	  /* shade white nodes reached */
+static Rboolean gc_inc_finishing = FALSE; /* in the final collection */
+static Rboolean gc_inc_failed = FALSE;	  /* grey stack overflow */
+static SEXP *gc_inc_grey = NULL;
+static R_size_t gc_inc_grey_top = 0, gc_inc_grey_size = 0;
+
+#define GC_INC_IS_WHITE(s) \
+    (NODE_IS_MARKED(s) && NODE_GENERATION(s) == GC_INC_GEN && \
+     (s)->sxpinfo.gcinc != gc_inc_black)
+#define GC_INC_SET_COLOR(s, c) ((s)->sxpinfo.gcinc = (c))
+
+/* marked nodes are live, except white ones in the final collection */
+#define NODE_IS_LIVE(s) \
+    (NODE_IS_MARKED(s) && ! (gc_inc_finishing && GC_INC_IS_WHITE(s)))
+
+static void gc_inc_shade(SEXP s)
+{
+    GC_INC_SET_COLOR(s, gc_inc_black);
+    if (gc_inc_grey_top == gc_inc_grey_size) {
+	R_size_t size = gc_inc_grey_size ? 2 * gc_inc_grey_size : 4096;
+	SEXP *grey = realloc(gc_inc_grey, size * sizeof(SEXP));
+	if (grey == NULL) {
+	    /* s is black but will not be scanned, so the cycle has to
+	       be abandoned */
+	    gc_inc_failed = TRUE;
+	    return;
+	}
+	gc_inc_grey = grey;
+	gc_inc_grey_size = size;
+    }
+    gc_inc_grey[gc_inc_grey_top++] = s;
+}
+
+#define GC_INC_SHADE(s) do { \
+  SEXP gs__n__ = (s); \
+  if (GC_INC_IS_WHITE(gs__n__)) \
+    gc_inc_shade(gs__n__); \
+} while (0)
+
+
 /* Managing Old-to-New References. */
 
 #define AGE_NODE(s,g) do { \
@@ -1210,8 +1487,22 @@ static void old_to_new(SEXP x, SEXP y)
 #define FIX_REFCNT(x, old, new) do {} while (0)
 #endif
 
+/* While an incremental cycle is marking, a white node stored in a
+   black node of the oldest generation is shaded.  Stores in younger
+   nodes need no shading, as the final collection of the cycle rescans
+   the younger generations; the extra test is only made on stores in
+   old nodes that do not create old-to-new references. */
+static void gc_inc_store(SEXP x, SEXP y)
+{
+    if (y && NODE_GENERATION(x) == GC_INC_GEN &&
+	x->sxpinfo.gcinc == gc_inc_black)
+	GC_INC_SHADE(y);
+}
+
 #define CHECK_OLD_TO_NEW(x,y) do { \
-  if (NODE_IS_OLDER(CHK(x), CHK(y))) old_to_new(x,y);  } while (0)
+  if (NODE_IS_MARKED(CHK(x))) { \
+    if (NODE_IS_OLDER(x, CHK(y))) old_to_new(x,y); \
+    else if (gc_inc_shading) gc_inc_store(x,y); } } while (0)
 
 
 /* Node Sorting.  SortNodes attempts to improve locality of reference
@@ -1350,7 +1641,7 @@ static void CheckFinalizers(void)
     SEXP s;
     R_finalizers_pending = FALSE;
     for (s = R_weak_refs; s != R_NilValue; s = WEAKREF_NEXT(s)) {
-	if (! NODE_IS_MARKED(WEAKREF_KEY(s)) && ! IS_READY_TO_FINALIZE(s))
+	if (! NODE_IS_LIVE(WEAKREF_KEY(s)) && ! IS_READY_TO_FINALIZE(s))
 	    SET_READY_TO_FINALIZE(s);
 	if (IS_READY_TO_FINALIZE(s))
 	    R_finalizers_pending = TRUE;
@@ -1578,14 +1869,446 @@ SEXP attribute_hidden do_regFinaliz(SEXP call, SEXP op, SEXP args, SEXP rho)
     } \
 } while (0)
 
+/* Parallel Marking.  If the environment variable R_GC_NUM_THREADS is
+   set to more than one thread at startup, the main processing loop of
+   a collection is run by a team of OpenMP threads.  The nodes
+   forwarded from the roots are spread over per-thread mark stacks.
+   Each thread marks children with an atomic update of the sxpinfo
+   word, works on a private buffer and spills the older half of it to
+   its shared stack when the buffer fills up or other threads are
+   idle; idle threads steal the older half of another thread's shared
+   stack.  Nodes marked in parallel are not unsnapped from the New
+   lists.  Since every unmarked node is on a New list, a pass over the
+   allocated part of the New lists, one node class per thread, then
+   moves the marked nodes to their generations.  If a shared stack
+   cannot be grown the nodes are left marked but untraced and the old
+   generations are rescanned serially.  Later processing of weak
+   references and the CHARSXP cache uses the serial loop. */
+
+static int R_gc_num_threads = 1;
+
+#if defined(_OPENMP) && ! defined(PROTECTCHECK)
+#define GC_MAX_THREADS 64
+#define GC_LOCAL_STACK_SIZE 512
+#define GC_MARK_STACK_KEEP 65536
+
+typedef struct {
+    SEXP *nodes;
+    R_size_t bottom, top, size;
+    omp_lock_t lock;
+} gc_mark_stack_t;
+
+static gc_mark_stack_t gc_mark_stacks[GC_MAX_THREADS];
+static uint64_t gc_mark_bit;	/* the mark bit within a sxpinfo word */
+static int gc_mark_idle, gc_mark_overflow;
+
+static void init_gc_mark_stacks(void)
+{
+    SEXPREC tmp;
+
+    memset(&tmp.sxpinfo, 0, sizeof(tmp.sxpinfo));
+    MARK_NODE(&tmp);
+    memcpy(&gc_mark_bit, &tmp.sxpinfo, sizeof(gc_mark_bit));
+    for (int i = 0; i < R_gc_num_threads; i++) {
+	gc_mark_stacks[i].nodes = NULL;
+	gc_mark_stacks[i].bottom = gc_mark_stacks[i].top = 0;
+	gc_mark_stacks[i].size = 0;
+	omp_init_lock(&gc_mark_stacks[i].lock);
+    }
+}
+
+/* mark s unless it is marked already; TRUE if this thread marked it */
+static R_INLINE Rboolean gc_try_mark(SEXP s)
+{
+    uint64_t *w = (uint64_t *) &s->sxpinfo, old;
+
+    if (NODE_IS_MARKED(s))
+	return FALSE;
+#pragma omp atomic capture
+    { old = *w; *w |= gc_mark_bit; }
+    return (old & gc_mark_bit) == 0;
+}
+
+static R_INLINE R_size_t gc_stack_count(gc_mark_stack_t *st)
+{
+    R_size_t bottom, top;
+#pragma omp atomic read
+    bottom = st->bottom;
+#pragma omp atomic read
+    top = st->top;
+    return top > bottom ? top - bottom : 0;
+}
+
+static Rboolean gc_push_nodes(gc_mark_stack_t *st, SEXP *nodes, int n)
+{
+    Rboolean ok = TRUE;
+
+    omp_set_lock(&st->lock);
+    if (st->top + n > st->size && st->bottom > 0) {
+	memmove(st->nodes, st->nodes + st->bottom,
+		(st->top - st->bottom) * sizeof(SEXP));
+	st->top -= st->bottom;
+	st->bottom = 0;
+    }
+    if (st->top + n > st->size) {
+	R_size_t size = st->size ? 2 * st->size : 4096;
+	SEXP *new_nodes;
+	while (size < st->top + n) size *= 2;
+	new_nodes = realloc(st->nodes, size * sizeof(SEXP));
+	if (new_nodes == NULL)
+	    ok = FALSE;
+	else {
+	    st->nodes = new_nodes;
+	    st->size = size;
+	}
+    }
+    if (ok) {
+	memcpy(st->nodes + st->top, nodes, n * sizeof(SEXP));
+	st->top += n;
+    }
+    omp_unset_lock(&st->lock);
+    return ok;
+}
+
+/* take nodes from the top of the owner's stack, or from the bottom
+   if stealing */
+static int gc_take_nodes(gc_mark_stack_t *st, SEXP *nodes, Rboolean steal)
+{
+    R_size_t avail;
+    int n;
+
+    omp_set_lock(&st->lock);
+    avail = st->top - st->bottom;
+    if (steal) avail = (avail + 1) / 2;
+    n = avail < GC_LOCAL_STACK_SIZE / 2 ? (int) avail : GC_LOCAL_STACK_SIZE / 2;
+    if (steal) {
+	memcpy(nodes, st->nodes + st->bottom, n * sizeof(SEXP));
+	st->bottom += n;
+    }
+    else {
+	st->top -= n;
+	memcpy(nodes, st->nodes + st->top, n * sizeof(SEXP));
+    }
+    if (st->bottom == st->top)
+	st->bottom = st->top = 0;
+    omp_unset_lock(&st->lock);
+    return n;
+}
+
+/* move the older half of the private buffer to the shared stack */
+static int gc_spill_nodes(gc_mark_stack_t *st, SEXP *local, int n)
+{
+    int k = n / 2;
+
+    if (! gc_push_nodes(st, local, k)) {
+#pragma omp atomic write
+	gc_mark_overflow = 1;
+    }
+    memmove(local, local + k, (n - k) * sizeof(SEXP));
+    return n - k;
+}
+
+/* Called with the private buffer empty.  Returns the number of nodes
+   stolen, or zero once all threads of the team are idle.  No thread
+   pushes on a stack other than its own, and a thread only goes idle
+   after finding its own stack empty, so all stacks are empty then. */
+static int gc_steal_nodes(int id, int nthreads, SEXP *local)
+{
+    int n, idle;
+
+#pragma omp atomic update
+    gc_mark_idle++;
+    for (;;) {
+	for (int k = 1; k < R_gc_num_threads; k++) {
+	    gc_mark_stack_t *st = gc_mark_stacks + (id + k) % R_gc_num_threads;
+	    if (gc_stack_count(st) > 0) {
+#pragma omp atomic update
+		gc_mark_idle--;
+		if ((n = gc_take_nodes(st, local, TRUE)) > 0)
+		    return n;
+#pragma omp atomic update
+		gc_mark_idle++;
+	    }
+	}
+#pragma omp atomic read
+	idle = gc_mark_idle;
+	if (idle == nthreads)
+	    return 0;
+    }
+}
+
+#define GC_MARK_CHILD(__c__, __dummy__) do { \
+  SEXP gm__c__ = (__c__); \
+  if (gm__c__ && gc_try_mark(gm__c__)) { \
+    if (n == GC_LOCAL_STACK_SIZE) \
+      n = gc_spill_nodes(own, local, n); \
+    local[n++] = gm__c__; \
+  } \
+} while (0)
+
+static void gc_mark_worker(int id, int nthreads)
+{
+    gc_mark_stack_t *own = gc_mark_stacks + id;
+    SEXP local[GC_LOCAL_STACK_SIZE], s;
+    int n = 0, idle;
+
+    for (;;) {
+	if (n == 0 &&
+	    (n = gc_take_nodes(own, local, FALSE)) == 0 &&
+	    (n = gc_steal_nodes(id, nthreads, local)) == 0)
+	    break;
+	s = local[--n];
+	DO_CHILDREN(s, GC_MARK_CHILD, 0);
+	if (n > 1) {
+#pragma omp atomic read
+	    idle = gc_mark_idle;
+	    if (idle > 0 && gc_stack_count(own) == 0)
+		n = gc_spill_nodes(own, local, n);
+	}
+    }
+}
+
+static void ParallelProcessNodes(SEXP forwarded_nodes)
+{
+    int i, gen, k = 0, nthreads = R_gc_num_threads;
+    SEXP s;
+
+    gc_mark_idle = 0;
+    gc_mark_overflow = 0;
+
+    /* nodes forwarded serially are already unsnapped */
+    while (forwarded_nodes != NULL) {
+	s = forwarded_nodes;
+	forwarded_nodes = NEXT_NODE(forwarded_nodes);
+	SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].Old[NODE_GENERATION(s)]);
+	R_GenHeap[NODE_CLASS(s)].OldCount[NODE_GENERATION(s)]++;
+	if (! gc_push_nodes(gc_mark_stacks + k, &s, 1))
+	    gc_mark_overflow = 1;
+	k = (k + 1) % nthreads;
+    }
+
+#pragma omp parallel num_threads(nthreads)
+    gc_mark_worker(omp_get_thread_num(), omp_get_num_threads());
+
+#pragma omp parallel for num_threads(nthreads) private(s) schedule(dynamic, 1)
+    for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	/* small nodes past Free are free; large and custom nodes are
+	   always added at the end of the list */
+	SEXP peg = R_GenHeap[i].New, next;
+	SEXP last = i < NUM_SMALL_NODE_CLASSES ? R_GenHeap[i].Free : peg;
+	for (s = NEXT_NODE(peg); s != last && s != peg; s = next) {
+	    next = NEXT_NODE(s);
+	    if (NODE_IS_MARKED(s)) {
+		int g = NODE_GENERATION(s);
+		UNSNAP_NODE(s);
+		SNAP_NODE(s, R_GenHeap[i].Old[g]);
+		R_GenHeap[i].OldCount[g]++;
+	    }
+	}
+    }
+
+    for (i = 0; i < nthreads; i++)
+	if (gc_mark_stacks[i].size > GC_MARK_STACK_KEEP) {
+	    free(gc_mark_stacks[i].nodes);
+	    gc_mark_stacks[i].nodes = NULL;
+	    gc_mark_stacks[i].size = 0;
+	}
+
+    if (gc_mark_overflow) {
+	forwarded_nodes = NULL;
+	for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	    for (i = 0; i < NUM_NODE_CLASSES; i++)
+		for (s = NEXT_NODE(R_GenHeap[i].Old[gen]);
+		     s != R_GenHeap[i].Old[gen];
+		     s = NEXT_NODE(s))
+		    FORWARD_CHILDREN(s);
+	PROCESS_NODES();
+    }
+}
+#endif
+
+static void init_gc_mark_threads(void)
+{
+    char *arg = getenv("R_GC_NUM_THREADS");
+    if (arg != NULL) {
+#if defined(_OPENMP) && ! defined(PROTECTCHECK)
+	int nthreads = atoi(arg);
+	if (nthreads > GC_MAX_THREADS)
+	    nthreads = GC_MAX_THREADS;
+	if (nthreads > 1) {
+	    R_gc_num_threads = nthreads;
+	    init_gc_mark_stacks();
+	}
+#endif
+    }
+}
+
+static void init_gc_incremental(void)
+{
+#if NUM_OLD_GENERATIONS > 1 && ! defined(EXPEL_OLD_TO_NEW) && \
+    ! defined(PROTECTCHECK)
+    char *arg = getenv("R_GC_PAUSE_BUDGET");
+    if (arg != NULL) {
+	double budget = atof(arg);
+	if (budget > 0)
+	    gc_inc_budget = budget / 1000;
+    }
+#endif
+}
+
+/* Incremental Cycle Slices. */
+
+static Rboolean gc_inc_full_request = FALSE;
+static double gc_pause_start, gc_inc_deadline;
+static int gc_inc_sweep_class;
+static PAGE_HEADER *gc_inc_sweep_page;
+
+#define GC_INC_SHADE_CHILD(__c__,__dummy__) do { \
+  SEXP gc__c__ = (__c__); \
+  if (gc__c__) \
+    GC_INC_SHADE(gc__c__); \
+} while (0)
+
+/* Slices end when the pause budget of the collection is used up, but
+   get at least a quarter of the budget so that cycles finish even if
+   the collections of the younger generations take longer. */
+static void gc_inc_start_slice(void)
+{
+    double now = currentTime();
+    gc_inc_deadline = gc_pause_start + gc_inc_budget;
+    if (gc_inc_deadline < now + gc_inc_budget / 4)
+	gc_inc_deadline = now + gc_inc_budget / 4;
+}
+
+/* scan grey nodes until the grey stack is empty or, unless all is
+   TRUE, the slice is over */
+static void gc_inc_mark(Rboolean all)
+{
+    R_size_t n = 0;
+
+    while (gc_inc_grey_top > 0) {
+	SEXP s = gc_inc_grey[--gc_inc_grey_top];
+	DO_CHILDREN(s, GC_INC_SHADE_CHILD, 0);
+	if (! all && ++n % 1024 == 0 && currentTime() > gc_inc_deadline)
+	    break;
+    }
+}
+
+/* drain the grey stack in the final collection; if a node could not be
+   shaded white nodes cannot be treated as unreachable */
+static void gc_inc_finish_mark(void)
+{
+    gc_inc_mark(TRUE);
+    if (gc_inc_failed) {
+	gc_inc_finishing = FALSE;
+	gc_inc_shading = FALSE;
+    }
+}
+
+static void gc_inc_free_node(SEXP s)
+{
+    int i = NODE_CLASS(s);
+    UNSNAP_NODE(s);
+    UNMARK_NODE(s);
+    SNAP_NODE(s, R_GenHeap[i].New);
+    R_GenHeap[i].OldCount[GC_INC_GEN]--;
+}
+
+static void gc_inc_free_list(SEXP peg)
+{
+    SEXP s, next;
+    for (s = NEXT_NODE(peg); s != peg; s = next) {
+	next = NEXT_NODE(s);
+	if (GC_INC_IS_WHITE(s))
+	    gc_inc_free_node(s);
+    }
+}
+
+/* free white nodes page by page until the slice is over; large
+   and custom nodes are not allocated from pages and are freed once
+   all pages are done */
+static void gc_inc_sweep(void)
+{
+    int i, n = 0;
+
+    while (gc_inc_sweep_class < NUM_SMALL_NODE_CLASSES) {
+	PAGE_HEADER *page = gc_inc_sweep_page;
+	if (page == NULL) {
+	    if (++gc_inc_sweep_class < NUM_SMALL_NODE_CLASSES)
+		gc_inc_sweep_page = R_GenHeap[gc_inc_sweep_class].pages;
+	    continue;
+	}
+	int node_size = NODE_SIZE(gc_inc_sweep_class);
+	int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+	char *data = PAGE_DATA(page);
+	for (int j = 0; j < page_count; j++, data += node_size) {
+	    SEXP s = (SEXP) data;
+	    if (GC_INC_IS_WHITE(s))
+		gc_inc_free_node(s);
+	}
+	gc_inc_sweep_page = page->next;
+	if (++n % 64 == 0 && currentTime() > gc_inc_deadline)
+	    return;
+    }
+    for (i = CUSTOM_NODE_CLASS; i <= LARGE_NODE_CLASS; i++)
+	gc_inc_free_list(R_GenHeap[i].Old[GC_INC_GEN]);
+    gc_inc_state = GC_INC_IDLE;
+    gc_inc_cycles++;
+}
+
+/* Nodes of the oldest generation stay on its old-to-new list until a
+   full collection, which in incremental mode is rare.  When a cycle is
+   done, nodes on the list that no longer refer to younger nodes are
+   moved back to the Old list, so that younger collections stop
+   scanning them. */
+#define GC_INC_CHECK_YOUNGER(__c__,__younger__) do { \
+  SEXP gy__c__ = (__c__); \
+  if (gy__c__ && NODE_GEN_IS_YOUNGER(gy__c__, GC_INC_GEN)) \
+    *(__younger__) = TRUE; \
+} while (0)
+
+static void gc_inc_drain_old_to_new(void)
+{
+#ifndef EXPEL_OLD_TO_NEW
+    for (int i = 0; i < NUM_NODE_CLASSES; i++) {
+	SEXP peg = R_GenHeap[i].OldToNew[GC_INC_GEN];
+	SEXP s = NEXT_NODE(peg);
+	while (s != peg) {
+	    SEXP next = NEXT_NODE(s);
+	    Rboolean younger = FALSE;
+	    DO_CHILDREN(s, GC_INC_CHECK_YOUNGER, &younger);
+	    if (! younger) {
+		UNSNAP_NODE(s);
+		SNAP_NODE(s, R_GenHeap[i].Old[GC_INC_GEN]);
+	    }
+	    s = next;
+	}
+    }
+#endif
+}
+
+static void gc_inc_cancel(void)
+{
+    gc_inc_state = GC_INC_IDLE;
+    gc_inc_shading = FALSE;
+    gc_inc_finishing = FALSE;
+    gc_inc_grey_top = 0;
+}
+
 static void RunGenCollect(R_size_t size_needed)
 {
-    int i, gen, gens_collected;
+    int i, gen, gens_collected, promoted_color;
     RCNTXT *ctxt;
     SEXP s;
     SEXP forwarded_nodes;
+    Rboolean inc_started = FALSE, inc_done = FALSE, shading;
+    gc_log_entry_t *log_entry = gc_log + gc_log_next;
+    R_size_t young[NUM_NODE_CLASSES];
 
     bad_sexp_type_seen = 0;
+    log_entry->incremental = gc_inc_state != GC_INC_IDLE;
+    for (i = 0; i < NUM_NODE_CLASSES; i++)
+	log_entry->promoted[i] = 0;
 
     /* determine number of generations to collect */
     while (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
@@ -1601,9 +2324,47 @@ static void RunGenCollect(R_size_t size_needed)
     num_old_gens_to_collect = NUM_OLD_GENERATIONS;
 #endif
 
+    /* in incremental mode collections of all generations are only done
+       on request, when memory is exhausted or when a cycle failed */
+    if (gc_inc_failed)
+	num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    else if (gc_inc_budget > 0 &&
+	     num_old_gens_to_collect == NUM_OLD_GENERATIONS &&
+	     ! gc_inc_full_request) {
+	num_old_gens_to_collect = GC_INC_GEN;
+	if (gc_inc_state == GC_INC_IDLE) {
+	    gc_inc_black = ! gc_inc_black;
+	    gc_inc_state = GC_INC_MARKING;
+	    gc_inc_shading = TRUE;
+	    inc_started = TRUE;
+	}
+    }
+
  again:
     gens_collected = num_old_gens_to_collect;
 
+    if (gens_collected == NUM_OLD_GENERATIONS) {
+	gc_inc_cancel();
+	gc_inc_failed = FALSE;
+    }
+    else if (gc_inc_state == GC_INC_MARKING && gc_inc_grey_top == 0 &&
+	     ! inc_started) {
+	/* the final collection of the cycle has to rescan all younger
+	   generations */
+	if (gens_collected < GC_INC_GEN)
+	    num_old_gens_to_collect = gens_collected = GC_INC_GEN;
+	gc_inc_finishing = TRUE;
+    }
+    promoted_color = gc_inc_state == GC_INC_MARKING && ! gc_inc_finishing ?
+	! gc_inc_black : gc_inc_black;
+
+    /* new nodes are promoted when they are aged into the generation
+       of an old node referring to them, and when they survive into
+       the youngest generation */
+    for (i = 0; i < NUM_NODE_CLASSES; i++)
+	for (young[i] = 0, gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	    young[i] += R_GenHeap[i].OldCount[gen];
+
 #ifndef EXPEL_OLD_TO_NEW
     /* eliminate old-to-new references in generations to collect by
        transferring referenced nodes to referring generation */
@@ -1623,6 +2384,13 @@ static void RunGenCollect(R_size_t size_needed)
     }
 #endif
 
+    for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	    log_entry->promoted[i] += R_GenHeap[i].OldCount[gen];
+	log_entry->promoted[i] -= young[i];
+	young[i] = gens_collected == 0 ? R_GenHeap[i].OldCount[0] : 0;
+    }
+
     DEBUG_CHECK_NODE_COUNTS("at start");
 
     /* unmark all marked nodes in old generations to be collected and
@@ -1635,6 +2403,8 @@ static void RunGenCollect(R_size_t size_needed)
 		SEXP next = NEXT_NODE(s);
 		if (gen < NUM_OLD_GENERATIONS - 1)
 		    SET_NODE_GENERATION(s, gen + 1);
+		if (NODE_GENERATION(s) == GC_INC_GEN)
+		    GC_INC_SET_COLOR(s, promoted_color);
 		UNMARK_NODE(s);
 		s = next;
 	    }
@@ -1744,26 +2514,42 @@ static void RunGenCollect(R_size_t size_needed)
     FORWARD_NODE(R_CachedScalarInteger);
 
     /* main processing loop */
+#if defined(_OPENMP) && ! defined(PROTECTCHECK)
+    if (R_gc_num_threads > 1 && ! gc_inc_shading) {
+	ParallelProcessNodes(forwarded_nodes);
+	forwarded_nodes = NULL;
+    }
+    else
+#endif
     PROCESS_NODES();
-
-    /* identify weakly reachable nodes */
+    if (gc_inc_finishing)
+	gc_inc_finish_mark();
+
+    /* identify weakly reachable nodes; until the final collection of a
+       cycle it is not known which white keys are reachable, so nodes
+       only reached from weak references are not shaded */
+    shading = gc_inc_shading;
+    if (! gc_inc_finishing)
+	gc_inc_shading = FALSE;
     {
 	Rboolean recheck_weak_refs;
 	do {
 	    recheck_weak_refs = FALSE;
 	    for (s = R_weak_refs; s != R_NilValue; s = WEAKREF_NEXT(s)) {
-		if (NODE_IS_MARKED(WEAKREF_KEY(s))) {
-		    if (! NODE_IS_MARKED(WEAKREF_VALUE(s))) {
+		if (NODE_IS_LIVE(WEAKREF_KEY(s))) {
+		    if (! NODE_IS_LIVE(WEAKREF_VALUE(s))) {
 			recheck_weak_refs = TRUE;
 			FORWARD_NODE(WEAKREF_VALUE(s));
 		    }
-		    if (! NODE_IS_MARKED(WEAKREF_FINALIZER(s))) {
+		    if (! NODE_IS_LIVE(WEAKREF_FINALIZER(s))) {
 			recheck_weak_refs = TRUE;
 			FORWARD_NODE(WEAKREF_FINALIZER(s));
 		    }
 		}
 	    }
 	    PROCESS_NODES();
+	    if (gc_inc_finishing)
+		gc_inc_finish_mark();
 	} while (recheck_weak_refs);
     }
 
@@ -1778,38 +2564,71 @@ static void RunGenCollect(R_size_t size_needed)
 	FORWARD_NODE(WEAKREF_FINALIZER(s));
     }
     PROCESS_NODES();
+    if (gc_inc_finishing)
+	gc_inc_finish_mark();
+    gc_inc_shading = shading;
 
     DEBUG_CHECK_NODE_COUNTS("after processing forwarded list");
 
-    /* process CHARSXP cache */
+    /* process CHARSXP cache; entries only reachable from the cache
+       are not shaded */
+    shading = gc_inc_shading;
+    gc_inc_shading = FALSE;
     if (R_StringHash != NULL) /* in case of GC during initialization */
     {
-	SEXP t;
-	int nc = 0;
-	for (i = 0; i < LENGTH(R_StringHash); i++) {
-	    s = VECTOR_ELT(R_StringHash, i);
-	    t = R_NilValue;
-	    while (s != R_NilValue) {
-		if (! NODE_IS_MARKED(CXHEAD(s))) { /* remove unused CHARSXP and cons cell */
-		    if (t == R_NilValue) /* head of list */
-			VECTOR_ELT(R_StringHash, i) = CXTAIL(s);
-		    else
-			CXTAIL(t) = CXTAIL(s);
+	/* a list of shards, each a hash table */
+	for (int k = 0; k < LENGTH(R_StringHash); k++) {
+	    SEXP t, table = VECTOR_ELT(R_StringHash, k);
+	    int nc = 0;
+	    for (i = 0; i < LENGTH(table); i++) {
+		s = VECTOR_ELT(table, i);
+		t = R_NilValue;
+		while (s != R_NilValue) {
+		    if (! NODE_IS_LIVE(CXHEAD(s))) { /* remove unused CHARSXP and cons cell */
+			if (t == R_NilValue) /* head of list */
+			    VECTOR_ELT(table, i) = CXTAIL(s);
+			else
+			    CXTAIL(t) = CXTAIL(s);
+			s = CXTAIL(s);
+			continue;
+		    }
+		    FORWARD_NODE(s);
+		    FORWARD_NODE(CXHEAD(s));
+		    t = s;
 		    s = CXTAIL(s);
-		    continue;
 		}
-		FORWARD_NODE(s);
-		FORWARD_NODE(CXHEAD(s));
-		t = s;
-		s = CXTAIL(s);
+		if(VECTOR_ELT(table, i) != R_NilValue) nc++;
 	    }
-	    if(VECTOR_ELT(R_StringHash, i) != R_NilValue) nc++;
+	    SET_TRUELENGTH(table, nc); /* SET_HASHPRI, really */
 	}
-	SET_TRUELENGTH(R_StringHash, nc); /* SET_HASHPRI, really */
     }
+    gc_inc_shading = shading;
     FORWARD_NODE(R_StringHash);
     PROCESS_NODES();
 
+    /* incremental cycle slice */
+    if (gc_inc_state != GC_INC_IDLE)
+	gc_inc_start_slice();
+    if (gc_inc_finishing)
+	gc_inc_finish_mark();
+    if (gc_inc_finishing) {
+	for (i = 0; i < NUM_NODE_CLASSES; i++)
+	    gc_inc_free_list(R_GenHeap[i].OldToNew[GC_INC_GEN]);
+	gc_inc_finishing = FALSE;
+	gc_inc_shading = FALSE;
+	gc_inc_state = GC_INC_SWEEPING;
+	gc_inc_sweep_class = 0;
+	gc_inc_sweep_page = R_GenHeap[0].pages;
+    }
+    else if (gc_inc_state == GC_INC_MARKING && ! gc_inc_failed)
+	gc_inc_mark(FALSE);
+    if (gc_inc_state == GC_INC_SWEEPING) {
+	gc_inc_sweep();
+	inc_done = gc_inc_state == GC_INC_IDLE;
+	if (inc_done)
+	    gc_inc_drain_old_to_new();
+    }
+
 #ifdef PROTECTCHECK
     for(i=0; i< NUM_SMALL_NODE_CLASSES;i++){
 	s = NEXT_NODE(R_GenHeap[i].New);
@@ -1884,27 +2703,48 @@ static void RunGenCollect(R_size_t size_needed)
 	    R_Collected -= R_GenHeap[i].OldCount[gen];
     }
     R_NodesInUse = R_NSize - R_Collected;
+    for (i = 0; i < NUM_NODE_CLASSES; i++)
+	log_entry->promoted[i] += R_GenHeap[i].OldCount[0] - young[i];
 
     if (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
 	if (R_Collected < R_MinFreeFrac * R_NSize ||
 	    VHEAP_FREE() < size_needed + R_MinFreeFrac * R_VSize) {
-	    num_old_gens_to_collect++;
-	    if (R_Collected <= 0 || VHEAP_FREE() < size_needed)
+	    if (R_Collected <= 0 || VHEAP_FREE() < size_needed) {
+		num_old_gens_to_collect++;
 		goto again;
+	    }
+	    else if (gc_inc_state != GC_INC_IDLE) {
+		/* nothing more can be freed until the cycle is done */
+		AdjustHeapSize(size_needed);
+		num_old_gens_to_collect = 0;
+	    }
+	    else num_old_gens_to_collect++;
 	}
 	else num_old_gens_to_collect = 0;
     }
     else num_old_gens_to_collect = 0;
 
     gen_gc_counts[gens_collected]++;
+    log_entry->level = gens_collected;
+    if (inc_started || gc_inc_state != GC_INC_IDLE)
+	log_entry->incremental = TRUE;
+
+    if (gc_inc_failed) {
+	/* a node could not be shaded; collect everything next time */
+	gc_inc_cancel();
+	num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    }
+    gc_inc_full_request = FALSE;
 
-    if (gens_collected == NUM_OLD_GENERATIONS) {
+    if (gens_collected == NUM_OLD_GENERATIONS || inc_done) {
 	/**** do some adjustment for intermediate collections? */
 	AdjustHeapSize(size_needed);
 	TryToReleasePages();
+	ReleaseLargePool();
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
-    else if (gens_collected > 0) {
+    else if (gens_collected > 0 && gc_inc_state != GC_INC_SWEEPING) {
+	/* the sweep keeps a pointer into the page lists */
 	TryToReleasePages();
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
@@ -1922,6 +2762,10 @@ static void RunGenCollect(R_size_t size_needed)
 	for (i = 0; i < NUM_OLD_GENERATIONS; i++)
 	    REprintf("+%d", gen_gc_counts[i + 1]);
 	REprintf(" (level %d) ... ", gens_collected);
+	if (gc_inc_state != GC_INC_IDLE || inc_done)
+	    REprintf("\nincremental cycle %d %s ... ", gc_inc_cycles + ! inc_done,
+		     inc_done ? "done" :
+		     gc_inc_state == GC_INC_MARKING ? "marking" : "sweeping");
 	DEBUG_GC_SUMMARY(gens_collected == NUM_OLD_GENERATIONS);
     }
 }
@@ -2029,6 +2873,39 @@ void attribute_hidden get_current_mem(size_t *smallvsize,
     return;
 }
 
+/* resident set size in bytes, NA where it cannot be found */
+static double ResidentSetSize(void)
+{
+    double rss = NA_REAL;
+#ifdef USE_LARGE_MMAP
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+	double size, resident;
+	if (fscanf(fp, "%lf %lf", &size, &resident) == 2)
+	    rss = resident * R_SysPageSize;
+	fclose(fp);
+    }
+#endif
+    return rss;
+}
+
+/* bytes of live nodes and vectors and of the memory holding them;
+   exact only after a collection, when the New lists are all free */
+static void HeapUsage(double *live, double *heap)
+{
+    double large = (double) R_LargeVallocSize * sizeof(VECREC) +
+	(double) R_GenHeap[LARGE_NODE_CLASS].AllocCount *
+	sizeof(SEXPREC_ALIGN);
+
+    *live = large;
+    *heap = large - R_LargeMappedBytes + R_LargeMappedSize;
+    for (int i = 0; i < NUM_SMALL_NODE_CLASSES; i++) {
+	for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	    *live += (double) R_GenHeap[i].OldCount[gen] * NODE_SIZE(i);
+	*heap += (double) R_GenHeap[i].PageCount * R_PAGE_SIZE;
+    }
+}
+
 SEXP attribute_hidden do_gc(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP value;
@@ -2064,6 +2941,7 @@ SEXP attribute_hidden do_gc(SEXP call, SEXP op, SEXP args, SEXP rho)
     if (reset_max){
 	    R_N_maxused = onsize - R_Collected;
 	    R_V_maxused = R_VSize - VHEAP_FREE();
+	    gc_max_pause = gc_last_pause;
     }
     REAL(value)[10] = R_N_maxused;
     REAL(value)[11] = R_V_maxused;
@@ -2073,6 +2951,34 @@ SEXP attribute_hidden do_gc(SEXP call, SEXP op, SEXP args, SEXP rho)
     return value;
 }
 
+/* live data against the resident set and the large vector mappings,
+   in Mb, and the fraction of the heap not in use.  Objects allocated
+   in the small vector and cons cell pages since the last collection
+   are not counted as live. */
+SEXP attribute_hidden do_memoryusage(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    double live, heap, rss = ResidentSetSize();
+    HeapUsage(&live, &heap);
+    SEXP value = allocVector(REALSXP, 5);
+    REAL(value)[0] = 0.1*ceil(10. * live/Mega);
+    REAL(value)[1] = ISNAN(rss) ? NA_REAL : 0.1*ceil(10. * rss/Mega);
+    REAL(value)[2] = 0.1*ceil(10. * R_LargeMappedSize/Mega);
+    REAL(value)[3] = 0.1*ceil(10. * R_LargePoolSize/Mega);
+    REAL(value)[4] = heap > 0 ? 1 - live/heap : 0;
+    return value;
+}
+
+/* pause of the last collection and the longest since gc(reset = TRUE) */
+SEXP attribute_hidden do_gcpause(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    SEXP value = allocVector(REALSXP, 2);
+    REAL(value)[0] = gc_last_pause;
+    REAL(value)[1] = gc_max_pause;
+    return value;
+}
+
 
 static void NORET mem_err_heap(R_size_t size)
 {
@@ -2103,6 +3009,9 @@ void attribute_hidden InitMemory()
 
     init_gctorture();
     init_gc_grow_settings();
+    init_gc_mark_threads();
+    init_gc_incremental();
+    init_large_alloc();
 
     gc_reporting = R_Verbose;
     R_StandardPPStackSize = R_PPStackSize;
@@ -2611,7 +3520,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	error("use of allocVector(CHARSXP ...) is defunct\n");
     case intCHARSXP:
 	type = CHARSXP;
-	size = BYTE2VEC(length + 1);
+	size = BYTE2VEC(CHAR_HASH_OFFSET(length) + sizeof(unsigned int));
 #if VALGRIND_LEVEL > 0
 	actual_size = length + 1;
 #endif
@@ -2742,7 +3651,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		   indexable by size_t. - TK */
 		mem = allocator ?
 		    custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-		    malloc(hdrsize + size * sizeof(VECREC));
+		    large_vec_alloc(size);
 		if (mem == NULL) {
 		    /* If we are near the address space limit, we
 		       might be short of address space.  So return
@@ -2750,7 +3659,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		    R_gc_no_finalizers(alloc_size);
 		    mem = allocator ?
 			custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-			malloc(hdrsize + size * sizeof(VECREC));
+			large_vec_alloc(size);
 		}
 		if (mem != NULL) {
 		    s = mem;
@@ -2920,6 +3829,7 @@ SEXP allocFormalsList6(SEXP sym1, SEXP sym2, SEXP sym3, SEXP sym4,
 void R_gc(void)
 {
     num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    gc_inc_full_request = TRUE;
     R_gc_internal(0);
 #ifndef IMMEDIATE_FINALIZERS
     R_RunPendingFinalizers();
@@ -2937,6 +3847,7 @@ void R_gc_lite(void)
 static void R_gc_no_finalizers(R_size_t size_needed)
 {
     num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    gc_inc_full_request = TRUE;
     R_gc_internal(size_needed);
 }
 
@@ -3025,11 +3936,28 @@ static void R_gc_internal(R_size_t size_needed)
     R_V_maxused = R_MAX(R_V_maxused, R_VSize - VHEAP_FREE());
 
     BEGIN_SUSPEND_INTERRUPTS {
+	double pause_start = currentTime();
+	R_size_t nused = R_NodesInUse;
+	R_size_t vused = R_SmallVallocSize + R_LargeVallocSize;
+	gc_pause_start = pause_start;
 	R_in_gc = TRUE;
 	gc_start_timing();
 	RunGenCollect(size_needed);
 	gc_end_timing();
 	R_in_gc = FALSE;
+	gc_last_pause = currentTime() - pause_start;
+	if (gc_last_pause > gc_max_pause)
+	    gc_max_pause = gc_last_pause;
+
+	gc_log_entry_t *log_entry = gc_log + gc_log_next;
+	log_entry->start = pause_start;
+	log_entry->pause = gc_last_pause;
+	R_size_t vnow = R_SmallVallocSize + R_LargeVallocSize;
+	log_entry->ncells = nused > R_NodesInUse ? nused - R_NodesInUse : 0;
+	log_entry->vcells = vused > vnow ? vused - vnow : 0;
+	gc_log_next = (gc_log_next + 1) % GC_LOG_SIZE;
+	if (gc_log_count < GC_LOG_SIZE)
+	    gc_log_count++;
     } END_SUSPEND_INTERRUPTS;
 
     if (bad_sexp_type_seen != 0 && first_bad_sexp_type == 0) {
@@ -3053,6 +3981,10 @@ static void R_gc_internal(R_size_t size_needed)
 	vcells = 0.1*ceil(10*vcells * vsfac/Mega);
 	REprintf("%.1f Mbytes of vectors used (%d%%)\n",
 		 vcells, (int) (vfrac + 0.5));
+	REprintf("%.1f ms pause", 1000 * gc_last_pause);
+	if (R_gc_num_threads > 1)
+	    REprintf(" (%d marking threads)", R_gc_num_threads);
+	REprintf("\n");
     }
 
 #ifdef IMMEDIATE_FINALIZERS
@@ -3148,6 +4080,132 @@ SEXP attribute_hidden do_memoryprofile(SEXP call, SEXP op, SEXP args, SEXP env)
     return ans;
 }
 
+/* labels of the node classes in gc.history() and memory.census():
+   small vector classes are named by the bytes of data they hold */
+static SEXP NodeClassLabel(const char *prefix, int i)
+{
+    char buf[32];
+    if (i == LARGE_NODE_CLASS)
+	snprintf(buf, sizeof(buf), "%slarge", prefix);
+    else if (i == CUSTOM_NODE_CLASS)
+	snprintf(buf, sizeof(buf), "%scustom", prefix);
+    else if (i == 0)
+	snprintf(buf, sizeof(buf), "%snodes", prefix);
+    else
+	snprintf(buf, sizeof(buf), "%sv%d", prefix,
+		 (int) (NodeClassSize[i] * sizeof(VECREC)));
+    return mkChar(buf);
+}
+
+SEXP attribute_hidden do_gchistory(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    SEXP ans, nms;
+    int i, j, n, first, reset;
+    const int ncols = 6 + NUM_NODE_CLASSES;
+
+    checkArity(op, args);
+    reset = asLogical(CAR(args));
+    n = gc_log_count;
+    PROTECT(ans = allocVector(VECSXP, ncols));
+    PROTECT(nms = allocVector(STRSXP, ncols));
+    SET_VECTOR_ELT(ans, 0, allocVector(REALSXP, n));
+    SET_VECTOR_ELT(ans, 1, allocVector(INTSXP, n));
+    SET_VECTOR_ELT(ans, 2, allocVector(LGLSXP, n));
+    for (j = 3; j < ncols; j++)
+	SET_VECTOR_ELT(ans, j, allocVector(REALSXP, n));
+    SET_STRING_ELT(nms, 0, mkChar("start"));
+    SET_STRING_ELT(nms, 1, mkChar("level"));
+    SET_STRING_ELT(nms, 2, mkChar("incremental"));
+    SET_STRING_ELT(nms, 3, mkChar("pause"));
+    SET_STRING_ELT(nms, 4, mkChar("ncells.freed"));
+    SET_STRING_ELT(nms, 5, mkChar("vcells.freed"));
+    for (j = 0; j < NUM_NODE_CLASSES; j++)
+	SET_STRING_ELT(nms, 6 + j, NodeClassLabel("promoted.", j));
+    setAttrib(ans, R_NamesSymbol, nms);
+
+    /* collections run by the allocations above push out the oldest
+       entries, so the last n are taken from the log as it is now */
+    first = (gc_log_next - n + GC_LOG_SIZE) % GC_LOG_SIZE;
+    for (i = 0; i < n; i++) {
+	gc_log_entry_t *e = gc_log + (first + i) % GC_LOG_SIZE;
+	REAL(VECTOR_ELT(ans, 0))[i] = e->start;
+	INTEGER(VECTOR_ELT(ans, 1))[i] = e->level;
+	LOGICAL(VECTOR_ELT(ans, 2))[i] = e->incremental;
+	REAL(VECTOR_ELT(ans, 3))[i] = e->pause;
+	REAL(VECTOR_ELT(ans, 4))[i] = e->ncells;
+	REAL(VECTOR_ELT(ans, 5))[i] = e->vcells;
+	for (j = 0; j < NUM_NODE_CLASSES; j++)
+	    REAL(VECTOR_ELT(ans, 6 + j))[i] = e->promoted[j];
+    }
+    if (reset == TRUE)
+	gc_log_count = 0;
+    UNPROTECT(2);
+    return ans;
+}
+
+/* number and size of the objects in use by type and node class */
+SEXP attribute_hidden do_memorycensus(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    SEXP ans, nms;
+    double count[MAX_NUM_SEXPTYPE][NUM_NODE_CLASSES];
+    double bytes[MAX_NUM_SEXPTYPE][NUM_NODE_CLASSES];
+    int i, t, n;
+
+    checkArity(op, args);
+    memset(count, 0, sizeof(count));
+    memset(bytes, 0, sizeof(bytes));
+
+    BEGIN_SUSPEND_INTERRUPTS {
+	/* run a full GC to make sure that all stuff in use is in Old space */
+	R_gc();
+	for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+	    for (i = 0; i < NUM_NODE_CLASSES; i++) {
+		SEXP s;
+		for (s = NEXT_NODE(R_GenHeap[i].Old[gen]);
+		     s != R_GenHeap[i].Old[gen];
+		     s = NEXT_NODE(s)) {
+		    t = TYPEOF(s);
+		    count[t][i]++;
+		    if (i < NUM_SMALL_NODE_CLASSES)
+			bytes[t][i] += NODE_SIZE(i);
+		    else
+			bytes[t][i] += sizeof(SEXPREC_ALIGN) + sizeof(VECREC) *
+			    vecSizeInVEC(s, IS_GROWABLE(s) ? XTRUELENGTH(s)
+					                   : XLENGTH(s));
+		}
+	    }
+	}
+    } END_SUSPEND_INTERRUPTS;
+
+    for (n = 0, t = 0; t < MAX_NUM_SEXPTYPE; t++)
+	for (i = 0; i < NUM_NODE_CLASSES; i++)
+	    if (count[t][i] > 0) n++;
+    PROTECT(ans = allocVector(VECSXP, 4));
+    SEXP type = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(ans, 0, type);
+    SEXP cls = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(ans, 1, cls);
+    SET_VECTOR_ELT(ans, 2, allocVector(REALSXP, n));
+    SET_VECTOR_ELT(ans, 3, allocVector(REALSXP, n));
+    for (n = 0, t = 0; t < MAX_NUM_SEXPTYPE; t++)
+	for (i = 0; i < NUM_NODE_CLASSES; i++)
+	    if (count[t][i] > 0) {
+		SET_STRING_ELT(type, n, mkChar(type2char(t)));
+		SET_STRING_ELT(cls, n, NodeClassLabel("", i));
+		REAL(VECTOR_ELT(ans, 2))[n] = count[t][i];
+		REAL(VECTOR_ELT(ans, 3))[n] = bytes[t][i];
+		n++;
+	    }
+    PROTECT(nms = allocVector(STRSXP, 4));
+    SET_STRING_ELT(nms, 0, mkChar("type"));
+    SET_STRING_ELT(nms, 1, mkChar("class"));
+    SET_STRING_ELT(nms, 2, mkChar("count"));
+    SET_STRING_ELT(nms, 3, mkChar("bytes"));
+    setAttrib(ans, R_NamesSymbol, nms);
+    UNPROTECT(2);
+    return ans;
+}
+
 /* "protect" push a single argument onto R_PPStack */
 
 /* In handling a stack overflow we have to be careful not to use
@@ -686,9 +686,13 @@ FUNTAB R_FunTab[] =
 {"prmatrix",	do_prmatrix,	0,	111,	6,	{PP_FUNCALL, PREC_FN,	0}},
 {"gc",		do_gc,		0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"gcinfo",	do_gcinfo,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"gc.history",	do_gchistory,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"gc.pause",	do_gcpause,	0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 {"gctorture",	do_gctorture,	0,	111,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"gctorture2",	do_gctorture2,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"memory.profile",do_memoryprofile, 0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
+{"memory.census",do_memorycensus, 0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
+{"memory.usage",do_memoryusage, 0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 {"split",	do_split,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"is.loaded",	do_isloaded,	0,	11,	-1,	{PP_FOREIGN, PREC_FN,	0}},
 {"recordGraphics", do_recordGraphics, 0, 211,     3,      {PP_FOREIGN, PREC_FN,	0}},
@@ -761,6 +765,17 @@ FUNTAB R_FunTab[] =
 {"mmap_file",	do_mmap_file,	0,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"munmap_file",	do_munmap_file,	0,	111,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"wrap_meta",	do_wrap_meta,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
+{"compress_vector",do_compress_vector,0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"string_buffer",do_string_buffer,0,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
+{"hash_index",	do_hash_index,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"hashMap",	do_hashmap,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"mapGet",	do_hashmap,	1,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
+{"mapSet",	do_hashmap,	2,	111,	3,	{PP_FUNCALL, PREC_FN,	0}},
+{"mapHas",	do_hashmap,	3,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"mapDelete",	do_hashmap,	4,	111,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"mapKeys",	do_hashmap,	5,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"mapValues",	do_hashmap,	6,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"mapLength",	do_hashmap,	7,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 
 /* Functions To Interact with the Operating System */
 
@@ -1182,6 +1197,7 @@ void attribute_hidden InitNames()
     /* NA_STRING */
     NA_STRING = allocCharsxp(strlen("NA"));
     strcpy(CHAR_RW(NA_STRING), "NA");
+    SET_CHAR_HASH(NA_STRING, R_CharHash("NA", 2));
     SET_CACHED(NA_STRING);  /* Mark it */
     R_print.na_string = NA_STRING;
     /* R_BlankString */
@@ -285,10 +285,12 @@ SEXP attribute_hidden do_relop_dflt(SEXP call, SEXP op, SEXP x, SEXP y)
 #define ISNA_INT(x) x == NA_INTEGER
 
 #define NR_HELPER(OP, type1, ACCESSOR1, ISNA1, type2, ACCESSOR2, ISNA2) do { \
-	type1 x1, *px1 = ACCESSOR1(s1);					\
-	type2 x2, *px2 = ACCESSOR2(s2);					\
+	type1 x1;							\
+	type2 x2;							\
 	int *pa = LOGICAL(ans);						\
-        MOD_ITERATE2(n, n1, n2, i, i1, i2, {                            \
+	MOD_ITERATE2_CHECK_BY_REGION(NINTERRUPT, n, n1, n2, i, i1, i2,	\
+				     s1, px1, type1, ACCESSOR1,		\
+				     s2, px2, type2, ACCESSOR2, {	\
 	    x1 = px1[i1];						\
 	    x2 = px2[i2];						\
             if (ISNA1(x1) || ISNA2(x2))                                 \
@@ -404,6 +406,32 @@ static SEXP complex_relop(RELOP_TYPE code, SEXP s1, SEXP s2, SEXP call)
 }
 
 
+/* == and != of a string buffer x and a single string y compare the
+   bytes, when equal strings must have the same bytes: y is ASCII or in
+   the encoding of the buffer. */
+static Rboolean string_buffer_eqop(RELOP_TYPE code, SEXP x, SEXP y, int *pa)
+{
+    R_strbuf_t sb;
+    if (XLENGTH(y) != 1 || !R_get_string_buffer(x, &sb))
+	return FALSE;
+    SEXP c = STRING_ELT(y, 0);
+    if (c != NA_STRING && !IS_ASCII(c) && getCharCE(c) != sb.enc)
+	return FALSE;
+
+    const char *cp = CHAR(c);
+    int clen = LENGTH(c), len;
+    for (R_xlen_t i = 0; i < sb.n; i++) {
+	const char *p = R_string_buffer_elt(&sb, i, &len);
+	if (p == NULL || c == NA_STRING)
+	    pa[i] = NA_LOGICAL;
+	else {
+	    int eq = len == clen && memcmp(p, cp, len) == 0;
+	    pa[i] = code == EQOP ? eq : !eq;
+	}
+    }
+    return TRUE;
+}
+
 /* POSIX allows EINVAL when one of the strings contains characters
    outside the collation domain. */
 static SEXP string_relop(RELOP_TYPE code, SEXP s1, SEXP s2)
@@ -420,6 +448,13 @@ static SEXP string_relop(RELOP_TYPE code, SEXP s1, SEXP s2)
     PROTECT(ans = allocVector(LGLSXP, n));
     int *pa = LOGICAL(ans);
 
+    if ((code == EQOP || code == NEOP) &&
+	(string_buffer_eqop(code, s1, s2, pa) ||
+	 string_buffer_eqop(code, s2, s1, pa))) {
+	UNPROTECT(3);
+	return ans;
+    }
+
     switch (code) {
     case EQOP:
 	MOD_ITERATE2(n, n1, n2, i, i1, i2, {
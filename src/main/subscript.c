@@ -666,6 +666,24 @@ integerSubscript(SEXP s, R_xlen_t ns, R_xlen_t nx, R_xlen_t *stretch, SEXP call)
     Rboolean isna = FALSE;
     canstretch = *stretch > 0;
     *stretch = 0;
+
+    /* sorted subscripts without NAs, such as compact sequences, only
+       need checking at their ends and are not expanded */
+    int sorted = ns > 0 ? INTEGER_IS_SORTED(s) : UNKNOWN_SORTEDNESS;
+    if (KNOWN_SORTED(sorted) && INTEGER_NO_NA(s)) {
+	int first = INTEGER_ELT(s, 0), last = INTEGER_ELT(s, ns - 1);
+	if (first > 0 && last > 0) {
+	    max = first > last ? first : last;
+	    if (max > nx) {
+		if(canstretch) *stretch = max;
+		else {
+		    ECALL(call, _("subscript out of bounds"));
+		}
+	    }
+	    return s;
+	}
+    }
+
     neg = FALSE;
     max = 0;
     const int *ps = INTEGER_RO(s);
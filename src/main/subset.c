@@ -40,6 +40,7 @@
 
 #include <Defn.h>
 #include <Internal.h>
+#include <R_ext/Itermacros.h>
 
 /* JMC convinced MM that this was not a good idea: */
 #undef _S4_subsettable
@@ -68,28 +69,32 @@ static R_INLINE SEXP VECTOR_ELT_FIX_NAMED(SEXP y, R_xlen_t i) {
 
 #define EXTRACT_SUBSET_LOOP(STDCODE, NACODE) do { \
 	if (TYPEOF(indx) == INTSXP) {		  \
-	    const int *pindx = INTEGER_RO(indx);  \
-	    for (i = 0; i < n; i++) {		  \
-		ii = pindx[i];			  \
-		if (0 < ii && ii <= nx) {	  \
-		    ii--;			  \
-		    STDCODE;			  \
-		}				  \
-		else /* out of bounds or NA */	  \
-		    NACODE;			  \
-	    }					  \
+	    ITERATE_BY_REGION(indx, pindx, idx, nb, int, INTEGER, { \
+		    for (R_xlen_t k = 0; k < nb; k++) { \
+			i = idx + k;		  \
+			ii = pindx[k];		  \
+			if (0 < ii && ii <= nx) { \
+			    ii--;		  \
+			    STDCODE;		  \
+			}			  \
+			else /* out of bounds or NA */ \
+			    NACODE;		  \
+		    }				  \
+		});				  \
 	}					  \
 	else {					  \
-	    const double *pindx = REAL_RO(indx);  \
-	    for (i = 0; i < n; i++) {		  \
-		double di = pindx[i];		  \
-		ii = (R_xlen_t) (di - 1);	  \
-		if (R_FINITE(di) &&		  \
-		    0 <= ii && ii < nx)		  \
-		    STDCODE;			  \
-		else				  \
-		    NACODE;			  \
-	    }					  \
+	    ITERATE_BY_REGION(indx, pindx, idx, nb, double, REAL, { \
+		    for (R_xlen_t k = 0; k < nb; k++) { \
+			double di = pindx[k];	  \
+			i = idx + k;		  \
+			ii = (R_xlen_t) (di - 1); \
+			if (R_FINITE(di) &&	  \
+			    0 <= ii && ii < nx)	  \
+			    STDCODE;		  \
+			else			  \
+			    NACODE;		  \
+		    }				  \
+		});				  \
 	}					  \
     } while (0)
     
@@ -106,6 +111,11 @@ SEXP attribute_hidden ExtractSubset(SEXP x, SEXP indx, SEXP call)
 	    return result;
     }
 
+    /* long contiguous or constant-stride subsets refer to x */
+    result = R_slice_view(x, indx);
+    if (result != NULL)
+	return result;
+
     R_xlen_t i, ii, n, nx;
     n = XLENGTH(indx);
     nx = xlength(x);
@@ -562,6 +562,8 @@ SEXP attribute_hidden do_summary(SEXP call, SEXP op, SEXP args, SEXP env)
 		toret = ALTINTEGER_SUM(vec, narm);
 	    else if (TYPEOF(vec) == REALSXP)
 		toret = ALTREAL_SUM(vec, narm);
+	    else if (TYPEOF(vec) == LGLSXP)
+		toret = ALTLOGICAL_SUM(vec, narm);
 	    break; 
 	case 2:
 	    if(TYPEOF(vec) == INTSXP) 
@@ -1097,13 +1099,14 @@ SEXP attribute_hidden do_which(SEXP call, SEXP op, SEXP args, SEXP rho)
     len = length(v);
     buf = (int *) R_alloc(len, sizeof(int));
 
-    int *pv = LOGICAL(v);
-    for (i = 0; i < len; i++) {
-	if (pv[i] == TRUE) {
-	    buf[j] = i + 1;
-	    j++;
-	}
-    }
+    ITERATE_BY_REGION(v, pv, idx, nb, int, LOGICAL, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		if (pv[k] == TRUE) {
+		    buf[j] = (int) (idx + k + 1);
+		    j++;
+		}
+	    }
+	});
 
     len = j;
     PROTECT(ans = allocVector(INTSXP, len));
@@ -27,6 +27,7 @@
 #define R_USE_SIGNALS 1
 #include <Defn.h>
 #include <Internal.h>
+#include <R_ext/Itermacros.h>
 
 #define NIL -1
 #define ARGUSED(x) LEVELS(x)
@@ -176,12 +177,17 @@ static R_INLINE hlen shash(SEXP x, R_xlen_t indx, HashData *d)
     unsigned int k;
     const char *p;
     if(!d->useUTF8 && d->useCache) return cshash(x, indx, d);
-    const void *vmax = vmaxget();
     /* Not having d->useCache really should not happen anymore. */
-    p = translateCharUTF8(STRING_ELT(x, indx));
-    k = 0;
-    while (*p++)
-	k = 11 * k + (unsigned int) *p; /* was 8 but 11 isn't a power of 2 */
+    SEXP s = STRING_ELT(x, indx);
+    /* cached strings which need no translation carry the hash of
+       their bytes; strings in "bytes" encoding only equal the same
+       bytes */
+    if (IS_CACHED(s) &&
+	(IS_ASCII(s) || IS_UTF8(s) || IS_BYTES(s) || s == NA_STRING))
+	return scatter(CHAR_HASH(s), d);
+    const void *vmax = vmaxget();
+    p = IS_BYTES(s) ? CHAR(s) : translateCharUTF8(s);
+    k = R_CharHash(p, (int) strlen(p));
     vmaxset(vmax); /* discard any memory used by translateChar */
     return scatter(k, d);
 }
@@ -200,11 +206,8 @@ static R_INLINE int iequal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
 }
 
 /* BDR 2002-1-17  We don't want NA and other NaNs to be equal */
-static R_INLINE int requal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
+static R_INLINE int dequal(double xi, double yj)
 {
-    if (i < 0 || j < 0) return 0;
-    double xi = REAL_ELT(x, i);
-    double yj = REAL_ELT(y, j);
     if (!ISNAN(xi) && !ISNAN(yj))
 	return (xi == yj);
     else if (R_IsNA(xi) && R_IsNA(yj)) return 1;
@@ -212,6 +215,12 @@ static R_INLINE int requal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
     else return 0;
 }
 
+static R_INLINE int requal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
+{
+    if (i < 0 || j < 0) return 0;
+    return dequal(REAL_ELT(x, i), REAL_ELT(y, j));
+}
+
 /* This is differentiating {NA,1}, {NA,0}, {NA, NaN}, {NA, NA},
  * but R's print() and format()  render all as "NA" */
 static int cplx_eq(Rcomplex x, Rcomplex y)
@@ -360,7 +369,7 @@ static void MKsetup(R_xlen_t n, HashData *d, R_xlen_t nmax)
 }
 
 #define IMAX 4294967296L
-static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
+static void HashFunSetup(SEXP x, HashData *d, R_xlen_t nmax)
 {
     d->useUTF8 = FALSE;
     d->useCache = TRUE;
@@ -413,6 +422,10 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
     default:
 	UNIMPLEMENTED_TYPE("HashTableSetup", x);
     }
+}
+
+static void HashTableAlloc(SEXP x, HashData *d)
+{
 #ifdef LONG_VECTOR_SUPPORT
     d->isLong = IS_LONG_VEC(x);
     if (d->isLong) {
@@ -426,6 +439,12 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
     }
 }
 
+static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
+{
+    HashFunSetup(x, d, nmax);
+    HashTableAlloc(x, d);
+}
+
 /* Open address hashing */
 /* Collision resolution is by linear probing */
 /* The table is guaranteed large so this is sufficient */
@@ -505,6 +524,303 @@ static void removeEntry(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 	}							\
     }
 
+/* The direction of an integer or double vector x known to be sorted
+   and to have no NAs, or UNKNOWN_SORTEDNESS.  Equal elements of such
+   a vector are adjacent, so duplicates and matches are found without
+   hashing. */
+static int sorted_no_na(SEXP x)
+{
+    int srt = UNKNOWN_SORTEDNESS;
+    switch (TYPEOF(x)) {
+    case INTSXP:
+	srt = INTEGER_IS_SORTED(x);
+	if (KNOWN_SORTED(srt) && INTEGER_NO_NA(x))
+	    return KNOWN_INCR(srt) ? SORTED_INCR : SORTED_DECR;
+	break;
+    case REALSXP:
+	srt = REAL_IS_SORTED(x);
+	if (KNOWN_SORTED(srt) && REAL_NO_NA(x))
+	    return KNOWN_INCR(srt) ? SORTED_INCR : SORTED_DECR;
+	break;
+    }
+    return UNKNOWN_SORTEDNESS;
+}
+
+/* v[i] is TRUE if x[i] equals its neighbour before it, or after it
+   with from_last; with stop, stop at the first such element and
+   return its 1-based index, or 0. */
+#define SORTED_DUPLICATED(etype, vtype) do {				\
+	etype prev = 0;							\
+	ITERATE_BY_REGION(x, px, idx, nb, etype, vtype, {		\
+		for (R_xlen_t k = 0; k < nb; k++) {			\
+		    R_xlen_t i = idx + k;				\
+		    int dup = i > 0 && px[k] == prev;			\
+		    prev = px[k];					\
+		    if (v != NULL) v[i] = 0;				\
+		    if (dup) {						\
+			if (v != NULL) v[from_last ? i - 1 : i] = 1;	\
+			if (from_last) last = i;			\
+			else if (stop) return i + 1;			\
+		    }							\
+		}							\
+	    });								\
+    } while (0)
+
+static R_xlen_t sorted_duplicated(SEXP x, Rboolean from_last, int *v,
+				  Rboolean stop)
+{
+    R_xlen_t last = 0;
+    if (TYPEOF(x) == INTSXP)
+	SORTED_DUPLICATED(int, INTEGER);
+    else
+	SORTED_DUPLICATED(double, REAL);
+    return last;
+}
+
+/* Hash indices of vectors made by hashIndex().  The index holds the
+   hash table of the whole vector and an integer vector of the
+   following; hashing by address is only valid for strings all in the
+   cache and either all in the native encoding or some marked as
+   bytes. */
+enum { HI_ADDR, HI_BYTES, HI_KNOWN, HI_CACHED, HI_LEN };
+
+static Rboolean any_enc_known(SEXP x)
+{
+    R_xlen_t n = XLENGTH(x);
+    for (R_xlen_t i = 0; i < n; i++)
+	if (ENC_KNOWN(STRING_ELT(x, i)))
+	    return TRUE;
+    return FALSE;
+}
+
+static void string_flags(SEXP x, int *flags)
+{
+    flags[HI_BYTES] = flags[HI_KNOWN] = FALSE;
+    flags[HI_CACHED] = TRUE;
+    R_xlen_t n = XLENGTH(x);
+    for (R_xlen_t i = 0; i < n; i++) {
+	SEXP s = STRING_ELT(x, i);
+	if (IS_BYTES(s)) flags[HI_BYTES] = TRUE;
+	if (ENC_KNOWN(s)) flags[HI_KNOWN] = TRUE;
+	if (!IS_CACHED(s)) flags[HI_CACHED] = FALSE;
+    }
+}
+
+/* Hashing on threads.  With R_num_math_threads > 1, vectors of at
+   least PAR_HASH_MIN elements are split into partitions by the top
+   bits of the hash codes of their elements.  Each partition has its
+   own table and is hashed by one thread in the order of the elements,
+   so the first (or with from_last the last) occurrence of each value
+   is the one serial hashing finds.  This is only done for ordinary
+   vectors whose hash functions do not allocate: integer, double and
+   complex vectors, and character vectors hashed by address with no
+   strings in a marked encoding. */
+#define PAR_HASH_MIN 100000
+#define PAR_HASH_BITS 8
+
+typedef struct {
+    int bits;		/* partition by the top bits of the hash codes */
+    int *start;		/* offsets of the partitions in idx */
+    int *idx;		/* indices of the elements by partition */
+    R_xlen_t *hstart;	/* offsets of the tables of the partitions in h */
+    int *h;		/* tables of positions in idx, or NIL */
+} ParHash;
+
+static int par_hash_threads(SEXP x, HashData *d)
+{
+#ifdef _OPENMP
+    if (R_num_math_threads < 2 || ALTREP(x) || XLENGTH(x) > INT_MAX)
+	return 1;
+    switch (TYPEOF(x)) {
+    case INTSXP:
+    case REALSXP:
+    case CPLXSXP: return R_num_math_threads;
+    case STRSXP: return !d->useUTF8 && d->useCache ? R_num_math_threads : 1;
+    }
+#endif
+    return 1;
+}
+
+/* Partition the elements of x by the hash codes of d, and allocate the
+   tables, in memory from R_alloc. */
+static void ParHashSetup(SEXP x, HashData *d, ParHash *ph, int nthreads)
+{
+    int n = LENGTH(x);
+    int bits = d->K < PAR_HASH_BITS ? d->K : PAR_HASH_BITS;
+    int shift = d->K - bits, npart = 1 << bits;
+    int *cnt = (int *) R_alloc((size_t) nthreads * npart, sizeof(int));
+    memset(cnt, 0, (size_t) nthreads * npart * sizeof(int));
+    ph->bits = bits;
+    ph->start = (int *) R_alloc(npart + 1, sizeof(int));
+    ph->idx = (int *) R_alloc(n, sizeof(int));
+    ph->hstart = (R_xlen_t *) R_alloc(npart + 1, sizeof(R_xlen_t));
+
+    /* count the elements of each partition in each chunk of x */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+#endif
+    for (int c = 0; c < nthreads; c++) {
+	int *cc = cnt + c * npart;
+	int to = (int) ((double) n * (c + 1) / nthreads);
+	for (int i = (int) ((double) n * c / nthreads); i < to; i++)
+	    cc[d->hash(x, i, d) >> shift]++;
+    }
+
+    /* where each chunk starts in each partition */
+    int k = 0;
+    for (int p = 0; p < npart; p++) {
+	ph->start[p] = k;
+	for (int c = 0; c < nthreads; c++) {
+	    int m = cnt[c * npart + p];
+	    cnt[c * npart + p] = k;
+	    k += m;
+	}
+    }
+    ph->start[npart] = k;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+#endif
+    for (int c = 0; c < nthreads; c++) {
+	int *cc = cnt + c * npart;
+	int to = (int) ((double) n * (c + 1) / nthreads);
+	for (int i = (int) ((double) n * c / nthreads); i < to; i++)
+	    ph->idx[cc[d->hash(x, i, d) >> shift]++] = i;
+    }
+
+    /* tables at least twice as long as the partitions, as in MKsetup */
+    ph->hstart[0] = 0;
+    for (int p = 0; p < npart; p++) {
+	R_xlen_t m = 2;
+	while (m < 2 * (R_xlen_t) (ph->start[p + 1] - ph->start[p]))
+	    m *= 2;
+	ph->hstart[p + 1] = ph->hstart[p] + m;
+    }
+    ph->h = (int *) R_alloc(ph->hstart[npart], sizeof(int));
+}
+
+/* Hash the partitions of x.  v and stop are as for sorted_duplicated(). */
+static R_xlen_t ParHashInsert(SEXP x, HashData *d, ParHash *ph, int nthreads,
+			      Rboolean from_last, int *v, Rboolean stop)
+{
+    int npart = 1 << ph->bits;
+    int *found = (int *) R_alloc(npart, sizeof(int));
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1)
+#endif
+    for (int p = 0; p < npart; p++) {
+	int *h = ph->h + ph->hstart[p];
+	hlen m = (hlen) (ph->hstart[p + 1] - ph->hstart[p]);
+	int from = ph->start[p], to = ph->start[p + 1];
+	for (hlen j = 0; j < m; j++) h[j] = NIL;
+	found[p] = 0;
+	for (int k = 0; k < to - from; k++) {
+	    int pos = from_last ? to - 1 - k : from + k;
+	    int i = ph->idx[pos], dup = 0;
+	    hlen j = d->hash(x, i, d) & (m - 1);
+	    while (h[j] != NIL) {
+		if (d->equal(x, ph->idx[h[j]], x, i)) {
+		    dup = 1;
+		    break;
+		}
+		j = (j + 1) & (m - 1);
+	    }
+	    if (!dup) h[j] = pos;
+	    if (v != NULL) v[i] = dup;
+	    if (dup && stop) {
+		found[p] = i + 1;
+		break;
+	    }
+	}
+    }
+
+    /* the first duplicate is the first found in any partition */
+    R_xlen_t first = 0;
+    for (int p = 0; p < npart; p++)
+	if (found[p] &&
+	    (first == 0 || (from_last ? found[p] > first : found[p] < first)))
+	    first = found[p];
+    return first;
+}
+
+static void ParHashLookup(SEXP table, HashData *d, ParHash *ph, int nthreads,
+			  SEXP x, int *pa, int nomatch)
+{
+    int shift = d->K - ph->bits;
+    R_xlen_t n = XLENGTH(x);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+#endif
+    for (R_xlen_t i = 0; i < n; i++) {
+	hlen code = d->hash(x, i, d);
+	int p = (int) (code >> shift);
+	int *h = ph->h + ph->hstart[p];
+	hlen m = (hlen) (ph->hstart[p + 1] - ph->hstart[p]);
+	hlen j = code & (m - 1);
+	int val = nomatch;
+	while (h[j] != NIL) {
+	    if (d->equal(table, ph->idx[h[j]], x, i)) {
+		val = ph->idx[h[j]] + 1;
+		break;
+	    }
+	    j = (j + 1) & (m - 1);
+	}
+	pa[i] = val;
+    }
+}
+
+/* The number of threads for duplicated() of x, with d set up for it, or 1 */
+static int ParDuplicatedSetup(SEXP x, HashData *d)
+{
+    if (R_num_math_threads < 2 || XLENGTH(x) < PAR_HASH_MIN)
+	return 1;
+    switch (TYPEOF(x)) {
+    case INTSXP:
+    case REALSXP:
+    case CPLXSXP:
+    case STRSXP: break;
+    default: return 1;
+    }
+    HashFunSetup(x, d, NA_INTEGER);
+    d->useUTF8 = FALSE;
+    d->useCache = TRUE;
+    if (TYPEOF(x) == STRSXP) {
+	int flags[HI_LEN];
+	string_flags(x, flags);
+	d->useUTF8 = !flags[HI_BYTES] && flags[HI_KNOWN];
+	d->useCache = flags[HI_CACHED];
+	if (flags[HI_KNOWN])
+	    return 1;
+    }
+    return par_hash_threads(x, d);
+}
+
+static R_xlen_t ParDuplicated(SEXP x, HashData *d, int nthreads,
+			      Rboolean from_last, int *v, Rboolean stop)
+{
+    const void *vmax = vmaxget();
+    ParHash ph;
+    ParHashSetup(x, d, &ph, nthreads);
+    R_xlen_t ans = ParHashInsert(x, d, &ph, nthreads, from_last, v, stop);
+    vmaxset(vmax);
+    return ans;
+}
+
+static SEXP ParHashMatch(SEXP table, SEXP x, HashData *d, int nthreads)
+{
+    const void *vmax = vmaxget();
+    ParHash ph;
+    ParHashSetup(table, d, &ph, nthreads);
+    ParHashInsert(table, d, &ph, nthreads, FALSE, NULL, FALSE);
+    SEXP ans = allocVector(INTSXP, XLENGTH(x));
+    ParHashLookup(table, d, &ph, nthreads, x, INTEGER0(ans), d->nomatch);
+    vmaxset(vmax);
+    return ans;
+}
+
+static Rboolean IndexedHashing(SEXP table, SEXP x, HashData *d, SEXP *data);
+static R_xlen_t indexed_duplicated(SEXP x, HashData *d, int *v);
+
 /* used in scan() */
 SEXP duplicated(SEXP x, Rboolean from_last)
 {
@@ -513,6 +829,27 @@ SEXP duplicated(SEXP x, Rboolean from_last)
 
     if (!isVector(x)) error(_("'duplicated' applies only to vectors"));
     R_xlen_t i, n = XLENGTH(x);
+    if (sorted_no_na(x) != UNKNOWN_SORTEDNESS) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	sorted_duplicated(x, from_last, LOGICAL(ans), FALSE);
+	UNPROTECT(1);
+	return ans;
+    }
+    HashData idata;
+    SEXP xdata;
+    if (!from_last && IndexedHashing(x, x, &idata, &xdata)) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	indexed_duplicated(xdata, &idata, LOGICAL(ans));
+	UNPROTECT(1);
+	return ans;
+    }
+    int nthreads;
+    if (nmax == NA_INTEGER && (nthreads = ParDuplicatedSetup(x, &idata)) > 1) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	ParDuplicated(x, &idata, nthreads, from_last, LOGICAL(ans), FALSE);
+	UNPROTECT(1);
+	return ans;
+    }
     DUPLICATED_INIT;
 
     PROTECT(data.HashTable);
@@ -542,6 +879,27 @@ static SEXP Duplicated(SEXP x, Rboolean from_last, int nmax)
 
     if (!isVector(x)) error(_("'duplicated' applies only to vectors"));
     R_xlen_t i, n = XLENGTH(x);
+    if (sorted_no_na(x) != UNKNOWN_SORTEDNESS) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	sorted_duplicated(x, from_last, LOGICAL(ans), FALSE);
+	UNPROTECT(1);
+	return ans;
+    }
+    HashData idata;
+    SEXP xdata;
+    if (!from_last && IndexedHashing(x, x, &idata, &xdata)) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	indexed_duplicated(xdata, &idata, LOGICAL(ans));
+	UNPROTECT(1);
+	return ans;
+    }
+    int nthreads;
+    if (nmax == NA_INTEGER && (nthreads = ParDuplicatedSetup(x, &idata)) > 1) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	ParDuplicated(x, &idata, nthreads, from_last, LOGICAL(ans), FALSE);
+	UNPROTECT(1);
+	return ans;
+    }
     DUPLICATED_INIT;
 
     PROTECT(data.HashTable);
@@ -572,6 +930,15 @@ R_xlen_t any_duplicated(SEXP x, Rboolean from_last)
 
     if (!isVector(x)) error(_("'duplicated' applies only to vectors"));
     R_xlen_t i, n = XLENGTH(x);
+    if (sorted_no_na(x) != UNKNOWN_SORTEDNESS)
+	return sorted_duplicated(x, from_last, NULL, TRUE);
+    HashData idata;
+    SEXP xdata;
+    if (!from_last && IndexedHashing(x, x, &idata, &xdata))
+	return indexed_duplicated(xdata, &idata, NULL);
+    int nthreads = ParDuplicatedSetup(x, &idata);
+    if (nthreads > 1)
+	return ParDuplicated(x, &idata, nthreads, from_last, NULL, TRUE);
 
     DUPLICATED_INIT;
     PROTECT(data.HashTable);
@@ -785,6 +1152,10 @@ SEXP attribute_hidden do_duplicated(SEXP call, SEXP op, SEXP args, SEXP env)
     default:
 	UNIMPLEMENTED_TYPE("duplicated", x);
     }
+    /* the unique elements of a sorted vector are sorted, and marked so */
+    int srt = sorted_no_na(x);
+    if (srt != UNKNOWN_SORTEDNESS)
+	ans = R_wrap_meta(ans, srt, TRUE);
     UNPROTECT(2);
     return ans;
 }
@@ -837,14 +1208,33 @@ static SEXP HashLookup(SEXP table, SEXP x, HashData *d)
     PROTECT(ans = allocVector(INTSXP, n));
     int *pa = INTEGER0(ans);
 
+/* An ALTREP x without a data pointer is copied a region at a time
+   into a short ordinary vector, which is looked up instead. */
+#define LOOKUP_BY_REGION(type, etype, vtype, LOOKUP) do {		\
+	if (DATAPTR_OR_NULL(x) != NULL) {				\
+	    for (i = 0; i < n; i++)					\
+		pa[i] = LOOKUP(table, x, i, d);				\
+	}								\
+	else {								\
+	    SEXP xb = PROTECT(allocVector(type, GET_REGION_BUFSIZE));	\
+	    etype *pxb = vtype##0(xb);					\
+	    R_xlen_t nb;						\
+	    for (i = 0; i < n; i += nb) {				\
+		nb = n - i > GET_REGION_BUFSIZE ? GET_REGION_BUFSIZE : n - i; \
+		vtype##_GET_REGION(x, i, nb, pxb);			\
+		for (R_xlen_t k = 0; k < nb; k++)			\
+		    pa[i + k] = LOOKUP(table, xb, k, d);		\
+	    }								\
+	    UNPROTECT(1);						\
+	}								\
+    } while (0)
+
     switch (TYPEOF(x)) {
     case INTSXP:
-	for (i = 0; i < n; i++)
-	    pa[i] = iLookup(table, x, i, d);
+	LOOKUP_BY_REGION(INTSXP, int, INTEGER, iLookup);
 	break;
     case REALSXP:
-	for (i = 0; i < n; i++)
-	    pa[i] = rLookup(table, x, i, d);
+	LOOKUP_BY_REGION(REALSXP, double, REAL, rLookup);
 	break;
     case STRSXP:
 	for (i = 0; i < n; i++)
@@ -859,6 +1249,74 @@ static SEXP HashLookup(SEXP table, SEXP x, HashData *d)
     return ans;
 }
 
+/* Set up d for looking up the elements of x in table, a vector made
+   by hashIndex(), and set *data to the vector the index refers to.
+   The index is built at the first lookup after table was modified,
+   and again if strings of x need to be hashed otherwise than those of
+   the previous x.  FALSE if table keeps no index. */
+static Rboolean IndexedHashing(SEXP table, SEXP x, HashData *d, SEXP *data)
+{
+    SEXP index = R_hash_index(table, data);
+    if (index == NULL || IS_LONG_VEC(*data))
+	return FALSE;
+
+    int tflags[HI_LEN], xflags[HI_LEN];
+    Rboolean useUTF8 = FALSE, useCache = TRUE;
+    if (TYPEOF(*data) == STRSXP) {
+	if (index != R_NilValue)
+	    memcpy(tflags, INTEGER(VECTOR_ELT(index, 1)), sizeof(tflags));
+	else
+	    string_flags(*data, tflags);
+	if (x == table)
+	    memcpy(xflags, tflags, sizeof(xflags));
+	else
+	    string_flags(x, xflags);
+	Rboolean useBytes = tflags[HI_BYTES] || xflags[HI_BYTES];
+	useUTF8 = !useBytes && (tflags[HI_KNOWN] || xflags[HI_KNOWN]);
+	useCache = tflags[HI_CACHED] && xflags[HI_CACHED];
+    }
+    int addr = !useUTF8 && useCache;
+
+    HashFunSetup(*data, d, NA_INTEGER);
+    d->useUTF8 = useUTF8;
+    d->useCache = useCache;
+    if (index != R_NilValue &&
+	(TYPEOF(*data) != STRSXP || INTEGER(VECTOR_ELT(index, 1))[HI_ADDR] == addr))
+	d->HashTable = VECTOR_ELT(index, 0);
+    else {
+	PROTECT(index = allocVector(VECSXP, 2));
+	SEXP flags = allocVector(INTSXP, HI_LEN);
+	SET_VECTOR_ELT(index, 1, flags);
+	tflags[HI_ADDR] = addr;
+	memcpy(INTEGER(flags), tflags, sizeof(tflags));
+	d->HashTable = allocVector(INTSXP, (R_xlen_t) d->M);
+	SET_VECTOR_ELT(index, 0, d->HashTable);
+	for (R_xlen_t i = 0; i < d->M; i++) HTDATA_INT(d)[i] = NIL;
+#ifdef LONG_VECTOR_SUPPORT
+	d->isLong = FALSE;
+#endif
+	DoHashing(*data, d);
+	R_set_hash_index(table, index);
+	UNPROTECT(1);
+    }
+    return TRUE;
+}
+
+/* duplicated() of the vector x indexed by d: x[i] is a duplicate unless
+   the index finds i itself.  With v NULL, return the 1-based index of
+   the first duplicate, or 0. */
+static R_xlen_t indexed_duplicated(SEXP x, HashData *d, int *v)
+{
+    R_xlen_t n = XLENGTH(x);
+    d->nomatch = 0;
+    for (R_xlen_t i = 0; i < n; i++) {
+	int dup = Lookup(x, x, i, d) != i + 1;
+	if (v != NULL) v[i] = dup;
+	else if (dup) return i + 1;
+    }
+    return 0;
+}
+
 static SEXP match_transform(SEXP s, SEXP env)
 {
     if(OBJECT(s)) {
@@ -872,16 +1330,186 @@ static SEXP match_transform(SEXP s, SEXP env)
 	    return r;
 	}
     }
-    /* else */
-    return duplicate(s);
+    /* else: nothing here modifies s, and a copy would drop a hash index */
+    return s;
 }
 
 // workhorse of R's match() and hence also  " ix %in% itable "
+/* The bytes of element i of a character vector, or NULL for NA */
+static R_INLINE const char *
+string_bytes(SEXP x, Rboolean isbuf, const R_strbuf_t *sb, R_xlen_t i,
+	     int *len)
+{
+    if (isbuf)
+	return R_string_buffer_elt(sb, i, len);
+    SEXP s = STRING_ELT(x, i);
+    if (s == NA_STRING)
+	return NULL;
+    *len = LENGTH(s);
+    return CHAR(s);
+}
+
+static R_INLINE hlen bhash(const char *p, int len, HashData *d)
+{
+    unsigned int k = 0;
+    for (int j = 0; j < len; j++)
+	k = 11 * k + (unsigned int) p[j];
+    return scatter(k, d);
+}
+
+/* Matches the elements of a string buffer x by their bytes, without
+   making them, which is valid when strings of the table that are equal
+   to them must have the same bytes: the buffer is all ASCII, or the
+   non-ASCII strings of the table are in the encoding of the buffer.
+   Returns NULL otherwise.  The table may also be a string buffer. */
+static SEXP StringBufferMatch(SEXP table, const R_strbuf_t *sb, int nomatch)
+{
+    R_strbuf_t tb;
+    Rboolean tbuf = R_get_string_buffer(table, &tb);
+    R_xlen_t i, n = sb->n, m = XLENGTH(table);
+    int len, tlen;
+
+    if (!sb->ascii) {
+	if (tbuf) {
+	    if (!tb.ascii && tb.enc != sb->enc)
+		return NULL;
+	}
+	else
+	    for (i = 0; i < m; i++) {
+		SEXP s = STRING_ELT(table, i);
+		if (s != NA_STRING && !IS_ASCII(s) && getCharCE(s) != sb->enc)
+		    return NULL;
+	    }
+    }
+
+    /* hash the first occurrence of each string in the table */
+    HashData d;
+    MKsetup(m, &d, NA_INTEGER);
+    const void *vmax = vmaxget();
+    R_xlen_t *h = (R_xlen_t *) R_alloc(d.M, sizeof(R_xlen_t));
+    for (hlen k = 0; k < d.M; k++) h[k] = NIL;
+    int napos = nomatch;
+    for (i = 0; i < m; i++) {
+	const char *p = string_bytes(table, tbuf, &tb, i, &len);
+	if (p == NULL) {
+	    if (napos == nomatch) napos = (int) (i + 1);
+	    continue;
+	}
+	hlen k = bhash(p, len, &d);
+	for (; h[k] != NIL; k = (k + 1) % d.M) {
+	    const char *q = string_bytes(table, tbuf, &tb, h[k], &tlen);
+	    if (tlen == len && memcmp(p, q, len) == 0)
+		break;
+	}
+	if (h[k] == NIL) h[k] = i;
+    }
+
+    SEXP ans = allocVector(INTSXP, n);
+    int *pa = INTEGER0(ans);
+    for (i = 0; i < n; i++) {
+	const char *p = R_string_buffer_elt(sb, i, &len);
+	if (p == NULL) {
+	    pa[i] = napos;
+	    continue;
+	}
+	pa[i] = nomatch;
+	for (hlen k = bhash(p, len, &d); h[k] != NIL; k = (k + 1) % d.M) {
+	    const char *q = string_bytes(table, tbuf, &tb, h[k], &tlen);
+	    if (tlen == len && memcmp(p, q, len) == 0) {
+		pa[i] = (int) (h[k] + 1);
+		break;
+	    }
+	}
+    }
+    vmaxset(vmax);
+    return ans;
+}
+
+/* Set val to the position of the first element of table satisfying
+   MATCH, reading table a region at a time. */
+#define MATCH_SCALAR_BY_REGION(etype, vtype, MATCH) do {		\
+	ITERATE_BY_REGION(table, table_p, j, nb, etype, vtype, {	\
+		R_xlen_t k = 0;						\
+		while (k < nb && !(MATCH)) k++;				\
+		if (k < nb) {						\
+		    val = (int) (j + k + 1);				\
+		    break;						\
+		}							\
+	    });								\
+    } while (0)
+
+/* match() in a table known to be sorted with no NAs, of direction
+   srt: a binary search for the first element equal to each x[i].  For
+   x sorted the same way the search gallops forward from the previous
+   position, so sorted x is merged with the table. */
+#define SORTED_MATCH(etype, vtype, ISNA_X) do {				\
+	const etype *tp = DATAPTR_OR_NULL(table);			\
+	R_xlen_t lo = 0, hi;						\
+	ITERATE_BY_REGION(x, px, idx, nb, etype, vtype, {		\
+		for (R_xlen_t k = 0; k < nb; k++) {			\
+		    etype v = px[k];					\
+		    if (ISNA_X(v)) {					\
+			pa[idx + k] = nomatch;				\
+			continue;					\
+		    }							\
+		    if (gallop) {					\
+			R_xlen_t step = 1;				\
+			while (lo + step <= n &&			\
+			       BEFORE(TABLE_ELT(lo + step - 1), v)) {	\
+			    lo += step;					\
+			    step *= 2;					\
+			}						\
+			hi = lo + step - 1 < n ? lo + step - 1 : n;	\
+		    }							\
+		    else {						\
+			lo = 0;						\
+			hi = n;						\
+		    }							\
+		    while (lo < hi) {					\
+			R_xlen_t mid = lo + (hi - lo) / 2;		\
+			if (BEFORE(TABLE_ELT(mid), v)) lo = mid + 1;	\
+			else hi = mid;					\
+		    }							\
+		    pa[idx + k] = lo < n && TABLE_ELT(lo) == v ?	\
+			(int) (lo + 1) : nomatch;			\
+		}							\
+	    });								\
+    } while (0)
+
+static SEXP SortedMatch(SEXP table, SEXP x, int srt, int nomatch)
+{
+    R_xlen_t n = XLENGTH(table), nx = XLENGTH(x);
+    SEXP ans = PROTECT(allocVector(INTSXP, nx));
+    int *pa = INTEGER0(ans);
+    int xsrt = TYPEOF(x) == INTSXP ? INTEGER_IS_SORTED(x) : REAL_IS_SORTED(x);
+    Rboolean gallop = KNOWN_SORTED(xsrt) && KNOWN_INCR(xsrt) == KNOWN_INCR(srt);
+    Rboolean incr = KNOWN_INCR(srt);
+
+#define BEFORE(a, b) (incr ? (a) < (b) : (a) > (b))
+    if (TYPEOF(x) == INTSXP) {
+#define TABLE_ELT(i) (tp != NULL ? tp[i] : INTEGER_ELT(table, i))
+#define ISNA_INT(v) ((v) == NA_INTEGER)
+	SORTED_MATCH(int, INTEGER, ISNA_INT);
+#undef ISNA_INT
+#undef TABLE_ELT
+    }
+    else {
+#define TABLE_ELT(i) (tp != NULL ? tp[i] : REAL_ELT(table, i))
+	SORTED_MATCH(double, REAL, ISNAN);
+#undef TABLE_ELT
+    }
+#undef BEFORE
+
+    UNPROTECT(1);
+    return ans;
+}
+
 SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 {
     SEXP ans, x, table;
     SEXPTYPE type;
     HashData data;
+    R_strbuf_t sb;
 
     R_xlen_t n = xlength(ix);
 
@@ -908,8 +1536,18 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
     PROTECT(x	  = coerceVector(x,	type)); nprot++;
     PROTECT(table = coerceVector(table, type)); nprot++;
 
+    int srt;
+    SEXP tdata;
+    if (!incomp && IndexedHashing(table, x, &data, &tdata)) {
+	data.nomatch = nmatch;
+	PROTECT(ans = HashLookup(tdata, x, &data)); nprot++;
+    }
+    else if ((type == INTSXP || type == REALSXP) && !incomp &&
+	     (srt = sorted_no_na(table)) != UNKNOWN_SORTEDNESS) {
+	PROTECT(ans = SortedMatch(table, x, srt, nmatch)); nprot++;
+    }
     // special case scalar x -- for speed only :
-    if(XLENGTH(x) == 1 && !incomp) {
+    else if(XLENGTH(x) == 1 && !incomp) {
       int val = nmatch;
       int nitable = LENGTH(itable);
       switch (type) {
@@ -921,33 +1559,20 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 	  break; }
       case LGLSXP:
       case INTSXP: {
-	  int x_val = INTEGER_ELT(x, 0),
-	      *table_p = INTEGER(table);
-	  for (int i=0; i < nitable; i++) if (table_p[i] == x_val) {
-		  val = i + 1; break;
-	      }
+	  int x_val = INTEGER_ELT(x, 0);
+	  MATCH_SCALAR_BY_REGION(int, INTEGER, table_p[k] == x_val);
 	  break; }
       case REALSXP: {
 	  double xv = REAL_ELT(x, 0);
 	  // pblm with signed 0s under IEC60559
 	  double x_val = (xv == 0.) ? 0. : xv;
-	  double *table_p = REAL(table);
 	  /* we want all NaNs except NA equal, and all NAs equal */
-	  if (R_IsNA(x_val)) {
-	      for (int i=0; i < nitable; i++) if (R_IsNA(table_p[i])) {
-		      val = i + 1; break;
-		  }
-	  }
-	  else if (R_IsNaN(x_val)) {
-	      for (int i=0; i < nitable; i++) if (R_IsNaN(table_p[i])) {
-		      val = i + 1; break;
-		  }
-	  }
-	  else {
-	      for (int i=0; i < nitable; i++) if (table_p[i] == x_val) {
-		      val = i + 1; break;
-	      }
-	  }
+	  if (R_IsNA(x_val))
+	      MATCH_SCALAR_BY_REGION(double, REAL, R_IsNA(table_p[k]));
+	  else if (R_IsNaN(x_val))
+	      MATCH_SCALAR_BY_REGION(double, REAL, R_IsNaN(table_p[k]));
+	  else
+	      MATCH_SCALAR_BY_REGION(double, REAL, table_p[k] == x_val);
 	  break; }
       case CPLXSXP: {
 	  Rcomplex x_val = COMPLEX_ELT(x, 0),
@@ -967,11 +1592,17 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
       }
       PROTECT(ans = ScalarInteger(val)); nprot++;
     }
+    else if (type == STRSXP && !incomp && R_get_string_buffer(x, &sb) &&
+	     (ans = StringBufferMatch(table, &sb, nmatch)) != NULL) {
+	PROTECT(ans); nprot++;
+    }
     else { // regular case
 
 	if (incomp) { PROTECT(incomp = coerceVector(incomp, type)); nprot++; }
 	data.nomatch = nmatch;
-	HashTableSetup(table, &data, NA_INTEGER);
+	HashFunSetup(table, &data, NA_INTEGER);
+	data.useUTF8 = FALSE;
+	data.useCache = TRUE;
 	if(type == STRSXP) {
 	    Rboolean useBytes = FALSE;
 	    Rboolean useUTF8 = FALSE;
@@ -1011,10 +1642,22 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 	    data.useUTF8 = useUTF8;
 	    data.useCache = useCache;
 	}
-	PROTECT(data.HashTable); nprot++;
-	DoHashing(table, &data);
-	if (incomp) UndoHashing(incomp, table, &data);
-	ans = HashLookup(table, x, &data);
+	int nthreads = 1;
+	if (!incomp && n + XLENGTH(table) >= PAR_HASH_MIN &&
+	    (nthreads = par_hash_threads(table, &data)) > 1)
+	    nthreads = par_hash_threads(x, &data);
+	if (nthreads > 1 && type == STRSXP &&
+	    (any_enc_known(x) || any_enc_known(table)))
+	    nthreads = 1;
+	if (nthreads > 1)
+	    ans = ParHashMatch(table, x, &data, nthreads);
+	else {
+	    HashTableAlloc(table, &data);
+	    PROTECT(data.HashTable); nprot++;
+	    DoHashing(table, &data);
+	    if (incomp) UndoHashing(incomp, table, &data);
+	    ans = HashLookup(table, x, &data);
+	}
     }
     UNPROTECT(nprot);
     return ans;
@@ -1825,3 +2468,284 @@ SEXP attribute_hidden do_sample2(SEXP call, SEXP op, SEXP args, SEXP env)
     UNPROTECT(2);
     return ans;
 }
+
+
+/* Hash maps: reference objects mapping keys to values.  The keys are
+   the elements of atomic vectors, without attributes, or of lists, and
+   are equal if they are identical().  The keys and values are kept in
+   two lists in the order they were added, and an open addressing table
+   holds their positions, so that lookups hash with vhash and compare
+   with vequal.  A deleted key leaves NA_INTEGER in the table and
+   R_UnboundValue in the lists.  When the lists are full they are
+   compacted, and doubled if more than half of them is in use, so that
+   adding a key takes amortized constant time.  All the state is in R
+   objects protected by the external pointer, so it is collected and
+   serialized with the map. */
+
+#define HASHMAP_TABLE(m) VECTOR_ELT(R_ExternalPtrProtected(m), 0)
+#define HASHMAP_KEYS(m) VECTOR_ELT(R_ExternalPtrProtected(m), 1)
+#define HASHMAP_VALUES(m) VECTOR_ELT(R_ExternalPtrProtected(m), 2)
+#define HASHMAP_INFO(m) INTEGER(R_ExternalPtrTag(m))
+
+enum { HM_USED, HM_COUNT, HM_K, HM_LEN };
+
+static SEXP check_hashmap(SEXP map)
+{
+    if (TYPEOF(map) != EXTPTRSXP || !inherits(map, "hashMap") ||
+	TYPEOF(R_ExternalPtrProtected(map)) != VECSXP ||
+	TYPEOF(R_ExternalPtrTag(map)) != INTSXP)
+	error(_("'%s' is not a hash map"), "map");
+    return map;
+}
+
+static void hashmap_data(SEXP map, HashData *d)
+{
+    d->K = HASHMAP_INFO(map)[HM_K];
+    d->M = (hlen) 1 << d->K;
+    d->useUTF8 = TRUE;
+    d->useCache = TRUE;
+}
+
+/* The hash code of element i of x as a key: for an atomic x, what vhash
+   gives for the element on its own */
+static hlen khash(SEXP x, R_xlen_t i, HashData *d)
+{
+    unsigned int h;
+    switch (TYPEOF(x)) {
+    case LGLSXP: h = (unsigned int) lhash(x, i, d); break;
+    case INTSXP: h = (unsigned int) ihash(x, i, d); break;
+    case REALSXP: h = (unsigned int) rhash(x, i, d); break;
+    case CPLXSXP: h = (unsigned int) chash(x, i, d); break;
+    case STRSXP: h = (unsigned int) shash(x, i, d); break;
+    case RAWSXP: h = (unsigned int) scatter((unsigned int) rawhash(x, i, d), d);
+	break;
+    default: return vhash(x, i, d);
+    }
+    return scatter(((2U * TYPEOF(x) + 100U) ^ h) * 97, d);
+}
+
+static int kequal(SEXP keys, R_xlen_t j, SEXP x, R_xlen_t i)
+{
+    if (TYPEOF(x) == VECSXP)
+	return vequal(keys, j, x, i);
+    SEXP k = VECTOR_ELT(keys, j);
+    if (TYPEOF(k) != TYPEOF(x) || XLENGTH(k) != 1 || ATTRIB(k) != R_NilValue)
+	return 0;
+    switch (TYPEOF(x)) {
+    case LGLSXP: return lequal(k, 0, x, i);
+    case INTSXP: return iequal(k, 0, x, i);
+    case REALSXP: return requal(k, 0, x, i);
+    case CPLXSXP: {
+	/* as identical(), unlike cequal */
+	Rcomplex a = COMPLEX_ELT(k, 0), b = COMPLEX_ELT(x, i);
+	return dequal(a.r, b.r) && dequal(a.i, b.i);
+    }
+    case STRSXP: return sequal(k, 0, x, i);
+    case RAWSXP: return rawequal(k, 0, x, i);
+    default: return 0;
+    }
+}
+
+/* The entry of the table holding key i of x, with *found set, or else
+   where the key would be added */
+static hlen hashmap_find(SEXP map, SEXP x, R_xlen_t i, HashData *d,
+			 Rboolean *found)
+{
+    int *h = INTEGER(HASHMAP_TABLE(map));
+    SEXP keys = HASHMAP_KEYS(map);
+    hlen j = khash(x, i, d), del = d->M;
+    while (h[j] != NIL) {
+	if (h[j] == NA_INTEGER) {
+	    if (del == d->M) del = j;
+	}
+	else if (kequal(keys, h[j], x, i)) {
+	    *found = TRUE;
+	    return j;
+	}
+	j = (j + 1) % d->M;
+    }
+    *found = FALSE;
+    return del < d->M ? del : j;
+}
+
+/* Element i of x as an R object */
+static SEXP vector_elt_object(SEXP x, R_xlen_t i)
+{
+    if (TYPEOF(x) == VECSXP)
+	return VECTOR_ELT(x, i);
+    SEXP ans = allocVector(TYPEOF(x), 1);
+    switch (TYPEOF(x)) {
+    case LGLSXP: LOGICAL0(ans)[0] = LOGICAL_ELT(x, i); break;
+    case INTSXP: INTEGER0(ans)[0] = INTEGER_ELT(x, i); break;
+    case REALSXP: REAL0(ans)[0] = REAL_ELT(x, i); break;
+    case CPLXSXP: COMPLEX0(ans)[0] = COMPLEX_ELT(x, i); break;
+    case STRSXP: SET_STRING_ELT(ans, 0, STRING_ELT(x, i)); break;
+    case RAWSXP: RAW0(ans)[0] = RAW_ELT(x, i); break;
+    default: UNIMPLEMENTED_TYPE("vector_elt_object", x);
+    }
+    return ans;
+}
+
+/* Move the keys and values to lists of length cap, and rebuild the table */
+static void hashmap_resize(SEXP map, R_xlen_t cap)
+{
+    int *info = HASHMAP_INFO(map);
+    SEXP keys = HASHMAP_KEYS(map), values = HASHMAP_VALUES(map);
+    SEXP nkeys = PROTECT(allocVector(VECSXP, cap));
+    SEXP nvalues = PROTECT(allocVector(VECSXP, cap));
+    R_xlen_t k = 0;
+    for (R_xlen_t i = 0; i < info[HM_USED]; i++)
+	if (VECTOR_ELT(keys, i) != R_UnboundValue) {
+	    SET_VECTOR_ELT(nkeys, k, VECTOR_ELT(keys, i));
+	    SET_VECTOR_ELT(nvalues, k++, VECTOR_ELT(values, i));
+	}
+
+    HashData d;
+    MKsetup(cap, &d, NA_INTEGER);
+    if (d.M > INT_MAX)
+	error(_("hash map is too large"));
+    SEXP table = allocVector(INTSXP, d.M);
+    int *h = INTEGER0(table);
+    for (hlen j = 0; j < d.M; j++) h[j] = NIL;
+    SEXP state = R_ExternalPtrProtected(map);
+    SET_VECTOR_ELT(state, 0, table);
+    SET_VECTOR_ELT(state, 1, nkeys);
+    SET_VECTOR_ELT(state, 2, nvalues);
+    info[HM_USED] = info[HM_COUNT] = (int) k;
+    info[HM_K] = d.K;
+    UNPROTECT(2);
+
+    hashmap_data(map, &d);
+    for (R_xlen_t i = 0; i < k; i++) {
+	hlen j = vhash(nkeys, i, &d);
+	while (h[j] != NIL) j = (j + 1) % d.M;
+	h[j] = (int) i;
+    }
+}
+
+static SEXP hashmap_new(SEXP ssize)
+{
+    double size = asReal(ssize);
+    if (ISNAN(size) || size < 0 || size > INT_MAX / 4)
+	error(_("invalid '%s' argument"), "size");
+    SEXP info = PROTECT(allocVector(INTSXP, HM_LEN));
+    for (int i = 0; i < HM_LEN; i++) INTEGER0(info)[i] = 0;
+    SEXP state = PROTECT(allocVector(VECSXP, 3));
+    SET_VECTOR_ELT(state, 1, allocVector(VECSXP, 0));
+    SEXP map = PROTECT(R_MakeExternalPtr(NULL, info, state));
+    classgets(map, mkString("hashMap"));
+    hashmap_resize(map, size < 8 ? 8 : (R_xlen_t) size);
+    UNPROTECT(3);
+    return map;
+}
+
+static SEXP hashmap_set(SEXP map, SEXP x, SEXP values)
+{
+    R_xlen_t n = XLENGTH(x), nv = XLENGTH(values);
+    if (n > 0 && nv == 0)
+	error(_("no values to set"));
+    HashData d;
+    hashmap_data(map, &d);
+    for (R_xlen_t i = 0; i < n; i++) {
+	Rboolean found;
+	hlen j = hashmap_find(map, x, i, &d, &found);
+	SEXP value = PROTECT(vector_elt_object(values, i % nv));
+	if (found) {
+	    SET_VECTOR_ELT(HASHMAP_VALUES(map), INTEGER(HASHMAP_TABLE(map))[j],
+			   value);
+	    UNPROTECT(1);
+	    continue;
+	}
+	int *info = HASHMAP_INFO(map);
+	R_xlen_t cap = XLENGTH(HASHMAP_KEYS(map));
+	if (info[HM_USED] == cap) {
+	    hashmap_resize(map, info[HM_COUNT] >= cap / 2 ? 2 * cap : cap);
+	    hashmap_data(map, &d);
+	    j = hashmap_find(map, x, i, &d, &found);
+	}
+	SEXP key = PROTECT(vector_elt_object(x, i));
+	int k = info[HM_USED]++;
+	SET_VECTOR_ELT(HASHMAP_KEYS(map), k, key);
+	SET_VECTOR_ELT(HASHMAP_VALUES(map), k, value);
+	INTEGER(HASHMAP_TABLE(map))[j] = k;
+	info[HM_COUNT]++;
+	UNPROTECT(2);
+    }
+    return map;
+}
+
+/* .Internal(hashMap(size))		[op=0]
+   .Internal(mapGet(map, keys, default))	[op=1]
+   .Internal(mapSet(map, keys, values))	[op=2]
+   .Internal(mapHas(map, keys))		[op=3]
+   .Internal(mapDelete(map, keys))	[op=4]
+   .Internal(mapKeys(map))		[op=5]
+   .Internal(mapValues(map))		[op=6]
+   .Internal(mapLength(map))		[op=7] */
+SEXP attribute_hidden do_hashmap(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    checkArity(op, args);
+    if (PRIMVAL(op) == 0)
+	return hashmap_new(CAR(args));
+
+    SEXP map = check_hashmap(CAR(args)), x, ans;
+    int *info = HASHMAP_INFO(map);
+    switch (PRIMVAL(op)) {
+    case 5:
+    case 6: {
+	SEXP from = PRIMVAL(op) == 5 ? HASHMAP_KEYS(map) : HASHMAP_VALUES(map);
+	SEXP keys = HASHMAP_KEYS(map);
+	R_xlen_t k = 0;
+	ans = PROTECT(allocVector(VECSXP, info[HM_COUNT]));
+	for (R_xlen_t i = 0; i < info[HM_USED]; i++)
+	    if (VECTOR_ELT(keys, i) != R_UnboundValue)
+		SET_VECTOR_ELT(ans, k++, VECTOR_ELT(from, i));
+	UNPROTECT(1);
+	return ans;
+    }
+    case 7:
+	return ScalarInteger(info[HM_COUNT]);
+    }
+
+    x = CADR(args);
+    if (isNull(x))
+	x = allocVector(VECSXP, 0);
+    if (!isVector(x) || TYPEOF(x) == EXPRSXP)
+	error(_("'%s' must be a vector or a list"), "keys");
+    if (PRIMVAL(op) == 2) {
+	SEXP values = CADDR(args);
+	if (!isVector(values) || TYPEOF(values) == EXPRSXP)
+	    error(_("'%s' must be a vector or a list"), "values");
+	return hashmap_set(map, x, values);
+    }
+
+    R_xlen_t n = XLENGTH(x);
+    HashData d;
+    hashmap_data(map, &d);
+    ans = PROTECT(allocVector(PRIMVAL(op) == 1 ? VECSXP : LGLSXP, n));
+    for (R_xlen_t i = 0; i < n; i++) {
+	Rboolean found;
+	hlen j = hashmap_find(map, x, i, &d, &found);
+	int *h = INTEGER(HASHMAP_TABLE(map));
+	switch (PRIMVAL(op)) {
+	case 1:
+	    SET_VECTOR_ELT(ans, i, found ? VECTOR_ELT(HASHMAP_VALUES(map), h[j])
+			   : CADDR(args));
+	    break;
+	case 3:
+	    LOGICAL0(ans)[i] = found;
+	    break;
+	case 4:
+	    LOGICAL0(ans)[i] = found;
+	    if (found) {
+		SET_VECTOR_ELT(HASHMAP_KEYS(map), h[j], R_UnboundValue);
+		SET_VECTOR_ELT(HASHMAP_VALUES(map), h[j], R_NilValue);
+		h[j] = NA_INTEGER;
+		info[HM_COUNT]--;
+	    }
+	    break;
+	}
+    }
+    UNPROTECT(1);
+    return ans;
+}
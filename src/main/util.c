@@ -26,6 +26,7 @@
 #include <Defn.h>
 #include <Internal.h>
 #include <R_ext/Print.h>
+#include <R_ext/Itermacros.h>
 #include <ctype.h>		/* for isspace */
 #include <float.h>		/* for DBL_MAX */
 
@@ -1415,6 +1416,11 @@ Rboolean utf8Valid(const char *str)
     return valid_utf8(str, strlen(str)) == 0;
 }
 
+Rboolean utf8ValidLen(const char *str, size_t len)
+{
+    return valid_utf8(str, len) == 0;
+}
+
 SEXP attribute_hidden do_validUTF8(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     checkArity(op, args);
@@ -2269,6 +2275,31 @@ SEXP attribute_hidden do_tabulate(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("invalid '%s' argument"), "nbin");
     int *x = INTEGER(in);
     SEXP ans;
+#ifdef _OPENMP
+    /* count on threads, each into its own bins, when the bins are few
+       compared to the elements */
+    int nthreads = R_num_math_threads;
+    if (nthreads > 1 && n >= 100000 && (double) nb * nthreads <= n / 4) {
+	R_xlen_t *cnt = (R_xlen_t *) R_alloc((size_t) nb * nthreads,
+					     sizeof(R_xlen_t));
+	memset(cnt, 0, (size_t) nb * nthreads * sizeof(R_xlen_t));
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+	for (int c = 0; c < nthreads; c++) {
+	    R_xlen_t *y = cnt + (size_t) nb * c;
+	    R_xlen_t to = (R_xlen_t) ((double) n * (c + 1) / nthreads);
+	    for (R_xlen_t i = (R_xlen_t) ((double) n * c / nthreads); i < to; i++)
+		if (x[i] != NA_INTEGER && x[i] > 0 && x[i] <= nb) y[x[i] - 1]++;
+	}
+	ans = allocVector(n > INT_MAX ? REALSXP : INTSXP, nb);
+	for (int j = 0; j < nb; j++) {
+	    R_xlen_t k = 0;
+	    for (int c = 0; c < nthreads; c++) k += cnt[(size_t) nb * c + j];
+	    if (TYPEOF(ans) == REALSXP) REAL(ans)[j] = (double) k;
+	    else INTEGER(ans)[j] = (int) k;
+	}
+	return ans;
+    }
+#endif
 #ifdef LONG_VECTOR_SUPPORT
     if (n > INT_MAX) {
 	ans = allocVector(REALSXP, nb);
@@ -2315,18 +2346,24 @@ SEXP attribute_hidden do_findinterval(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("invalid '%s' argument"), "rightmost.closed");
     if (si == NA_INTEGER)
 	error(_("invalid '%s' argument"), "all.inside");
-    SEXP ans = allocVector(INTSXP, nx);
-    double *rxt = REAL(xt), *rx = REAL(x);
+    SEXP ans = PROTECT(allocVector(INTSXP, nx));
+    double *rxt = REAL(xt);
+    int *pa = INTEGER(ans);
+    /* the previous interval is the first guess, so sorted x take few
+       comparisons; x is read a region at a time */
     int ii = 1;
-    for(int i = 0; i < nx; i++) {
-	if (ISNAN(rx[i]))
-	    ii = NA_INTEGER;
-	else {
-	    int mfl;
-	    ii = findInterval2(rxt, n, rx[i], sr, si, lO, ii, &mfl); // -> ../appl/interv.c
-	}
-	INTEGER(ans)[i] = ii;
-    }
+    ITERATE_BY_REGION(x, rx, i, nb, double, REAL, {
+	    for (R_xlen_t k = 0; k < nb; k++) {
+		if (ISNAN(rx[k]))
+		    ii = NA_INTEGER;
+		else {
+		    int mfl;
+		    ii = findInterval2(rxt, n, rx[k], sr, si, lO, ii, &mfl); // -> ../appl/interv.c
+		}
+		pa[i + k] = ii;
+	    }
+	});
+    UNPROTECT(1);
     return ans;
 }
 